@@ -0,0 +1,588 @@
+#include "blackbox.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <algorithm>
+#include <sys/time.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "nvs_handle.hpp"
+
+decltype(BlackBox::args) BlackBox::args;
+
+static const char *MODE_NAMES[] = {"off", "auto", "always"};
+
+static uint32_t sector_crc(const BlackBox::SectorHeader &header)
+{
+    return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(&header), offsetof(BlackBox::SectorHeader, crc));
+}
+
+static uint16_t record_crc(const BlackBox::RecordHeader &header, const uint8_t *payload)
+{
+    const uint32_t crc = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(&header), offsetof(BlackBox::RecordHeader, crc));
+    return static_cast<uint16_t>(esp_rom_crc32_le(crc, payload, header.length));
+}
+
+static bool is_valid_sector(const BlackBox::SectorHeader &header)
+{
+    return header.magic == BlackBox::SECTOR_MAGIC && header.sequence != UINT32_MAX && header.crc == sector_crc(header);
+}
+
+BlackBox::BlackBox(const char *label)
+{
+    _partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (!_partition)
+    {
+        ESP_LOGW(TAG, "Partition '%s' not found, black box disabled", label);
+        return;
+    }
+    _sector_count = _partition->size / SECTOR_SIZE;
+    if (_sector_count < 2)
+    {
+        ESP_LOGE(TAG, "Partition '%s' too small", label);
+        _partition = nullptr;
+        return;
+    }
+
+    for (auto &stage : _stage)
+    {
+        stage = static_cast<uint8_t *>(heap_caps_malloc(STAGE_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+        if (!stage)
+        {
+            ESP_LOGE(TAG, "Failed to allocate stage buffer");
+            _partition = nullptr;
+            return;
+        }
+    }
+
+    _stage_lock = xSemaphoreCreateMutex();
+    _flash_lock = xSemaphoreCreateMutex();
+    _flushed = xSemaphoreCreateBinary();
+
+    load_config();
+    if (!scan())
+    {
+        _partition = nullptr;
+        return;
+    }
+
+    _wake = xSemaphoreCreateBinary();
+    auto task_func = [](void *arg)
+    {
+        BlackBox *instance = static_cast<BlackBox *>(arg);
+        instance->writer_task();
+    };
+    xTaskCreatePinnedToCore(task_func, "blackbox", StackSize, this, 1, nullptr, tskNO_AFFINITY);
+
+    ESP_LOGI(TAG, "%zu sectors at 0x%" PRIx32 ", newest #%" PRIu32 ", mode %s",
+             _sector_count, _partition->address, _sequence, MODE_NAMES[static_cast<int>(_mode.load())]);
+}
+
+// 与程序同生命周期, 不回收后台任务
+BlackBox::~BlackBox()
+{
+    flush(pdMS_TO_TICKS(1000));
+}
+
+bool BlackBox::is_ready() const
+{
+    return _wake != nullptr;
+}
+
+bool BlackBox::is_active() const
+{
+    switch (_mode.load(std::memory_order_relaxed))
+    {
+    case Mode::ALWAYS:
+        return is_ready();
+    case Mode::AUTO:
+        return is_ready() && !_storage_present.load(std::memory_order_relaxed);
+    default:
+        return false;
+    }
+}
+
+// 找出序号最大的扇区作为当前扇区, 并定位其中第一个空闲位置
+bool BlackBox::scan()
+{
+    uint8_t *buffer = static_cast<uint8_t *>(heap_caps_malloc(SECTOR_SIZE, MALLOC_CAP_8BIT));
+    if (!buffer)
+    {
+        ESP_LOGE(TAG, "Failed to allocate scan buffer");
+        return false;
+    }
+
+    bool found = false;
+    uint32_t oldest = 0;
+    for (size_t i = 0; i < _sector_count; i++)
+    {
+        SectorHeader header;
+        if (esp_partition_read(_partition, i * SECTOR_SIZE, &header, sizeof(header)) != ESP_OK || !is_valid_sector(header))
+        {
+            continue;
+        }
+        if (!found || header.sequence > _sequence)
+        {
+            _sequence = header.sequence;
+            _sector = i;
+        }
+        if (!found || header.sequence < oldest)
+        {
+            oldest = header.sequence;
+        }
+        found = true;
+    }
+
+    if (!found)
+    {
+        // 空分区: 第一条记录写到扇区 0
+        _sector = _sector_count - 1;
+        _sequence = 0;
+        _first_sequence = 1;
+        _offset = SECTOR_SIZE;
+        heap_caps_free(buffer);
+        return true;
+    }
+    _first_sequence = std::max<uint32_t>(oldest, _sequence >= _sector_count ? _sequence - _sector_count + 1 : 1);
+
+    size_t offset = sizeof(SectorHeader);
+    if (esp_partition_read(_partition, _sector * SECTOR_SIZE, buffer, SECTOR_SIZE) != ESP_OK)
+    {
+        offset = SECTOR_SIZE;
+    }
+    while (offset + sizeof(RecordHeader) <= SECTOR_SIZE)
+    {
+        RecordHeader header;
+        memcpy(&header, buffer + offset, sizeof(header));
+        if (header.length == 0xFF && header.type == 0xFF && header.crc == 0xFFFF)
+        {
+            break;
+        }
+        if (offset + sizeof(header) + header.length > SECTOR_SIZE ||
+            header.crc != record_crc(header, buffer + offset + sizeof(header)))
+        {
+            // 掉电时写了一半的记录, 之后的位置不能再编程
+            offset = SECTOR_SIZE;
+            break;
+        }
+        offset += sizeof(header) + header.length;
+    }
+    // 剩余部分必须仍是擦除状态, 否则换扇区
+    if (offset < SECTOR_SIZE && std::any_of(buffer + offset, buffer + SECTOR_SIZE, [](uint8_t b)
+                                            { return b != 0xFF; }))
+    {
+        offset = SECTOR_SIZE;
+    }
+    _offset = offset;
+
+    heap_caps_free(buffer);
+    return true;
+}
+
+bool BlackBox::append(uint8_t type, const void *payload, size_t length)
+{
+    if (!is_ready() || length > MAX_PAYLOAD)
+    {
+        return false;
+    }
+
+    if (_mark_pending.exchange(false))
+    {
+        struct timeval now;
+        gettimeofday(&now, nullptr);
+        const MarkRecord mark = {
+            .unix_us = static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_usec,
+            .timer_us = esp_timer_get_time(),
+        };
+        stage_record(RECORD_MARK, &mark, sizeof(mark));
+    }
+    return stage_record(type, payload, length);
+}
+
+bool BlackBox::stage_record(uint8_t type, const void *payload, size_t length)
+{
+    RecordHeader header = {
+        .length = static_cast<uint8_t>(length),
+        .type = type,
+        .crc = 0,
+    };
+    header.crc = record_crc(header, static_cast<const uint8_t *>(payload));
+    const size_t total = sizeof(header) + length;
+
+    xSemaphoreTake(_stage_lock, portMAX_DELAY);
+    if (STAGE_SIZE - _stage_used[_fill] < total)
+    {
+        if (_pending >= 0)
+        {
+            // 后台任务还在写上一个缓冲
+            xSemaphoreGive(_stage_lock);
+            _dropped++;
+            return false;
+        }
+        _pending = _fill;
+        _fill ^= 1;
+        _stage_used[_fill] = 0;
+        xSemaphoreGive(_wake);
+    }
+    uint8_t *dest = _stage[_fill] + _stage_used[_fill];
+    memcpy(dest, &header, sizeof(header));
+    memcpy(dest + sizeof(header), payload, length);
+    _stage_used[_fill] += total;
+    xSemaphoreGive(_stage_lock);
+
+    _records++;
+    return true;
+}
+
+void BlackBox::writer_task()
+{
+    while (true)
+    {
+        xSemaphoreTake(_wake, pdMS_TO_TICKS(FLUSH_INTERVAL_MS));
+
+        // 写完待写缓冲后, 把填了一半的缓冲也换出来写掉
+        while (true)
+        {
+            xSemaphoreTake(_stage_lock, portMAX_DELAY);
+            if (_pending < 0 && _stage_used[_fill] > 0)
+            {
+                _pending = _fill;
+                _fill ^= 1;
+                _stage_used[_fill] = 0;
+            }
+            const int buffer = _pending;
+            xSemaphoreGive(_stage_lock);
+            if (buffer < 0)
+            {
+                break;
+            }
+
+            xSemaphoreTake(_flash_lock, portMAX_DELAY);
+            write_stage(_stage[buffer], _stage_used[buffer]);
+            xSemaphoreGive(_flash_lock);
+
+            xSemaphoreTake(_stage_lock, portMAX_DELAY);
+            _pending = -1;
+            xSemaphoreGive(_stage_lock);
+        }
+        xSemaphoreGive(_flushed);
+    }
+}
+
+// 记录不跨扇区; 同一扇区内连续的记录合并为一次写入
+void BlackBox::write_stage(const uint8_t *data, size_t length)
+{
+    size_t position = 0;
+    size_t batch_start = 0;
+    while (position < length)
+    {
+        RecordHeader header;
+        memcpy(&header, data + position, sizeof(header));
+        const size_t total = sizeof(header) + header.length;
+
+        if (_offset + total > SECTOR_SIZE)
+        {
+            const size_t batch_length = position - batch_start;
+            if (batch_length > 0 &&
+                esp_partition_write(_partition, _sector * SECTOR_SIZE + _offset - batch_length, data + batch_start, batch_length) == ESP_OK)
+            {
+                _flash_bytes += batch_length;
+            }
+            if (!open_next_sector())
+            {
+                // 剩余记录无处可写
+                for (size_t p = position; p < length; p += sizeof(header) + data[p])
+                {
+                    _dropped++;
+                }
+                return;
+            }
+            batch_start = position;
+        }
+        _offset += total;
+        position += total;
+    }
+
+    const size_t batch_length = position - batch_start;
+    if (batch_length > 0)
+    {
+        const esp_err_t ret = esp_partition_write(_partition, _sector * SECTOR_SIZE + _offset - batch_length, data + batch_start, batch_length);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Write failed: %s", esp_err_to_name(ret));
+            // 写入位置已不可信, 下一条记录换扇区
+            _offset = SECTOR_SIZE;
+            return;
+        }
+        _flash_bytes += batch_length;
+    }
+}
+
+bool BlackBox::open_next_sector()
+{
+    const size_t next = (_sector + 1) % _sector_count;
+    esp_err_t ret = esp_partition_erase_range(_partition, next * SECTOR_SIZE, SECTOR_SIZE);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Erase sector %zu failed: %s", next, esp_err_to_name(ret));
+        return false;
+    }
+    _erases++;
+
+    SectorHeader header = {
+        .magic = SECTOR_MAGIC,
+        .sequence = _sequence + 1,
+        .crc = 0,
+    };
+    header.crc = sector_crc(header);
+    ret = esp_partition_write(_partition, next * SECTOR_SIZE, &header, sizeof(header));
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Write sector header failed: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    _sector = next;
+    _sequence++;
+    _offset = sizeof(header);
+    if (_sequence - _first_sequence >= _sector_count)
+    {
+        _first_sequence = _sequence - _sector_count + 1;
+    }
+    return true;
+}
+
+bool BlackBox::flush(TickType_t timeout)
+{
+    if (!is_ready())
+    {
+        return false;
+    }
+    // 清掉旧的完成信号, 等下一轮写完
+    xSemaphoreTake(_flushed, 0);
+    xSemaphoreGive(_wake);
+    return xSemaphoreTake(_flushed, timeout) == pdTRUE;
+}
+
+void BlackBox::set_mode(Mode mode)
+{
+    if (_mode.exchange(mode) != mode)
+    {
+        _mark_pending = true;
+    }
+}
+
+BlackBox::Mode BlackBox::get_mode() const
+{
+    return _mode.load();
+}
+
+void BlackBox::storage_listener(bool available, void *context)
+{
+    BlackBox *instance = static_cast<BlackBox *>(context);
+    if (instance->_storage_present.exchange(available) != available && !available)
+    {
+        instance->_mark_pending = true;
+    }
+}
+
+bool BlackBox::export_to(const char *path)
+{
+    if (!is_ready())
+    {
+        ESP_LOGE(TAG, "Black box not available");
+        return false;
+    }
+    flush(pdMS_TO_TICKS(2000));
+
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return false;
+    }
+    uint8_t *buffer = static_cast<uint8_t *>(heap_caps_malloc(SECTOR_SIZE, MALLOC_CAP_8BIT));
+    if (!buffer)
+    {
+        ESP_LOGE(TAG, "Failed to allocate export buffer");
+        fclose(file);
+        return false;
+    }
+
+    // 文件头: magic, 扇区大小, 扇区数, 之后为扇区原样内容
+    uint32_t file_header[3] = {FILE_MAGIC, SECTOR_SIZE, 0};
+    bool ok = fwrite(file_header, sizeof(file_header), 1, file) == 1;
+
+    // 导出期间暂停写入, 暂存区满时新记录会被丢弃
+    xSemaphoreTake(_flash_lock, portMAX_DELAY);
+    for (size_t i = 1; ok && i <= _sector_count; i++)
+    {
+        const size_t sector = (_sector + i) % _sector_count;
+        SectorHeader header;
+        if (esp_partition_read(_partition, sector * SECTOR_SIZE, buffer, SECTOR_SIZE) != ESP_OK)
+        {
+            continue;
+        }
+        memcpy(&header, buffer, sizeof(header));
+        if (!is_valid_sector(header))
+        {
+            continue;
+        }
+        ok = fwrite(buffer, SECTOR_SIZE, 1, file) == 1;
+        file_header[2]++;
+    }
+    xSemaphoreGive(_flash_lock);
+
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(file_header, sizeof(file_header), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    heap_caps_free(buffer);
+
+    if (!ok)
+    {
+        ESP_LOGE(TAG, "Failed to write %s", path);
+        return false;
+    }
+    printf("Exported %" PRIu32 " sectors to %s\n", file_header[2], path);
+    return true;
+}
+
+bool BlackBox::erase_all()
+{
+    if (!is_ready())
+    {
+        return false;
+    }
+    flush(pdMS_TO_TICKS(2000));
+
+    xSemaphoreTake(_flash_lock, portMAX_DELAY);
+    const esp_err_t ret = esp_partition_erase_range(_partition, 0, _sector_count * SECTOR_SIZE);
+    _sector = _sector_count - 1;
+    _sequence = 0;
+    _first_sequence = 1;
+    _offset = SECTOR_SIZE;
+    xSemaphoreGive(_flash_lock);
+
+    _mark_pending = true;
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Erase failed: %s", esp_err_to_name(ret));
+        return false;
+    }
+    return true;
+}
+
+void BlackBox::print_stats()
+{
+    if (!is_ready())
+    {
+        printf("Black box not available\n");
+        return;
+    }
+
+    xSemaphoreTake(_flash_lock, portMAX_DELAY);
+    const uint32_t sequence = _sequence;
+    const uint32_t used = sequence ? sequence - _first_sequence + 1 : 0;
+    const size_t sector = _sector;
+    const size_t offset = _offset;
+    const uint32_t erases = _erases;
+    const uint64_t flash_bytes = _flash_bytes;
+    xSemaphoreGive(_flash_lock);
+
+    printf("Partition '%s': %" PRIu32 " KiB, %zu sectors, mode %s%s\n",
+           _partition->label, _partition->size / 1024, _sector_count,
+           MODE_NAMES[static_cast<int>(_mode.load())], is_active() ? " (recording)" : "");
+    printf("Sectors: %" PRIu32 " used, newest #%" PRIu32 " at %zu, offset %zu\n", used, sequence, sector, offset);
+    printf("Records: %" PRIu32 " staged, %" PRIu32 " dropped; %" PRIu32 " erases, %" PRIu64 " bytes written since boot\n",
+           _records.load(), _dropped.load(), erases, flash_bytes);
+}
+
+void BlackBox::load_config()
+{
+    esp_err_t ret;
+    std::unique_ptr<nvs::NVSHandle> nvs_handle = nvs::open_nvs_handle(NVS_NAMESPACE, NVS_READONLY, &ret);
+    if (ret != ESP_OK)
+    {
+        return; // 从未保存过
+    }
+
+    uint8_t mode;
+    if (nvs_handle->get_item(NVS_KEY_MODE, mode) == ESP_OK && mode <= static_cast<uint8_t>(Mode::ALWAYS))
+    {
+        _mode = static_cast<Mode>(mode);
+    }
+}
+
+void BlackBox::save_config()
+{
+    esp_err_t ret;
+    std::unique_ptr<nvs::NVSHandle> nvs_handle = nvs::open_nvs_handle(NVS_NAMESPACE, NVS_READWRITE, &ret);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Open NVS failed: %s", esp_err_to_name(ret));
+        return;
+    }
+
+    nvs_handle->set_item(NVS_KEY_MODE, static_cast<uint8_t>(_mode.load()));
+    nvs_handle->commit();
+}
+
+int BlackBox::command(void *context, int argc, char **argv)
+{
+    BlackBox *instance = static_cast<BlackBox *>(context);
+    int nerrors = arg_parse(argc, argv, (void **)&args);
+    if (nerrors != 0)
+    {
+        arg_print_errors(stderr, args.end, argv[0]);
+        return 1;
+    }
+
+    if (args.mode->count > 0)
+    {
+        const char *name = args.mode->sval[0];
+        size_t i = 0;
+        while (i < sizeof(MODE_NAMES) / sizeof(MODE_NAMES[0]) && strcmp(name, MODE_NAMES[i]) != 0)
+        {
+            i++;
+        }
+        if (i == sizeof(MODE_NAMES) / sizeof(MODE_NAMES[0]))
+        {
+            printf("Unknown mode '%s', expected off, auto or always\n", name);
+            return 1;
+        }
+        instance->set_mode(static_cast<Mode>(i));
+        instance->save_config();
+    }
+    if (args.save->count > 0)
+    {
+        return instance->export_to(args.save->sval[0]) ? 0 : 1;
+    }
+    if (args.erase->count > 0)
+    {
+        return instance->erase_all() ? 0 : 1;
+    }
+
+    instance->print_stats();
+    return 0;
+}
+
+void BlackBox::registerConsoleCommands()
+{
+    args.mode = arg_str0("m", "mode", "<off|auto|always>", "Record only while the SD card is absent (auto) or always");
+    args.save = arg_str0("s", "save", "<file>", "Export sectors oldest first for tools/blackbox.py");
+    args.erase = arg_lit0(nullptr, "erase", "Erase the whole partition");
+    args.end = arg_end(3);
+
+    const esp_console_cmd_t blackbox_cmd = {
+        .command = "blackbox",
+        .help = "Show or export the internal flash black box",
+        .hint = nullptr,
+        .func = nullptr,
+        .argtable = &args,
+        .func_w_context = &BlackBox::command,
+        .context = this,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&blackbox_cmd));
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_partition.h"
+#include "esp_console.h"
+#include "argtable3/argtable3.h"
+
+    // 片上 Flash 黑匣子: 独立分区上的原始环形记录区, 不经过文件系统.
+    // 每个 4 KiB 扇区以扇区头开始, 之后顺序追加记录, 写满后擦除下一个扇区继续, 绕回时覆盖最旧的扇区.
+    // 记录先拷贝到内存暂存, 由后台任务批量写入, 调用方不等待擦写. 格式见 tools/blackbox.py
+    class BlackBox
+    {
+    public:
+        enum class Mode : uint8_t
+        {
+            OFF,
+            AUTO,   // 只在存储卡不在时记录
+            ALWAYS, // 一直记录, 注意 Flash 擦写寿命
+        };
+
+        static constexpr uint32_t SECTOR_MAGIC = 0x31584242; // "BBX1"
+        static constexpr uint32_t FILE_MAGIC = 0x46584242;   // "BBXF", 导出文件
+        static constexpr size_t SECTOR_SIZE = 4096;
+        static constexpr size_t MAX_PAYLOAD = 250;
+
+        // 记录类型
+        static constexpr uint8_t RECORD_MARK = 0; // 开始记录, 载荷为 MarkRecord
+        static constexpr uint8_t RECORD_CAN = 1;  // CAN 帧, 载荷为 CanRecord 去掉未用的数据字节
+
+        struct SectorHeader
+        {
+            uint32_t magic;
+            uint32_t sequence; // 每换一个扇区加 1
+            uint32_t crc;      // 前两个字段的 CRC32
+        };
+
+        // 全 0xFF 表示扇区内已无记录
+        struct RecordHeader
+        {
+            uint8_t length; // 载荷长度
+            uint8_t type;
+            uint16_t crc; // length、type 与载荷的 CRC32 低 16 位
+        };
+
+        struct MarkRecord
+        {
+            int64_t unix_us;  // 墙上时间
+            int64_t timer_us; // esp_timer 时间
+        };
+
+        struct __attribute__((packed)) CanRecord
+        {
+            int64_t timestamp_us;
+            uint32_t identifier;
+            uint8_t channel;
+            uint8_t flags; // bit0 扩展帧, bit1 远程帧
+            uint8_t dlc;
+            uint8_t data[8];
+        };
+
+        explicit BlackBox(const char *label = "blackbox");
+        ~BlackBox();
+
+        bool is_ready() const;
+        // 按模式与存储卡状态判断当前是否需要记录
+        bool is_active() const;
+
+        // 拷贝到暂存区, 暂存区满时丢弃并计数
+        bool append(uint8_t type, const void *payload, size_t length);
+
+        // 等暂存的记录写入 Flash
+        bool flush(TickType_t timeout = portMAX_DELAY);
+
+        void set_mode(Mode mode);
+        Mode get_mode() const;
+
+        // 签名与 SDCard::PresenceCallback 相同, context 为 BlackBox*
+        static void storage_listener(bool available, void *context);
+
+        // 按从旧到新的顺序导出有效扇区
+        bool export_to(const char *path);
+        bool erase_all();
+        void print_stats();
+
+        void registerConsoleCommands();
+
+    private:
+        const char *TAG = "BlackBox";
+        static const uint32_t StackSize = 3072;
+
+        static constexpr size_t STAGE_SIZE = 2048;
+        static constexpr uint32_t FLUSH_INTERVAL_MS = 500;
+
+        const esp_partition_t *_partition = nullptr;
+        size_t _sector_count = 0;
+
+        // 以下仅在持 _flash_lock 时访问
+        size_t _sector = 0;     // 当前扇区
+        size_t _offset = 0;     // 当前扇区的写入位置, 等于 SECTOR_SIZE 时下一条记录换扇区
+        uint32_t _sequence = 0; // 当前扇区序号, 0 表示分区为空
+        uint32_t _first_sequence = 0;
+        uint32_t _erases = 0;
+        uint64_t _flash_bytes = 0;
+
+        // 双缓冲暂存: 调用方填 _stage[_fill], 写满或定时交给后台任务
+        uint8_t *_stage[2] = {};
+        size_t _stage_used[2] = {};
+        int _fill = 0;
+        int _pending = -1; // 等待写入的缓冲, -1 为无
+        SemaphoreHandle_t _stage_lock = nullptr;
+        SemaphoreHandle_t _flash_lock = nullptr;
+        SemaphoreHandle_t _wake = nullptr;
+        SemaphoreHandle_t _flushed = nullptr;
+
+        std::atomic<Mode> _mode{Mode::AUTO};
+        std::atomic<bool> _storage_present{true};
+        std::atomic<bool> _mark_pending{true}; // 下一条记录前先写开始标记
+        std::atomic<uint32_t> _records{0};
+        std::atomic<uint32_t> _dropped{0};
+
+        static constexpr const char *NVS_NAMESPACE = "blackbox";
+        static constexpr const char *NVS_KEY_MODE = "mode";
+
+        static struct
+        {
+            struct arg_str *mode;
+            struct arg_str *save;
+            struct arg_lit *erase;
+            struct arg_end *end;
+        } args;
+
+        bool scan();
+        void writer_task();
+        void write_stage(const uint8_t *data, size_t length);
+        bool open_next_sector();
+        bool stage_record(uint8_t type, const void *payload, size_t length);
+
+        void load_config();
+        void save_config();
+
+        static int command(void *context, int argc, char **argv);
+    };
+
+#ifdef __cplusplus
+}
+#endif
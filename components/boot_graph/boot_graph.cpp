@@ -0,0 +1,250 @@
+#include "boot_graph.hpp"
+
+#include <cstdio>
+#include <algorithm>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "boot_trace.hpp"
+
+BootGraph::BootGraph()
+{
+    _lock = xSemaphoreCreateMutex();
+    for (SemaphoreHandle_t &wake : _wake)
+    {
+        wake = xSemaphoreCreateBinary();
+    }
+    _done_bits = xEventGroupCreate();
+}
+
+BootGraph::~BootGraph()
+{
+    // 只应在 wait_all() 之后析构, 此时工作任务已退出
+    vSemaphoreDelete(_lock);
+    for (SemaphoreHandle_t wake : _wake)
+    {
+        vSemaphoreDelete(wake);
+    }
+    vEventGroupDelete(_done_bits);
+}
+
+int BootGraph::add(const char *name, StageFunc func, std::initializer_list<int> deps, int core)
+{
+    return add_stage(name, std::move(func), deps, core, false);
+}
+
+int BootGraph::add_lazy(const char *name, StageFunc func, std::initializer_list<int> deps)
+{
+    return add_stage(name, std::move(func), deps, ANY_CORE, true);
+}
+
+int BootGraph::add_stage(const char *name, StageFunc func, std::initializer_list<int> deps, int core, bool lazy)
+{
+    if (_start_us != 0 || _count >= MAX_STAGES)
+    {
+        ESP_LOGE(TAG, "Cannot add stage %s", name);
+        return -1;
+    }
+    uint32_t mask = 0;
+    for (int dep : deps)
+    {
+        // 依赖必须是已登记的阶段, 前一个阶段登记失败时这里一并失败
+        if (dep < 0 || dep >= static_cast<int>(_count))
+        {
+            ESP_LOGE(TAG, "Stage %s has an invalid dependency", name);
+            return -1;
+        }
+        mask |= 1UL << dep;
+    }
+    if (core >= portNUM_PROCESSORS)
+    {
+        core = ANY_CORE;
+    }
+
+    Stage &stage = _stages[_count];
+    stage.name = name;
+    stage.func = std::move(func);
+    stage.deps = mask;
+    stage.core = core;
+    stage.lazy = lazy;
+    stage.state = STAGE_PENDING;
+    if (!lazy)
+    {
+        _critical |= 1UL << _count;
+    }
+    return static_cast<int>(_count++);
+}
+
+void BootGraph::start()
+{
+    _start_us = esp_timer_get_time();
+
+    auto task_func = [](void *arg)
+    {
+        WorkerContext *context = static_cast<WorkerContext *>(arg);
+        context->graph->worker_task(context->worker);
+    };
+    for (int i = 0; i < WORKER_COUNT; i++)
+    {
+        const Worker worker = static_cast<Worker>(i);
+        const BaseType_t core = worker == WORKER_LAZY ? tskNO_AFFINITY : static_cast<BaseType_t>(worker);
+        if (core != tskNO_AFFINITY && core >= portNUM_PROCESSORS)
+        {
+            continue;
+        }
+        _contexts[i] = {this, worker};
+        xTaskCreatePinnedToCore(task_func, worker == WORKER_LAZY ? "boot_lazy" : "boot", StackSize, &_contexts[i], Priority, nullptr, core);
+    }
+}
+
+BootGraph::Stage *BootGraph::next_stage(Worker worker, bool &remaining)
+{
+    const bool lazy = worker == WORKER_LAZY;
+    for (size_t i = 0; i < _count; i++)
+    {
+        Stage &stage = _stages[i];
+        if (stage.state != STAGE_PENDING || stage.lazy != lazy)
+        {
+            continue;
+        }
+        if (!lazy && stage.core != ANY_CORE && stage.core != worker)
+        {
+            continue;
+        }
+        remaining = true;
+
+        uint32_t needed = stage.deps;
+        if (lazy)
+        {
+            needed |= _critical;
+        }
+        if ((_done & needed) == needed)
+        {
+            stage.state = STAGE_RUNNING;
+            return &stage;
+        }
+    }
+    return nullptr;
+}
+
+void BootGraph::run(Stage &stage)
+{
+    stage.ran_core = xPortGetCoreID();
+    stage.start_us = esp_timer_get_time();
+    const uint32_t trace = BootTrace::begin(stage.name);
+    stage.func();
+    BootTrace::end(trace);
+    stage.end_us = esp_timer_get_time();
+
+    const uint32_t bit = 1UL << (&stage - _stages);
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    stage.state = STAGE_DONE;
+    _done |= bit;
+    xSemaphoreGive(_lock);
+
+    xEventGroupSetBits(_done_bits, bit);
+    for (SemaphoreHandle_t wake : _wake)
+    {
+        xSemaphoreGive(wake);
+    }
+}
+
+void BootGraph::worker_task(Worker worker)
+{
+    while (true)
+    {
+        bool remaining = false;
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        Stage *stage = next_stage(worker, remaining);
+        xSemaphoreGive(_lock);
+
+        if (stage)
+        {
+            run(*stage);
+            continue;
+        }
+        if (!remaining)
+        {
+            break;
+        }
+        // 依赖还在别的核上执行, 等任一阶段完成
+        xSemaphoreTake(_wake[worker], portMAX_DELAY);
+    }
+    vTaskDelete(nullptr);
+}
+
+bool BootGraph::wait(int stage, TickType_t timeout)
+{
+    if (stage < 0 || stage >= static_cast<int>(_count))
+    {
+        return false;
+    }
+    const EventBits_t bit = 1UL << stage;
+    return (xEventGroupWaitBits(_done_bits, bit, pdFALSE, pdTRUE, timeout) & bit) != 0;
+}
+
+void BootGraph::wait_critical()
+{
+    if (_critical)
+    {
+        xEventGroupWaitBits(_done_bits, _critical, pdFALSE, pdTRUE, portMAX_DELAY);
+    }
+}
+
+void BootGraph::wait_all()
+{
+    const EventBits_t all = (1UL << _count) - 1;
+    if (all)
+    {
+        xEventGroupWaitBits(_done_bits, all, pdFALSE, pdTRUE, portMAX_DELAY);
+    }
+}
+
+int64_t BootGraph::ready_time(const Stage &stage) const
+{
+    // 最后一个依赖完成的时刻; 惰性阶段还要等关键阶段全部完成
+    int64_t ready = _start_us;
+    const uint32_t needed = stage.lazy ? (stage.deps | _critical) : stage.deps;
+    for (size_t i = 0; i < _count; i++)
+    {
+        if (needed & (1UL << i))
+        {
+            ready = std::max(ready, _stages[i].end_us);
+        }
+    }
+    return ready;
+}
+
+void BootGraph::print_timings() const
+{
+    int64_t critical_end = _start_us;
+    int64_t all_end = _start_us;
+    int64_t busy = 0;
+
+    // 时间为上电后的毫秒数, wait 为依赖就绪到开始执行的排队时间
+    printf("%-12s %4s %9s %9s %9s %9s\n", "stage", "core", "start", "end", "time", "wait");
+    for (size_t i = 0; i < _count; i++)
+    {
+        const Stage &stage = _stages[i];
+        if (stage.state != STAGE_DONE)
+        {
+            printf("%-12s %4s\n", stage.name, stage.state == STAGE_RUNNING ? "run" : "-");
+            continue;
+        }
+        const int64_t duration = stage.end_us - stage.start_us;
+        printf("%-12s %3d%c %9.1f %9.1f %9.1f %9.1f\n", stage.name, stage.ran_core, stage.lazy ? '*' : ' ',
+               stage.start_us / 1000.0, stage.end_us / 1000.0, duration / 1000.0,
+               (stage.start_us - ready_time(stage)) / 1000.0);
+        busy += duration;
+        all_end = std::max(all_end, stage.end_us);
+        if (!stage.lazy)
+        {
+            critical_end = std::max(critical_end, stage.end_us);
+        }
+    }
+
+    const int64_t elapsed = all_end - _start_us;
+    printf("Graph start %.1f ms, critical done %.1f ms, all done %.1f ms (* lazy)\n",
+           _start_us / 1000.0, critical_end / 1000.0, all_end / 1000.0);
+    printf("Stage time %.1f ms in %.1f ms wall, x%.2f\n",
+           busy / 1000.0, elapsed / 1000.0, elapsed > 0 ? static_cast<double>(busy) / elapsed : 0.0);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+
+    // 启动依赖图: 各子系统的初始化登记为阶段, 声明依赖与可选的核.
+    // start() 后两个核各有一个工作任务, 取依赖已完成的阶段并行执行;
+    // 惰性阶段在全部关键阶段完成后由低优先级任务依次执行, 不占用关键路径.
+    // 依赖只能指向先登记的阶段, 图中不会有环. 每个阶段的就绪/开始/结束时间由 print_timings() 输出
+    class BootGraph
+    {
+    public:
+        using StageFunc = std::function<void()>;
+
+        static constexpr size_t MAX_STAGES = 24; // 每个阶段占事件组一位
+        static constexpr int ANY_CORE = -1;
+
+        BootGraph();
+        ~BootGraph();
+
+        // 返回阶段编号, 供后续阶段声明依赖; 失败返回 -1
+        int add(const char *name, StageFunc func, std::initializer_list<int> deps = {}, int core = ANY_CORE);
+        // 惰性阶段: 关键阶段全部完成后才执行
+        int add_lazy(const char *name, StageFunc func, std::initializer_list<int> deps = {});
+
+        void start();
+
+        bool wait(int stage, TickType_t timeout = portMAX_DELAY);
+        void wait_critical();
+        void wait_all();
+
+        void print_timings() const;
+
+    private:
+        const char *TAG = "BootGraph";
+        static const uint32_t StackSize = 8192;
+        static const UBaseType_t Priority = 1; // 与 app_main 同级, 先启动的接收任务不被初始化饿死
+
+        enum StageState : uint8_t
+        {
+            STAGE_PENDING,
+            STAGE_RUNNING,
+            STAGE_DONE,
+        };
+
+        struct Stage
+        {
+            const char *name;
+            StageFunc func;
+            uint32_t deps; // 依赖阶段的位掩码
+            int core;
+            bool lazy;
+            StageState state;
+            int ran_core;
+            int64_t start_us;
+            int64_t end_us;
+        };
+
+        // 工作任务: 每核一个关键任务, 另有一个惰性任务
+        enum Worker : uint8_t
+        {
+            WORKER_CORE0,
+            WORKER_CORE1,
+            WORKER_LAZY,
+            WORKER_COUNT,
+        };
+
+        struct WorkerContext
+        {
+            BootGraph *graph;
+            Worker worker;
+        };
+
+        Stage _stages[MAX_STAGES] = {};
+        size_t _count = 0;
+        uint32_t _done = 0;
+        uint32_t _critical = 0; // 关键阶段的位掩码
+        int64_t _start_us = 0;
+
+        SemaphoreHandle_t _lock = nullptr;
+        SemaphoreHandle_t _wake[WORKER_COUNT] = {};
+        WorkerContext _contexts[WORKER_COUNT] = {};
+        EventGroupHandle_t _done_bits = nullptr;
+
+        int add_stage(const char *name, StageFunc func, std::initializer_list<int> deps, int core, bool lazy);
+        Stage *next_stage(Worker worker, bool &remaining);
+        void run(Stage &stage);
+        void worker_task(Worker worker);
+        int64_t ready_time(const Stage &stage) const;
+    };
+
+#ifdef __cplusplus
+}
+#endif
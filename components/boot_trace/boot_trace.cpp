@@ -0,0 +1,187 @@
+#include "boot_trace.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+RTC_NOINIT_ATTR BootTrace::Trace BootTrace::_trace;
+RTC_NOINIT_ATTR BootTrace::Trace BootTrace::_last;
+std::atomic<uint32_t> BootTrace::_next{0};
+std::atomic<bool> BootTrace::_finished{false};
+decltype(BootTrace::boottime_args) BootTrace::boottime_args;
+
+// 全局对象构造阶段开始追踪, 早于 app_main 和各组件的构造
+__attribute__((constructor)) static void boot_trace_start()
+{
+    BootTrace::start();
+}
+
+void BootTrace::start()
+{
+    // 上电后 RTC 内存是随机值, 魔数不对就当作没有上一次记录
+    if (_trace.magic == MAGIC)
+    {
+        memcpy(&_last, &_trace, sizeof(Trace));
+    }
+    else
+    {
+        memset(&_last, 0, sizeof(Trace));
+    }
+    memset(&_trace, 0, sizeof(Trace));
+    _trace.magic = MAGIC;
+    _next = 0;
+    _finished = false;
+    mark("app_start");
+}
+
+uint32_t BootTrace::claim(const char *name, int64_t now)
+{
+    const uint32_t index = _next.fetch_add(1);
+    if (index >= MAX_ENTRIES)
+    {
+        return INVALID;
+    }
+    Entry &entry = _trace.entries[index];
+    strncpy(entry.name, name, NAME_LEN - 1);
+    entry.name[NAME_LEN - 1] = '\0';
+    entry.start_us = static_cast<uint32_t>(now);
+    entry.end_us = 0;
+    entry.core = static_cast<uint8_t>(xPortGetCoreID());
+    entry.span = false;
+    return index;
+}
+
+uint32_t BootTrace::begin(const char *name)
+{
+    const int64_t now = esp_timer_get_time();
+    if (_finished.load() || now > LIMIT_US)
+    {
+        return INVALID;
+    }
+    const uint32_t index = claim(name, now);
+    if (index != INVALID)
+    {
+        _trace.entries[index].span = true;
+    }
+    return index;
+}
+
+void BootTrace::end(uint32_t index)
+{
+    if (index < MAX_ENTRIES)
+    {
+        _trace.entries[index].end_us = static_cast<uint32_t>(esp_timer_get_time());
+    }
+}
+
+void BootTrace::mark(const char *name)
+{
+    const int64_t now = esp_timer_get_time();
+    if (!_finished.load() && now <= LIMIT_US)
+    {
+        claim(name, now);
+    }
+}
+
+void BootTrace::finish(const char *name)
+{
+    if (_finished.exchange(true))
+    {
+        return;
+    }
+    const int64_t now = esp_timer_get_time();
+    if (now <= LIMIT_US)
+    {
+        claim(name, now);
+        _trace.finished = 1;
+        ESP_LOGI(TAG, "%s at %.1f ms after reset", name, now / 1000.0);
+    }
+}
+
+bool BootTrace::is_finished()
+{
+    return _finished.load();
+}
+
+void BootTrace::print(const Trace &trace)
+{
+    // 时间为复位后的毫秒数, 未结束的区间结束列为 -
+    printf("%-16s %4s %9s %9s %9s\n", "name", "core", "start", "end", "time");
+    for (const Entry &entry : trace.entries)
+    {
+        if (entry.name[0] == '\0')
+        {
+            continue;
+        }
+        if (!entry.span)
+        {
+            printf("%-16s %4u %9.1f\n", entry.name, entry.core, entry.start_us / 1000.0);
+        }
+        else if (entry.end_us == 0)
+        {
+            printf("%-16s %4u %9.1f %9s\n", entry.name, entry.core, entry.start_us / 1000.0, "-");
+        }
+        else
+        {
+            printf("%-16s %4u %9.1f %9.1f %9.1f\n", entry.name, entry.core, entry.start_us / 1000.0,
+                   entry.end_us / 1000.0, (entry.end_us - entry.start_us) / 1000.0);
+        }
+    }
+    if (trace.entries[MAX_ENTRIES - 1].name[0] != '\0')
+    {
+        printf("Trace full, later entries dropped\n");
+    }
+}
+
+int BootTrace::boottimeCommand(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&boottime_args);
+    if (nerrors != 0)
+    {
+        arg_print_errors(stderr, boottime_args.end, argv[0]);
+        return 1;
+    }
+
+    if (boottime_args.last->count > 0)
+    {
+        if (_last.magic != MAGIC)
+        {
+            printf("No trace from the previous boot (power-on reset clears RTC memory)\n");
+            return 0;
+        }
+        print(_last);
+        if (!_last.finished)
+        {
+            printf("Reset before the first CAN frame was logged\n");
+        }
+        return 0;
+    }
+    if (!_finished.load())
+    {
+        printf("Still recording, waiting for the first CAN frame\n");
+    }
+    print(_trace);
+    return 0;
+}
+
+void BootTrace::registerConsoleCommands()
+{
+    boottime_args.last = arg_lit0("l", "last", "Show the trace kept from the previous boot");
+    boottime_args.end = arg_end(2);
+
+    const esp_console_cmd_t boottime_cmd = {
+        .command = "boottime",
+        .help = "Print subsystem init and driver install times from reset to the first logged CAN frame",
+        .hint = nullptr,
+        .func = &BootTrace::boottimeCommand,
+        .argtable = &boottime_args,
+        .func_w_context = nullptr,
+        .context = nullptr,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&boottime_cmd));
+}
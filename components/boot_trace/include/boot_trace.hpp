@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "esp_console.h"
+#include "argtable3/argtable3.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+// 启动耗时追踪: 记录各子系统构造与驱动安装的起止时刻, 直到第一帧 CAN 交给记录器.
+// 时间取自系统定时器, 复位后从 0 计数, app_start 之前即 ROM 与二级引导的耗时.
+// 表放在 RTC 内存, 软件复位、看门狗复位后仍可用 boottime -l 查看上一次启动
+class BootTrace
+{
+public:
+    static constexpr size_t MAX_ENTRIES = 40;
+    static constexpr size_t NAME_LEN = 16;
+    static constexpr uint32_t INVALID = UINT32_MAX;
+    static constexpr int64_t LIMIT_US = 60 * 1000 * 1000; // 总线上一直没有帧时, 超过后不再记录
+
+    // 开始一段记录, 返回编号交给 end(); 追踪已结束或表满时返回 INVALID
+    static uint32_t begin(const char *name);
+    static void end(uint32_t index);
+    // 单个时刻
+    static void mark(const char *name);
+    // 打点并结束本次追踪, 之后运行中重装驱动等不再记录
+    static void finish(const char *name);
+    static bool is_finished();
+
+    static void registerConsoleCommands();
+
+    // 作用域内的一段记录
+    class Scope
+    {
+    public:
+        explicit Scope(const char *name) : _index(begin(name)) {}
+        ~Scope() { end(_index); }
+
+    private:
+        uint32_t _index;
+    };
+
+    // 上电初始化全局对象时调用: 保存上一次的记录, 开始本次追踪
+    static void start();
+
+private:
+    static constexpr const char *TAG = "BootTrace";
+    static constexpr uint32_t MAGIC = 0x54425431; // "1TBT"
+
+    struct Entry
+    {
+        char name[NAME_LEN]; // 复制名字, 换了固件后上一次的记录仍可读
+        uint32_t start_us;
+        uint32_t end_us; // 区间未结束时为 0, 复位前卡在哪一步由此可见
+        uint8_t core;
+        bool span;
+        uint8_t reserved[2];
+    };
+
+    struct Trace
+    {
+        uint32_t magic;
+        uint32_t finished;
+        Entry entries[MAX_ENTRIES];
+    };
+
+    static Trace _trace; // 本次启动, RTC 内存
+    static Trace _last;  // 上一次启动, RTC 内存
+    static std::atomic<uint32_t> _next;
+    static std::atomic<bool> _finished;
+
+    static struct
+    {
+        struct arg_lit *last;
+        struct arg_end *end;
+    } boottime_args;
+
+    static uint32_t claim(const char *name, int64_t now);
+    static void print(const Trace &trace);
+    static int boottimeCommand(int argc, char **argv);
+};
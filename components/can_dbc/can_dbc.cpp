@@ -0,0 +1,431 @@
+#include "can_dbc.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <algorithm>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+decltype(CanDbc::signal_args) CanDbc::signal_args;
+
+namespace
+{
+    const int NO_MUX_VALUE = -1;
+
+    // 解析阶段的中间结构, 编译后丢弃
+    struct ParsedSignal
+    {
+        std::string name;
+        std::string unit;
+        uint32_t start_bit;
+        uint32_t length;
+        bool big_endian;
+        bool is_signed;
+        double factor;
+        double offset;
+        bool is_multiplexor;
+        int mux;
+    };
+
+    struct ParsedMessage
+    {
+        uint32_t key;
+        std::vector<ParsedSignal> signals;
+    };
+
+    // " SG_ Name m3 : 24|16@1+ (0.125,0) [0|8031.875] "rpm" Vector__XXX"
+    bool parse_signal_line(const char *line, ParsedSignal &signal)
+    {
+        const char *colon = strchr(line, ':');
+        if (colon == nullptr)
+        {
+            return false;
+        }
+
+        char name[64] = {0};
+        char mux[16] = {0};
+        int fields = sscanf(line, " SG_ %63s %15s", name, mux);
+        if (fields < 1)
+        {
+            return false;
+        }
+        signal.name = name;
+        signal.is_multiplexor = false;
+        signal.mux = NO_MUX_VALUE;
+        if (fields == 2 && mux[0] == 'M')
+        {
+            signal.is_multiplexor = true;
+        }
+        else if (fields == 2 && mux[0] == 'm')
+        {
+            signal.mux = atoi(&mux[1]);
+        }
+
+        unsigned start = 0, length = 0;
+        char order = 0, sign = 0;
+        double min = 0, max = 0;
+        char unit[32] = {0};
+        fields = sscanf(colon + 1, " %u|%u@%c%c (%lf,%lf) [%lf|%lf] \"%31[^\"]\"",
+                        &start, &length, &order, &sign, &signal.factor, &signal.offset, &min, &max, unit);
+        if (fields < 6 || length == 0 || length > 64)
+        {
+            return false;
+        }
+
+        signal.start_bit = start;
+        signal.length = length;
+        signal.big_endian = (order == '0');
+        signal.is_signed = (sign == '-');
+        signal.unit = unit;
+        return true;
+    }
+}
+
+CanDbc::CanDbc()
+{
+}
+
+CanDbc::~CanDbc()
+{
+}
+
+bool CanDbc::load(const std::string &file_path)
+{
+    FILE *file = fopen(file_path.c_str(), "r");
+    if (!file)
+    {
+        ESP_LOGE(TAG, "Failed to open DBC: %s", file_path.c_str());
+        return false;
+    }
+
+    std::vector<ParsedMessage> parsed;
+    char line[256];
+    bool in_message = false;
+    while (fgets(line, sizeof(line), file))
+    {
+        unsigned long id = 0;
+        if (strncmp(line, "BO_ ", 4) == 0 && sscanf(line, "BO_ %lu", &id) == 1)
+        {
+            parsed.push_back({static_cast<uint32_t>(id), {}});
+            in_message = true;
+            continue;
+        }
+
+        const char *p = line;
+        while (*p == ' ' || *p == '\t')
+        {
+            p++;
+        }
+
+        if (in_message && strncmp(p, "SG_ ", 4) == 0)
+        {
+            ParsedSignal signal;
+            if (parse_signal_line(p, signal))
+            {
+                parsed.back().signals.push_back(std::move(signal));
+            }
+            else
+            {
+                ESP_LOGW(TAG, "Skip malformed signal: %s", p);
+            }
+        }
+        else if (*p == '\n' || *p == '\r' || *p == '\0')
+        {
+            in_message = false;
+        }
+    }
+    fclose(file);
+
+    std::sort(parsed.begin(), parsed.end(), [](const ParsedMessage &a, const ParsedMessage &b)
+              { return a.key < b.key; });
+
+    _messages.clear();
+    _signals.clear();
+    _info.clear();
+
+    for (const ParsedMessage &message : parsed)
+    {
+        MessageDesc desc = {};
+        desc.key = message.key;
+        desc.first_signal = static_cast<uint16_t>(_signals.size());
+        desc.mux_signal = NO_MUX;
+
+        for (const ParsedSignal &signal : message.signals)
+        {
+            SignalDesc sig = {};
+            sig.length = static_cast<uint8_t>(signal.length);
+            sig.mask = (signal.length == 64) ? UINT64_MAX : ((1ULL << signal.length) - 1);
+            sig.factor = static_cast<float>(signal.factor);
+            sig.offset = static_cast<float>(signal.offset);
+            sig.mux = static_cast<int16_t>(signal.mux);
+            sig.flags = (signal.is_signed ? FLAG_SIGNED : 0);
+
+            if (signal.big_endian)
+            {
+                // Motorola: start_bit 为 MSB 的锯齿编号, 换算到大端64位整数中的位置
+                int msb = (7 - static_cast<int>(signal.start_bit / 8)) * 8 + static_cast<int>(signal.start_bit % 8);
+                int lsb = msb - static_cast<int>(signal.length) + 1;
+                if (signal.start_bit >= 64 || lsb < 0)
+                {
+                    ESP_LOGW(TAG, "Signal out of range: %s", signal.name.c_str());
+                    continue;
+                }
+                sig.shift = static_cast<uint8_t>(lsb);
+                sig.min_dlc = static_cast<uint8_t>(8 - lsb / 8);
+                sig.flags |= FLAG_BIG_ENDIAN;
+            }
+            else
+            {
+                if (signal.start_bit + signal.length > 64)
+                {
+                    ESP_LOGW(TAG, "Signal out of range: %s", signal.name.c_str());
+                    continue;
+                }
+                sig.shift = static_cast<uint8_t>(signal.start_bit);
+                sig.min_dlc = static_cast<uint8_t>((signal.start_bit + signal.length - 1) / 8 + 1);
+            }
+
+            if (signal.is_multiplexor)
+            {
+                desc.mux_signal = static_cast<int16_t>(_signals.size() - desc.first_signal);
+            }
+
+            _signals.push_back(sig);
+            _info.push_back({signal.name, signal.unit, message.key});
+        }
+
+        desc.signal_count = static_cast<uint16_t>(_signals.size() - desc.first_signal);
+        if (desc.signal_count > 0)
+        {
+            _messages.push_back(desc);
+        }
+    }
+
+    _values.assign(_signals.size(), 0.0f);
+    _update_count.assign(_signals.size(), 0);
+
+    ESP_LOGI(TAG, "Loaded %s: %zu messages, %zu signals", file_path.c_str(), _messages.size(), _signals.size());
+    return !_messages.empty();
+}
+
+const CanDbc::MessageDesc *CanDbc::find_message(uint32_t key) const
+{
+    auto it = std::lower_bound(_messages.begin(), _messages.end(), key, [](const MessageDesc &m, uint32_t k)
+                               { return m.key < k; });
+    if (it == _messages.end() || it->key != key)
+    {
+        return nullptr;
+    }
+    return &(*it);
+}
+
+uint64_t CanDbc::extract_raw(const SignalDesc &signal, uint64_t le, uint64_t be)
+{
+    uint64_t word = (signal.flags & FLAG_BIG_ENDIAN) ? be : le;
+    return (word >> signal.shift) & signal.mask;
+}
+
+float CanDbc::to_physical(const SignalDesc &signal, uint64_t raw)
+{
+    if ((signal.flags & FLAG_SIGNED) && signal.length < 64 && (raw >> (signal.length - 1)) & 1)
+    {
+        // 符号扩展
+        return static_cast<float>(static_cast<int64_t>(raw | ~signal.mask)) * signal.factor + signal.offset;
+    }
+    if (signal.flags & FLAG_SIGNED)
+    {
+        return static_cast<float>(static_cast<int64_t>(raw)) * signal.factor + signal.offset;
+    }
+    return static_cast<float>(raw) * signal.factor + signal.offset;
+}
+
+size_t CanDbc::decode_into(const twai_message_t &message, float *values, uint32_t *update_count) const
+{
+    const uint32_t key = message.identifier | (message.extd ? EXTENDED_FLAG : 0);
+    const MessageDesc *desc = find_message(key);
+    if (desc == nullptr || message.rtr)
+    {
+        return 0;
+    }
+
+    // 一次装载为小端/大端两个64位字, 每个信号只需一次移位和掩码
+    uint64_t le = 0;
+    uint64_t be = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        le |= static_cast<uint64_t>(message.data[i]) << (8 * i);
+        be = (be << 8) | message.data[i];
+    }
+
+    const SignalDesc *signals = &_signals[desc->first_signal];
+    const uint8_t dlc = message.data_length_code;
+
+    int32_t mux_value = NO_MUX;
+    if (desc->mux_signal != NO_MUX && dlc >= signals[desc->mux_signal].min_dlc)
+    {
+        mux_value = static_cast<int32_t>(extract_raw(signals[desc->mux_signal], le, be));
+    }
+
+    size_t decoded = 0;
+    for (uint16_t i = 0; i < desc->signal_count; i++)
+    {
+        const SignalDesc &signal = signals[i];
+        if (dlc < signal.min_dlc || (signal.mux != NO_MUX && signal.mux != mux_value))
+        {
+            continue;
+        }
+        const size_t index = desc->first_signal + i;
+        values[index] = to_physical(signal, extract_raw(signal, le, be));
+        update_count[index]++;
+        decoded++;
+    }
+    return decoded;
+}
+
+size_t CanDbc::decode(const twai_message_t &message)
+{
+    if (_messages.empty())
+    {
+        return 0;
+    }
+    return decode_into(message, _values.data(), _update_count.data());
+}
+
+int CanDbc::find_signal(const std::string &name) const
+{
+    for (size_t i = 0; i < _info.size(); i++)
+    {
+        if (_info[i].name == name)
+        {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+bool CanDbc::get_value(int index, float &value) const
+{
+    if (index < 0 || static_cast<size_t>(index) >= _values.size() || _update_count[index] == 0)
+    {
+        return false;
+    }
+    value = _values[index];
+    return true;
+}
+
+bool CanDbc::get_value(const std::string &name, float &value) const
+{
+    return get_value(find_signal(name), value);
+}
+
+size_t CanDbc::get_message_count() const
+{
+    return _messages.size();
+}
+
+size_t CanDbc::get_signal_count() const
+{
+    return _signals.size();
+}
+
+void CanDbc::print_signals(const char *filter) const
+{
+    for (size_t i = 0; i < _info.size(); i++)
+    {
+        const SignalInfo &info = _info[i];
+        if (filter && filter[0] != '\0' && info.name.find(filter) == std::string::npos)
+        {
+            continue;
+        }
+        if (_update_count[i] == 0)
+        {
+            printf("0x%08" PRIX32 " %-32s ---\n", info.message_key & ~EXTENDED_FLAG, info.name.c_str());
+        }
+        else
+        {
+            printf("0x%08" PRIX32 " %-32s %g %s (%" PRIu32 ")\n", info.message_key & ~EXTENDED_FLAG, info.name.c_str(),
+                   _values[i], info.unit.c_str(), _update_count[i]);
+        }
+    }
+}
+
+// 用表内所有报文构造伪随机帧, 统计解码吞吐; 结果写入临时表, 不影响实时值
+void CanDbc::run_benchmark(int iterations)
+{
+    if (_messages.empty() || iterations <= 0)
+    {
+        printf("No DBC loaded\n");
+        return;
+    }
+
+    std::vector<float> values(_signals.size());
+    std::vector<uint32_t> counts(_signals.size());
+
+    twai_message_t message = {};
+    message.data_length_code = 8;
+    uint32_t seed = 0x12345678;
+    size_t decoded = 0;
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < iterations; i++)
+    {
+        const MessageDesc &desc = _messages[i % _messages.size()];
+        message.identifier = desc.key & ~EXTENDED_FLAG;
+        message.extd = (desc.key & EXTENDED_FLAG) ? 1 : 0;
+        seed = seed * 1664525 + 1013904223;
+        memcpy(message.data, &seed, sizeof(seed));
+        memcpy(&message.data[4], &seed, sizeof(seed));
+        decoded += decode_into(message, values.data(), counts.data());
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    if (elapsed <= 0)
+    {
+        elapsed = 1;
+    }
+
+    printf("%d frames, %zu signals in %" PRId64 " us\n", iterations, decoded, elapsed);
+    printf("%.0f frames/s, %.0f signals/s, %.2f us/frame\n",
+           iterations * 1e6 / elapsed, decoded * 1e6 / elapsed, static_cast<double>(elapsed) / iterations);
+}
+
+int CanDbc::signalCommand(void *context, int argc, char **argv)
+{
+    CanDbc *instance = static_cast<CanDbc *>(context);
+
+    int nerrors = arg_parse(argc, argv, (void **)&signal_args);
+    if (nerrors != 0)
+    {
+        arg_print_errors(stderr, signal_args.end, argv[0]);
+        return 1;
+    }
+
+    if (signal_args.bench->count > 0)
+    {
+        instance->run_benchmark(signal_args.bench->ival[0]);
+        return 0;
+    }
+
+    const char *filter = signal_args.name->count > 0 ? signal_args.name->sval[0] : nullptr;
+    instance->print_signals(filter);
+    return 0;
+}
+
+void CanDbc::registerConsoleCommands()
+{
+    signal_args.name = arg_str0(nullptr, nullptr, "<name>", "Signal name (substring match)");
+    signal_args.bench = arg_int0("b", "bench", "<frames>", "Benchmark decode throughput");
+    signal_args.end = arg_end(2);
+
+    const esp_console_cmd_t signal_cmd = {
+        .command = "signal",
+        .help = "Show latest decoded CAN signal values",
+        .hint = nullptr,
+        .func = nullptr,
+        .argtable = &signal_args,
+        .func_w_context = &CanDbc::signalCommand,
+        .context = this,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&signal_cmd));
+}
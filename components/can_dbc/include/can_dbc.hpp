@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "driver/twai.h"
+#include "esp_console.h"
+#include "argtable3/argtable3.h"
+
+    // DBC 信号解码: 加载时编译为按ID排序的报文表 + 连续存放的信号描述表,
+    // 解码时二分查找报文, 之后只遍历该报文自己的信号
+    class CanDbc
+    {
+    public:
+        CanDbc();
+        ~CanDbc();
+
+        // 解析 DBC 文件并编译信号表
+        bool load(const std::string &file_path);
+
+        // 解码一帧, 更新信号最新值, 返回本帧解码出的信号数
+        size_t decode(const twai_message_t &message);
+
+        // 按名字查找信号, 未找到返回 -1
+        int find_signal(const std::string &name) const;
+
+        // 获取信号最新值, 从未收到过返回 false
+        bool get_value(int index, float &value) const;
+        bool get_value(const std::string &name, float &value) const;
+
+        size_t get_message_count() const;
+        size_t get_signal_count() const;
+
+        void registerConsoleCommands();
+
+    private:
+        const char *TAG = "CanDbc";
+
+        static constexpr uint32_t EXTENDED_FLAG = 0x80000000UL; // 与DBC中扩展帧ID的写法一致
+        static constexpr int16_t NO_MUX = -1;
+
+        // 解码热路径只访问这两张表, 名称等冷数据单独存放
+        struct SignalDesc
+        {
+            uint64_t mask;   // (1 << length) - 1
+            float factor;    // 比例系数
+            float offset;    // 偏移量
+            uint8_t shift;   // 对齐到 LSB 所需右移位数
+            uint8_t length;  // 位宽
+            uint8_t min_dlc; // 完整覆盖该信号所需最小 DLC
+            uint8_t flags;   // FLAG_*
+            int16_t mux;     // 复用值, NO_MUX 表示非复用信号
+        };
+
+        struct MessageDesc
+        {
+            uint32_t key;          // identifier | EXTENDED_FLAG
+            uint16_t first_signal; // _signals 中起始下标
+            uint16_t signal_count; // 信号个数
+            int16_t mux_signal;    // 复用选择信号下标(相对 first_signal), NO_MUX 表示无
+        };
+
+        static constexpr uint8_t FLAG_BIG_ENDIAN = 0x01;
+        static constexpr uint8_t FLAG_SIGNED = 0x02;
+
+        struct SignalInfo
+        {
+            std::string name;
+            std::string unit;
+            uint32_t message_key;
+        };
+
+        std::vector<MessageDesc> _messages;  // 按 key 升序
+        std::vector<SignalDesc> _signals;    // 按报文分组连续存放
+        std::vector<SignalInfo> _info;       // 与 _signals 下标一致
+        std::vector<float> _values;          // 最新值
+        std::vector<uint32_t> _update_count; // 更新次数, 0 表示从未收到
+
+        const MessageDesc *find_message(uint32_t key) const;
+        size_t decode_into(const twai_message_t &message, float *values, uint32_t *update_count) const;
+        static uint64_t extract_raw(const SignalDesc &signal, uint64_t le, uint64_t be);
+        static float to_physical(const SignalDesc &signal, uint64_t raw);
+
+        static struct
+        {
+            struct arg_str *name;
+            struct arg_int *bench;
+            struct arg_end *end;
+        } signal_args;
+
+        static int signalCommand(void *context, int argc, char **argv);
+        void print_signals(const char *filter) const;
+        void run_benchmark(int iterations);
+    };
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,640 @@
+#include "can_gateway.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <sstream>
+
+#include "esp_log.h"
+
+// 按 Action 下标排列, CRSF 输入规则不会出现在 CAN 路由区间中
+const CanGateway::Handler CanGateway::handlers[] = {
+    &CanGateway::do_can_to_can,
+    &CanGateway::do_can_to_crsf,
+    &CanGateway::do_unused,
+};
+
+static const uint8_t CRSF_SYNC = 0xC8;
+static const uint8_t CRSF_TYPE_BATTERY = 0x08;
+static const uint8_t CRSF_TYPE_BARO_ALTITUDE = 0x09;
+
+static const char *const FIELD_NAMES[] = {"voltage", "current", "capacity", "remaining", "altitude", "vspeed"};
+
+CanGateway::CanGateway()
+{
+}
+
+CanGateway::~CanGateway()
+{
+}
+
+void CanGateway::set_can_sink(CanSink sink, void *arg)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    _can_sink = sink;
+    _can_sink_arg = arg;
+}
+
+void CanGateway::set_crsf_sink(CrsfSink sink, void *arg)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    _crsf_sink = sink;
+    _crsf_sink_arg = arg;
+}
+
+bool CanGateway::parse_id(const std::string &token, uint32_t &key)
+{
+    std::string value = token;
+    bool extended = false;
+    if (!value.empty() && (value.back() == 'x' || value.back() == 'X'))
+    {
+        value.pop_back();
+        extended = true;
+    }
+
+    char *end = nullptr;
+    unsigned long id = strtoul(value.c_str(), &end, 0);
+    if (value.empty() || *end != '\0' || id > 0x1FFFFFFFUL)
+    {
+        return false;
+    }
+    if (id > 0x7FF)
+    {
+        extended = true;
+    }
+    key = static_cast<uint32_t>(id) | (extended ? EXTENDED_FLAG : 0);
+    return true;
+}
+
+// 位定义与 DBC 一致: Intel 的 start 为 LSB, Motorola 的 start 为 MSB(锯齿编号)
+bool CanGateway::parse_signal(const std::string &spec, const std::string &factor, const std::string &offset, SignalSpec &signal)
+{
+    unsigned start, length;
+    char order, sign;
+    if (sscanf(spec.c_str(), "%u|%u@%c%c", &start, &length, &order, &sign) != 4 ||
+        length == 0 || length > 64 || start > 63 ||
+        (order != '0' && order != '1') || (sign != '+' && sign != '-'))
+    {
+        return false;
+    }
+
+    signal.length = length;
+    signal.mask = (length == 64) ? ~0ULL : ((1ULL << length) - 1);
+    signal.big_endian = (order == '0');
+    signal.is_signed = (sign == '-');
+
+    if (signal.big_endian)
+    {
+        const int msb = (7 - start / 8) * 8 + start % 8;
+        const int shift = msb - static_cast<int>(length) + 1;
+        if (shift < 0)
+        {
+            return false;
+        }
+        signal.shift = shift;
+        signal.min_dlc = 8 - shift / 8;
+    }
+    else
+    {
+        if (start + length > 64)
+        {
+            return false;
+        }
+        signal.shift = start;
+        signal.min_dlc = (start + length + 7) / 8;
+    }
+
+    char *end = nullptr;
+    signal.factor = strtof(factor.c_str(), &end);
+    if (*end != '\0' || signal.factor == 0.0f)
+    {
+        return false;
+    }
+    signal.offset = strtof(offset.c_str(), &end);
+    return *end == '\0';
+}
+
+bool CanGateway::parse_field(const std::string &token, uint32_t &field)
+{
+    for (size_t i = 0; i < static_cast<size_t>(CrsfField::COUNT); i++)
+    {
+        if (token == FIELD_NAMES[i])
+        {
+            field = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *CanGateway::field_name(uint32_t field)
+{
+    return field < static_cast<uint32_t>(CrsfField::COUNT) ? FIELD_NAMES[field] : "?";
+}
+
+// 指令行返回 true 且 rule.action 为 COUNT
+bool CanGateway::parse_line(const std::string &line, Rule &rule, Table &table, std::string &error)
+{
+    std::istringstream iss(line);
+    std::vector<std::string> tokens;
+    std::string token;
+    while (iss >> token)
+    {
+        tokens.push_back(token);
+    }
+
+    rule = {};
+    const std::string &kind = tokens[0];
+    if (kind == "can2can")
+    {
+        rule.action = Action::CAN_TO_CAN;
+        if (tokens.size() != 3 || !parse_id(tokens[1], rule.src) || !parse_id(tokens[2], rule.dst))
+        {
+            error = "expected: can2can <src_id> <dst_id>";
+            return false;
+        }
+    }
+    else if (kind == "can2crsf")
+    {
+        rule.action = Action::CAN_TO_CRSF;
+        if (tokens.size() != 6 || !parse_id(tokens[1], rule.src))
+        {
+            error = "expected: can2crsf <src_id> <signal> <factor> <offset> <field>";
+            return false;
+        }
+        if (!parse_signal(tokens[2], tokens[3], tokens[4], rule.signal))
+        {
+            error = "bad signal definition";
+            return false;
+        }
+        if (!parse_field(tokens[5], rule.dst))
+        {
+            error = "unknown field " + tokens[5];
+            return false;
+        }
+    }
+    else if (kind == "crsf2can")
+    {
+        rule.action = Action::CRSF_TO_CAN;
+        if (tokens.size() != 6 || !parse_id(tokens[2], rule.dst))
+        {
+            error = "expected: crsf2can <channel> <dst_id> <signal> <factor> <offset>";
+            return false;
+        }
+        const int channel = atoi(tokens[1].c_str());
+        if (channel < 1 || channel > static_cast<int>(CRSF_CHANNELS))
+        {
+            error = "channel must be 1..16";
+            return false;
+        }
+        rule.src = channel - 1;
+        if (!parse_signal(tokens[3], tokens[4], tokens[5], rule.signal))
+        {
+            error = "bad signal definition";
+            return false;
+        }
+    }
+    else if (kind == "period")
+    {
+        rule.action = Action::COUNT;
+        const int period_ms = tokens.size() == 3 ? atoi(tokens[2].c_str()) : -1;
+        if (period_ms < 0)
+        {
+            error = "expected: period <crsf2can|can2crsf> <ms>";
+            return false;
+        }
+        if (tokens[1] == "crsf2can")
+        {
+            table.crsf2can_period_us = period_ms * 1000LL;
+        }
+        else if (tokens[1] == "can2crsf")
+        {
+            table.can2crsf_period_us = period_ms * 1000LL;
+        }
+        else
+        {
+            error = "unknown period " + tokens[1];
+            return false;
+        }
+    }
+    else
+    {
+        error = "unknown rule " + kind;
+        return false;
+    }
+    return true;
+}
+
+bool CanGateway::compile(const std::string &text)
+{
+    Table table;
+    std::vector<Rule> can_rules;
+    std::vector<Rule> crsf_rules;
+
+    std::istringstream iss(text);
+    std::string line;
+    int line_number = 0;
+    while (std::getline(iss, line))
+    {
+        line_number++;
+        const size_t comment = line.find('#');
+        if (comment != std::string::npos)
+        {
+            line.erase(comment);
+        }
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+        {
+            continue;
+        }
+
+        Rule rule;
+        std::string error;
+        if (!parse_line(line, rule, table, error))
+        {
+            ESP_LOGE(TAG, "Line %d: %s", line_number, error.c_str());
+            return false;
+        }
+        if (rule.action == Action::CRSF_TO_CAN)
+        {
+            crsf_rules.push_back(rule);
+        }
+        else if (rule.action != Action::COUNT)
+        {
+            can_rules.push_back(rule);
+        }
+    }
+
+    if (can_rules.size() + crsf_rules.size() > UINT16_MAX)
+    {
+        ESP_LOGE(TAG, "Too many rules");
+        return false;
+    }
+
+    // 同一源ID的规则相邻, 保持文件中的先后顺序
+    std::stable_sort(can_rules.begin(), can_rules.end(), [](const Rule &a, const Rule &b)
+                     { return a.src < b.src; });
+
+    table.rules = can_rules;
+    table.crsf_first = can_rules.size();
+    table.rules.insert(table.rules.end(), crsf_rules.begin(), crsf_rules.end());
+
+    // 标准帧直接按ID下标索引, 扩展帧二分查找
+    table.std_index.assign(STD_ID_COUNT, 0);
+    for (size_t first = 0; first < can_rules.size();)
+    {
+        size_t last = first;
+        while (last < can_rules.size() && can_rules[last].src == can_rules[first].src)
+        {
+            last++;
+        }
+        const uint32_t key = can_rules[first].src;
+        if (key & EXTENDED_FLAG)
+        {
+            table.ext_routes.push_back({key, static_cast<uint16_t>(first), static_cast<uint16_t>(last - first)});
+        }
+        else
+        {
+            table.std_index[key] = (static_cast<uint32_t>(first) << 16) | (last - first);
+        }
+        first = last;
+    }
+
+    for (const Rule &rule : crsf_rules)
+    {
+        if (std::find(table.crsf_frames.begin(), table.crsf_frames.end(), rule.dst) == table.crsf_frames.end())
+        {
+            table.crsf_frames.push_back(rule.dst);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stats.assign(table.rules.size(), RuleStats{});
+        _table = std::move(table);
+        _source_text = text;
+        _battery_sent_us = NEVER;
+        _baro_sent_us = NEVER;
+        _crsf2can_sent_us = NEVER;
+    }
+
+    ESP_LOGI(TAG, "Compiled %zu CAN rules, %zu CRSF rules", can_rules.size(), crsf_rules.size());
+    return true;
+}
+
+uint64_t CanGateway::extract(const SignalSpec &signal, const uint8_t *data)
+{
+    uint64_t word = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        word |= static_cast<uint64_t>(data[i]) << (signal.big_endian ? (56 - 8 * i) : (8 * i));
+    }
+    return (word >> signal.shift) & signal.mask;
+}
+
+void CanGateway::insert(const SignalSpec &signal, uint64_t raw, uint64_t &le, uint64_t &be)
+{
+    uint64_t &word = signal.big_endian ? be : le;
+    word &= ~(signal.mask << signal.shift);
+    word |= (raw & signal.mask) << signal.shift;
+}
+
+uint8_t CanGateway::crsf_crc(const uint8_t *data, size_t length)
+{
+    uint8_t crc = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0xD5 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+bool CanGateway::period_elapsed(int64_t &last_us, int64_t now_us, int64_t period_us)
+{
+    if (last_us != NEVER && now_us - last_us < period_us)
+    {
+        return false;
+    }
+    last_us = now_us;
+    return true;
+}
+
+void CanGateway::record_hit(size_t index, int64_t timestamp_us, int64_t now_us, bool delivered)
+{
+    RuleStats &stats = _stats[index];
+    stats.hits++;
+    if (!delivered)
+    {
+        stats.drops++;
+    }
+    const uint32_t latency = static_cast<uint32_t>(std::max<int64_t>(0, now_us - timestamp_us));
+    stats.latency_sum_us += latency;
+    stats.latency_max_us = std::max(stats.latency_max_us, latency);
+}
+
+void CanGateway::route_can(const CanFrameRecord &record, int64_t now_us)
+{
+    const twai_message_t &message = record.message;
+
+    std::lock_guard<std::mutex> guard(_lock);
+    if (_table.std_index.empty())
+    {
+        return;
+    }
+
+    size_t first, count;
+    if (!message.extd && message.identifier < STD_ID_COUNT)
+    {
+        const uint32_t entry = _table.std_index[message.identifier];
+        if (entry == 0)
+        {
+            return;
+        }
+        first = entry >> 16;
+        count = entry & 0xFFFF;
+    }
+    else
+    {
+        const uint32_t key = message.identifier | EXTENDED_FLAG;
+        auto it = std::lower_bound(_table.ext_routes.begin(), _table.ext_routes.end(), key, [](const Route &route, uint32_t value)
+                                   { return route.key < value; });
+        if (it == _table.ext_routes.end() || it->key != key)
+        {
+            return;
+        }
+        first = it->first;
+        count = it->count;
+    }
+
+    for (size_t i = first; i < first + count; i++)
+    {
+        const Rule &rule = _table.rules[i];
+        (this->*handlers[static_cast<size_t>(rule.action)])(i, rule, record, now_us);
+    }
+}
+
+void CanGateway::do_can_to_can(size_t index, const Rule &rule, const CanFrameRecord &record, int64_t now_us)
+{
+    twai_message_t message = record.message;
+    message.identifier = rule.dst & 0x1FFFFFFF;
+    message.extd = (rule.dst & EXTENDED_FLAG) ? 1 : 0;
+
+    const bool delivered = _can_sink != nullptr && _can_sink(message, _can_sink_arg);
+    record_hit(index, record.timestamp_us, now_us, delivered);
+}
+
+void CanGateway::do_can_to_crsf(size_t index, const Rule &rule, const CanFrameRecord &record, int64_t now_us)
+{
+    const SignalSpec &signal = rule.signal;
+    if (record.message.data_length_code < signal.min_dlc)
+    {
+        record_hit(index, record.timestamp_us, now_us, false);
+        return;
+    }
+
+    uint64_t raw = extract(signal, record.message.data);
+    float value;
+    if (signal.is_signed && signal.length < 64 && (raw >> (signal.length - 1)) & 1)
+    {
+        value = static_cast<float>(static_cast<int64_t>(raw | ~signal.mask));
+    }
+    else
+    {
+        value = static_cast<float>(raw);
+    }
+    _telemetry[rule.dst] = value * signal.factor + signal.offset;
+    record_hit(index, record.timestamp_us, now_us, true);
+
+    // 同一遥测帧的多个字段共用一个发送周期
+    if (rule.dst <= static_cast<uint32_t>(CrsfField::REMAINING))
+    {
+        if (period_elapsed(_battery_sent_us, now_us, _table.can2crsf_period_us))
+        {
+            send_battery(now_us);
+        }
+    }
+    else if (period_elapsed(_baro_sent_us, now_us, _table.can2crsf_period_us))
+    {
+        send_baro(now_us);
+    }
+}
+
+void CanGateway::do_unused(size_t index, const Rule &rule, const CanFrameRecord &record, int64_t now_us)
+{
+}
+
+bool CanGateway::send_crsf(uint8_t type, const uint8_t *payload, size_t length)
+{
+    if (_crsf_sink == nullptr)
+    {
+        return false;
+    }
+
+    uint8_t frame[64];
+    frame[0] = CRSF_SYNC;
+    frame[1] = static_cast<uint8_t>(length + 2); // type + payload + crc
+    frame[2] = type;
+    memcpy(&frame[3], payload, length);
+    frame[3 + length] = crsf_crc(&frame[2], length + 1);
+    return _crsf_sink(frame, length + 4, _crsf_sink_arg);
+}
+
+void CanGateway::send_battery(int64_t now_us)
+{
+    auto clamp = [](float value, float max_value) -> uint32_t
+    {
+        return static_cast<uint32_t>(std::min(std::max(std::lround(value), 0L), static_cast<long>(max_value)));
+    };
+
+    const uint32_t voltage = clamp(_telemetry[static_cast<size_t>(CrsfField::VOLTAGE)] * 10.0f, UINT16_MAX);
+    const uint32_t current = clamp(_telemetry[static_cast<size_t>(CrsfField::CURRENT)] * 10.0f, UINT16_MAX);
+    const uint32_t capacity = clamp(_telemetry[static_cast<size_t>(CrsfField::CAPACITY)], 0xFFFFFF);
+    const uint32_t remaining = clamp(_telemetry[static_cast<size_t>(CrsfField::REMAINING)], 100);
+
+    const uint8_t payload[8] = {
+        static_cast<uint8_t>(voltage >> 8), static_cast<uint8_t>(voltage),
+        static_cast<uint8_t>(current >> 8), static_cast<uint8_t>(current),
+        static_cast<uint8_t>(capacity >> 16), static_cast<uint8_t>(capacity >> 8), static_cast<uint8_t>(capacity),
+        static_cast<uint8_t>(remaining)};
+    send_crsf(CRSF_TYPE_BATTERY, payload, sizeof(payload));
+}
+
+void CanGateway::send_baro(int64_t now_us)
+{
+    // 高度: 最高位为 0 时单位 dm 且偏移 10000, 超出范围时最高位置 1 单位改为 m
+    const long decimeters = std::lround(_telemetry[static_cast<size_t>(CrsfField::ALTITUDE)] * 10.0f);
+    uint16_t altitude;
+    if (decimeters < -10000)
+    {
+        altitude = 0;
+    }
+    else if (decimeters + 10000 < 0x8000)
+    {
+        altitude = static_cast<uint16_t>(decimeters + 10000);
+    }
+    else
+    {
+        altitude = 0x8000 | static_cast<uint16_t>(std::min(decimeters / 10, 0x7FFFL));
+    }
+
+    const long vspeed_cm = std::lround(_telemetry[static_cast<size_t>(CrsfField::VSPEED)] * 100.0f);
+    const int16_t vspeed = static_cast<int16_t>(std::min(std::max(vspeed_cm, -32768L), 32767L));
+
+    const uint8_t payload[4] = {
+        static_cast<uint8_t>(altitude >> 8), static_cast<uint8_t>(altitude),
+        static_cast<uint8_t>(static_cast<uint16_t>(vspeed) >> 8), static_cast<uint8_t>(vspeed)};
+    send_crsf(CRSF_TYPE_BARO_ALTITUDE, payload, sizeof(payload));
+}
+
+// CRSF 原始值 172..1811 对应 988..2012us
+void CanGateway::route_crsf(const uint16_t *channels, size_t count, int64_t timestamp_us, int64_t now_us)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    if (_table.crsf_first == _table.rules.size() ||
+        !period_elapsed(_crsf2can_sent_us, now_us, _table.crsf2can_period_us))
+    {
+        return;
+    }
+
+    for (uint32_t dst : _table.crsf_frames)
+    {
+        uint64_t le = 0, be = 0;
+        uint8_t dlc = 0;
+        for (size_t i = _table.crsf_first; i < _table.rules.size(); i++)
+        {
+            const Rule &rule = _table.rules[i];
+            if (rule.dst != dst || rule.src >= count)
+            {
+                continue;
+            }
+            const float microseconds = (static_cast<float>(channels[rule.src]) - 992.0f) * 5.0f / 8.0f + 1500.0f;
+            const int64_t raw = std::llround((microseconds - rule.signal.offset) / rule.signal.factor);
+            insert(rule.signal, static_cast<uint64_t>(raw), le, be);
+            dlc = std::max(dlc, rule.signal.min_dlc);
+        }
+
+        twai_message_t message = {};
+        message.identifier = dst & 0x1FFFFFFF;
+        message.extd = (dst & EXTENDED_FLAG) ? 1 : 0;
+        message.data_length_code = dlc;
+        for (int i = 0; i < 8; i++)
+        {
+            message.data[i] = static_cast<uint8_t>(le >> (8 * i)) | static_cast<uint8_t>(be >> (56 - 8 * i));
+        }
+
+        const bool delivered = _can_sink != nullptr && _can_sink(message, _can_sink_arg);
+        for (size_t i = _table.crsf_first; i < _table.rules.size(); i++)
+        {
+            const Rule &rule = _table.rules[i];
+            if (rule.dst == dst)
+            {
+                record_hit(i, timestamp_us, now_us, delivered && rule.src < count);
+            }
+        }
+    }
+}
+
+size_t CanGateway::get_rule_count() const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _table.rules.size();
+}
+
+bool CanGateway::get_rule_stats(size_t index, RuleStats &stats) const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    if (index >= _stats.size())
+    {
+        return false;
+    }
+    stats = _stats[index];
+    return true;
+}
+
+std::string CanGateway::describe_rule(size_t index) const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    if (index >= _table.rules.size())
+    {
+        return "";
+    }
+
+    const Rule &rule = _table.rules[index];
+    char buffer[64];
+    auto id_str = [](uint32_t key, char *out, size_t size)
+    {
+        snprintf(out, size, (key & EXTENDED_FLAG) ? "0x%08lxx" : "0x%03lx", static_cast<unsigned long>(key & 0x1FFFFFFF));
+    };
+    char src[16], dst[16];
+    switch (rule.action)
+    {
+    case Action::CAN_TO_CAN:
+        id_str(rule.src, src, sizeof(src));
+        id_str(rule.dst, dst, sizeof(dst));
+        snprintf(buffer, sizeof(buffer), "can %s -> can %s", src, dst);
+        break;
+    case Action::CAN_TO_CRSF:
+        id_str(rule.src, src, sizeof(src));
+        snprintf(buffer, sizeof(buffer), "can %s -> crsf %s", src, field_name(rule.dst));
+        break;
+    case Action::CRSF_TO_CAN:
+        id_str(rule.dst, dst, sizeof(dst));
+        snprintf(buffer, sizeof(buffer), "crsf ch%lu -> can %s", static_cast<unsigned long>(rule.src + 1), dst);
+        break;
+    default:
+        buffer[0] = '\0';
+        break;
+    }
+    return buffer;
+}
+
+void CanGateway::clear_stats()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    std::fill(_stats.begin(), _stats.end(), RuleStats{});
+}
@@ -0,0 +1,238 @@
+#include "can_gateway.hpp"
+
+#include <cstdio>
+#include <cinttypes>
+#include <memory>
+
+#include "twai_device.hpp"
+#include "elrs.hpp"
+#include "nvs_handle.hpp"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+static const uint32_t StackSize = 1024 * 4;
+
+static const char *NVS_NAMESPACE = "gateway";
+static const char *NVS_KEY_RULES = "rules";
+static const size_t NVS_MAX_RULES_SIZE = 4000; // NVS 字符串上限
+
+decltype(CanGateway::gateway_args) CanGateway::gateway_args;
+
+bool CanGateway::load(const std::string &file_path)
+{
+    // 失败也记下路径, 插卡或修正规则文件后可用 gateway -r 重新加载
+    _source_path = file_path;
+
+    FILE *file = fopen(file_path.c_str(), "r");
+    if (file == nullptr)
+    {
+        ESP_LOGW(TAG, "No rule file %s", file_path.c_str());
+        return false;
+    }
+
+    std::string text;
+    char buffer[256];
+    size_t bytes;
+    while ((bytes = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        text.append(buffer, bytes);
+    }
+    fclose(file);
+
+    if (!compile(text))
+    {
+        return false;
+    }
+
+    // 同步到NVS, SD卡不在时仍可使用最近一次有效规则
+    if (text.size() >= NVS_MAX_RULES_SIZE)
+    {
+        ESP_LOGW(TAG, "Rules too large for NVS backup (%zu bytes)", text.size());
+        return true;
+    }
+
+    esp_err_t ret;
+    std::unique_ptr<nvs::NVSHandle> nvs_handle = nvs::open_nvs_handle(NVS_NAMESPACE, NVS_READWRITE, &ret);
+    if (ret != ESP_OK)
+    {
+        return true;
+    }
+
+    size_t size = 0;
+    if (nvs_handle->get_item_size(nvs::ItemType::SZ, NVS_KEY_RULES, size) == ESP_OK && size == text.size() + 1)
+    {
+        std::string stored(size, '\0');
+        if (nvs_handle->get_string(NVS_KEY_RULES, stored.data(), size) == ESP_OK && stored.compare(0, text.size(), text) == 0)
+        {
+            return true; // 内容未变, 不重复擦写
+        }
+    }
+    nvs_handle->set_string(NVS_KEY_RULES, text.c_str());
+    nvs_handle->commit();
+    return true;
+}
+
+bool CanGateway::load_nvs()
+{
+    esp_err_t ret;
+    std::unique_ptr<nvs::NVSHandle> nvs_handle = nvs::open_nvs_handle(NVS_NAMESPACE, NVS_READONLY, &ret);
+    if (ret != ESP_OK)
+    {
+        return false;
+    }
+
+    size_t size = 0;
+    if (nvs_handle->get_item_size(nvs::ItemType::SZ, NVS_KEY_RULES, size) != ESP_OK || size == 0)
+    {
+        return false;
+    }
+    std::string text(size, '\0');
+    if (nvs_handle->get_string(NVS_KEY_RULES, text.data(), size) != ESP_OK)
+    {
+        return false;
+    }
+    text.resize(size - 1);
+
+    ESP_LOGI(TAG, "Using rules from NVS");
+    return compile(text);
+}
+
+bool CanGateway::twai_sink(const twai_message_t &message, void *arg)
+{
+    // 发送队列满时丢弃, 不阻塞路由任务
+    return static_cast<TWAI_Device *>(arg)->send_message(message, 0);
+}
+
+bool CanGateway::elrs_sink(const uint8_t *frame, size_t length, void *arg)
+{
+    return static_cast<ELRS *>(arg)->send_frame(frame, length);
+}
+
+void CanGateway::elrs_channels(const uint16_t *channels, size_t count, void *arg)
+{
+    CanGateway *gateway = static_cast<CanGateway *>(arg);
+    if (gateway->_twai == nullptr)
+    {
+        return;
+    }
+    const int64_t now_us = gateway->_twai->get_timestamp_us();
+    gateway->route_crsf(channels, count, now_us, now_us);
+}
+
+void CanGateway::route_task()
+{
+    CanRxDispatcher &dispatcher = _twai->get_rx_dispatcher();
+    CanFrameRecord record;
+
+    while (true)
+    {
+        if (dispatcher.receive(_subscription, record, portMAX_DELAY))
+        {
+            route_can(record, _twai->get_timestamp_us());
+        }
+    }
+}
+
+bool CanGateway::start(TWAI_Device &twai)
+{
+    _pending_twai = nullptr;
+    _subscription = twai.get_rx_dispatcher().subscribe("gateway", 64);
+    if (_subscription < 0)
+    {
+        ESP_LOGE(TAG, "Subscribe TWAI RX failed");
+        return false;
+    }
+    _twai = &twai;
+    set_can_sink(&CanGateway::twai_sink, &twai);
+
+    auto task_func = [](void *arg)
+    {
+        CanGateway *instance = static_cast<CanGateway *>(arg);
+        instance->route_task();
+    };
+    xTaskCreatePinnedToCore(task_func, "can_gateway", StackSize, this, 2, nullptr, tskNO_AFFINITY);
+    return true;
+}
+
+void CanGateway::defer_start(TWAI_Device &twai)
+{
+    _pending_twai = &twai;
+    ESP_LOGW(TAG, "No rules, routing starts after gateway -r");
+}
+
+void CanGateway::attach_elrs(ELRS &elrs)
+{
+    set_crsf_sink(&CanGateway::elrs_sink, &elrs);
+    elrs.set_channel_callback(&CanGateway::elrs_channels, this);
+}
+
+void CanGateway::print_stats() const
+{
+    const size_t count = get_rule_count();
+    printf("%3s %-36s %8s %6s %8s %8s\n", "#", "rule", "hits", "drops", "avg_us", "max_us");
+    for (size_t i = 0; i < count; i++)
+    {
+        RuleStats stats;
+        if (!get_rule_stats(i, stats))
+        {
+            break;
+        }
+        const uint32_t average = stats.hits ? static_cast<uint32_t>(stats.latency_sum_us / stats.hits) : 0;
+        printf("%3zu %-36s %8" PRIu32 " %6" PRIu32 " %8" PRIu32 " %8" PRIu32 "\n",
+               i, describe_rule(i).c_str(), stats.hits, stats.drops, average, stats.latency_max_us);
+    }
+}
+
+int CanGateway::gatewayCommand(void *context, int argc, char **argv)
+{
+    CanGateway *instance = static_cast<CanGateway *>(context);
+
+    int nerrors = arg_parse(argc, argv, (void **)&gateway_args);
+    if (nerrors != 0)
+    {
+        arg_print_errors(stderr, gateway_args.end, argv[0]);
+        return 1;
+    }
+
+    if (gateway_args.reload->count > 0)
+    {
+        if (instance->_source_path.empty() || !instance->load(instance->_source_path))
+        {
+            printf("Reload failed, keep current rules\n");
+            return 1;
+        }
+        // 启动时没有可用规则, 首次加载成功后开始路由
+        if (instance->_pending_twai != nullptr && !instance->start(*instance->_pending_twai))
+        {
+            printf("Start routing failed\n");
+            return 1;
+        }
+    }
+    if (gateway_args.clear->count > 0)
+    {
+        instance->clear_stats();
+    }
+
+    instance->print_stats();
+    return 0;
+}
+
+void CanGateway::registerConsoleCommands()
+{
+    gateway_args.reload = arg_lit0("r", "reload", "Reload rule file");
+    gateway_args.clear = arg_lit0("c", "clear", "Clear rule counters");
+    gateway_args.end = arg_end(2);
+
+    const esp_console_cmd_t gateway_cmd = {
+        .command = "gateway",
+        .help = "Show CAN/CRSF routing rules with hit counters and latency",
+        .hint = nullptr,
+        .func = nullptr,
+        .argtable = &gateway_args,
+        .func_w_context = &CanGateway::gatewayCommand,
+        .context = this,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&gateway_cmd));
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <array>
+#include <mutex>
+
+#include "can_frame.hpp"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "driver/twai.h"
+#include "esp_console.h"
+#include "argtable3/argtable3.h"
+
+    class TWAI_Device;
+    class ELRS;
+
+    // CAN <-> CRSF 路由引擎
+    // 规则文本在启动时编译成按源ID索引的跳转表, 收到帧后直接定位到该ID的规则区间,
+    // 按动作类型调用对应处理函数. 路由核心(compile/route_*)不依赖 RTOS, 可在主机上用合成输入测试.
+    //
+    // 规则格式, 每行一条, # 开头为注释:
+    //   can2can  <src_id> <dst_id>                                   CAN 转发并改写ID
+    //   can2crsf <src_id> <start>|<len>@<0|1><+|-> <factor> <offset> <field>
+    //                                                                CAN 信号 -> CRSF 遥测字段
+    //   crsf2can <channel> <dst_id> <start>|<len>@<0|1><+|-> <factor> <offset>
+    //                                                                CRSF 通道(微秒) -> CAN 信号
+    //   period   <crsf2can|can2crsf> <ms>                            输出最小间隔
+    // ID 大于 0x7FF 或以 x 结尾时为扩展帧; 信号位定义与 DBC 相同(@1 Intel, @0 Motorola).
+    // field: voltage(V) current(A) capacity(mAh) remaining(%) altitude(m) vspeed(m/s)
+    class CanGateway
+    {
+    public:
+        // 输出接口, 返回 false 计为丢弃
+        using CanSink = bool (*)(const twai_message_t &message, void *arg);
+        using CrsfSink = bool (*)(const uint8_t *frame, size_t length, void *arg);
+
+        static constexpr size_t CRSF_CHANNELS = 16;
+
+        struct RuleStats
+        {
+            uint32_t hits;           // 执行次数
+            uint32_t drops;          // 输出失败或DLC不足
+            uint32_t latency_max_us; // 输入时间戳到输出的最大延迟
+            uint64_t latency_sum_us; // 用于求平均
+        };
+
+        CanGateway();
+        ~CanGateway();
+
+        void set_can_sink(CanSink sink, void *arg);
+        void set_crsf_sink(CrsfSink sink, void *arg);
+
+        // 编译规则文本, 失败时保留原有规则
+        bool compile(const std::string &text);
+
+        // 输入: 帧时间戳与当前时间使用同一时间基准(微秒)
+        void route_can(const CanFrameRecord &record, int64_t now_us);
+        void route_crsf(const uint16_t *channels, size_t count, int64_t timestamp_us, int64_t now_us);
+
+        size_t get_rule_count() const;
+        bool get_rule_stats(size_t index, RuleStats &stats) const;
+        std::string describe_rule(size_t index) const;
+        void clear_stats();
+
+        // 以下为设备侧接口, 实现见 can_gateway_task.cpp
+        bool load(const std::string &file_path); // 从SD加载, 成功后同步到NVS
+        bool load_nvs();                         // SD不可用时加载NVS中的最近一次有效规则
+        bool start(TWAI_Device &twai);           // 订阅TWAI接收并启动路由任务
+        void defer_start(TWAI_Device &twai);     // 启动时没有规则: gateway -r 首次加载成功后再 start
+        void attach_elrs(ELRS &elrs);            // CRSF 通道输入与遥测输出
+        void registerConsoleCommands();
+
+    private:
+        const char *TAG = "CanGateway";
+
+        static constexpr uint32_t EXTENDED_FLAG = 0x80000000UL;
+        static constexpr size_t STD_ID_COUNT = 0x800;
+        static constexpr int64_t NEVER = INT64_MIN; // 从未输出过
+
+        enum class Action : uint8_t
+        {
+            CAN_TO_CAN,
+            CAN_TO_CRSF,
+            CRSF_TO_CAN,
+            COUNT,
+        };
+
+        enum class CrsfField : uint8_t
+        {
+            VOLTAGE,
+            CURRENT,
+            CAPACITY,
+            REMAINING,
+            ALTITUDE,
+            VSPEED,
+            COUNT,
+        };
+
+        struct SignalSpec
+        {
+            uint64_t mask;
+            float factor;
+            float offset;
+            uint8_t shift; // 在 LE/BE 64 位字中的位置
+            uint8_t length;
+            uint8_t min_dlc;
+            bool big_endian;
+            bool is_signed;
+        };
+
+        struct Rule
+        {
+            Action action;
+            uint32_t src;   // CAN key 或 CRSF 通道(0起)
+            uint32_t dst;   // CAN key 或 CrsfField
+            SignalSpec signal;
+        };
+
+        // 同一源ID的规则区间
+        struct Route
+        {
+            uint32_t key;
+            uint16_t first;
+            uint16_t count;
+        };
+
+        // 编译结果, 整体替换
+        struct Table
+        {
+            std::vector<Rule> rules;           // CAN 输入规则按源key排序在前, CRSF 输入规则在后
+            std::vector<uint32_t> std_index;   // 标准帧ID -> (first << 16 | count), 0 为无规则
+            std::vector<Route> ext_routes;     // 扩展帧按 key 排序
+            std::vector<uint32_t> crsf_frames; // crsf2can 输出的目标 key 列表
+            size_t crsf_first = 0;             // CRSF 输入规则起始下标
+            int64_t crsf2can_period_us = 20000;
+            int64_t can2crsf_period_us = 100000;
+        };
+
+        using Handler = void (CanGateway::*)(size_t index, const Rule &rule, const CanFrameRecord &record, int64_t now_us);
+        static const Handler handlers[static_cast<size_t>(Action::COUNT)];
+
+        mutable std::mutex _lock;
+        Table _table;
+        std::vector<RuleStats> _stats;
+
+        CanSink _can_sink = nullptr;
+        void *_can_sink_arg = nullptr;
+        CrsfSink _crsf_sink = nullptr;
+        void *_crsf_sink_arg = nullptr;
+
+        std::array<float, static_cast<size_t>(CrsfField::COUNT)> _telemetry{};
+        int64_t _battery_sent_us = NEVER;
+        int64_t _baro_sent_us = NEVER;
+        int64_t _crsf2can_sent_us = NEVER;
+
+        std::string _source_text; // 当前规则文本, 用于同步到NVS
+        std::string _source_path; // 规则文件路径, 用于重新加载
+
+        void do_can_to_can(size_t index, const Rule &rule, const CanFrameRecord &record, int64_t now_us);
+        void do_can_to_crsf(size_t index, const Rule &rule, const CanFrameRecord &record, int64_t now_us);
+        void do_unused(size_t index, const Rule &rule, const CanFrameRecord &record, int64_t now_us);
+
+        static bool period_elapsed(int64_t &last_us, int64_t now_us, int64_t period_us);
+
+        void record_hit(size_t index, int64_t timestamp_us, int64_t now_us, bool delivered);
+        void send_battery(int64_t now_us);
+        void send_baro(int64_t now_us);
+        bool send_crsf(uint8_t type, const uint8_t *payload, size_t length);
+
+        static bool parse_line(const std::string &line, Rule &rule, Table &table, std::string &error);
+        static bool parse_id(const std::string &token, uint32_t &key);
+        static bool parse_signal(const std::string &spec, const std::string &factor, const std::string &offset, SignalSpec &signal);
+        static bool parse_field(const std::string &token, uint32_t &field);
+        static const char *field_name(uint32_t field);
+
+        static uint64_t extract(const SignalSpec &signal, const uint8_t *data);
+        static void insert(const SignalSpec &signal, uint64_t raw, uint64_t &le, uint64_t &be);
+        static uint8_t crsf_crc(const uint8_t *data, size_t length);
+
+        // 设备侧
+        int _subscription = -1;
+        TWAI_Device *_twai = nullptr;
+        TWAI_Device *_pending_twai = nullptr; // defer_start 记下的设备, 启动后清空
+
+        static struct
+        {
+            struct arg_lit *reload;
+            struct arg_lit *clear;
+            struct arg_end *end;
+        } gateway_args;
+
+        static int gatewayCommand(void *context, int argc, char **argv);
+        static bool twai_sink(const twai_message_t &message, void *arg);
+        static bool elrs_sink(const uint8_t *frame, size_t length, void *arg);
+        static void elrs_channels(const uint16_t *channels, size_t count, void *arg);
+        void route_task();
+        void print_stats() const;
+    };
+
+#ifdef __cplusplus
+}
+#endif
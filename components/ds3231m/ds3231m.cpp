@@ -2,6 +2,7 @@
 #include <cstring>
 #include <sys/time.h>
 #include <time.h>
+#include <inttypes.h>
 
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
@@ -10,6 +11,8 @@
 #include "driver/i2c_master.h"
 #include "driver/gpio.h"
 #include "ds3231m.hpp"
+#include "event_log.hpp"
+#include "boot_trace.hpp"
 
 #include "beep.hpp"
 
@@ -27,7 +30,7 @@ void RTC::task(void)
     {
         if (xSemaphoreTake(_isr_sem, pdMS_TO_TICKS(200)))
         {
-            ESP_LOGI(TAG, "INT Task");
+            EVENT_LOG("rtc: interrupt");
         }
         if (xSemaphoreTake(_sntp_sem, pdMS_TO_TICKS(500)))
         {
@@ -38,7 +41,7 @@ void RTC::task(void)
             set_config();
             set_status();
             set_time(time_utc0);
-            ESP_LOGI(TAG, "UTC0:=%s", get_utc0_time().c_str());
+            EVENT_LOG("rtc: set from sntp, epoch %" PRIu32, static_cast<uint32_t>(sys_now));
             get_config();
             get_status();
         }
@@ -86,7 +89,9 @@ RTC::RTC(QueueHandle_t &beep_queue,
         .flags = {0},
     };
 
+    const uint32_t trace = BootTrace::begin("i2c_init");
     ESP_ERROR_CHECK(i2c_new_master_bus(&i2c_bus_config, &bus_handle));
+    BootTrace::end(trace);
     ESP_ERROR_CHECK(i2c_master_bus_add_device((bus_handle), &(dev_cfg), &(dev_handle)));
     init_io();
     get_config();
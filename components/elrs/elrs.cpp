@@ -89,6 +89,17 @@ ELRS::ELRS(QueueHandle_t &tx_queue, uint32_t CAN_ID, uart_port_t port, gpio_num_
 
 ELRS::~ELRS() {}
 
+void ELRS::set_channel_callback(void (*callback)(const uint16_t *channels, size_t count, void *arg), void *arg)
+{
+    _channel_callback_arg = arg;
+    _channel_callback = callback;
+}
+
+bool ELRS::send_frame(const uint8_t *frame, size_t length)
+{
+    return uart_write_bytes(_port, frame, length) == static_cast<int>(length);
+}
+
 bool ELRS::check_crc(const uint8_t *data, size_t len) const
 {
     uint8_t crc = 0;
@@ -120,6 +131,10 @@ void ELRS::process_packet(const uint8_t *data, std::time_t &last_time)
 
     parse_channels(data);
     frame_count++;
+    if (_channel_callback != nullptr)
+    {
+        _channel_callback(channels.data(), channels.size(), _channel_callback_arg);
+    }
 #ifdef DEBUG_ENABLE_SERIAL_OUTPUT
     char bar_buffer[BAR_LENGTH + 1];
     printf("\033[H"); // 清屏
@@ -36,6 +36,9 @@ extern "C"
         int frame_count = 0;
         std::array<uint16_t, 16> channels;
 
+        void (*_channel_callback)(const uint16_t *channels, size_t count, void *arg) = nullptr;
+        void *_channel_callback_arg = nullptr;
+
         std::array<uint8_t, 256> generate_crc_lut()
         {
             for (size_t idx = 0; idx < 256; ++idx)
@@ -70,6 +73,12 @@ extern "C"
              uint8_t uart_queen_size = 10);
         ~ELRS();
 
+        // 每解析出一帧通道数据回调一次, 在接收任务中执行
+        void set_channel_callback(void (*callback)(const uint16_t *channels, size_t count, void *arg), void *arg);
+
+        // 向接收机发送一帧完整的 CRSF 数据(遥测等)
+        bool send_frame(const uint8_t *frame, size_t length);
+
         std::array<uint16_t, 16> &get_channels(void)
         {
             return channels;
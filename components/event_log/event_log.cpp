@@ -0,0 +1,309 @@
+#include "event_log.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cinttypes>
+#include <algorithm>
+
+#include "esp_log.h"
+
+static const size_t DEFAULT_DUMP_COUNT = 32;
+static const size_t LINE_SIZE = 160;
+
+EventLog::Ring EventLog::_rings[portNUM_PROCESSORS];
+decltype(EventLog::evtlog_args) EventLog::evtlog_args;
+
+size_t EventLog::snapshot(int core, Event *events, size_t count)
+{
+    Ring &ring = _rings[core];
+    const uint32_t head = ring.head.load(std::memory_order_acquire);
+    const uint32_t base = ring.base.load(std::memory_order_relaxed);
+    uint32_t available = head - base;
+    available = std::min<uint32_t>(available, RING_DEPTH);
+    available = std::min<uint32_t>(available, count);
+
+    size_t copied = 0;
+    for (uint32_t index = head - available; index != head; index++)
+    {
+        const Record &slot = ring.slots[index & (RING_DEPTH - 1)];
+        const uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != index + 1)
+        {
+            continue; // 仍在写入或已被覆盖
+        }
+
+        Event &event = events[copied];
+        event.timestamp_us = slot.timestamp_us;
+        event.format = slot.format;
+        memcpy(event.args, slot.args, sizeof(event.args));
+        event.core = core;
+
+        // 复制期间被覆盖则丢弃
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == sequence)
+        {
+            copied++;
+        }
+    }
+    return copied;
+}
+
+size_t EventLog::format(const Event &event, char *buffer, size_t size)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    size_t used = 0;
+    size_t arg = 0;
+    const char *cursor = event.format;
+    buffer[0] = '\0';
+
+    auto append = [&](int written)
+    {
+        if (written > 0)
+        {
+            used = std::min(size - 1, used + static_cast<size_t>(written));
+        }
+    };
+
+    while (*cursor != '\0' && used + 1 < size)
+    {
+        if (*cursor != '%')
+        {
+            buffer[used++] = *cursor++;
+            buffer[used] = '\0';
+            continue;
+        }
+
+        // 取出一个完整的转换说明, 按转换字符决定参数类型后交给 snprintf
+        const char *start = cursor++;
+        cursor += strspn(cursor, "-+ #0");
+        cursor += strspn(cursor, "0123456789.");
+        bool is_long = false;
+        while (*cursor != '\0' && strchr("hlLqjzt", *cursor) != nullptr)
+        {
+            is_long |= (*cursor == 'l');
+            cursor++;
+        }
+        const char conversion = *cursor;
+        if (conversion == '\0')
+        {
+            break;
+        }
+        cursor++;
+
+        char spec[16];
+        const size_t spec_length = std::min<size_t>(cursor - start, sizeof(spec) - 1);
+        memcpy(spec, start, spec_length);
+        spec[spec_length] = '\0';
+
+        if (conversion == '%')
+        {
+            append(snprintf(buffer + used, size - used, "%%"));
+            continue;
+        }
+        if (arg >= MAX_ARGS)
+        {
+            append(snprintf(buffer + used, size - used, "<?>"));
+            continue;
+        }
+        const uintptr_t word = event.args[arg++];
+
+        switch (conversion)
+        {
+        case 'd':
+        case 'i':
+            if (is_long)
+                append(snprintf(buffer + used, size - used, spec, static_cast<long>(static_cast<int32_t>(word))));
+            else
+                append(snprintf(buffer + used, size - used, spec, static_cast<int>(word)));
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            if (is_long)
+                append(snprintf(buffer + used, size - used, spec, static_cast<unsigned long>(static_cast<uint32_t>(word))));
+            else
+                append(snprintf(buffer + used, size - used, spec, static_cast<unsigned int>(word)));
+            break;
+        case 'c':
+            append(snprintf(buffer + used, size - used, spec, static_cast<int>(word)));
+            break;
+        case 's':
+        {
+            const char *text = reinterpret_cast<const char *>(word);
+            append(snprintf(buffer + used, size - used, spec, text ? text : "(null)"));
+            break;
+        }
+        case 'p':
+            append(snprintf(buffer + used, size - used, spec, reinterpret_cast<void *>(word)));
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        {
+            const uint32_t bits = static_cast<uint32_t>(word);
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            append(snprintf(buffer + used, size - used, spec, static_cast<double>(value)));
+            break;
+        }
+        default:
+            append(snprintf(buffer + used, size - used, "<%c?>", conversion));
+            break;
+        }
+    }
+    return used;
+}
+
+void EventLog::dump(size_t count)
+{
+    Event *events = static_cast<Event *>(malloc(sizeof(Event) * RING_DEPTH * portNUM_PROCESSORS));
+    if (events == nullptr)
+    {
+        ESP_LOGE(TAG, "No memory for event snapshot");
+        return;
+    }
+
+    size_t total = 0;
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        total += snapshot(core, events + total, RING_DEPTH);
+    }
+    std::sort(events, events + total, [](const Event &a, const Event &b)
+              { return a.timestamp_us < b.timestamp_us; });
+
+    char line[LINE_SIZE];
+    for (size_t i = total > count ? total - count : 0; i < total; i++)
+    {
+        format(events[i], line, sizeof(line));
+        printf("%6" PRId64 ".%06" PRId64 " [%d] %s\n",
+               events[i].timestamp_us / 1000000, events[i].timestamp_us % 1000000, events[i].core, line);
+    }
+    free(events);
+}
+
+bool EventLog::save(const char *path)
+{
+    Event *events = static_cast<Event *>(malloc(sizeof(Event) * RING_DEPTH * portNUM_PROCESSORS));
+    if (events == nullptr)
+    {
+        ESP_LOGE(TAG, "No memory for event snapshot");
+        return false;
+    }
+
+    size_t total = 0;
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        total += snapshot(core, events + total, RING_DEPTH);
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        free(events);
+        return false;
+    }
+
+    // 文件头: magic, 记录大小, 记录数; 格式串与 %s 参数只保存地址, 由主机工具从 ELF 中解析
+    const uint32_t header[3] = {FILE_MAGIC, sizeof(SavedRecord), static_cast<uint32_t>(total)};
+    bool ok = fwrite(header, sizeof(header), 1, file) == 1;
+    for (size_t i = 0; ok && i < total; i++)
+    {
+        SavedRecord record = {};
+        record.timestamp_us = events[i].timestamp_us;
+        record.format = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(events[i].format));
+        for (size_t arg = 0; arg < MAX_ARGS; arg++)
+        {
+            record.args[arg] = static_cast<uint32_t>(events[i].args[arg]);
+        }
+        record.core = static_cast<uint8_t>(events[i].core);
+        ok = fwrite(&record, sizeof(record), 1, file) == 1;
+    }
+    ok = (fclose(file) == 0) && ok;
+    free(events);
+
+    if (!ok)
+    {
+        ESP_LOGE(TAG, "Failed to write %s", path);
+        return false;
+    }
+    printf("Saved %zu events to %s\n", total, path);
+    return true;
+}
+
+void EventLog::clear()
+{
+    for (Ring &ring : _rings)
+    {
+        ring.base.store(ring.head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+void EventLog::print_stats()
+{
+    printf("%-6s %10s %10s %6s\n", "core", "written", "overwrite", "depth");
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        const Ring &ring = _rings[core];
+        const uint32_t written = ring.head.load(std::memory_order_relaxed) - ring.base.load(std::memory_order_relaxed);
+        const uint32_t overwritten = written > RING_DEPTH ? written - RING_DEPTH : 0;
+        printf("%-6d %10" PRIu32 " %10" PRIu32 " %6zu\n", core, written, overwritten, RING_DEPTH);
+    }
+}
+
+int EventLog::evtlogCommand(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&evtlog_args);
+    if (nerrors != 0)
+    {
+        arg_print_errors(stderr, evtlog_args.end, argv[0]);
+        return 1;
+    }
+
+    if (evtlog_args.stats->count > 0)
+    {
+        print_stats();
+        return 0;
+    }
+    if (evtlog_args.save->count > 0)
+    {
+        return save(evtlog_args.save->sval[0]) ? 0 : 1;
+    }
+    if (evtlog_args.clear->count > 0)
+    {
+        clear();
+        return 0;
+    }
+
+    const size_t count = evtlog_args.count->count > 0 ? static_cast<size_t>(std::max(evtlog_args.count->ival[0], 0)) : DEFAULT_DUMP_COUNT;
+    dump(count);
+    return 0;
+}
+
+void EventLog::registerConsoleCommands()
+{
+    evtlog_args.count = arg_int0("n", "count", "<n>", "Number of events to print (default 32)");
+    evtlog_args.save = arg_str0("s", "save", "<file>", "Save raw events for tools/evtlog.py");
+    evtlog_args.clear = arg_lit0("c", "clear", "Clear recorded events");
+    evtlog_args.stats = arg_lit0(nullptr, "stats", "Show per-core ring counters");
+    evtlog_args.end = arg_end(4);
+
+    const esp_console_cmd_t evtlog_cmd = {
+        .command = "evtlog",
+        .help = "Print the binary system event log",
+        .hint = nullptr,
+        .func = &EventLog::evtlogCommand,
+        .argtable = &evtlog_args,
+        .func_w_context = nullptr,
+        .context = nullptr,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&evtlog_cmd));
+}
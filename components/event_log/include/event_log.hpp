@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <atomic>
+#include <type_traits>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+#include "argtable3/argtable3.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+// 二进制事件日志: 调用处只记录格式串地址与原始参数, 写入当前核的环形缓冲,
+// 直到 evtlog 命令或主机工具 (tools/evtlog.py + ELF) 读取时才格式化.
+// 环满后覆盖最旧的记录, 写入无锁, 可在任务与中断中调用
+class EventLog
+{
+public:
+    static constexpr size_t MAX_ARGS = 4;
+    static constexpr size_t RING_DEPTH = 256; // 每核记录数, 必须是2的幂
+    static constexpr uint32_t FILE_MAGIC = 0x314C5645; // "EVL1"
+
+    // 从环中读出的一条事件
+    struct Event
+    {
+        int64_t timestamp_us;
+        const char *format;
+        uintptr_t args[MAX_ARGS];
+        int core;
+    };
+
+    // 导出文件中的记录, 与 tools/evtlog.py 保持一致
+    struct SavedRecord
+    {
+        int64_t timestamp_us;
+        uint32_t format;
+        uint32_t args[MAX_ARGS];
+        uint8_t core;
+        uint8_t reserved[3];
+    };
+
+    template <typename... Args>
+    static inline void write(const char *format, Args... args)
+    {
+        static_assert(sizeof...(Args) <= MAX_ARGS, "too many event arguments");
+        Ring &ring = _rings[xPortGetCoreID()];
+        const uint32_t index = ring.head.fetch_add(1, std::memory_order_relaxed);
+        Record &slot = ring.slots[index & (RING_DEPTH - 1)];
+
+        slot.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.timestamp_us = esp_timer_get_time();
+        slot.format = format;
+        [[maybe_unused]] size_t i = 0;
+        ((slot.args[i++] = to_word(args)), ...);
+        slot.sequence.store(index + 1, std::memory_order_release);
+    }
+
+    // 将记录格式化为文本, 返回写入长度
+    static size_t format(const Event &event, char *buffer, size_t size);
+
+    // 按时间顺序输出各核最近 count 条记录
+    static void dump(size_t count);
+    static bool save(const char *path);
+    static void clear();
+    static void print_stats();
+
+    static void registerConsoleCommands();
+
+private:
+    static constexpr const char *TAG = "EventLog";
+
+    struct Record
+    {
+        int64_t timestamp_us;
+        std::atomic<uint32_t> sequence; // 写入中为 0, 完成后为序号 + 1
+        const char *format;
+        uintptr_t args[MAX_ARGS];
+    };
+
+    struct Ring
+    {
+        std::atomic<uint32_t> head;
+        std::atomic<uint32_t> base; // clear() 之后的起点
+        Record slots[RING_DEPTH];
+    };
+
+    static Ring _rings[portNUM_PROCESSORS];
+
+    static struct
+    {
+        struct arg_int *count;
+        struct arg_str *save;
+        struct arg_lit *clear;
+        struct arg_lit *stats;
+        struct arg_end *end;
+    } evtlog_args;
+
+    // 参数按32位原样保存; 浮点数转为 float 保存位模式, %s 参数必须指向静态字符串
+    template <typename T>
+    static inline uintptr_t to_word(T value)
+    {
+        static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T> || std::is_pointer_v<T>, "event arguments must be scalars");
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            const float narrowed = static_cast<float>(value);
+            uint32_t bits;
+            memcpy(&bits, &narrowed, sizeof(bits));
+            return bits;
+        }
+        else if constexpr (std::is_pointer_v<T>)
+        {
+            return reinterpret_cast<uintptr_t>(value);
+        }
+        else
+        {
+            static_assert(sizeof(T) <= sizeof(uint32_t), "64-bit event arguments are not supported");
+            return static_cast<uintptr_t>(value);
+        }
+    }
+
+    // 复制某核环中完整的记录, 返回条数
+    static size_t snapshot(int core, Event *events, size_t count);
+
+    static int evtlogCommand(int argc, char **argv);
+};
+
+// 格式串必须是字面量, 以便主机工具按地址在 ELF 中找到它
+#define EVENT_LOG(format, ...) EventLog::write("" format, ##__VA_ARGS__)
@@ -0,0 +1,301 @@
+#include "gs_usb.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include "esp_heap_caps.h"
+
+static const uint32_t SW_VERSION = 2;
+static const uint32_t HW_VERSION = 1;
+
+GsUsb::GsUsb()
+{
+}
+
+GsUsb::~GsUsb()
+{
+    heap_caps_free(_rx_ring);
+    heap_caps_free(_echo_ring);
+}
+
+bool GsUsb::init()
+{
+    if (_rx_ring)
+    {
+        return true;
+    }
+    // USB 直接从环中的帧发起传输, 需 DMA 可访问
+    _rx_ring = static_cast<HostFrame *>(heap_caps_malloc(sizeof(HostFrame) * RX_RING_DEPTH, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL));
+    _echo_ring = static_cast<HostFrame *>(heap_caps_malloc(sizeof(HostFrame) * ECHO_RING_DEPTH, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL));
+    if (!_rx_ring || !_echo_ring)
+    {
+        heap_caps_free(_rx_ring);
+        heap_caps_free(_echo_ring);
+        _rx_ring = _echo_ring = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void GsUsb::set_apply_sink(ApplySink sink, void *arg)
+{
+    _apply = sink;
+    _apply_arg = arg;
+}
+
+void GsUsb::set_transmit_sink(TransmitSink sink, void *arg)
+{
+    _transmit = sink;
+    _transmit_arg = arg;
+}
+
+void GsUsb::set_clock_source(ClockSource clock, void *arg)
+{
+    _clock = clock;
+    _clock_arg = arg;
+}
+
+uint32_t GsUsb::now_us() const
+{
+    return _clock ? static_cast<uint32_t>(_clock(_clock_arg)) : 0;
+}
+
+uint32_t GsUsb::timing_to_bitrate(const BitTiming &timing)
+{
+    const uint32_t quanta = 1 + timing.prop_seg + timing.phase_seg1 + timing.phase_seg2;
+    if (timing.brp == 0)
+    {
+        return 0;
+    }
+    const uint64_t divider = static_cast<uint64_t>(timing.brp) * quanta;
+    return static_cast<uint32_t>((FCLK_CAN + divider / 2) / divider);
+}
+
+int GsUsb::handle_control(uint8_t request, uint16_t channel, uint8_t *data, size_t length, bool to_host)
+{
+    switch (request)
+    {
+    case BREQ_HOST_FORMAT:
+        // 旧内核探测时发送 0x0000beef, 只支持小端
+        return to_host ? -1 : 0;
+
+    case BREQ_DEVICE_CONFIG:
+    {
+        if (!to_host || length < sizeof(DeviceConfig))
+        {
+            return -1;
+        }
+        const DeviceConfig config = {
+            .reserved1 = 0,
+            .reserved2 = 0,
+            .reserved3 = 0,
+            .icount = 0, // 只导出片上 TWAI
+            .sw_version = SW_VERSION,
+            .hw_version = HW_VERSION,
+        };
+        memcpy(data, &config, sizeof(config));
+        return sizeof(config);
+    }
+
+    case BREQ_BT_CONST:
+    {
+        if (!to_host || channel != 0 || length < sizeof(BtConst))
+        {
+            return -1;
+        }
+        // ESP32-S3 TWAI: BRP 为 2..16384 的偶数
+        const BtConst bt_const = {
+            .feature = FLAG_LISTEN_ONLY | FLAG_HW_TIMESTAMP,
+            .fclk_can = FCLK_CAN,
+            .tseg1_min = 1,
+            .tseg1_max = 16,
+            .tseg2_min = 1,
+            .tseg2_max = 8,
+            .sjw_max = 4,
+            .brp_min = 2,
+            .brp_max = 16384,
+            .brp_inc = 2,
+        };
+        memcpy(data, &bt_const, sizeof(bt_const));
+        return sizeof(bt_const);
+    }
+
+    case BREQ_BITTIMING:
+        if (to_host || channel != 0 || length != sizeof(BitTiming))
+        {
+            return -1;
+        }
+        memcpy(&_timing, data, sizeof(_timing));
+        return 0;
+
+    case BREQ_MODE:
+    {
+        DeviceMode mode;
+        if (to_host || channel != 0 || length != sizeof(mode))
+        {
+            return -1;
+        }
+        memcpy(&mode, data, sizeof(mode));
+        if (mode.mode == MODE_RESET)
+        {
+            _started.store(false, std::memory_order_release);
+            return 0;
+        }
+        if (mode.mode != MODE_START)
+        {
+            return -1;
+        }
+
+        const uint32_t bitrate = timing_to_bitrate(_timing);
+        if (bitrate == 0 || (_apply && !_apply(bitrate, mode.flags & FLAG_LISTEN_ONLY, _apply_arg)))
+        {
+            return -1;
+        }
+        _timestamps = mode.flags & FLAG_HW_TIMESTAMP;
+        _overflow_pending = false;
+        _started.store(true, std::memory_order_release);
+        return 0;
+    }
+
+    case BREQ_TIMESTAMP:
+    {
+        if (!to_host || length < sizeof(uint32_t))
+        {
+            return -1;
+        }
+        const uint32_t timestamp = now_us();
+        memcpy(data, &timestamp, sizeof(timestamp));
+        return sizeof(timestamp);
+    }
+
+    default:
+        return -1;
+    }
+}
+
+void GsUsb::encode_frame(const CanFrameRecord &record, HostFrame &frame)
+{
+    const twai_message_t &message = record.message;
+    frame.echo_id = ECHO_ID_RX;
+    frame.can_id = message.identifier | (message.extd ? CAN_EFF_FLAG : 0) | (message.rtr ? CAN_RTR_FLAG : 0);
+    frame.can_dlc = std::min<uint8_t>(message.data_length_code, sizeof(frame.data));
+    frame.channel = 0;
+    frame.flags = 0;
+    frame.reserved = 0;
+    memcpy(frame.data, message.data, sizeof(frame.data));
+    frame.timestamp_us = static_cast<uint32_t>(record.timestamp_us);
+}
+
+bool GsUsb::decode_frame(const HostFrame &frame, twai_message_t &message)
+{
+    if (frame.can_id & CAN_ERR_FLAG)
+    {
+        return false;
+    }
+    memset(&message, 0, sizeof(message));
+    message.extd = (frame.can_id & CAN_EFF_FLAG) ? 1 : 0;
+    message.rtr = (frame.can_id & CAN_RTR_FLAG) ? 1 : 0;
+    message.identifier = frame.can_id & (message.extd ? 0x1FFFFFFFUL : 0x7FFUL);
+    message.data_length_code = std::min<uint8_t>(frame.can_dlc, sizeof(message.data));
+    memcpy(message.data, frame.data, sizeof(message.data));
+    return true;
+}
+
+bool GsUsb::queue_rx(const CanFrameRecord &record)
+{
+    if (!_rx_ring || !is_started())
+    {
+        return false;
+    }
+
+    const uint32_t head = _rx_head.load(std::memory_order_relaxed);
+    if (head - _rx_tail.load(std::memory_order_acquire) >= RX_RING_DEPTH)
+    {
+        // 主机来不及取, 下一帧带溢出标志
+        _overflow_pending = true;
+        _rx_dropped++;
+        return false;
+    }
+
+    HostFrame &frame = _rx_ring[head & (RX_RING_DEPTH - 1)];
+    encode_frame(record, frame);
+    if (_overflow_pending)
+    {
+        frame.flags |= FRAME_FLAG_OVERFLOW;
+        _overflow_pending = false;
+    }
+    _rx_head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+bool GsUsb::handle_host_frame(const uint8_t *data, size_t length)
+{
+    if (!_echo_ring || length < FRAME_SIZE)
+    {
+        return false;
+    }
+    HostFrame frame = {};
+    memcpy(&frame, data, std::min(length, sizeof(frame)));
+    _tx_frames++;
+
+    twai_message_t message;
+    if (!decode_frame(frame, message) || !_transmit || !_transmit(message, _transmit_arg))
+    {
+        _tx_failed++;
+    }
+
+    // 主机按回显释放发送上下文, 发送失败也要回显, 否则主机发送队列会停住
+    const uint32_t head = _echo_head.load(std::memory_order_relaxed);
+    if (head - _echo_tail.load(std::memory_order_acquire) >= ECHO_RING_DEPTH)
+    {
+        return false; // 主机最多 10 个未回显的帧, 不会发生
+    }
+    frame.timestamp_us = now_us();
+    _echo_ring[head % ECHO_RING_DEPTH] = frame;
+    _echo_head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+const GsUsb::HostFrame *GsUsb::peek_in_frame()
+{
+    if (!_rx_ring)
+    {
+        return nullptr;
+    }
+    // 回显优先, 主机据此继续发送
+    const uint32_t echo_tail = _echo_tail.load(std::memory_order_relaxed);
+    if (_echo_head.load(std::memory_order_acquire) != echo_tail)
+    {
+        _in_flight_echo = true;
+        return &_echo_ring[echo_tail % ECHO_RING_DEPTH];
+    }
+    const uint32_t rx_tail = _rx_tail.load(std::memory_order_relaxed);
+    if (_rx_head.load(std::memory_order_acquire) != rx_tail)
+    {
+        _in_flight_echo = false;
+        return &_rx_ring[rx_tail & (RX_RING_DEPTH - 1)];
+    }
+    return nullptr;
+}
+
+void GsUsb::complete_in_frame()
+{
+    if (_in_flight_echo)
+    {
+        _echo_tail.fetch_add(1, std::memory_order_release);
+    }
+    else
+    {
+        _rx_tail.fetch_add(1, std::memory_order_release);
+        _rx_frames++;
+    }
+}
+
+GsUsb::Stats GsUsb::get_stats() const
+{
+    return {
+        .rx_frames = _rx_frames.load(),
+        .rx_dropped = _rx_dropped.load(),
+        .tx_frames = _tx_frames.load(),
+        .tx_failed = _tx_failed.load(),
+    };
+}
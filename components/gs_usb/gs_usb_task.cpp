@@ -0,0 +1,257 @@
+#include "gs_usb.hpp"
+
+#include <cinttypes>
+#include "twai_device.hpp"
+#include "usb_can_mode.hpp"
+#include "esp_log.h"
+#include "tinyusb.h"
+#include "device/usbd_pvt.h"
+
+#define GS_USB_DESC_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_VENDOR_DESC_LEN)
+
+enum
+{
+    ITF_NUM_GS_USB = 0,
+    ITF_NUM_TOTAL
+};
+
+// 与 candleLight 固件相同, 旧内核的 gs_usb 驱动写死了端点号
+enum
+{
+    EDPT_GS_USB_OUT = 0x02,
+    EDPT_GS_USB_IN = 0x81,
+};
+
+static const uint8_t RHPORT = 0;
+static const uint16_t EDPT_SIZE = 64;
+
+// 使用 candleLight 的 VID/PID, 内核 gs_usb 驱动按此自动绑定
+static const UsbCanMode::DeviceInfo device_info = {
+    .vendor_id = 0x1D50,
+    .product_id = 0x606F,
+    .iad = false,
+    .product = "gs_usb CAN Logger",
+    .interface_name = "gs_usb",
+};
+
+static uint8_t const gs_usb_configuration_desc[] = {
+    // Config number, interface count, string index, total length, attribute, power in mA
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, GS_USB_DESC_TOTAL_LEN, 0, 100),
+
+    // Interface number, string index, EP Out & EP In address, EP size
+    TUD_VENDOR_DESCRIPTOR(ITF_NUM_GS_USB, 4, EDPT_GS_USB_OUT, EDPT_GS_USB_IN, EDPT_SIZE),
+};
+
+// TinyUSB 应用类驱动: 控制请求交给协议层, IN 端点直接从发送环中的帧发起传输,
+// 一次传输完成后在回调中立即接续下一帧, 不经过任务切换
+struct GsUsbDriver
+{
+    static inline GsUsb *instance = nullptr;
+    static inline uint8_t ep_in = 0;
+    static inline uint8_t ep_out = 0;
+    CFG_TUSB_MEM_ALIGN static inline uint8_t out_buffer[EDPT_SIZE];
+    CFG_TUSB_MEM_ALIGN static inline uint8_t control_buffer[64];
+
+    static void init(void)
+    {
+    }
+
+    static void reset(uint8_t rhport)
+    {
+        (void)rhport;
+        ep_in = 0;
+        ep_out = 0;
+    }
+
+    static uint16_t open(uint8_t rhport, tusb_desc_interface_t const *itf, uint16_t max_len)
+    {
+        if (!instance || itf->bInterfaceClass != TUSB_CLASS_VENDOR_SPECIFIC || itf->bInterfaceNumber != ITF_NUM_GS_USB)
+        {
+            return 0;
+        }
+        const uint16_t length = sizeof(tusb_desc_interface_t) + itf->bNumEndpoints * sizeof(tusb_desc_endpoint_t);
+        if (max_len < length || !usbd_open_edpt_pair(rhport, tu_desc_next(itf), itf->bNumEndpoints, TUSB_XFER_BULK, &ep_out, &ep_in))
+        {
+            return 0;
+        }
+        usbd_edpt_xfer(rhport, ep_out, out_buffer, sizeof(out_buffer));
+        return length;
+    }
+
+    static bool control_xfer(uint8_t rhport, uint8_t stage, tusb_control_request_t const *request)
+    {
+        if (!instance || request->bmRequestType_bit.type != TUSB_REQ_TYPE_VENDOR || request->wLength > sizeof(control_buffer))
+        {
+            return false;
+        }
+        const bool to_host = request->bmRequestType_bit.direction == TUSB_DIR_IN;
+
+        if (stage == CONTROL_STAGE_SETUP)
+        {
+            if (!to_host)
+            {
+                // 先收参数, 在数据阶段处理
+                return tud_control_xfer(rhport, request, control_buffer, request->wLength);
+            }
+            const int length = instance->handle_control(request->bRequest, request->wValue, control_buffer, request->wLength, true);
+            return length >= 0 && tud_control_xfer(rhport, request, control_buffer, static_cast<uint16_t>(length));
+        }
+        if (stage == CONTROL_STAGE_DATA && !to_host)
+        {
+            return instance->handle_control(request->bRequest, request->wValue, control_buffer, request->wLength, false) >= 0;
+        }
+        return true;
+    }
+
+    static bool xfer(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes)
+    {
+        if (ep_addr == ep_out)
+        {
+            if (result == XFER_RESULT_SUCCESS)
+            {
+                instance->handle_host_frame(out_buffer, xferred_bytes);
+            }
+            usbd_edpt_xfer(rhport, ep_out, out_buffer, sizeof(out_buffer));
+            kick();
+            return true;
+        }
+        if (ep_addr == ep_in)
+        {
+            if (result == XFER_RESULT_SUCCESS)
+            {
+                instance->complete_in_frame();
+            }
+            kick();
+            return true;
+        }
+        return false;
+    }
+
+    // IN 端点空闲且有待发帧时发起传输; 转发任务与 USB 任务都会调用, 以端点占用互斥
+    static void kick()
+    {
+        if (!instance || ep_in == 0 || !tud_ready() || !usbd_edpt_claim(RHPORT, ep_in))
+        {
+            return;
+        }
+        const GsUsb::HostFrame *frame = instance->peek_in_frame();
+        if (!frame || !usbd_edpt_xfer(RHPORT, ep_in, reinterpret_cast<uint8_t *>(const_cast<GsUsb::HostFrame *>(frame)), instance->frame_size()))
+        {
+            usbd_edpt_release(RHPORT, ep_in);
+        }
+    }
+};
+
+static const usbd_class_driver_t gs_usb_driver = {
+#if CFG_TUSB_DEBUG >= 2
+    .name = "GS_USB",
+#endif
+    .init = &GsUsbDriver::init,
+    .reset = &GsUsbDriver::reset,
+    .open = &GsUsbDriver::open,
+    .control_xfer_cb = &GsUsbDriver::control_xfer,
+    .xfer_cb = &GsUsbDriver::xfer,
+    .sof = nullptr,
+};
+
+extern "C" usbd_class_driver_t const *usbd_app_driver_get_cb(uint8_t *driver_count)
+{
+    *driver_count = 1;
+    return &gs_usb_driver;
+}
+
+bool GsUsb::apply_twai(uint32_t bitrate, bool listen_only, void *arg)
+{
+    TWAI_Device *twai = static_cast<TWAI_Device *>(arg);
+    const twai_mode_t mode = listen_only ? TWAI_MODE_LISTEN_ONLY : TWAI_MODE_NORMAL;
+    if (twai->get_bitrate() == bitrate && twai->get_mode() == mode)
+    {
+        return true;
+    }
+    return twai->reconfigure(bitrate, mode) == ESP_OK;
+}
+
+bool GsUsb::transmit_twai(const twai_message_t &message, void *arg)
+{
+    // 发送队列满时丢弃, 不阻塞 USB 任务
+    return static_cast<TWAI_Device *>(arg)->send_message(message, 0);
+}
+
+int64_t GsUsb::clock_twai(void *arg)
+{
+    return static_cast<TWAI_Device *>(arg)->get_timestamp_us();
+}
+
+void GsUsb::forward_task()
+{
+    CanRxDispatcher &dispatcher = _twai->get_rx_dispatcher();
+    CanFrameRecord record;
+
+    while (true)
+    {
+        if (!dispatcher.receive(_subscription, record, portMAX_DELAY))
+        {
+            continue;
+        }
+        // 取完已到的帧再启动传输, 其后由传输完成回调接续
+        do
+        {
+            queue_rx(record);
+        } while (dispatcher.receive(_subscription, record, 0));
+        GsUsbDriver::kick();
+    }
+}
+
+bool GsUsb::start(TWAI_Device &twai)
+{
+    if (!init())
+    {
+        ESP_LOGE(TAG, "Failed to allocate frame rings");
+        return false;
+    }
+    _subscription = twai.get_rx_dispatcher().subscribe("gs_usb", 256);
+    if (_subscription < 0)
+    {
+        ESP_LOGE(TAG, "Subscribe TWAI RX failed");
+        return false;
+    }
+    _twai = &twai;
+    set_apply_sink(&GsUsb::apply_twai, &twai);
+    set_transmit_sink(&GsUsb::transmit_twai, &twai);
+    set_clock_source(&GsUsb::clock_twai, &twai);
+    GsUsbDriver::instance = this;
+
+    esp_err_t ret = UsbCanMode::install_driver(device_info, gs_usb_configuration_desc);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "USB driver install failed: %s", esp_err_to_name(ret));
+        GsUsbDriver::instance = nullptr;
+        return false;
+    }
+
+    auto task_func = [](void *arg)
+    {
+        GsUsb *instance = static_cast<GsUsb *>(arg);
+        instance->forward_task();
+    };
+    xTaskCreatePinnedToCore(task_func, "gs_usb", StackSize, this, 2, nullptr, tskNO_AFFINITY);
+
+    ESP_LOGI(TAG, "gs_usb device started, USB console unavailable until reset");
+    return true;
+}
+
+int GsUsb::command(int argc, char **argv)
+{
+    return UsbCanMode::reboot_into(UsbCanMode::Mode::GS_USB);
+}
+
+void GsUsb::registerConsoleCommands()
+{
+    const esp_console_cmd_t cmd = {
+        .command = "gsusb",
+        .help = "Reboot as a gs_usb (candleLight) SocketCAN adapter until the next reset",
+        .hint = NULL,
+        .func = &GsUsb::command,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+#include "can_frame.hpp"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "driver/twai.h"
+#include "esp_console.h"
+#include "argtable3/argtable3.h"
+
+    class TWAI_Device;
+
+    // gs_usb (candleLight) USB 设备: 主机端 Linux 内核 gs_usb 驱动把本机识别为 SocketCAN 接口 can0.
+    // 协议层(控制请求、帧编解码、发送环)不依赖 RTOS 与 USB 栈, 可在主机上测试; USB 类驱动见 gs_usb_task.cpp.
+    // USB 与控制台共用片上 PHY, 需重启进入此模式, 其余业务(含写卡)照常运行.
+    class GsUsb
+    {
+    public:
+        // 控制请求, 与 Linux drivers/net/can/usb/gs_usb.c 一致
+        enum Request : uint8_t
+        {
+            BREQ_HOST_FORMAT = 0,
+            BREQ_BITTIMING = 1,
+            BREQ_MODE = 2,
+            BREQ_BERR = 3,
+            BREQ_BT_CONST = 4,
+            BREQ_DEVICE_CONFIG = 5,
+            BREQ_TIMESTAMP = 6,
+            BREQ_IDENTIFY = 7,
+        };
+
+        static constexpr uint32_t MODE_RESET = 0;
+        static constexpr uint32_t MODE_START = 1;
+
+        // 模式标志与能力位
+        static constexpr uint32_t FLAG_LISTEN_ONLY = 1 << 0;
+        static constexpr uint32_t FLAG_HW_TIMESTAMP = 1 << 4;
+
+        // 帧标志
+        static constexpr uint8_t FRAME_FLAG_OVERFLOW = 1 << 0;
+
+        // SocketCAN can_id 标志位
+        static constexpr uint32_t CAN_EFF_FLAG = 0x80000000UL;
+        static constexpr uint32_t CAN_RTR_FLAG = 0x40000000UL;
+        static constexpr uint32_t CAN_ERR_FLAG = 0x20000000UL;
+
+        static constexpr uint32_t ECHO_ID_RX = 0xFFFFFFFFUL; // 接收帧, 非发送回显
+        static constexpr uint32_t FCLK_CAN = 80000000;       // TWAI 时钟源 APB
+
+        struct DeviceConfig
+        {
+            uint8_t reserved1;
+            uint8_t reserved2;
+            uint8_t reserved3;
+            uint8_t icount; // 通道数 - 1
+            uint32_t sw_version;
+            uint32_t hw_version;
+        };
+
+        struct BtConst
+        {
+            uint32_t feature;
+            uint32_t fclk_can;
+            uint32_t tseg1_min;
+            uint32_t tseg1_max;
+            uint32_t tseg2_min;
+            uint32_t tseg2_max;
+            uint32_t sjw_max;
+            uint32_t brp_min;
+            uint32_t brp_max;
+            uint32_t brp_inc;
+        };
+
+        struct BitTiming
+        {
+            uint32_t prop_seg;
+            uint32_t phase_seg1;
+            uint32_t phase_seg2;
+            uint32_t sjw;
+            uint32_t brp;
+        };
+
+        struct DeviceMode
+        {
+            uint32_t mode;
+            uint32_t flags;
+        };
+
+        // 主机开启硬件时间戳后每帧带 timestamp_us, 否则只传到 data 为止
+        struct HostFrame
+        {
+            uint32_t echo_id;
+            uint32_t can_id;
+            uint8_t can_dlc;
+            uint8_t channel;
+            uint8_t flags;
+            uint8_t reserved;
+            uint8_t data[8];
+            uint32_t timestamp_us;
+        };
+        static constexpr size_t FRAME_SIZE = offsetof(HostFrame, timestamp_us);
+
+        // 启动 CAN 控制器, bitrate 由主机下发的位时序换算
+        using ApplySink = bool (*)(uint32_t bitrate, bool listen_only, void *arg);
+        // 发送主机下发的帧, 返回 false 计为发送失败
+        using TransmitSink = bool (*)(const twai_message_t &message, void *arg);
+        // 当前时间(微秒), 与接收帧时间戳同一基准
+        using ClockSource = int64_t (*)(void *arg);
+
+        struct Stats
+        {
+            uint32_t rx_frames;  // 已送往主机
+            uint32_t rx_dropped; // 发送环满丢弃
+            uint32_t tx_frames;  // 主机下发
+            uint32_t tx_failed;  // 发送队列满
+        };
+
+        GsUsb();
+        ~GsUsb();
+
+        // 分配发送环(DMA 可访问的内部 RAM), start() 会调用
+        bool init();
+
+        void set_apply_sink(ApplySink sink, void *arg);
+        void set_transmit_sink(TransmitSink sink, void *arg);
+        void set_clock_source(ClockSource clock, void *arg);
+
+        // 控制请求: to_host 时把回复写入 data 并返回长度, 否则处理 data 中的参数; 不支持或参数错误返回 -1(STALL)
+        int handle_control(uint8_t request, uint16_t channel, uint8_t *data, size_t length, bool to_host);
+
+        // 接收帧入发送环, 未启动时忽略
+        bool queue_rx(const CanFrameRecord &record);
+        // 处理主机下发的帧, 发送后回显
+        bool handle_host_frame(const uint8_t *data, size_t length);
+
+        // 发送环消费端, 由 USB IN 端点的持有者调用: 取出待发帧(不出队), 传输完成后出队
+        const HostFrame *peek_in_frame();
+        void complete_in_frame();
+
+        bool is_started() const { return _started.load(std::memory_order_acquire); }
+        size_t frame_size() const { return _timestamps ? sizeof(HostFrame) : FRAME_SIZE; }
+        Stats get_stats() const;
+
+        static uint32_t timing_to_bitrate(const BitTiming &timing);
+        static void encode_frame(const CanFrameRecord &record, HostFrame &frame);
+        static bool decode_frame(const HostFrame &frame, twai_message_t &message);
+
+        // 以下为设备侧接口, 实现见 gs_usb_task.cpp
+        bool start(TWAI_Device &twai); // 安装 USB 驱动并订阅 TWAI 接收, 是否启动由 UsbCanMode::take_boot_request 决定
+        void registerConsoleCommands();
+
+    private:
+        const char *TAG = "GsUsb";
+        static const uint32_t StackSize = 3072;
+
+        static constexpr size_t RX_RING_DEPTH = 128; // 2 的幂
+        static constexpr size_t ECHO_RING_DEPTH = 16;
+
+        // 发送环: 接收帧由转发任务写入, 回显帧由 USB 任务写入, 各自单生产者;
+        // 消费者为 IN 端点持有者, 同一时刻只有一个
+        HostFrame *_rx_ring = nullptr;
+        HostFrame *_echo_ring = nullptr;
+        std::atomic<uint32_t> _rx_head{0};
+        std::atomic<uint32_t> _rx_tail{0};
+        std::atomic<uint32_t> _echo_head{0};
+        std::atomic<uint32_t> _echo_tail{0};
+        bool _in_flight_echo = false;
+        bool _overflow_pending = false;
+
+        BitTiming _timing = {};
+        std::atomic<bool> _started{false};
+        bool _timestamps = false;
+
+        ApplySink _apply = nullptr;
+        void *_apply_arg = nullptr;
+        TransmitSink _transmit = nullptr;
+        void *_transmit_arg = nullptr;
+        ClockSource _clock = nullptr;
+        void *_clock_arg = nullptr;
+
+        std::atomic<uint32_t> _rx_frames{0};
+        std::atomic<uint32_t> _rx_dropped{0};
+        std::atomic<uint32_t> _tx_frames{0};
+        std::atomic<uint32_t> _tx_failed{0};
+
+        uint32_t now_us() const;
+
+        // 设备侧
+
+        int _subscription = -1;
+        TWAI_Device *_twai = nullptr;
+
+        friend struct GsUsbDriver;
+
+        static bool apply_twai(uint32_t bitrate, bool listen_only, void *arg);
+        static bool transmit_twai(const twai_message_t &message, void *arg);
+        static int64_t clock_twai(void *arg);
+        void forward_task();
+        static int command(int argc, char **argv);
+    };
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // 分块日志文件: 由若干按扇区对齐的独立块组成, 每块为块头加数据(可选 LZ4 块格式压缩), 不足一个扇区补 0.
+    // 块头带文件内序号与累计行数, 掉电后从文件尾向前找到最后一个校验通过的块即可恢复. 文件格式见 tools/logcat.py
+    class LogBlockEncoder
+    {
+    public:
+        static constexpr uint32_t BLOCK_MAGIC = 0x314B4C43; // "CLK1"
+        static constexpr uint32_t FLAG_LZ4 = 0x0001;        // 数据为 LZ4 块格式
+        static constexpr size_t SECTOR_SIZE = 512;
+
+        struct BlockHeader
+        {
+            uint32_t magic;
+            uint32_t sequence;      // 文件内从 0 递增
+            uint32_t flags;
+            uint32_t raw_length;    // 解压后长度
+            uint32_t stored_length; // 块头之后的数据长度, 不含补齐
+            uint32_t line_total;    // 文件开头到本块结束的换行数
+            uint32_t crc;           // 块头前六个字段与数据的 CRC32
+        };
+
+        // 块头加数据补齐到整扇区后的长度
+        static size_t block_size(uint32_t stored_length)
+        {
+            return (sizeof(BlockHeader) + stored_length + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+        }
+
+        LogBlockEncoder() = default;
+        ~LogBlockEncoder();
+
+        // 分配输出缓冲, compress 时另分配哈希表; max_raw_length 为单块最大原始长度
+        bool init(size_t max_raw_length, bool compress);
+
+        // 编码一块, 返回补齐后的总长度, 结果位于 output(); line_total 传入前一块的累计行数, 返回本块的
+        size_t encode(const uint8_t *data, size_t length, bool compress, uint32_t sequence, uint32_t &line_total);
+        const uint8_t *output() const { return _output; }
+
+        // 校验块头与数据, header 之后紧跟 stored_length 字节
+        static bool check_block(const BlockHeader &header, const uint8_t *payload, size_t max_raw_length);
+
+        // 找文件中最后一个完整且校验通过的块, 得到其累计行数, 下一块序号与补齐后的数据末尾.
+        // 断电撕裂的尾块与预分配的全 0 尾部被跳过; 没有有效块时返回 false, 输出均为 0
+        static bool recover(FILE *file, size_t max_raw_length, uint32_t &lines, uint32_t &next_sequence, long &data_end);
+
+        // LZ4 块压缩, 输出超过 capacity 或没有压缩收益时返回 0
+        static size_t compress(const uint8_t *src, size_t length, uint8_t *dst, size_t capacity, uint32_t *table);
+
+    private:
+        static constexpr int HASH_BITS = 12;
+
+        uint32_t *_table = nullptr;
+        uint8_t *_output = nullptr;
+        size_t _max_raw_length = 0;
+    };
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // 拔卡期间的暂存区: 只存整行的字节环形缓冲, 另带若干段标记, 记录从某个位置起的数据应写入哪个文件.
+    // 位置为单调递增的 64 位字节序号, 调用方负责加锁
+    class LogSpill
+    {
+    public:
+        enum class Action : uint8_t
+        {
+            REOPEN, // 重新打开拔卡时正在写的文件
+            OPEN,   // 拔卡期间 init() 的文件名
+            CLOSE,  // 拔卡期间 shutdown()
+        };
+
+        struct Segment
+        {
+            uint64_t start;
+            Action action;
+            char name[96];
+        };
+
+        static constexpr size_t MAX_SEGMENTS = 16;
+
+        LogSpill() = default;
+        ~LogSpill();
+
+        // 优先在 PSRAM 中分配 psram_bytes, 失败时在内部 RAM 中分配 internal_bytes
+        bool init(size_t psram_bytes, size_t internal_bytes);
+        bool is_enabled() const { return _data != nullptr; }
+        bool in_psram() const { return _in_psram; }
+
+        size_t capacity() const { return _capacity; }
+        size_t used() const { return static_cast<size_t>(_head - _tail); }
+        size_t peak() const { return _peak; }
+        uint32_t get_dropped_lines() const { return _dropped_lines; }
+        uint64_t get_dropped_bytes() const { return _dropped_bytes; }
+        bool empty() const { return _head == _tail && _segment_count == 0; }
+
+        // 追加一行, 空间不足时整行丢弃并计数
+        bool push(const std::string_view *parts, size_t count, bool newline);
+        // 放回队首, 用于拔卡时尚未交给写入任务的缓冲; 空间不足时丢弃
+        bool push_front(const char *data, size_t length);
+
+        // 在队尾/队首插入段标记, 标记数达到上限时返回 false, 此时之后的数据仍属于前一段
+        bool mark(Action action, const char *name = "");
+        bool mark_front(Action action);
+
+        // 队首数据之前有段标记时取出
+        bool pop_segment(Segment &segment);
+        // 读出至多 length 字节, 不越过下一个段标记
+        size_t read(char *buffer, size_t length);
+
+        // 数据取出后没能写到卡上
+        void count_drop(uint32_t lines, size_t bytes);
+
+    private:
+        static constexpr uint64_t POSITION_BASE = 1ULL << 40;
+
+        void copy_in(uint64_t position, const char *data, size_t length);
+
+        char *_data = nullptr;
+        size_t _capacity = 0;
+        bool _in_psram = false;
+        uint64_t _head = 0; // 下一个写入位置
+        uint64_t _tail = 0; // 下一个读出位置
+        size_t _peak = 0;
+
+        Segment *_segments = nullptr; // 按 start 递增的环形数组
+        size_t _segment_first = 0;
+        size_t _segment_count = 0;
+
+        uint32_t _dropped_lines = 0;
+        uint64_t _dropped_bytes = 0;
+    };
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,16 +1,93 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <initializer_list>
 #include <vector>
+#include <unordered_map>
 #include <ctime>
 #include <time.h>
 #include <chrono>
+#include <cstdint>
+#include <atomic>
+
+#include "log_block.hpp"
+#include "log_spill.hpp"
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+
+    // 轮转与保留策略, 各项为 0 表示不启用
+    struct RotationPolicy
+    {
+        uint32_t max_lines = 0;       // 行数上限
+        uint64_t max_bytes = 0;       // 文件大小上限
+        uint32_t max_seconds = 0;     // 单文件时长上限
+        uint64_t prealloc_bytes = 0;  // 后台预分配的连续空间
+        uint64_t retention_bytes = 0; // 日志目录总大小上限, 超出删除最旧文件
+        uint64_t min_free_bytes = 0;  // 卡剩余空间下限, 不足删除最旧文件
+    };
+
+    // 落盘时机
+    enum class Durability : uint8_t
+    {
+        EVERY_RECORD, // 每条记录写入并 fsync 后才返回
+        INTERVAL,     // 每隔 sync_interval_ms 写出未满缓冲并 fsync
+        ON_CLOSE,     // 只写满缓冲, 关闭/轮转/flush() 时才 fsync
+    };
+
+    // 异步写入: 调用方只拷贝到内存缓冲, 写入任务负责 write()/fsync()
+    struct AsyncWriteConfig
+    {
+        size_t buffer_size = 16 * 1024; // 单块缓冲大小, 向上取整到扇区
+        Durability durability = Durability::INTERVAL;
+        uint32_t sync_interval_ms = 1000;
+    };
+
+    // 文件格式, 非 PLAIN 时需启用异步写入
+    enum class LogFileFormat : uint8_t
+    {
+        PLAIN,  // 文本, 续写依赖 .idx 索引
+        FRAMED, // 扇区对齐的校验块, 文件名追加 .blk, 掉电后可从文件尾快速恢复
+        LZ4,    // 同 FRAMED, 块内 LZ4 压缩, 文件名追加 .lz4
+    };
+
+    // 拔卡暂存区大小, 优先使用 PSRAM
+    struct SpillConfig
+    {
+        size_t psram_bytes = 1024 * 1024;
+        size_t internal_bytes = 32 * 1024; // 没有 PSRAM 时在内部 RAM 中分配
+    };
+
+    struct WriterStats
+    {
+        uint32_t writes = 0;         // write() 次数
+        uint64_t write_total_us = 0; // write() 累计耗时
+        uint32_t write_max_us = 0;
+        uint32_t syncs = 0; // fsync() 次数
+        uint64_t sync_total_us = 0;
+        uint32_t sync_max_us = 0;
+        uint32_t stalls = 0;        // 两块缓冲都在写, 调用方被阻塞的次数
+        uint32_t errors = 0;        // write() 未写完
+        uint64_t bytes_written = 0; // 已交给文件系统的字节数
+        uint64_t raw_bytes = 0;         // 送入压缩的原始字节数
+        uint64_t compressed_bytes = 0;  // 压缩后写出的字节数(含块头)
+        uint64_t compress_total_us = 0; // 压缩累计耗时
+        uint32_t pending = 0;       // 等待写入的缓冲块数
+        uint32_t buffered = 0;      // 当前缓冲中尚未提交的字节数
+        uint32_t spill_used = 0;          // 暂存区中等待写回卡的字节数
+        uint32_t spill_peak = 0;
+        uint32_t spill_dropped_lines = 0; // 暂存区满或写回失败丢弃的行数
+        uint64_t spill_dropped_bytes = 0;
+    };
+
     class LoggerBase
     {
     public:
@@ -31,10 +108,53 @@ extern "C"
 
         void getFileExtension(const std::string &filename);
 
-        // 记录文本信息
-        void log(const std::string &message);
-        void log(const std::string &message, int max_lines);
+        // 记录文本信息, 换行符由日志器追加, 不拼接临时字符串
+        void log(std::string_view message);
+        void log(std::string_view message, int max_lines);
+
+        // 把若干片段依次写成一行
+        bool logv(const std::string_view *parts, size_t count, int max_lines = 0);
+        bool logv(std::initializer_list<std::string_view> parts, int max_lines = 0)
+        {
+            return logv(parts.begin(), parts.size(), max_lines);
+        }
+
+        // 原地写入: reserve() 返回至少 length 字节的连续空间, 调用方格式化后以实际长度 commit(),
+        // 日志器追加换行. 异步写入时直接指向写入缓冲, 两次调用之间持有缓冲锁, 必须成对且尽快调用.
+        // length 超过单块缓冲或文件不可写时返回 nullptr, 此时不要调用 commit()
+        char *reserve(size_t length, int max_lines = 0);
+        bool commit(size_t length);
+
+        // 设置轮转策略并启动后台任务: 预创建下一个文件、关闭旧文件、执行保留策略.
+        // 轮转后的文件与首个文件同目录, 命名为 <首个文件名>_<序号><后缀>
+        void set_rotation_policy(const RotationPolicy &policy);
+
+        // 启用异步双缓冲写入, 需在 init() 之前调用
+        bool enable_async_writer(const AsyncWriteConfig &config);
+
+        // 把已缓冲的数据写出并 fsync, 超时返回 false
+        bool flush(TickType_t timeout = portMAX_DELAY);
+
+        // 设置文件格式, 下一次 init() 打开的文件生效
+        bool set_file_format(LogFileFormat format);
+        LogFileFormat get_file_format() const;
+
+        // 启用拔卡暂存: 卡不在时记录写入暂存区, 插卡后由后台任务按原顺序写回
+        bool enable_spill(const SpillConfig &config);
+
+        // 存储卡挂载状态变化, 拔卡须在卸载前通知: 关闭文件, 未写出的缓冲转入暂存区.
+        // 未启用暂存时等同于 shutdown(), 插卡后由调用方重新 init()
+        void set_storage_available(bool available);
+        // 签名与 SDCard::PresenceCallback 相同, context 为 LoggerBase*
+        static void storage_listener(bool available, void *context);
 
+        WriterStats get_writer_stats() const;
+
+        // 打印写入统计, 吞吐量为距上次打印的平均值
+        void print_writer_stats();
+
+        // 字符串组按首个分隔符拆成 键/值, 首次使用时把整个文件载入哈希表, 之后查重与查找不再读卡;
+        // 写入时同步追加到文件, 同一个键以文件中最后一行为准; 拔插卡后缓存作废, 卡不在时查不到
         bool is_string_group_exists(const std::vector<std::string> &string_group, const std::string &delimiter = ":");
 
         bool log_string_group(const std::vector<std::string> &string_group, const std::string &delimiter = ":");
@@ -62,10 +182,119 @@ extern "C"
         virtual void close_file();
 
         // 写入文件
-        virtual bool write_to_file(const std::string &message);
+        virtual bool write_to_file(std::string_view message);
+        // 依次写入各片段, newline 时再追加换行; 异步时整组在一次持锁内拷贝, 不会与其他调用交错
+        bool write_parts(const std::string_view *parts, size_t count, bool newline);
+
+        // 从文件 offset 处开始统计行数, 遇到 NUL(预分配未写入区域)停止, data_end 返回有效数据末尾
+        int read_line_count(const std::string &file_path, long offset = 0, long *data_end = nullptr);
+
+        // 续写索引: 与日志文件同名的 .idx 文件, 记录某一时刻的行数与字节偏移,
+        // 重新打开时只需统计该偏移之后的尾部, 索引损坏或超出文件长度时退回全量统计
+        int resume_line_count(const std::string &file_path);
+        // 分块文件恢复: 先二分跳过预分配的全 0 尾部, 再逐扇区向前找最后一个校验通过的块,
+        // 返回其累计行数与下一个序号, data_end 为该块末尾; 没有有效块时返回 false
+        bool recover_blocks(const std::string &file_path, uint32_t &lines, uint32_t &next_sequence, long &data_end);
+        bool load_index(uint32_t &lines, uint32_t &offset);
+        void save_index();
+        static void write_index(const std::string &file_path, int lines, uint32_t bytes);
+        void on_line_written();
+
+        // 打开 _current_file_path, 必要时写文件头
+        bool open_log();
+        bool should_rotate(int max_lines) const;
+        void rotate();
+        std::string rotation_path(int sequence) const;
+
+        enum class WorkerCommandType : uint8_t
+        {
+            PREPARE, // 预创建下一个文件
+            CLOSE,   // 关闭轮转下来的旧文件
+            DISCARD, // 删除未使用的预创建文件
+            FENCE,   // 前面的命令处理完后释放 done
+        };
+
+        struct WorkerCommand
+        {
+            WorkerCommandType type;
+            FILE *file;
+            char path[160];
+            char active_path[160]; // 保留策略不能删除的文件
+            int lines;
+            uint32_t bytes;
+            bool preallocated;
+            uint32_t generation;
+            SemaphoreHandle_t done;
+        };
+
+        void worker_task();
+        bool post_command(WorkerCommandType type, FILE *file, const std::string &path, int lines = 0, uint32_t bytes = 0, bool preallocated = false);
+        // 预创建 rotation_path(_rotation_seq + 1), 计入 _prepares_pending
+        void post_prepare();
+        void prepare_file(const WorkerCommand &command);
+        void close_rotated(FILE *target, const char *path, int lines, uint32_t bytes, bool preallocated);
+        void enforce_retention(const char *active_path, const char *next_path);
+
+        // 作废在途的预创建, 已就绪的交给后台删除
+        void discard_next_file();
+
+        // 当前文件交出去关闭: 异步写入时由写入任务在数据写完后关闭, 否则 background 决定是否交给后台
+        void retire_file(bool background);
+
+        enum class WriterCommandType : uint8_t
+        {
+            WRITE, // 写出一块缓冲
+            SYNC,  // fsync 当前文件, 完成后释放 done
+            INDEX, // 前面的数据写出后再写续写索引
+            CLOSE, // 写完后关闭文件
+            OPEN,  // 切换到新文件, 设置分块序号与累计行数的起点
+            FENCE, // 前面的命令处理完后释放 done
+        };
+
+        struct WriterCommand
+        {
+            WriterCommandType type;
+            FILE *file;
+            int buffer;
+            uint32_t length;
+            SemaphoreHandle_t done;
+            char path[160];
+            int lines;
+            uint32_t bytes;
+            bool preallocated;
+            LogFileFormat format;
+            uint32_t sequence;
+        };
+
+        void writer_task();
+        bool append_async(const std::string_view *parts, size_t count, bool newline);
+        bool fill_buffer(const char *data, size_t length);
+        bool submit_fill_buffer(TickType_t timeout);
+        void post_writer(const WriterCommand &command);
+        void write_buffer(FILE *target, int buffer, uint32_t length, LogFileFormat format);
+        void sync_file(FILE *target);
+        void periodic_sync();
+        void attach_writer_file();
+
+        // init() 的打开部分: 计算路径、续写或新建文件并预创建下一个
+        bool open_named(const std::string &file_name);
 
-        // 从文件中读取行数
-        int read_line_count(const std::string &file_path);
+        enum class StorageState : uint8_t
+        {
+            PRESENT,  // 直接写卡
+            ABSENT,   // 写入暂存区
+            DRAINING, // 后台写回暂存区, 新记录仍追加到暂存区之后
+        };
+
+        // 以下调用方持 _storage_lock
+        bool is_spilling() const;
+        bool spill_line(const std::string_view *parts, size_t count, bool newline);
+        void detach_storage();
+        // 等写入任务与后台任务处理完已提交的命令, 拔卡后不能再有人访问旧文件
+        void wait_workers_idle();
+
+        void drain_task();
+        void drain_spill();
 
     private:
         std::string _mount_full_path;                                         // 挂载点路径
@@ -75,6 +304,103 @@ extern "C"
         int line_count;                                                       // 当前文件的行数
         std::string _current_file_path;                                       // 当前文件完整地址
         std::chrono::time_point<std::chrono::steady_clock> time_file_created; // 文件创建时间
+        uint32_t _file_bytes = 0;                                             // 当前文件字节数
+        int _indexed_lines = 0;                                               // 上次写索引时的行数
+        bool _file_preallocated = false;                                      // 当前文件为预分配, 关闭时截断
+
+        RotationPolicy _policy;
+        std::string _rotation_base; // 首个文件去掉后缀的路径
+        int _rotation_seq = 0;
+
+        // 后台任务与预创建文件, 由 _next_ready 交接: 后台写好后置位, 前台取走后清零
+        QueueHandle_t _worker_queue = nullptr;
+        FILE *_next_file = nullptr;
+        char _next_path[160] = {};
+        bool _next_preallocated = false;
+        std::atomic<bool> _next_ready{false};
+        std::atomic<uint32_t> _generation{0}; // init/shutdown 递增, 作废在途的预创建
+        SemaphoreHandle_t _next_lock = nullptr; // 代数递增与发布预创建文件互斥, 作废不会落在检查与发布之间
+        std::atomic<int> _prepares_pending{0};  // 已投递未处理完的 PREPARE, 期间后台可能正在清零下一个序号的文件
+        bool _rotation_deferred = false;        // 等待后台预创建而推迟了轮转
+
+        bool load_string_groups(const std::string &delimiter);
+        void invalidate_string_groups();
+        bool has_string_group(const std::vector<std::string> &string_group, const std::string &delimiter); // 调用方持有 _storage_lock
+        static std::string join_string_group(const std::vector<std::string> &string_group, const std::string &delimiter);
+
+        std::unordered_map<std::string, std::string> _string_groups;
+        std::string _string_groups_path; // 已载入的文件, 为空或与 _current_file_path 不同时重新载入; 受 _storage_lock 保护
+        std::string _string_groups_delimiter;
+
+        // 异步写入: 调用方填充 _buffers[_fill_index], 写满后交给写入任务并换另一块.
+        // _buffer_free 计数另一块是否空闲, 取不到说明写入任务还没写完
+        bool _async = false;
+        AsyncWriteConfig _async_config;
+        char *_buffers[2] = {};
+        int _fill_index = 0;
+        size_t _fill_used = 0;
+        SemaphoreHandle_t _buffer_lock = nullptr;
+        SemaphoreHandle_t _buffer_free = nullptr;
+        SemaphoreHandle_t _flush_done = nullptr;
+        QueueHandle_t _writer_queue = nullptr;
+        FILE *_writer_file = nullptr; // 写入任务定时 fsync 的目标, 持 _buffer_lock 修改
+        LogFileFormat _writer_format = LogFileFormat::PLAIN; // _writer_file 的格式, 同上
+
+        // 格式: _format_requested 在 init() 时锁存到 _format, 同一文件内不会混用
+        LogBlockEncoder _encoder;
+        LogFileFormat _format_requested = LogFileFormat::PLAIN;
+        LogFileFormat _format = LogFileFormat::PLAIN;
+        uint32_t _resume_sequence = 0; // 续写分块文件时的起点, 由 recover_blocks 得到
+        uint32_t _resume_lines = 0;
+        uint32_t _block_sequence = 0; // 以下两项仅写入任务访问
+        uint32_t _block_lines = 0;
+        // 异步时索引推迟到所含数据随下一块缓冲提交后再写
+        bool _index_pending = false;
+        int _pending_lines = 0;
+        uint32_t _pending_bytes = 0;
+
+        // 卡在位状态与暂存区. 公开的写入/打开/关闭接口持 _storage_lock, reserve() 到 commit() 之间一直持有.
+        // 非 PRESENT 时调用方只访问暂存区, 文件由排空任务独占; 拔卡时先取 _drain_lock 等排空任务让出文件
+        StorageState _storage_state = StorageState::PRESENT;
+        SemaphoreHandle_t _storage_lock = nullptr;
+        SemaphoreHandle_t _drain_lock = nullptr;
+        SemaphoreHandle_t _drain_start = nullptr;
+        SemaphoreHandle_t _fence_done = nullptr;
+        LogSpill _spill;
+        bool _spill_full = false; // 本次拔卡已记录过丢弃事件
+
+        // reserve() 的空间: 异步且直接写卡时在写入缓冲内, 否则为 _reserve_buffer
+        char *_reserved = nullptr;
+        size_t _reserved_length = 0;
+        std::vector<char> _reserve_buffer;
+
+        std::atomic<uint32_t> _stat_writes{0};
+        std::atomic<uint32_t> _stat_write_max_us{0};
+        std::atomic<uint64_t> _stat_write_total_us{0};
+        std::atomic<uint32_t> _stat_syncs{0};
+        std::atomic<uint32_t> _stat_sync_max_us{0};
+        std::atomic<uint64_t> _stat_sync_total_us{0};
+        std::atomic<uint32_t> _stat_stalls{0};
+        std::atomic<uint32_t> _stat_errors{0};
+        std::atomic<uint64_t> _stat_bytes{0};
+        std::atomic<uint64_t> _stat_raw_bytes{0};
+        std::atomic<uint64_t> _stat_compressed_bytes{0};
+        std::atomic<uint64_t> _stat_compress_us{0};
+        uint64_t _last_print_compress_us = 0;
+        uint64_t _synced_bytes = 0; // 上次 fsync 时的 _stat_bytes, 仅写入任务访问
+        uint64_t _last_print_bytes = 0;
+        int64_t _last_print_us = 0;
+
+        static constexpr uint32_t INDEX_MAGIC = 0x31584449;  // "IDX1"
+        static constexpr int INDEX_INTERVAL_LINES = 1000;    // 每写入这么多行更新一次索引
+
+        struct ResumeIndex
+        {
+            uint32_t magic;
+            uint32_t line_count;
+            uint32_t byte_offset;
+            uint32_t crc; // 前三个字段的 CRC32
+        };
     };
 
 #ifdef __cplusplus
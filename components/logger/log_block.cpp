@@ -0,0 +1,309 @@
+#include "log_block.hpp"
+
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+
+static const size_t MIN_MATCH = 4;
+static const size_t LAST_LITERALS = 5; // 块尾必须留作字面量的字节数
+static const size_t MF_LIMIT = 12;     // 距块尾不足此长度不再查找匹配
+static const size_t MAX_DISTANCE = 65535;
+
+LogBlockEncoder::~LogBlockEncoder()
+{
+    heap_caps_free(_table);
+    heap_caps_free(_output);
+}
+
+bool LogBlockEncoder::init(size_t max_raw_length, bool compress)
+{
+    if (!_output)
+    {
+        // 输出直接交给 write(), 与日志缓冲一样使用扇区对齐的 DMA 内存
+        _output = static_cast<uint8_t *>(heap_caps_aligned_alloc(SECTOR_SIZE, block_size(max_raw_length), MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL));
+        if (!_output)
+        {
+            return false;
+        }
+        _max_raw_length = max_raw_length;
+    }
+    else if (max_raw_length > _max_raw_length)
+    {
+        return false;
+    }
+
+    if (compress && !_table)
+    {
+        _table = static_cast<uint32_t *>(heap_caps_malloc(sizeof(uint32_t) << HASH_BITS, MALLOC_CAP_INTERNAL));
+        if (!_table)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t LogBlockEncoder::encode(const uint8_t *data, size_t length, bool compress, uint32_t sequence, uint32_t &line_total)
+{
+    BlockHeader header = {};
+    header.magic = BLOCK_MAGIC;
+    header.sequence = sequence;
+    header.raw_length = length;
+    header.line_total = line_total;
+    for (const uint8_t *p = data; (p = static_cast<const uint8_t *>(memchr(p, '\n', data + length - p))) != nullptr; p++)
+    {
+        header.line_total++;
+    }
+
+    uint8_t *payload = _output + sizeof(BlockHeader);
+    size_t stored = (compress && _table) ? LogBlockEncoder::compress(data, length, payload, length, _table) : 0;
+    if (stored)
+    {
+        header.flags |= FLAG_LZ4;
+    }
+    else
+    {
+        memcpy(payload, data, length);
+        stored = length;
+    }
+    header.stored_length = stored;
+    header.crc = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(&header), offsetof(BlockHeader, crc));
+    header.crc = esp_rom_crc32_le(header.crc, payload, stored);
+    memcpy(_output, &header, sizeof(header));
+
+    // 补齐到整扇区, 下一块从扇区边界开始
+    const size_t total = block_size(stored);
+    memset(payload + stored, 0, total - sizeof(header) - stored);
+
+    line_total = header.line_total;
+    return total;
+}
+
+bool LogBlockEncoder::check_block(const BlockHeader &header, const uint8_t *payload, size_t max_raw_length)
+{
+    if (header.magic != BLOCK_MAGIC || header.raw_length > max_raw_length)
+    {
+        return false;
+    }
+    if ((header.flags & FLAG_LZ4) ? header.stored_length >= header.raw_length : header.stored_length != header.raw_length)
+    {
+        return false;
+    }
+    uint32_t crc = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(&header), offsetof(BlockHeader, crc));
+    crc = esp_rom_crc32_le(crc, payload, header.stored_length);
+    return crc == header.crc;
+}
+
+bool LogBlockEncoder::recover(FILE *file, size_t max_raw_length, uint32_t &lines, uint32_t &next_sequence, long &data_end)
+{
+    lines = 0;
+    next_sequence = 0;
+    data_end = 0;
+
+    if (fseek(file, 0, SEEK_END) != 0)
+    {
+        return false;
+    }
+    const long size = ftell(file);
+    const long sectors = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    const long max_block = block_size(max_raw_length);
+
+    BlockHeader header;
+    auto read_header = [&](long sector)
+    {
+        return fseek(file, sector * SECTOR_SIZE, SEEK_SET) == 0 &&
+               fread(&header, sizeof(header), 1, file) == 1;
+    };
+    auto zero_header = [&]()
+    {
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&header);
+        return std::all_of(bytes, bytes + sizeof(header), [](uint8_t b)
+                           { return b == 0; });
+    };
+
+    // 预分配未写入部分全为 0, 而每个扇区开头不是块头就是块内数据, 不会全 0: 二分找到数据末尾
+    long low = 0, high = sectors;
+    while (low < high)
+    {
+        const long mid = low + (high - low) / 2;
+        if (read_header(mid) && !zero_header())
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    std::vector<uint8_t> payload;
+    auto valid_block = [&](long offset)
+    {
+        if (fseek(file, offset, SEEK_SET) != 0 || fread(&header, sizeof(header), 1, file) != 1 ||
+            header.magic != BLOCK_MAGIC || header.stored_length > max_raw_length ||
+            offset + static_cast<long>(sizeof(header) + header.stored_length) > size)
+        {
+            return false;
+        }
+        payload.resize(header.stored_length);
+        return fread(payload.data(), 1, payload.size(), file) == payload.size() &&
+               check_block(header, payload.data(), max_raw_length);
+    };
+    auto accept = [&](long offset)
+    {
+        lines = header.line_total;
+        next_sequence = header.sequence + 1;
+        data_end = offset + block_size(header.stored_length);
+    };
+
+    // 从数据末尾向前逐扇区找最后一个完整且校验通过的块, 断电撕裂的尾块被跳过.
+    // 只回看两个最大块的范围, 正常情况下几次读取即可完成
+    bool found = false;
+    const long window = 2 * max_block / static_cast<long>(SECTOR_SIZE);
+    for (long sector = low - 1; sector >= 0 && sector >= low - window; sector--)
+    {
+        if (valid_block(sector * SECTOR_SIZE))
+        {
+            accept(sector * SECTOR_SIZE);
+            found = true;
+            break;
+        }
+    }
+
+    // 尾部损坏范围超出窗口: 从头沿块链前进, 保留最长的有效前缀
+    if (!found)
+    {
+        long offset = 0;
+        while (valid_block(offset))
+        {
+            accept(offset);
+            found = true;
+            offset = data_end;
+        }
+    }
+
+    return found;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// 写 LZ4 扩展长度: 255 的若干倍加余数
+static inline uint8_t *write_length(uint8_t *op, size_t length)
+{
+    while (length >= 255)
+    {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = static_cast<uint8_t>(length);
+    return op;
+}
+
+size_t LogBlockEncoder::compress(const uint8_t *src, size_t length, uint8_t *dst, size_t capacity, uint32_t *table)
+{
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *const end = src + length;
+    uint8_t *op = dst;
+    uint8_t *const op_end = dst + capacity;
+
+    if (length > MF_LIMIT)
+    {
+        memset(table, 0, sizeof(uint32_t) << HASH_BITS);
+        const uint8_t *const mf_limit = end - MF_LIMIT;
+        const uint8_t *const match_limit = end - LAST_LITERALS;
+
+        ip++;
+        while (ip < mf_limit)
+        {
+            const uint32_t sequence = read32(ip);
+            const uint32_t hash = (sequence * 2654435761U) >> (32 - HASH_BITS);
+            const uint8_t *ref = src + table[hash];
+            table[hash] = ip - src;
+
+            if (ref >= ip || ip - ref > static_cast<ptrdiff_t>(MAX_DISTANCE) || read32(ref) != sequence)
+            {
+                // 连续未命中时加大步长, 不可压缩数据上快速略过
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            // 向前扩展匹配
+            while (ip > anchor && ref > src && ip[-1] == ref[-1])
+            {
+                ip--;
+                ref--;
+            }
+
+            size_t match = MIN_MATCH;
+            while (ip + match < match_limit && ip[match] == ref[match])
+            {
+                match++;
+            }
+
+            const size_t literals = ip - anchor;
+            // token + 字面量长度扩展 + 字面量 + 偏移 + 匹配长度扩展
+            if (op + 1 + literals / 255 + 1 + literals + 2 + (match - MIN_MATCH) / 255 + 1 > op_end)
+            {
+                return 0;
+            }
+
+            uint8_t *token = op++;
+            *token = static_cast<uint8_t>((literals >= 15 ? 15 : literals) << 4);
+            if (literals >= 15)
+            {
+                op = write_length(op, literals - 15);
+            }
+            memcpy(op, anchor, literals);
+            op += literals;
+
+            const uint16_t offset = static_cast<uint16_t>(ip - ref);
+            *op++ = offset & 0xFF;
+            *op++ = offset >> 8;
+
+            const size_t match_code = match - MIN_MATCH;
+            *token |= static_cast<uint8_t>(match_code >= 15 ? 15 : match_code);
+            if (match_code >= 15)
+            {
+                op = write_length(op, match_code - 15);
+            }
+
+            ip += match;
+            anchor = ip;
+            if (ip < mf_limit)
+            {
+                table[(read32(ip - 2) * 2654435761U) >> (32 - HASH_BITS)] = ip - 2 - src;
+            }
+        }
+    }
+
+    // 剩余部分全部作为字面量
+    const size_t literals = end - anchor;
+    if (op + 1 + literals / 255 + 1 + literals > op_end)
+    {
+        return 0;
+    }
+    *op++ = static_cast<uint8_t>((literals >= 15 ? 15 : literals) << 4);
+    if (literals >= 15)
+    {
+        op = write_length(op, literals - 15);
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+
+    // 没有压缩收益按原样存储
+    if (static_cast<size_t>(op - dst) >= length)
+    {
+        return 0;
+    }
+    return op - dst;
+}
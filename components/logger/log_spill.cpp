@@ -0,0 +1,178 @@
+#include "log_spill.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+
+LogSpill::~LogSpill()
+{
+    heap_caps_free(_data);
+    heap_caps_free(_segments);
+}
+
+bool LogSpill::init(size_t psram_bytes, size_t internal_bytes)
+{
+    if (_data)
+    {
+        return true;
+    }
+
+    _segments = static_cast<Segment *>(heap_caps_malloc(sizeof(Segment) * MAX_SEGMENTS, MALLOC_CAP_8BIT));
+    if (!_segments)
+    {
+        return false;
+    }
+
+    // 只在拔卡期间使用, 不需要 DMA, 放 PSRAM 不占内部 RAM
+    if (psram_bytes)
+    {
+        _data = static_cast<char *>(heap_caps_malloc(psram_bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+        _capacity = psram_bytes;
+        _in_psram = _data != nullptr;
+    }
+    if (!_data && internal_bytes)
+    {
+        _data = static_cast<char *>(heap_caps_malloc(internal_bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+        _capacity = internal_bytes;
+    }
+    if (!_data)
+    {
+        heap_caps_free(_segments);
+        _segments = nullptr;
+        _capacity = 0;
+        return false;
+    }
+    // 起点留出余量, push_front() 向前移动 _tail 不会下溢
+    _head = _tail = POSITION_BASE;
+    return true;
+}
+
+void LogSpill::copy_in(uint64_t position, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        const size_t offset = position % _capacity;
+        const size_t chunk = std::min(length, _capacity - offset);
+        memcpy(_data + offset, data, chunk);
+        position += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+bool LogSpill::push(const std::string_view *parts, size_t count, bool newline)
+{
+    size_t length = newline ? 1 : 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        length += parts[i].size();
+    }
+    if (!_data || length > _capacity - used())
+    {
+        count_drop(1, length);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        copy_in(_head, parts[i].data(), parts[i].size());
+        _head += parts[i].size();
+    }
+    if (newline)
+    {
+        copy_in(_head, "\n", 1);
+        _head++;
+    }
+    _peak = std::max(_peak, used());
+    return true;
+}
+
+bool LogSpill::push_front(const char *data, size_t length)
+{
+    if (!_data || length > _capacity - used())
+    {
+        uint32_t lines = 0;
+        for (const char *p = data; (p = static_cast<const char *>(memchr(p, '\n', data + length - p))) != nullptr; p++)
+        {
+            lines++;
+        }
+        count_drop(lines, length);
+        return false;
+    }
+    _tail -= length;
+    copy_in(_tail, data, length);
+    _peak = std::max(_peak, used());
+    return true;
+}
+
+bool LogSpill::mark(Action action, const char *name)
+{
+    // CLOSE 之后必有 OPEN, 为其留一个位置
+    const size_t needed = action == Action::CLOSE ? 2 : 1;
+    if (!_segments || _segment_count + needed > MAX_SEGMENTS)
+    {
+        return false;
+    }
+    Segment &segment = _segments[(_segment_first + _segment_count) % MAX_SEGMENTS];
+    segment.start = _head;
+    segment.action = action;
+    snprintf(segment.name, sizeof(segment.name), "%s", name);
+    _segment_count++;
+    return true;
+}
+
+bool LogSpill::mark_front(Action action)
+{
+    if (!_segments || _segment_count == MAX_SEGMENTS)
+    {
+        return false;
+    }
+    _segment_first = (_segment_first + MAX_SEGMENTS - 1) % MAX_SEGMENTS;
+    Segment &segment = _segments[_segment_first];
+    segment.start = _tail;
+    segment.action = action;
+    segment.name[0] = '\0';
+    _segment_count++;
+    return true;
+}
+
+bool LogSpill::pop_segment(Segment &segment)
+{
+    if (_segment_count == 0 || _segments[_segment_first].start > _tail)
+    {
+        return false;
+    }
+    segment = _segments[_segment_first];
+    _segment_first = (_segment_first + 1) % MAX_SEGMENTS;
+    _segment_count--;
+    return true;
+}
+
+size_t LogSpill::read(char *buffer, size_t length)
+{
+    uint64_t limit = _head;
+    if (_segment_count > 0)
+    {
+        limit = std::min(limit, _segments[_segment_first].start);
+    }
+    length = std::min<uint64_t>(length, limit - _tail);
+
+    size_t done = 0;
+    while (done < length)
+    {
+        const size_t offset = _tail % _capacity;
+        const size_t chunk = std::min(length - done, _capacity - offset);
+        memcpy(buffer + done, _data + offset, chunk);
+        _tail += chunk;
+        done += chunk;
+    }
+    return done;
+}
+
+void LogSpill::count_drop(uint32_t lines, size_t bytes)
+{
+    _dropped_lines += lines;
+    _dropped_bytes += bytes;
+}
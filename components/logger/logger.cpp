@@ -6,16 +6,38 @@
 #include <sstream>
 #include <cstring>
 #include <cstdio>
+#include <cstddef>
+#include <cinttypes>
 #include <ctime>
+#include <cerrno>
 
+#include <algorithm>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_vfs_fat.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "event_log.hpp"
+
+static const uint32_t StackSize = 1024 * 6;
+static const size_t WORKER_QUEUE_LENGTH = 4;
+static const size_t WRITER_QUEUE_LENGTH = 4;
+static const size_t SECTOR_SIZE = 512;
+static const size_t DRAIN_CHUNK = 4096;
+static const TickType_t FENCE_TIMEOUT = pdMS_TO_TICKS(2000);
+static const char *FORMAT_SUFFIX[] = {"", ".blk", ".lz4"};
+static const char *FORMAT_NAMES[] = {"plain", "framed", "lz4"};
 
 // 构造函数
 LoggerBase::LoggerBase(const std::string &mount_point)
     : _mount_full_path(mount_point), file(nullptr), is_initialized(false), line_count(0)
 {
+    _storage_lock = xSemaphoreCreateMutex();
+    _fence_done = xSemaphoreCreateBinary();
+    _next_lock = xSemaphoreCreateMutex();
 }
 
 // 析构函数
@@ -24,6 +46,10 @@ LoggerBase::~LoggerBase()
     if (file)
     {
         printf("Closing file...\n");
+        if (_async)
+        {
+            flush();
+        }
         close_file();
     }
 }
@@ -49,21 +75,79 @@ void LoggerBase::create_dir_recursive(const std::string &path)
 // 初始化日志文件
 bool LoggerBase::init(const std::string &file_name)
 {
-    _current_file_path = _mount_full_path + "/" + file_name;
+    xSemaphoreTake(_storage_lock, portMAX_DELAY);
+    bool ok = true;
+    if (is_spilling())
+    {
+        // 卡不在: 只记下文件名, 插卡后由排空任务打开, 之后暂存的记录写入该文件.
+        // 标记用完时续写前一个文件, 不丢记录
+        if (!_spill.mark(LogSpill::Action::OPEN, file_name.c_str()))
+        {
+            EVENT_LOG("logger: too many files while storage absent, appending to previous");
+        }
+    }
+    else
+    {
+        ok = open_named(file_name);
+    }
+    if (ok)
+    {
+        is_initialized = true;
+    }
+    xSemaphoreGive(_storage_lock);
+    return ok;
+}
+
+bool LoggerBase::open_named(const std::string &file_name)
+{
+    const std::string plain_path = _mount_full_path + "/" + file_name;
+    _format = _async ? _format_requested : LogFileFormat::PLAIN;
+    _current_file_path = plain_path + FORMAT_SUFFIX[static_cast<int>(_format)];
 
-    create_dir_recursive(_current_file_path);
+    getFileExtension(plain_path);
 
-    getFileExtension(_current_file_path);
+    _rotation_base = plain_path.substr(0, plain_path.size() - _file_extention.size());
+    _rotation_seq = 0;
+    // 同名日志之前已轮转过: 续写最后一个文件, 预创建不能覆盖已有序号
+    while (access(rotation_path(_rotation_seq + 1).c_str(), F_OK) == 0)
+    {
+        _rotation_seq++;
+    }
+    if (_rotation_seq > 0)
+    {
+        _current_file_path = rotation_path(_rotation_seq);
+    }
+    discard_next_file();
+
+    if (!open_log())
+    {
+        return false;
+    }
+
+    if (_worker_queue)
+    {
+        post_prepare();
+    }
+    return true;
+}
+
+bool LoggerBase::open_log()
+{
+    create_dir_recursive(_current_file_path);
 
     ESP_LOGI(TAG, "filepath:=%s", _current_file_path.c_str());
 
     // 读取当前文件的行数
-    line_count = read_line_count(_current_file_path);
+    line_count = resume_line_count(_current_file_path);
+    _indexed_lines = line_count;
+    _file_preallocated = false;
+    time_file_created = std::chrono::steady_clock::now();
 
     if (!open_file(_current_file_path))
     {
         return false;
     }
+    attach_writer_file();
 
     // 生成并写入文件头
     // 如果文件是新创建的，写入文件头
@@ -86,8 +170,8 @@ bool LoggerBase::init(const std::string &file_name)
             return false;
         }
         line_count++; // 文件头算作一行
+        save_index();
     }
-    is_initialized = true;
     ESP_LOGI(TAG, "Logger initialized successfully! Initial line count: %d\n", line_count);
     return true;
 }
@@ -141,166 +225,381 @@ void LoggerBase::getFileExtension(const std::string &filename)
 }
 
 // 记录文本信息
-void LoggerBase::log(const std::string &message)
+void LoggerBase::log(std::string_view message)
 {
-    if (!is_initialized || !file)
+    xSemaphoreTake(_storage_lock, portMAX_DELAY);
+    // 每条记录都会走到这里, 错误只写事件日志, 不在调用处格式化
+    if (!is_initialized || (!is_spilling() && !file))
     {
-        ESP_LOGE(TAG, "ERROR");
-        return;
+        EVENT_LOG("logger: log while not initialized");
+    }
+    else if (is_spilling())
+    {
+        spill_line(&message, 1, true);
     }
+    else if (false == write_parts(&message, 1, true))
+    {
+        EVENT_LOG("logger: write failed, errno %d", errno);
+    }
+    xSemaphoreGive(_storage_lock);
+}
+
+void LoggerBase::log(std::string_view message, int max_lines)
+{
+    logv(&message, 1, max_lines);
+}
 
-    if (false == write_to_file(message + "\n"))
+bool LoggerBase::logv(const std::string_view *parts, size_t count, int max_lines)
+{
+    xSemaphoreTake(_storage_lock, portMAX_DELAY);
+    bool ok = false;
+    if (!is_initialized || (!is_spilling() && !file))
+    {
+        EVENT_LOG("logger: log while not initialized");
+    }
+    else if (is_spilling())
+    {
+        // 暂存期间不轮转, 写回后由下一条记录判断
+        ok = spill_line(parts, count, true);
+    }
+    else
     {
-        ESP_LOGE(TAG, "CANT WRITE TO FILE!");
+        // 检查行数/大小/时长，如果达到阈值则切换到新文件
+        if (should_rotate(max_lines))
+        {
+            rotate();
+        }
+
+        // 写入日志
+        if (!is_initialized || !file)
+        {
+            ok = false;
+        }
+        else if (!write_parts(parts, count, true))
+        {
+            EVENT_LOG("logger: write failed at line %d, errno %d", line_count, errno);
+        }
+        else
+        {
+            on_line_written(); // 更新行数
+            ok = true;
+        }
     }
+    xSemaphoreGive(_storage_lock);
+    return ok;
 }
 
-void LoggerBase::log(const std::string &message, int max_lines)
+char *LoggerBase::reserve(size_t length, int max_lines)
 {
-    if (!is_initialized || !file)
+    xSemaphoreTake(_storage_lock, portMAX_DELAY);
+    if (!is_initialized || (!is_spilling() && !file))
     {
-        ESP_LOGE(TAG, "Logger not initialized or file not open!\n");
-        return;
+        xSemaphoreGive(_storage_lock);
+        EVENT_LOG("logger: log while not initialized");
+        return nullptr;
+    }
+
+    if (!is_spilling() && should_rotate(max_lines))
+    {
+        rotate();
+        if (!is_initialized || !file)
+        {
+            xSemaphoreGive(_storage_lock);
+            return nullptr;
+        }
     }
 
-    // 检查行数，如果达到阈值则创建新文件
-    if (line_count >= max_lines)
+    // 同步写入或暂存期间格式化到 _reserve_buffer, commit() 时再拷贝
+    const size_t needed = length + 1; // 含换行
+    if (!_async || is_spilling())
     {
-        ESP_LOGE(TAG, "Reached max lines (%d). Creating new file...", max_lines);
-        shutdown();
-        const size_t bufferSize = 64;
-        char buffer[bufferSize];
-        std::time_t now = std::time(nullptr);
-        std::strftime(buffer, bufferSize, "%Y_%m_%d-%H_%M_%S", std::localtime(&now));
-        std::string new_file_name = std::string(buffer) + _file_extention;
-        init(new_file_name);
+        if (_reserve_buffer.size() < needed)
+        {
+            _reserve_buffer.resize(needed);
+        }
+        _reserved = _reserve_buffer.data();
+        _reserved_length = length;
+        return _reserved;
+    }
+
+    if (needed > _async_config.buffer_size)
+    {
+        xSemaphoreGive(_storage_lock);
+        EVENT_LOG("logger: reserve %u exceeds write buffer", static_cast<unsigned>(length));
+        return nullptr;
+    }
+
+    // 当前块剩余空间不足时先提交, 预留区必须连续; 锁一直持有到 commit()
+    xSemaphoreTake(_buffer_lock, portMAX_DELAY);
+    if (_async_config.buffer_size - _fill_used < needed)
+    {
+        submit_fill_buffer(portMAX_DELAY);
+        if (_async_config.buffer_size - _fill_used < needed)
+        {
+            xSemaphoreGive(_buffer_lock);
+            xSemaphoreGive(_storage_lock);
+            EVENT_LOG("logger: reserve failed, no free buffer");
+            return nullptr;
+        }
+    }
+    _reserved = _buffers[_fill_index] + _fill_used;
+    _reserved_length = length;
+    return _reserved;
+}
+
+bool LoggerBase::commit(size_t length)
+{
+    if (_reserved == nullptr)
+    {
+        return false;
     }
+    length = std::min(length, _reserved_length);
+    _reserved[length] = '\n';
+    _reserved = nullptr;
 
-    // 写入日志
-    if (write_to_file(message + "\n"))
+    bool ok;
+    if (is_spilling())
     {
-        line_count++; // 更新行数
-        // ESP_LOGE(TAG, "Message written to file: %s", message.c_str());
+        const std::string_view line(_reserve_buffer.data(), length + 1);
+        ok = spill_line(&line, 1, false);
+        xSemaphoreGive(_storage_lock);
+        return ok;
+    }
+
+    if (_async)
+    {
+        _fill_used += length + 1;
+        ok = _fill_used < _async_config.buffer_size || submit_fill_buffer(portMAX_DELAY);
+        xSemaphoreGive(_buffer_lock);
+        _file_bytes += length + 1;
+        if (ok && _async_config.durability == Durability::EVERY_RECORD)
+        {
+            ok = flush();
+        }
+    }
+    else
+    {
+        const std::string_view line(_reserve_buffer.data(), length + 1);
+        ok = write_parts(&line, 1, false);
+    }
+
+    if (!ok)
+    {
+        EVENT_LOG("logger: write failed at line %d, errno %d", line_count, errno);
     }
     else
     {
-        ESP_LOGE(TAG, "Failed to write message to file!");
+        on_line_written();
     }
+    xSemaphoreGive(_storage_lock);
+    return ok;
 }
 
-bool LoggerBase::is_string_group_exists(const std::vector<std::string> &string_group, const std::string &delimiter)
+std::string LoggerBase::join_string_group(const std::vector<std::string> &string_group, const std::string &delimiter)
 {
-    std::string target_line;
+    std::string line;
     for (size_t i = 0; i < string_group.size(); i++)
     {
-        target_line += string_group[i];
+        line += string_group[i];
         if (i < string_group.size() - 1)
         {
-            target_line += delimiter;
+            line += delimiter;
         }
     }
+    line.erase(line.find_last_not_of("\n") + 1);
+    return line;
+}
+
+// 调用方持有 _storage_lock; 只有卡在位且完整读过文件才算载入, 否则下次重新读取
+bool LoggerBase::load_string_groups(const std::string &delimiter)
+{
+    if (!_string_groups_path.empty() && _string_groups_path == _current_file_path && _string_groups_delimiter == delimiter)
+    {
+        return true;
+    }
 
-    target_line.erase(target_line.find_last_not_of("\n") + 1);
+    invalidate_string_groups();
+    if (is_spilling() || !file)
+    {
+        // 卡不在或暂存区尚未写回, 文件内容不完整
+        return false;
+    }
 
     FILE *temp_file = fopen(_current_file_path.c_str(), "r");
     if (!temp_file)
     {
-        printf("Failed to open file for reading.\n");
+        ESP_LOGE(TAG, "Failed to open file for reading.");
         return false;
     }
-
     char buffer[256];
     while (fgets(buffer, sizeof(buffer), temp_file))
     {
         std::string line(buffer);
-        line.erase(line.find_last_not_of("\n") + 1); // 去掉换行符
-        if (line == target_line)
+        line.erase(line.find_last_not_of("\r\n") + 1);
+
+        // 跳过文件头
+        if (line.rfind("File Created At:", 0) == 0 || line.find_first_not_of('-') == std::string::npos)
+        {
+            continue;
+        }
+        const size_t pos = line.find(delimiter);
+        if (pos == std::string::npos || pos == 0)
         {
-            fclose(temp_file);
-            return true;
+            continue;
         }
+        _string_groups.insert_or_assign(line.substr(0, pos), line.substr(pos + delimiter.size()));
     }
-
+    const bool read_error = ferror(temp_file);
     fclose(temp_file);
-    return false;
+    if (read_error)
+    {
+        ESP_LOGE(TAG, "Failed to read string groups from %s", _current_file_path.c_str());
+        _string_groups.clear();
+        return false;
+    }
+
+    _string_groups_path = _current_file_path;
+    _string_groups_delimiter = delimiter;
+    ESP_LOGI(TAG, "Loaded %zu string groups from %s", _string_groups.size(), _current_file_path.c_str());
+    return true;
+}
+
+void LoggerBase::invalidate_string_groups()
+{
+    _string_groups.clear();
+    _string_groups_path.clear();
+}
+
+bool LoggerBase::is_string_group_exists(const std::vector<std::string> &string_group, const std::string &delimiter)
+{
+    xSemaphoreTake(_storage_lock, portMAX_DELAY);
+    const bool exists = has_string_group(string_group, delimiter);
+    xSemaphoreGive(_storage_lock);
+    return exists;
+}
+
+bool LoggerBase::has_string_group(const std::vector<std::string> &string_group, const std::string &delimiter)
+{
+    if (!load_string_groups(delimiter))
+    {
+        return false;
+    }
+
+    const std::string target_line = join_string_group(string_group, delimiter);
+    const size_t pos = target_line.find(delimiter);
+    if (pos == std::string::npos)
+    {
+        return false;
+    }
+    auto it = _string_groups.find(target_line.substr(0, pos));
+    return it != _string_groups.end() && it->second == target_line.substr(pos + delimiter.size());
 }
 
 bool LoggerBase::log_string_group(const std::vector<std::string> &string_group, const std::string &delimiter)
 {
-    if (!is_initialized || !file)
+    xSemaphoreTake(_storage_lock, portMAX_DELAY);
+    if (!is_initialized || (!is_spilling() && !file))
     {
+        xSemaphoreGive(_storage_lock);
         ESP_LOGE(TAG, "Logger not initialized or file not open!");
         return false;
     }
 
-    // 检查字符串组是否已存在
-    if (is_string_group_exists(string_group, delimiter))
+    // 检查字符串组是否已存在, 卡不在时无法读取文件, 不查重
+    if (!is_spilling() && has_string_group(string_group, delimiter))
     {
+        xSemaphoreGive(_storage_lock);
         ESP_LOGE(TAG, "String group already exists. Skipping write.");
         return false;
     }
 
     // 将字符串组拼接为一行
-    std::string line;
-    for (size_t i = 0; i < string_group.size(); i++)
+    const std::string line = join_string_group(string_group, delimiter);
+
+    // 写入文件, 卡不在时进入暂存区
+    const std::string_view line_view(line);
+    bool ok;
+    if (is_spilling())
     {
-        line += string_group[i];
-        if (i < string_group.size() - 1)
+        ok = spill_line(&line_view, 1, true);
+    }
+    else if ((ok = write_parts(&line_view, 1, true)))
+    {
+        on_line_written(); // 更新行数
+        const size_t pos = line.find(delimiter);
+        if (pos != std::string::npos && pos > 0 && _string_groups_path == _current_file_path)
         {
-            line += delimiter;
+            _string_groups.insert_or_assign(line.substr(0, pos), line.substr(pos + delimiter.size()));
         }
     }
+    xSemaphoreGive(_storage_lock);
 
-    // 写入文件
-    if (write_to_file(line + "\n"))
+    if (ok)
     {
-        line_count++; // 更新行数
         ESP_LOGI(TAG, "String group written to file: %s", line.c_str());
-        return true;
     }
     else
     {
         ESP_LOGE(TAG, "Failed to write string group to file!");
-        return false;
     }
+    return ok;
 }
 
 std::string LoggerBase::find_string_group_key(const std::string &key_string, const std::string &delimiter)
 {
-    FILE *temp_file = fopen(_current_file_path.c_str(), "r");
-    if (!temp_file)
+    xSemaphoreTake(_storage_lock, portMAX_DELAY);
+    if (!load_string_groups(delimiter))
     {
-        ESP_LOGE(TAG, "Failed to open file for reading.");
+        xSemaphoreGive(_storage_lock);
         return "";
     }
 
-    char buffer[256];
-    while (fgets(buffer, sizeof(buffer), temp_file))
+    auto it = _string_groups.find(key_string);
+    const bool found = it != _string_groups.end();
+    const std::string value = found ? it->second : std::string();
+    xSemaphoreGive(_storage_lock);
+
+    if (!found)
     {
-        std::string line(buffer);
-        if (std::string::npos != line.find(key_string))
-        {
-            size_t dotPos = line.find_last_of(delimiter);
-            ESP_LOGE(TAG, "Find Match SSID:=%s KEY:=%s", key_string.c_str(), line.substr(dotPos + 1).c_str());
-            fclose(temp_file);
-            return line.substr(dotPos + 1);
-        }
+        ESP_LOGE(TAG, "Not Find Match SSID:=%s", key_string.c_str());
+        return "";
     }
-
-    ESP_LOGE(TAG, "Not Find Match SSID:=%s", key_string.c_str());
-    fclose(temp_file);
-    return "";
+    ESP_LOGI(TAG, "Find Match SSID:=%s", key_string.c_str());
+    return value;
 }
 
 void LoggerBase::shutdown()
 {
-    if (is_initialized)
+    xSemaphoreTake(_storage_lock, portMAX_DELAY);
+    if (is_initialized && is_spilling())
     {
-        close_file();
+        // 卡不在: 记下关闭位置, 排空任务写完之前的记录后关闭文件
+        _spill.mark(LogSpill::Action::CLOSE);
+        is_initialized = false;
+        ESP_LOGI(TAG, "Logger shutdown while storage absent.");
+    }
+    else if (is_initialized)
+    {
+        discard_next_file();
+        retire_file(false);
         is_initialized = false; // 标记为未初始化
         line_count = 0;         // 重置行数
         ESP_LOGI(TAG, "Logger shutdown successfully.");
     }
+    xSemaphoreGive(_storage_lock);
+}
+
+// 作废在途的预创建, 已就绪的交给后台删除
+void LoggerBase::discard_next_file()
+{
+    xSemaphoreTake(_next_lock, portMAX_DELAY);
+    _generation++;
+    if (_next_ready.load(std::memory_order_acquire))
+    {
+        _next_ready.store(false, std::memory_order_relaxed);
+        post_command(WorkerCommandType::DISCARD, _next_file, _next_path);
+    }
+    xSemaphoreGive(_next_lock);
 }
 
 int LoggerBase::get_line_count() const
@@ -336,23 +635,58 @@ void LoggerBase::close_file()
 {
     if (file)
     {
+        if (_file_preallocated)
+        {
+            // 去掉预分配但未写入的部分, 分块文件以实际写出位置为准
+            fflush(file);
+            ftruncate(fileno(file), _format != LogFileFormat::PLAIN ? lseek(fileno(file), 0, SEEK_CUR) : static_cast<off_t>(_file_bytes));
+        }
         fclose(file);
         file = nullptr;
     }
 }
 
 // 写入文件
-bool LoggerBase::write_to_file(const std::string &message)
+bool LoggerBase::write_to_file(std::string_view message)
+{
+    return write_parts(&message, 1, false);
+}
+
+bool LoggerBase::write_parts(const std::string_view *parts, size_t count, bool newline)
 {
-    if (fprintf(file, "%s", message.c_str()) < 0)
+    size_t length = newline ? 1 : 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        length += parts[i].size();
+    }
+
+    if (_async)
+    {
+        if (!append_async(parts, count, newline))
+        {
+            return false;
+        }
+        _file_bytes += length;
+        return _async_config.durability != Durability::EVERY_RECORD || flush();
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (fwrite(parts[i].data(), 1, parts[i].size(), file) != parts[i].size())
+        {
+            return false;
+        }
+    }
+    if (newline && fputc('\n', file) == EOF)
     {
         return false;
     }
     fflush(file); // 确保数据写入文件
+    _file_bytes += length;
     return true;
 }
 
-int LoggerBase::read_line_count(const std::string &file_path)
+int LoggerBase::read_line_count(const std::string &file_path, long offset, long *data_end)
 {
     FILE *temp_file = fopen(file_path.c_str(), "r");
     if (!temp_file)
@@ -360,15 +694,1238 @@ int LoggerBase::read_line_count(const std::string &file_path)
         ESP_LOGE(TAG, "File does not exist or cannot be opened. Starting with line count 0.");
         return 0;
     }
+    fseek(temp_file, offset, SEEK_SET);
 
     int count = 0;
-    char buffer[256];
-    while (fgets(buffer, sizeof(buffer), temp_file))
+    long end = offset;
+    char buffer[512];
+    size_t bytes;
+    while ((bytes = fread(buffer, 1, sizeof(buffer), temp_file)) > 0)
     {
-        count++;
+        // 预分配文件未写入的部分为 0
+        const char *nul = static_cast<const char *>(memchr(buffer, '\0', bytes));
+        const size_t valid = nul ? static_cast<size_t>(nul - buffer) : bytes;
+        for (const char *p = buffer; (p = static_cast<const char *>(memchr(p, '\n', buffer + valid - p))) != nullptr; p++)
+        {
+            count++;
+        }
+        end += valid;
+        if (nul)
+        {
+            break;
+        }
     }
 
     fclose(temp_file);
-    ESP_LOGI(TAG, "Read line count from file: %d", count);
+    if (data_end)
+    {
+        *data_end = end;
+    }
     return count;
 }
+
+int LoggerBase::resume_line_count(const std::string &file_path)
+{
+    struct stat st;
+    if (stat(file_path.c_str(), &st) != 0)
+    {
+        remove((file_path + ".idx").c_str()); // 残留的旧索引
+        _file_bytes = 0;
+        _resume_sequence = 0;
+        _resume_lines = 0;
+        return 0;
+    }
+
+    if (_format != LogFileFormat::PLAIN)
+    {
+        // 分块文件没有续写索引, 最后一个有效块的块头带有累计行数
+        uint32_t lines = 0, next_sequence = 0;
+        long data_end = 0;
+        recover_blocks(file_path, lines, next_sequence, data_end);
+        _file_bytes = 0; // 只用于本次写入的轮转判断
+        _resume_sequence = next_sequence;
+        _resume_lines = lines;
+        if (data_end < st.st_size)
+        {
+            ESP_LOGW(TAG, "Truncate %s to %ld bytes", file_path.c_str(), data_end);
+            truncate(file_path.c_str(), data_end);
+        }
+        else if (data_end > st.st_size)
+        {
+            // 末块数据完整但补齐被截断, 补 0 使下一块仍从扇区边界开始
+            static const char zeros[LogBlockEncoder::SECTOR_SIZE] = {};
+            FILE *pad_file = fopen(file_path.c_str(), "ab");
+            if (pad_file)
+            {
+                fwrite(zeros, 1, data_end - st.st_size, pad_file);
+                fclose(pad_file);
+            }
+        }
+        ESP_LOGI(TAG, "Recovered %" PRIu32 " blocks, %" PRIu32 " lines", next_sequence, lines);
+        return lines;
+    }
+
+    uint32_t lines = 0, offset = 0;
+    if (!load_index(lines, offset) || offset > static_cast<uint32_t>(st.st_size))
+    {
+        // 索引缺失/损坏, 或掉电后文件比索引短: 全量统计
+        ESP_LOGW(TAG, "No valid index, rescanning %s", file_path.c_str());
+        lines = 0;
+        offset = 0;
+    }
+
+    long data_end = 0;
+    const int tail = read_line_count(file_path, offset, &data_end);
+    _file_bytes = data_end;
+    if (data_end < st.st_size)
+    {
+        // 掉电前未关闭的预分配文件, 截掉未写入部分后再追加
+        ESP_LOGW(TAG, "Truncate %s to %ld bytes", file_path.c_str(), data_end);
+        truncate(file_path.c_str(), data_end);
+    }
+    ESP_LOGI(TAG, "Resume line count %" PRIu32 " + %d (tail from byte %" PRIu32 ")", lines, tail, offset);
+    return lines + tail;
+}
+
+bool LoggerBase::load_index(uint32_t &lines, uint32_t &offset)
+{
+    FILE *index_file = fopen((_current_file_path + ".idx").c_str(), "rb");
+    if (!index_file)
+    {
+        return false;
+    }
+
+    ResumeIndex index;
+    const bool read_ok = fread(&index, sizeof(index), 1, index_file) == 1;
+    fclose(index_file);
+
+    if (!read_ok || index.magic != INDEX_MAGIC ||
+        index.crc != esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(&index), offsetof(ResumeIndex, crc)))
+    {
+        return false;
+    }
+    lines = index.line_count;
+    offset = index.byte_offset;
+    return true;
+}
+
+// 同步写入时日志内容已 fflush, 索引记录的偏移不会超过已写出的数据;
+// 异步写入时先挂起, 等包含这些数据的缓冲提交给写入任务后再由其写索引
+void LoggerBase::save_index()
+{
+    if (_format != LogFileFormat::PLAIN)
+    {
+        return;
+    }
+    if (_async)
+    {
+        _index_pending = true;
+        _pending_lines = line_count;
+        _pending_bytes = _file_bytes;
+        _indexed_lines = line_count;
+        return;
+    }
+    write_index(_current_file_path, line_count, _file_bytes);
+    _indexed_lines = line_count;
+}
+
+void LoggerBase::write_index(const std::string &file_path, int lines, uint32_t bytes)
+{
+    ResumeIndex index;
+    index.magic = INDEX_MAGIC;
+    index.line_count = lines;
+    index.byte_offset = bytes;
+    index.crc = esp_rom_crc32_le(0, reinterpret_cast<const uint8_t *>(&index), offsetof(ResumeIndex, crc));
+
+    FILE *index_file = fopen((file_path + ".idx").c_str(), "wb");
+    if (!index_file)
+    {
+        ESP_LOGE("Logger", "Failed to write index for %s", file_path.c_str());
+        return;
+    }
+    fwrite(&index, sizeof(index), 1, index_file);
+    fclose(index_file);
+}
+
+void LoggerBase::on_line_written()
+{
+    line_count++;
+    if (line_count - _indexed_lines >= INDEX_INTERVAL_LINES)
+    {
+        save_index();
+    }
+}
+
+void LoggerBase::set_rotation_policy(const RotationPolicy &policy)
+{
+    _policy = policy;
+    if (_worker_queue)
+    {
+        return;
+    }
+
+    _worker_queue = xQueueCreate(WORKER_QUEUE_LENGTH, sizeof(WorkerCommand));
+    auto task_func = [](void *arg)
+    {
+        LoggerBase *instance = static_cast<LoggerBase *>(arg);
+        instance->worker_task();
+    };
+    xTaskCreatePinnedToCore(task_func, "log_worker", StackSize, this, 1, nullptr, tskNO_AFFINITY);
+
+    if (is_initialized)
+    {
+        post_prepare();
+    }
+}
+
+bool LoggerBase::should_rotate(int max_lines) const
+{
+    if (max_lines > 0 && line_count >= max_lines)
+    {
+        return true;
+    }
+    if (_policy.max_lines && line_count >= static_cast<int>(_policy.max_lines))
+    {
+        return true;
+    }
+    if (_policy.max_bytes && _file_bytes >= _policy.max_bytes)
+    {
+        return true;
+    }
+    if (_policy.max_seconds &&
+        std::chrono::steady_clock::now() - time_file_created >= std::chrono::seconds(_policy.max_seconds))
+    {
+        return true;
+    }
+    return false;
+}
+
+std::string LoggerBase::rotation_path(int sequence) const
+{
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "_%03d", sequence);
+    return _rotation_base + suffix + _file_extention + FORMAT_SUFFIX[static_cast<int>(_format)];
+}
+
+// 后台已备好下一个文件时只交换文件指针, 旧文件的截断/关闭/索引交给后台
+void LoggerBase::rotate()
+{
+    if (!_next_ready.load(std::memory_order_acquire) && _prepares_pending.load() > 0)
+    {
+        // 后台正在预创建同一序号的文件(保留策略, 整块清零), 此时内联打开会被它覆盖.
+        // 继续写当前文件, 预分配文件写过头只是变长, 下次写入时再检查
+        if (!_rotation_deferred)
+        {
+            EVENT_LOG("logger: next file not ready, rotation deferred");
+            _rotation_deferred = true;
+        }
+        return;
+    }
+    _rotation_deferred = false;
+
+    if (!_next_ready.load(std::memory_order_acquire))
+    {
+        // 没有在途的预创建(投递失败或预创建失败), 作废后以下一个序号直接打开
+        EVENT_LOG("logger: next file not ready, rotating inline");
+        discard_next_file();
+        retire_file(false);
+        _current_file_path = rotation_path(++_rotation_seq);
+        is_initialized = open_log();
+    }
+    else
+    {
+        retire_file(true);
+
+        file = _next_file;
+        _current_file_path = _next_path;
+        _file_preallocated = _next_preallocated;
+        _next_ready.store(false, std::memory_order_relaxed);
+        _rotation_seq++;
+        _resume_sequence = 0;
+        _resume_lines = 0;
+        attach_writer_file();
+
+        line_count = 0;
+        _indexed_lines = 0;
+        _file_bytes = 0;
+        time_file_created = std::chrono::steady_clock::now();
+
+        const std::string header = (_file_extention == ".asc") ? generate_file_header_asc() : generate_file_header();
+        if (write_to_file(header))
+        {
+            line_count++; // 文件头算作一行
+        }
+    }
+
+    ESP_LOGI(TAG, "Rotated to %s", _current_file_path.c_str());
+    if (_worker_queue && is_initialized)
+    {
+        post_prepare();
+    }
+}
+
+// 先计数再投递, 后台处理完递减, 投递失败时撤回
+void LoggerBase::post_prepare()
+{
+    _prepares_pending++;
+    if (!post_command(WorkerCommandType::PREPARE, nullptr, rotation_path(_rotation_seq + 1), 0, 0, _format != LogFileFormat::LZ4))
+    {
+        _prepares_pending--;
+    }
+}
+
+bool LoggerBase::post_command(WorkerCommandType type, FILE *file_handle, const std::string &path, int lines, uint32_t bytes, bool preallocated)
+{
+    WorkerCommand command = {};
+    command.type = type;
+    command.file = file_handle;
+    snprintf(command.path, sizeof(command.path), "%s", path.c_str());
+    snprintf(command.active_path, sizeof(command.active_path), "%s", _current_file_path.c_str());
+    command.lines = lines;
+    command.bytes = bytes;
+    command.preallocated = preallocated;
+    command.generation = _generation.load(std::memory_order_relaxed);
+
+    // CLOSE 必须送达, 否则文件句柄泄漏
+    return xQueueSend(_worker_queue, &command, type == WorkerCommandType::CLOSE ? portMAX_DELAY : 0) == pdTRUE;
+}
+
+void LoggerBase::worker_task()
+{
+    WorkerCommand command;
+    while (true)
+    {
+        if (xQueueReceive(_worker_queue, &command, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
+
+        switch (command.type)
+        {
+        case WorkerCommandType::PREPARE:
+            prepare_file(command);
+            _prepares_pending--;
+            break;
+        case WorkerCommandType::CLOSE:
+            close_rotated(command.file, command.path, command.lines, command.bytes, command.preallocated);
+            break;
+        case WorkerCommandType::DISCARD:
+            fclose(command.file);
+            remove(command.path);
+            break;
+        case WorkerCommandType::FENCE:
+            xSemaphoreGive(command.done);
+            break;
+        }
+    }
+}
+
+void LoggerBase::prepare_file(const WorkerCommand &command)
+{
+    if (_next_ready.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    // 先腾出空间再分配
+    enforce_retention(command.active_path, command.path);
+
+    create_dir_recursive(command.path);
+
+    bool preallocated = false;
+    FILE *next = nullptr;
+    // 压缩文件写入量小, 不值得整块清零, command.preallocated 为 false 时跳过预分配
+    if (_policy.prealloc_bytes && command.preallocated)
+    {
+        // 连续簇分配后清零, 未写入部分以 NUL 结尾, 掉电后可据此找到数据末尾
+        const std::string base_path = _mount_full_path.substr(0, _mount_full_path.find('/', 1));
+        if (esp_vfs_fat_create_contiguous_file(base_path.c_str(), command.path, _policy.prealloc_bytes, true) == ESP_OK)
+        {
+            next = fopen(command.path, "r+");
+        }
+        if (next)
+        {
+            static const char zeros[4096] = {};
+            for (uint64_t written = 0; written < _policy.prealloc_bytes; written += sizeof(zeros))
+            {
+                const size_t chunk = std::min<uint64_t>(sizeof(zeros), _policy.prealloc_bytes - written);
+                if (fwrite(zeros, 1, chunk, next) != chunk)
+                {
+                    // 卡已拔出或写满, 不再逐块等待超时
+                    fclose(next);
+                    next = nullptr;
+                    break;
+                }
+            }
+        }
+        if (next)
+        {
+            fflush(next);
+            fseek(next, 0, SEEK_SET);
+            preallocated = true;
+        }
+        else
+        {
+            ESP_LOGW(TAG, "Preallocate %s failed, fall back to plain file", command.path);
+        }
+    }
+    if (!next)
+    {
+        next = fopen(command.path, "w");
+    }
+    if (!next)
+    {
+        ESP_LOGE(TAG, "Failed to precreate %s", command.path);
+        return;
+    }
+
+    // 准备期间已 shutdown 或重新 init, 该文件作废; 检查与发布在锁内, discard_next_file 要么在此之前
+    // 递增代数, 要么在此之后看到 _next_ready 并交回删除
+    xSemaphoreTake(_next_lock, portMAX_DELAY);
+    const bool current = command.generation == _generation.load(std::memory_order_acquire);
+    if (current)
+    {
+        _next_file = next;
+        snprintf(_next_path, sizeof(_next_path), "%s", command.path);
+        _next_preallocated = preallocated;
+        _next_ready.store(true, std::memory_order_release);
+    }
+    xSemaphoreGive(_next_lock);
+
+    if (!current)
+    {
+        fclose(next);
+        remove(command.path);
+    }
+}
+
+void LoggerBase::close_rotated(FILE *target, const char *path, int lines, uint32_t bytes, bool preallocated)
+{
+    if (preallocated)
+    {
+        fflush(target);
+        ftruncate(fileno(target), bytes);
+    }
+    fclose(target);
+    write_index(path, lines, bytes);
+}
+
+// 按修改时间从旧到新删除, 直到目录总量和卡剩余空间都满足策略
+void LoggerBase::enforce_retention(const char *active_path, const char *next_path)
+{
+    if (!_policy.retention_bytes && !_policy.min_free_bytes)
+    {
+        return;
+    }
+
+    struct Entry
+    {
+        std::filesystem::path path;
+        uint64_t size;
+        time_t mtime;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+
+    std::error_code ec;
+    for (auto it = std::filesystem::recursive_directory_iterator(_mount_full_path, ec);
+         !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+    {
+        if (!it->is_regular_file(ec) || it->path().extension() == ".idx")
+        {
+            continue;
+        }
+        struct stat st;
+        if (stat(it->path().c_str(), &st) != 0)
+        {
+            continue;
+        }
+        entries.push_back({it->path(), static_cast<uint64_t>(st.st_size), st.st_mtime});
+        total += st.st_size;
+    }
+
+    uint64_t free_bytes = UINT64_MAX;
+    if (_policy.min_free_bytes)
+    {
+        uint64_t total_bytes;
+        const std::string base_path = _mount_full_path.substr(0, _mount_full_path.find('/', 1));
+        if (esp_vfs_fat_info(base_path.c_str(), &total_bytes, &free_bytes) != ESP_OK)
+        {
+            free_bytes = UINT64_MAX;
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)
+              { return a.mtime != b.mtime ? a.mtime < b.mtime : a.path < b.path; });
+
+    for (const Entry &entry : entries)
+    {
+        const bool over_quota = _policy.retention_bytes && total > _policy.retention_bytes;
+        const bool low_space = _policy.min_free_bytes && free_bytes < _policy.min_free_bytes;
+        if (!over_quota && !low_space)
+        {
+            break;
+        }
+        if (entry.path == active_path || entry.path == next_path)
+        {
+            continue;
+        }
+
+        ESP_LOGW(TAG, "Retention: remove %s (%" PRIu64 " bytes)", entry.path.c_str(), entry.size);
+        remove(entry.path.c_str());
+        remove((entry.path.string() + ".idx").c_str());
+        total -= entry.size;
+        if (free_bytes != UINT64_MAX)
+        {
+            free_bytes += entry.size;
+        }
+    }
+}
+
+void LoggerBase::retire_file(bool background)
+{
+    if (_async)
+    {
+        // 先提交残留数据, 写入任务按顺序写完后再关闭
+        xSemaphoreTake(_buffer_lock, portMAX_DELAY);
+        submit_fill_buffer(portMAX_DELAY);
+        _writer_file = nullptr;
+        xSemaphoreGive(_buffer_lock);
+
+        WriterCommand command = {};
+        command.type = WriterCommandType::CLOSE;
+        command.file = file;
+        snprintf(command.path, sizeof(command.path), "%s", _current_file_path.c_str());
+        command.lines = line_count;
+        command.bytes = _file_bytes;
+        command.preallocated = _file_preallocated;
+        command.format = _format;
+        post_writer(command);
+
+        _index_pending = false;
+        _indexed_lines = line_count;
+        file = nullptr;
+        return;
+    }
+
+    if (background)
+    {
+        post_command(WorkerCommandType::CLOSE, file, _current_file_path, line_count, _file_bytes, _file_preallocated);
+        file = nullptr;
+        return;
+    }
+
+    save_index();
+    close_file();
+}
+
+bool LoggerBase::enable_async_writer(const AsyncWriteConfig &config)
+{
+    if (_async)
+    {
+        return true;
+    }
+    if (is_initialized)
+    {
+        ESP_LOGE(TAG, "Async writer must be enabled before init");
+        return false;
+    }
+
+    _async_config = config;
+    _async_config.buffer_size = std::max(SECTOR_SIZE, (config.buffer_size + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE);
+
+    // 扇区对齐的 DMA 内存, 整块写入时 FATFS 可直接多扇区传输, 不经过驱动的中转缓冲
+    for (char *&buffer : _buffers)
+    {
+        buffer = static_cast<char *>(heap_caps_aligned_alloc(SECTOR_SIZE, _async_config.buffer_size, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL));
+        if (buffer == nullptr)
+        {
+            ESP_LOGE(TAG, "Failed to allocate %zu bytes write buffer", _async_config.buffer_size);
+            heap_caps_free(_buffers[0]);
+            heap_caps_free(_buffers[1]);
+            _buffers[0] = _buffers[1] = nullptr;
+            return false;
+        }
+    }
+
+    _buffer_lock = xSemaphoreCreateMutex();
+    _buffer_free = xSemaphoreCreateCounting(1, 1);
+    _flush_done = xSemaphoreCreateBinary();
+    _writer_queue = xQueueCreate(WRITER_QUEUE_LENGTH, sizeof(WriterCommand));
+    _last_print_us = esp_timer_get_time();
+
+    auto task_func = [](void *arg)
+    {
+        LoggerBase *instance = static_cast<LoggerBase *>(arg);
+        instance->writer_task();
+    };
+    xTaskCreatePinnedToCore(task_func, "log_writer", StackSize, this, 2, nullptr, tskNO_AFFINITY);
+
+    _async = true;
+    return true;
+}
+
+bool LoggerBase::set_file_format(LogFileFormat format)
+{
+    if (format == LogFileFormat::PLAIN)
+    {
+        _format_requested = format;
+        return true;
+    }
+    if (!_async)
+    {
+        ESP_LOGE(TAG, "Framed formats require the async writer");
+        return false;
+    }
+    if (!_encoder.init(_async_config.buffer_size, format == LogFileFormat::LZ4))
+    {
+        ESP_LOGE(TAG, "Failed to allocate block encoder");
+        return false;
+    }
+    _format_requested = format;
+    return true;
+}
+
+LogFileFormat LoggerBase::get_file_format() const
+{
+    return _format_requested;
+}
+
+bool LoggerBase::enable_spill(const SpillConfig &config)
+{
+    if (_spill.is_enabled())
+    {
+        return true;
+    }
+    if (!_spill.init(config.psram_bytes, config.internal_bytes))
+    {
+        ESP_LOGE(TAG, "Failed to allocate spill buffer");
+        return false;
+    }
+
+    _drain_lock = xSemaphoreCreateMutex();
+    _drain_start = xSemaphoreCreateBinary();
+
+    auto task_func = [](void *arg)
+    {
+        LoggerBase *instance = static_cast<LoggerBase *>(arg);
+        instance->drain_task();
+    };
+    xTaskCreatePinnedToCore(task_func, "log_drain", StackSize, this, 1, nullptr, tskNO_AFFINITY);
+
+    ESP_LOGI(TAG, "Spill buffer %zu bytes in %s", _spill.capacity(), _spill.in_psram() ? "PSRAM" : "internal RAM");
+    return true;
+}
+
+void LoggerBase::storage_listener(bool available, void *context)
+{
+    static_cast<LoggerBase *>(context)->set_storage_available(available);
+}
+
+void LoggerBase::set_storage_available(bool available)
+{
+    if (available)
+    {
+        xSemaphoreTake(_storage_lock, portMAX_DELAY);
+        invalidate_string_groups(); // 可能换了卡, 下次查找时重新读取
+        if (_storage_state == StorageState::ABSENT)
+        {
+            // 暂存区为空也走一遍排空任务, 由它执行拔卡期间记下的打开/关闭
+            _storage_state = _spill.is_enabled() ? StorageState::DRAINING : StorageState::PRESENT;
+            EVENT_LOG("logger: storage back, %u bytes spilled", static_cast<unsigned>(_spill.used()));
+            if (_drain_start)
+            {
+                xSemaphoreGive(_drain_start);
+            }
+        }
+        xSemaphoreGive(_storage_lock);
+        return;
+    }
+
+    // 排空任务正在写卡时先等它写完当前一块
+    if (_drain_lock)
+    {
+        xSemaphoreTake(_drain_lock, portMAX_DELAY);
+    }
+    xSemaphoreTake(_storage_lock, portMAX_DELAY);
+    invalidate_string_groups(); // 拔卡期间的记录进入暂存区, 不在缓存中
+    if (_storage_state != StorageState::ABSENT)
+    {
+        detach_storage();
+        _storage_state = StorageState::ABSENT;
+        _spill_full = false;
+        EVENT_LOG("logger: storage removed, %u bytes spilled", static_cast<unsigned>(_spill.used()));
+    }
+    xSemaphoreGive(_storage_lock);
+    if (_drain_lock)
+    {
+        xSemaphoreGive(_drain_lock);
+    }
+}
+
+bool LoggerBase::is_spilling() const
+{
+    return _spill.is_enabled() && _storage_state != StorageState::PRESENT;
+}
+
+bool LoggerBase::spill_line(const std::string_view *parts, size_t count, bool newline)
+{
+    if (_spill.push(parts, count, newline))
+    {
+        return true;
+    }
+    if (!_spill_full)
+    {
+        _spill_full = true;
+        EVENT_LOG("logger: spill full, dropping");
+    }
+    return false;
+}
+
+// 卸载前调用: 之后不能再有任何任务访问旧文件, 否则新挂载复用的文件描述符会被误写或误关
+void LoggerBase::detach_storage()
+{
+    discard_next_file();
+
+    if (file)
+    {
+        if (_async && _spill.is_enabled())
+        {
+            // 还没交给写入任务的数据放回暂存区队首, 插卡后续写到同一个文件.
+            // 已提交的块写到拔出的卡上会失败, 计入写入错误
+            xSemaphoreTake(_buffer_lock, portMAX_DELAY);
+            _spill.push_front(_buffers[_fill_index], _fill_used);
+            _file_bytes -= _fill_used;
+            _fill_used = 0;
+            xSemaphoreGive(_buffer_lock);
+        }
+        retire_file(false);
+        if (_spill.is_enabled())
+        {
+            _spill.mark_front(LogSpill::Action::REOPEN);
+        }
+    }
+
+    if (!_spill.is_enabled())
+    {
+        is_initialized = false;
+        line_count = 0;
+    }
+    wait_workers_idle();
+}
+
+void LoggerBase::wait_workers_idle()
+{
+    if (_writer_queue)
+    {
+        xSemaphoreTake(_fence_done, 0); // 清掉上次超时后迟到的完成信号
+        WriterCommand command = {};
+        command.type = WriterCommandType::FENCE;
+        command.done = _fence_done;
+        post_writer(command);
+        if (xSemaphoreTake(_fence_done, FENCE_TIMEOUT) != pdTRUE)
+        {
+            ESP_LOGW(TAG, "Writer still busy after storage removal");
+        }
+    }
+    if (_worker_queue)
+    {
+        xSemaphoreTake(_fence_done, 0);
+        WorkerCommand command = {};
+        command.type = WorkerCommandType::FENCE;
+        command.done = _fence_done;
+        xQueueSend(_worker_queue, &command, portMAX_DELAY);
+        if (xSemaphoreTake(_fence_done, FENCE_TIMEOUT) != pdTRUE)
+        {
+            ESP_LOGW(TAG, "Worker still busy after storage removal");
+        }
+    }
+}
+
+void LoggerBase::drain_task()
+{
+    while (true)
+    {
+        if (xSemaphoreTake(_drain_start, portMAX_DELAY) == pdTRUE)
+        {
+            drain_spill();
+        }
+    }
+}
+
+// 每次只在锁内取出一块, 写卡时不持 _storage_lock, 调用方照常追加到暂存区;
+// 写回速度超过记录速度后暂存区变空, 在锁内切回直接写卡, 顺序不变
+void LoggerBase::drain_spill()
+{
+    std::vector<char> chunk(DRAIN_CHUNK);
+    const int64_t start = esp_timer_get_time();
+    uint64_t drained = 0;
+
+    while (true)
+    {
+        xSemaphoreTake(_drain_lock, portMAX_DELAY);
+        xSemaphoreTake(_storage_lock, portMAX_DELAY);
+        if (_storage_state != StorageState::DRAINING)
+        {
+            // 写回途中又被拔出, 剩余数据留在暂存区
+            xSemaphoreGive(_storage_lock);
+            xSemaphoreGive(_drain_lock);
+            return;
+        }
+
+        LogSpill::Segment segment;
+        const bool has_segment = _spill.pop_segment(segment);
+        const size_t length = has_segment ? 0 : _spill.read(chunk.data(), chunk.size());
+        if (!has_segment && length == 0)
+        {
+            _storage_state = StorageState::PRESENT;
+            is_initialized = file != nullptr;
+            _spill_full = false;
+            xSemaphoreGive(_storage_lock);
+            xSemaphoreGive(_drain_lock);
+
+            const uint32_t elapsed_ms = static_cast<uint32_t>((esp_timer_get_time() - start) / 1000);
+            EVENT_LOG("logger: spill drained, %u bytes in %u ms", static_cast<unsigned>(drained), static_cast<unsigned>(elapsed_ms));
+            ESP_LOGI(TAG, "Spill drained, %" PRIu64 " bytes in %" PRIu32 " ms", drained, elapsed_ms);
+            return;
+        }
+        xSemaphoreGive(_storage_lock);
+
+        if (has_segment)
+        {
+            switch (segment.action)
+            {
+            case LogSpill::Action::REOPEN:
+                if (!file && !_current_file_path.empty() && open_log() && _worker_queue)
+                {
+                    post_prepare();
+                }
+                break;
+            case LogSpill::Action::OPEN:
+                if (file)
+                {
+                    discard_next_file();
+                    retire_file(false);
+                }
+                open_named(segment.name);
+                break;
+            case LogSpill::Action::CLOSE:
+                if (file)
+                {
+                    discard_next_file();
+                    retire_file(false);
+                }
+                line_count = 0;
+                break;
+            }
+        }
+        else
+        {
+            const std::string_view data(chunk.data(), length);
+            const uint32_t lines = std::count(data.begin(), data.end(), '\n');
+            if (file && write_parts(&data, 1, false))
+            {
+                line_count += lines;
+                drained += length;
+            }
+            else
+            {
+                // 文件没能打开或写卡失败, 这部分记录无法写回
+                EVENT_LOG("logger: spill drain failed, %u bytes lost", static_cast<unsigned>(length));
+                xSemaphoreTake(_storage_lock, portMAX_DELAY);
+                _spill.count_drop(lines, length);
+                xSemaphoreGive(_storage_lock);
+            }
+        }
+        xSemaphoreGive(_drain_lock);
+    }
+}
+
+bool LoggerBase::recover_blocks(const std::string &file_path, uint32_t &lines, uint32_t &next_sequence, long &data_end)
+{
+    lines = 0;
+    next_sequence = 0;
+    data_end = 0;
+
+    FILE *temp_file = fopen(file_path.c_str(), "rb");
+    if (!temp_file)
+    {
+        return false;
+    }
+    fseek(temp_file, 0, SEEK_END);
+    const long size = ftell(temp_file);
+    const bool found = LogBlockEncoder::recover(temp_file, _async_config.buffer_size, lines, next_sequence, data_end);
+    fclose(temp_file);
+    if (!found && size > 0)
+    {
+        ESP_LOGW(TAG, "No valid block in %s", file_path.c_str());
+    }
+    return found;
+}
+
+void LoggerBase::attach_writer_file()
+{
+    if (_async)
+    {
+        xSemaphoreTake(_buffer_lock, portMAX_DELAY);
+        _writer_file = file;
+        _writer_format = _format;
+        xSemaphoreGive(_buffer_lock);
+
+        if (file && _format != LogFileFormat::PLAIN)
+        {
+            WriterCommand command = {};
+            command.type = WriterCommandType::OPEN;
+            command.file = file;
+            command.sequence = _resume_sequence;
+            command.lines = _resume_lines;
+            post_writer(command);
+        }
+    }
+}
+
+bool LoggerBase::append_async(const std::string_view *parts, size_t count, bool newline)
+{
+    xSemaphoreTake(_buffer_lock, portMAX_DELAY);
+    bool ok = true;
+    for (size_t i = 0; ok && i < count; i++)
+    {
+        ok = fill_buffer(parts[i].data(), parts[i].size());
+    }
+    if (ok && newline)
+    {
+        ok = fill_buffer("\n", 1);
+    }
+    xSemaphoreGive(_buffer_lock);
+    return ok;
+}
+
+// 调用方持 _buffer_lock
+bool LoggerBase::fill_buffer(const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        const size_t chunk = std::min(length, _async_config.buffer_size - _fill_used);
+        memcpy(_buffers[_fill_index] + _fill_used, data, chunk);
+        _fill_used += chunk;
+        data += chunk;
+        length -= chunk;
+
+        if (_fill_used == _async_config.buffer_size && !submit_fill_buffer(portMAX_DELAY))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 调用方持 _buffer_lock
+bool LoggerBase::submit_fill_buffer(TickType_t timeout)
+{
+    if (_fill_used == 0 || _writer_file == nullptr)
+    {
+        return true;
+    }
+
+    // 另一块还在写: 反压调用方
+    if (xSemaphoreTake(_buffer_free, 0) != pdTRUE)
+    {
+        _stat_stalls++;
+        if (xSemaphoreTake(_buffer_free, timeout) != pdTRUE)
+        {
+            return false;
+        }
+    }
+
+    WriterCommand command = {};
+    command.type = WriterCommandType::WRITE;
+    command.file = _writer_file;
+    command.buffer = _fill_index;
+    command.length = _fill_used;
+    command.format = _writer_format;
+    post_writer(command);
+
+    _fill_index ^= 1;
+    _fill_used = 0;
+
+    if (_index_pending)
+    {
+        WriterCommand index = {};
+        index.type = WriterCommandType::INDEX;
+        snprintf(index.path, sizeof(index.path), "%s", _current_file_path.c_str());
+        index.lines = _pending_lines;
+        index.bytes = _pending_bytes;
+        post_writer(index);
+        _index_pending = false;
+    }
+    return true;
+}
+
+void LoggerBase::post_writer(const WriterCommand &command)
+{
+    // 写入任务从不等待 _buffer_lock, 阻塞发送不会死锁
+    xQueueSend(_writer_queue, &command, portMAX_DELAY);
+}
+
+bool LoggerBase::flush(TickType_t timeout)
+{
+    if (!_async)
+    {
+        if (file)
+        {
+            fflush(file);
+            fsync(fileno(file));
+        }
+        return true;
+    }
+
+    if (xSemaphoreTake(_buffer_lock, timeout) != pdTRUE)
+    {
+        return false;
+    }
+    FILE *target = _writer_file;
+    bool ok = submit_fill_buffer(timeout);
+    if (ok && target)
+    {
+        xSemaphoreTake(_flush_done, 0); // 清掉上次超时后迟到的完成信号
+        WriterCommand command = {};
+        command.type = WriterCommandType::SYNC;
+        command.file = target;
+        command.done = _flush_done;
+        post_writer(command);
+    }
+    xSemaphoreGive(_buffer_lock);
+
+    if (ok && target)
+    {
+        ok = xSemaphoreTake(_flush_done, timeout) == pdTRUE;
+    }
+    return ok;
+}
+
+void LoggerBase::writer_task()
+{
+    const bool interval = _async_config.durability == Durability::INTERVAL;
+    const TickType_t period = std::max<TickType_t>(1, pdMS_TO_TICKS(_async_config.sync_interval_ms));
+    TickType_t last_sync = xTaskGetTickCount();
+    WriterCommand command;
+
+    while (true)
+    {
+        TickType_t wait = portMAX_DELAY;
+        if (interval)
+        {
+            const TickType_t elapsed = xTaskGetTickCount() - last_sync;
+            wait = elapsed >= period ? 0 : period - elapsed;
+        }
+
+        if (xQueueReceive(_writer_queue, &command, wait) == pdTRUE)
+        {
+            switch (command.type)
+            {
+            case WriterCommandType::WRITE:
+                write_buffer(command.file, command.buffer, command.length, command.format);
+                break;
+            case WriterCommandType::SYNC:
+                sync_file(command.file);
+                xSemaphoreGive(command.done);
+                break;
+            case WriterCommandType::INDEX:
+                write_index(command.path, command.lines, command.bytes);
+                break;
+            case WriterCommandType::CLOSE:
+                // fclose 会同步 FAT 目录项, 之后写索引; 分块文件没有索引, 按实际写出位置截断
+                if (command.format != LogFileFormat::PLAIN)
+                {
+                    if (command.preallocated)
+                    {
+                        ftruncate(fileno(command.file), lseek(fileno(command.file), 0, SEEK_CUR));
+                    }
+                    fclose(command.file);
+                }
+                else
+                {
+                    close_rotated(command.file, command.path, command.lines, command.bytes, command.preallocated);
+                }
+                _synced_bytes = _stat_bytes.load(std::memory_order_relaxed);
+                break;
+            case WriterCommandType::OPEN:
+                _block_sequence = command.sequence;
+                _block_lines = command.lines;
+                break;
+            case WriterCommandType::FENCE:
+                xSemaphoreGive(command.done);
+                break;
+            }
+        }
+
+        if (interval && xTaskGetTickCount() - last_sync >= period)
+        {
+            periodic_sync();
+            last_sync = xTaskGetTickCount();
+        }
+    }
+}
+
+void LoggerBase::write_buffer(FILE *target, int buffer, uint32_t length, LogFileFormat format)
+{
+    const bool framed = format != LogFileFormat::PLAIN;
+    const void *data = _buffers[buffer];
+    if (framed)
+    {
+        const bool compress = format == LogFileFormat::LZ4;
+        const int64_t encode_start = esp_timer_get_time();
+        const uint32_t raw_length = length;
+        length = _encoder.encode(reinterpret_cast<const uint8_t *>(_buffers[buffer]), raw_length, compress, _block_sequence++, _block_lines);
+        data = _encoder.output();
+        if (compress)
+        {
+            _stat_compress_us += esp_timer_get_time() - encode_start;
+            _stat_raw_bytes += raw_length;
+            _stat_compressed_bytes += length;
+        }
+        // 原始缓冲已拷贝到块输出, 提前还给调用方
+        xSemaphoreGive(_buffer_free);
+    }
+
+    const int64_t start = esp_timer_get_time();
+    const ssize_t written = write(fileno(target), data, length);
+    const uint32_t elapsed = static_cast<uint32_t>(esp_timer_get_time() - start);
+
+    _stat_writes++;
+    _stat_write_total_us += elapsed;
+    if (elapsed > _stat_write_max_us.load(std::memory_order_relaxed))
+    {
+        _stat_write_max_us.store(elapsed, std::memory_order_relaxed);
+    }
+    if (written != static_cast<ssize_t>(length))
+    {
+        _stat_errors++;
+        EVENT_LOG("logger: short write %d/%" PRIu32 " bytes, errno %d", static_cast<int>(written), length, errno);
+    }
+    if (written > 0)
+    {
+        _stat_bytes += written;
+    }
+    if (!framed)
+    {
+        xSemaphoreGive(_buffer_free);
+    }
+}
+
+void LoggerBase::sync_file(FILE *target)
+{
+    const int64_t start = esp_timer_get_time();
+    fsync(fileno(target));
+    const uint32_t elapsed = static_cast<uint32_t>(esp_timer_get_time() - start);
+
+    _stat_syncs++;
+    _stat_sync_total_us += elapsed;
+    if (elapsed > _stat_sync_max_us.load(std::memory_order_relaxed))
+    {
+        _stat_sync_max_us.store(elapsed, std::memory_order_relaxed);
+    }
+    _synced_bytes = _stat_bytes.load(std::memory_order_relaxed);
+}
+
+// 写入任务中执行: 写出未满的缓冲并 fsync. 调用方正持锁时跳过, 下个周期再试
+void LoggerBase::periodic_sync()
+{
+    if (xSemaphoreTake(_buffer_lock, 0) != pdTRUE)
+    {
+        return;
+    }
+
+    FILE *target = _writer_file;
+    const LogFileFormat format = _writer_format;
+    int buffer = -1;
+    uint32_t length = 0;
+    // 另一块空闲说明队列里没有待写缓冲, 直接写不会乱序
+    if (target && _fill_used > 0 && xSemaphoreTake(_buffer_free, 0) == pdTRUE)
+    {
+        buffer = _fill_index;
+        length = _fill_used;
+        _fill_index ^= 1;
+        _fill_used = 0;
+    }
+    xSemaphoreGive(_buffer_lock);
+
+    if (buffer >= 0)
+    {
+        write_buffer(target, buffer, length, format);
+    }
+    if (target && _stat_bytes.load(std::memory_order_relaxed) != _synced_bytes)
+    {
+        sync_file(target);
+    }
+}
+
+WriterStats LoggerBase::get_writer_stats() const
+{
+    WriterStats stats;
+    stats.writes = _stat_writes.load(std::memory_order_relaxed);
+    stats.write_total_us = _stat_write_total_us.load(std::memory_order_relaxed);
+    stats.write_max_us = _stat_write_max_us.load(std::memory_order_relaxed);
+    stats.syncs = _stat_syncs.load(std::memory_order_relaxed);
+    stats.sync_total_us = _stat_sync_total_us.load(std::memory_order_relaxed);
+    stats.sync_max_us = _stat_sync_max_us.load(std::memory_order_relaxed);
+    stats.stalls = _stat_stalls.load(std::memory_order_relaxed);
+    stats.errors = _stat_errors.load(std::memory_order_relaxed);
+    stats.bytes_written = _stat_bytes.load(std::memory_order_relaxed);
+    stats.raw_bytes = _stat_raw_bytes.load(std::memory_order_relaxed);
+    stats.compressed_bytes = _stat_compressed_bytes.load(std::memory_order_relaxed);
+    stats.compress_total_us = _stat_compress_us.load(std::memory_order_relaxed);
+    if (_async)
+    {
+        stats.pending = 1 - uxSemaphoreGetCount(_buffer_free);
+        stats.buffered = _fill_used;
+    }
+    stats.spill_used = _spill.used();
+    stats.spill_peak = _spill.peak();
+    stats.spill_dropped_lines = _spill.get_dropped_lines();
+    stats.spill_dropped_bytes = _spill.get_dropped_bytes();
+    return stats;
+}
+
+void LoggerBase::print_writer_stats()
+{
+    if (!_async)
+    {
+        printf("log writer: synchronous\n");
+        return;
+    }
+
+    const WriterStats stats = get_writer_stats();
+    const int64_t now = esp_timer_get_time();
+    const int64_t elapsed_us = now - _last_print_us;
+    const uint64_t rate = elapsed_us > 0 ? (stats.bytes_written - _last_print_bytes) * 1000000ULL / elapsed_us : 0;
+    const uint64_t compress_us = stats.compress_total_us - _last_print_compress_us;
+    _last_print_bytes = stats.bytes_written;
+    _last_print_compress_us = stats.compress_total_us;
+    _last_print_us = now;
+
+    static const char *DURABILITY_NAMES[] = {"record", "interval", "close"};
+    printf("log writer: durability %s, buffer 2x%zu, format %s\n", DURABILITY_NAMES[static_cast<int>(_async_config.durability)],
+           _async_config.buffer_size, FORMAT_NAMES[static_cast<int>(_format)]);
+    printf("  write: %" PRIu32 " calls, avg %" PRIu32 " us, max %" PRIu32 " us, %" PRIu32 " errors\n",
+           stats.writes, stats.writes ? static_cast<uint32_t>(stats.write_total_us / stats.writes) : 0, stats.write_max_us, stats.errors);
+    printf("  fsync: %" PRIu32 " calls, avg %" PRIu32 " us, max %" PRIu32 " us\n",
+           stats.syncs, stats.syncs ? static_cast<uint32_t>(stats.sync_total_us / stats.syncs) : 0, stats.sync_max_us);
+    printf("  queue: %" PRIu32 " pending, %" PRIu32 " bytes buffered, %" PRIu32 " stalls\n", stats.pending, stats.buffered, stats.stalls);
+    printf("  total: %" PRIu64 " bytes, %" PRIu64 " B/s\n", stats.bytes_written, rate);
+    if (_spill.is_enabled())
+    {
+        static const char *STORAGE_NAMES[] = {"present", "absent", "draining"};
+        printf("  spill: card %s, %zu KiB %s, %" PRIu32 " bytes pending, peak %" PRIu32 ", dropped %" PRIu32 " lines / %" PRIu64 " bytes\n",
+               STORAGE_NAMES[static_cast<int>(_storage_state)], _spill.capacity() / 1024, _spill.in_psram() ? "PSRAM" : "internal",
+               stats.spill_used, stats.spill_peak, stats.spill_dropped_lines, stats.spill_dropped_bytes);
+    }
+    if (stats.compressed_bytes)
+    {
+        // CPU 占用为写入任务压缩耗时占距上次打印的时间比例
+        printf("  lz4: ratio %.2f, %" PRIu64 " us/KiB, cpu %.1f%%\n",
+               static_cast<double>(stats.raw_bytes) / stats.compressed_bytes,
+               stats.raw_bytes ? stats.compress_total_us * 1024 / stats.raw_bytes : 0,
+               elapsed_us > 0 ? 100.0 * compress_us / elapsed_us : 0.0);
+    }
+}
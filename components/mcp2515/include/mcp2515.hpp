@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+
+#include "can_frame.hpp"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "esp_err.h"
+
+    // SPI 外挂 CAN 控制器 (MCP2515), 作为第二路CAN通道
+    class MCP2515
+    {
+    public:
+        enum class Bitrate : uint8_t
+        {
+            KBPS_125,
+            KBPS_250,
+            KBPS_500,
+            KBPS_1000,
+        };
+
+        // 引脚没有默认值, 由 menuconfig 中的 MCP2515 选项给出
+        MCP2515(QueueHandle_t &rx_queue,
+                std::chrono::time_point<std::chrono::steady_clock> &origin_time,
+                gpio_num_t sclk_pin,
+                gpio_num_t mosi_pin,
+                gpio_num_t miso_pin,
+                gpio_num_t cs_pin,
+                gpio_num_t int_pin,
+                uint8_t channel = 2,
+                Bitrate bitrate = Bitrate::KBPS_250,
+                uint32_t crystal_hz = 16000000,
+                spi_host_device_t spi_host = SPI2_HOST,
+                int spi_clock_hz = 10 * 1000 * 1000);
+
+        ~MCP2515();
+
+        // 控制器是否初始化成功
+        bool is_ready() const;
+
+        // 发送消息 (使用TXB0)
+        esp_err_t send_message(const twai_message_t &message);
+
+        // 接收溢出计数 (RX0OVR/RX1OVR)
+        uint32_t get_overrun_count() const;
+
+    private:
+        const char *TAG = "MCP2515";
+
+        /* SPI 指令 */
+        static constexpr uint8_t INSTR_RESET = 0xC0;
+        static constexpr uint8_t INSTR_READ = 0x03;
+        static constexpr uint8_t INSTR_WRITE = 0x02;
+        static constexpr uint8_t INSTR_BIT_MODIFY = 0x05;
+        static constexpr uint8_t INSTR_READ_STATUS = 0xA0;
+        static constexpr uint8_t INSTR_READ_RXB0 = 0x90; // 从 RXB0SIDH 开始连续读, 结束后自动清 RX0IF
+        static constexpr uint8_t INSTR_READ_RXB1 = 0x94; // 从 RXB1SIDH 开始连续读, 结束后自动清 RX1IF
+        static constexpr uint8_t INSTR_LOAD_TXB0 = 0x40; // 从 TXB0SIDH 开始连续写
+        static constexpr uint8_t INSTR_RTS_TXB0 = 0x81;
+
+        /* 寄存器 */
+        enum reg : uint8_t
+        {
+            REG_RXB0CTRL = 0x60,
+            REG_RXB1CTRL = 0x70,
+            REG_TXB0CTRL = 0x30,
+            REG_CNF3 = 0x28,
+            REG_CNF2 = 0x29,
+            REG_CNF1 = 0x2A,
+            REG_CANINTE = 0x2B,
+            REG_CANINTF = 0x2C,
+            REG_EFLG = 0x2D,
+            REG_CANSTAT = 0x0E,
+            REG_CANCTRL = 0x0F,
+        };
+
+        /* CANCTRL.REQOP */
+        static constexpr uint8_t MODE_NORMAL = 0x00;
+        static constexpr uint8_t MODE_CONFIG = 0x80;
+        static constexpr uint8_t MODE_MASK = 0xE0;
+
+        /* 一个接收缓冲区: SIDH SIDL EID8 EID0 DLC D0..D7 */
+        static constexpr size_t RX_BUFFER_LEN = 13;
+
+        QueueHandle_t &_rx_queue;
+        const std::chrono::time_point<std::chrono::steady_clock> &_origin_time;
+        const uint8_t _channel;
+        const spi_host_device_t _spi_host;
+        const gpio_num_t _int_pin;
+
+        spi_device_handle_t _spi = nullptr;
+        SemaphoreHandle_t _int_sem = nullptr;
+        bool _ready = false;
+        uint32_t _overrun_count = 0;
+
+        static void IRAM_ATTR gpio_isr_handler(void *arg);
+
+        void task(void);
+
+        esp_err_t transfer(const uint8_t *tx, uint8_t *rx, size_t len);
+        esp_err_t reset(void);
+        uint8_t read_register(uint8_t address);
+        esp_err_t write_register(uint8_t address, uint8_t value);
+        esp_err_t bit_modify(uint8_t address, uint8_t mask, uint8_t value);
+        uint8_t read_status(void);
+        bool set_mode(uint8_t mode);
+        bool set_bitrate(Bitrate bitrate, uint32_t crystal_hz);
+
+        void read_rx_buffer(uint8_t instruction);
+        static void decode_rx_buffer(const uint8_t *buf, twai_message_t &message);
+    };
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,392 @@
+#include "mcp2515.hpp"
+
+#include <cstring>
+#include <cinttypes>
+
+#include "esp_log.h"
+#include "boot_trace.hpp"
+
+static const uint32_t StackSize = 1024 * 4;
+
+/* READ STATUS 返回位 */
+static const uint8_t STATUS_RX0IF = 0x01;
+static const uint8_t STATUS_RX1IF = 0x02;
+static const uint8_t STATUS_TXB0REQ = 0x04;
+
+/* EFLG */
+static const uint8_t EFLG_RX0OVR = 0x40;
+static const uint8_t EFLG_RX1OVR = 0x80;
+
+// CNF1/CNF2/CNF3, 采样点75%, SJW 1TQ, 单次采样.
+// 每位 16TQ 时 PropSeg 3 + PS1 8 + PS2 4, 8TQ 时 PropSeg 2 + PS1 3 + PS2 2
+struct BitTiming
+{
+    uint8_t cnf1;
+    uint8_t cnf2;
+    uint8_t cnf3;
+};
+
+static const BitTiming timing_16mhz[] = {
+    {0x03, 0xBA, 0x03}, // 125k, 16TQ
+    {0x01, 0xBA, 0x03}, // 250k, 16TQ
+    {0x00, 0xBA, 0x03}, // 500k, 16TQ
+    {0x00, 0x91, 0x01}, // 1M, 8TQ
+};
+
+// 8MHz 晶振下 1M 每位只有 4TQ, 低于下限, CNF2 为 0 表示不支持
+static const BitTiming timing_8mhz[] = {
+    {0x01, 0xBA, 0x03}, // 125k, 16TQ
+    {0x00, 0xBA, 0x03}, // 250k, 16TQ
+    {0x00, 0x91, 0x01}, // 500k, 8TQ
+    {0x00, 0x00, 0x00}, // 1M
+};
+
+void IRAM_ATTR MCP2515::gpio_isr_handler(void *arg)
+{
+    MCP2515 *instance = static_cast<MCP2515 *>(arg);
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR(instance->_int_sem, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+// INT 引脚低电平有效, 任一 RXnIF 置位期间保持低电平, 下降沿触发中断; 空闲时不访问 SPI.
+// 每次唤醒把所有满的接收缓冲区读空
+void MCP2515::task(void)
+{
+    while (1)
+    {
+        uint8_t status;
+        while ((status = read_status()) & (STATUS_RX0IF | STATUS_RX1IF))
+        {
+            if (status & STATUS_RX0IF)
+            {
+                read_rx_buffer(INSTR_READ_RXB0);
+            }
+            if (status & STATUS_RX1IF)
+            {
+                read_rx_buffer(INSTR_READ_RXB1);
+            }
+        }
+
+        uint8_t eflg = read_register(REG_EFLG);
+        if (eflg & (EFLG_RX0OVR | EFLG_RX1OVR))
+        {
+            _overrun_count++;
+            bit_modify(REG_EFLG, EFLG_RX0OVR | EFLG_RX1OVR, 0x00);
+            ESP_LOGW(TAG, "RX overrun, total=%" PRIu32, _overrun_count);
+        }
+
+        // 读空后 INT 仍为低: 读取期间又收到帧, 下降沿已过, 隔一个节拍再读
+        xSemaphoreTake(_int_sem, gpio_get_level(_int_pin) == 0 ? 1 : portMAX_DELAY);
+    }
+}
+
+MCP2515::MCP2515(QueueHandle_t &rx_queue,
+                 std::chrono::time_point<std::chrono::steady_clock> &origin_time,
+                 gpio_num_t sclk_pin,
+                 gpio_num_t mosi_pin,
+                 gpio_num_t miso_pin,
+                 gpio_num_t cs_pin,
+                 gpio_num_t int_pin,
+                 uint8_t channel,
+                 Bitrate bitrate,
+                 uint32_t crystal_hz,
+                 spi_host_device_t spi_host,
+                 int spi_clock_hz) : _rx_queue(rx_queue),
+                                     _origin_time(origin_time),
+                                     _channel(channel),
+                                     _spi_host(spi_host),
+                                     _int_pin(int_pin)
+{
+    spi_bus_config_t bus_cfg = {};
+    bus_cfg.mosi_io_num = mosi_pin;
+    bus_cfg.miso_io_num = miso_pin;
+    bus_cfg.sclk_io_num = sclk_pin;
+    bus_cfg.quadwp_io_num = -1;
+    bus_cfg.quadhd_io_num = -1;
+    bus_cfg.max_transfer_sz = 32;
+
+    const uint32_t trace = BootTrace::begin("spi_init");
+    esp_err_t ret = spi_bus_initialize(_spi_host, &bus_cfg, SPI_DMA_DISABLED);
+    BootTrace::end(trace);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "SPI bus init failed: %s", esp_err_to_name(ret));
+        return;
+    }
+
+    spi_device_interface_config_t dev_cfg = {};
+    dev_cfg.mode = 0;
+    dev_cfg.clock_speed_hz = spi_clock_hz;
+    dev_cfg.spics_io_num = cs_pin;
+    dev_cfg.queue_size = 2;
+
+    ret = spi_bus_add_device(_spi_host, &dev_cfg, &_spi);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "SPI add device failed: %s", esp_err_to_name(ret));
+        return;
+    }
+
+    if (reset() != ESP_OK || !set_mode(MODE_CONFIG))
+    {
+        ESP_LOGE(TAG, "Controller not detected on SPI%d", _spi_host + 1);
+        return;
+    }
+
+    if (!set_bitrate(bitrate, crystal_hz))
+    {
+        ESP_LOGE(TAG, "Bitrate not supported with %" PRIu32 " Hz crystal", crystal_hz);
+        return;
+    }
+
+    // 两个接收缓冲区都接收所有帧, RXB0 满时滚动到 RXB1
+    write_register(REG_RXB0CTRL, 0x64);
+    write_register(REG_RXB1CTRL, 0x60);
+    // 仅使能接收中断
+    write_register(REG_CANINTF, 0x00);
+    write_register(REG_CANINTE, 0x03);
+
+    _int_sem = xSemaphoreCreateBinary();
+
+    gpio_config_t io_conf = {};
+    io_conf.intr_type = GPIO_INTR_NEGEDGE;
+    io_conf.mode = GPIO_MODE_INPUT;
+    io_conf.pin_bit_mask = (1ULL << _int_pin);
+    io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+    io_conf.pull_up_en = GPIO_PULLUP_ENABLE;
+    gpio_config(&io_conf);
+
+    ret = gpio_install_isr_service(0);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE)
+    {
+        ESP_LOGE(TAG, "INT Pin ISR Init Failed! 0x%x", ret);
+        return;
+    }
+    gpio_isr_handler_add(_int_pin, gpio_isr_handler, this);
+
+    if (!set_mode(MODE_NORMAL))
+    {
+        ESP_LOGE(TAG, "Failed to enter normal mode");
+        return;
+    }
+
+    auto task_func = [](void *arg)
+    {
+        MCP2515 *instance = static_cast<MCP2515 *>(arg);
+        instance->task(); // 调用类的成员函数
+    };
+
+    xTaskCreatePinnedToCore(task_func, "mcp2515_rx", StackSize, this, configMAX_PRIORITIES - 2, nullptr, tskNO_AFFINITY);
+
+    _ready = true;
+    ESP_LOGI(TAG, "CAN channel %d ready", _channel);
+}
+
+MCP2515::~MCP2515()
+{
+    if (_ready)
+    {
+        gpio_isr_handler_remove(_int_pin);
+    }
+    if (_spi)
+    {
+        spi_bus_remove_device(_spi);
+        spi_bus_free(_spi_host);
+    }
+}
+
+bool MCP2515::is_ready() const
+{
+    return _ready;
+}
+
+uint32_t MCP2515::get_overrun_count() const
+{
+    return _overrun_count;
+}
+
+esp_err_t MCP2515::transfer(const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    spi_transaction_t t = {};
+    t.length = len * 8;
+    t.tx_buffer = tx;
+    t.rx_buffer = rx;
+    return spi_device_polling_transmit(_spi, &t);
+}
+
+esp_err_t MCP2515::reset(void)
+{
+    const uint8_t tx = INSTR_RESET;
+    esp_err_t ret = transfer(&tx, nullptr, 1);
+    // 复位后振荡器起振需要 128 个 OSC 周期, 留足余量
+    vTaskDelay(pdMS_TO_TICKS(5));
+    return ret;
+}
+
+uint8_t MCP2515::read_register(uint8_t address)
+{
+    const uint8_t tx[3] = {INSTR_READ, address, 0x00};
+    uint8_t rx[3] = {};
+    transfer(tx, rx, sizeof(tx));
+    return rx[2];
+}
+
+esp_err_t MCP2515::write_register(uint8_t address, uint8_t value)
+{
+    const uint8_t tx[3] = {INSTR_WRITE, address, value};
+    return transfer(tx, nullptr, sizeof(tx));
+}
+
+esp_err_t MCP2515::bit_modify(uint8_t address, uint8_t mask, uint8_t value)
+{
+    const uint8_t tx[4] = {INSTR_BIT_MODIFY, address, mask, value};
+    return transfer(tx, nullptr, sizeof(tx));
+}
+
+uint8_t MCP2515::read_status(void)
+{
+    const uint8_t tx[2] = {INSTR_READ_STATUS, 0x00};
+    uint8_t rx[2] = {};
+    transfer(tx, rx, sizeof(tx));
+    return rx[1];
+}
+
+bool MCP2515::set_mode(uint8_t mode)
+{
+    bit_modify(REG_CANCTRL, MODE_MASK, mode);
+    for (int i = 0; i < 10; i++)
+    {
+        if ((read_register(REG_CANSTAT) & MODE_MASK) == mode)
+        {
+            return true;
+        }
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    return false;
+}
+
+bool MCP2515::set_bitrate(Bitrate bitrate, uint32_t crystal_hz)
+{
+    const BitTiming *table;
+    if (crystal_hz == 16000000)
+    {
+        table = timing_16mhz;
+    }
+    else if (crystal_hz == 8000000)
+    {
+        table = timing_8mhz;
+    }
+    else
+    {
+        return false;
+    }
+
+    const BitTiming &timing = table[static_cast<uint8_t>(bitrate)];
+    if (timing.cnf2 == 0)
+    {
+        return false;
+    }
+    write_register(REG_CNF1, timing.cnf1);
+    write_register(REG_CNF2, timing.cnf2);
+    write_register(REG_CNF3, timing.cnf3);
+    return true;
+}
+
+// 单次 SPI 事务突发读取整个接收缓冲区(13字节), 读完后硬件自动清除对应 RXnIF
+void MCP2515::read_rx_buffer(uint8_t instruction)
+{
+    uint8_t tx[1 + RX_BUFFER_LEN] = {instruction};
+    uint8_t rx[1 + RX_BUFFER_LEN] = {};
+
+    if (transfer(tx, rx, sizeof(tx)) != ESP_OK)
+    {
+        return;
+    }
+
+    CanFrameRecord record = {};
+    record.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _origin_time).count();
+    record.channel = _channel;
+    decode_rx_buffer(&rx[1], record.message);
+
+    if (xQueueSend(_rx_queue, &record, 0) != pdTRUE)
+    {
+        _overrun_count++;
+    }
+}
+
+void MCP2515::decode_rx_buffer(const uint8_t *buf, twai_message_t &message)
+{
+    const uint8_t sidh = buf[0];
+    const uint8_t sidl = buf[1];
+    const uint8_t eid8 = buf[2];
+    const uint8_t eid0 = buf[3];
+    const uint8_t dlc = buf[4];
+
+    memset(&message, 0, sizeof(message));
+
+    if (sidl & 0x08) // IDE
+    {
+        message.extd = 1;
+        message.identifier = (static_cast<uint32_t>(sidh) << 21) |
+                             (static_cast<uint32_t>(sidl & 0xE0) << 13) |
+                             (static_cast<uint32_t>(sidl & 0x03) << 16) |
+                             (static_cast<uint32_t>(eid8) << 8) |
+                             eid0;
+        message.rtr = (dlc & 0x40) ? 1 : 0;
+    }
+    else
+    {
+        message.identifier = (static_cast<uint32_t>(sidh) << 3) | (sidl >> 5);
+        message.rtr = (sidl & 0x10) ? 1 : 0; // SRR
+    }
+
+    message.data_length_code = dlc & 0x0F;
+    if (message.data_length_code > 8)
+    {
+        message.data_length_code = 8;
+    }
+    memcpy(message.data, &buf[5], message.data_length_code);
+}
+
+esp_err_t MCP2515::send_message(const twai_message_t &message)
+{
+    if (!_ready)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (read_status() & STATUS_TXB0REQ)
+    {
+        return ESP_ERR_TIMEOUT; // 上一帧仍在发送
+    }
+
+    uint8_t tx[1 + RX_BUFFER_LEN] = {INSTR_LOAD_TXB0};
+    uint8_t *buf = &tx[1];
+    const uint32_t id = message.identifier;
+    const uint8_t dlc = message.data_length_code > 8 ? 8 : message.data_length_code;
+
+    if (message.extd)
+    {
+        buf[0] = static_cast<uint8_t>(id >> 21);
+        buf[1] = static_cast<uint8_t>(((id >> 13) & 0xE0) | 0x08 | ((id >> 16) & 0x03));
+        buf[2] = static_cast<uint8_t>(id >> 8);
+        buf[3] = static_cast<uint8_t>(id);
+    }
+    else
+    {
+        buf[0] = static_cast<uint8_t>(id >> 3);
+        buf[1] = static_cast<uint8_t>((id & 0x07) << 5);
+    }
+    buf[4] = dlc | (message.rtr ? 0x40 : 0x00);
+    memcpy(&buf[5], message.data, dlc);
+
+    esp_err_t ret = transfer(tx, nullptr, sizeof(tx));
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    const uint8_t rts = INSTR_RTS_TXB0;
+    return transfer(&rts, nullptr, 1);
+}
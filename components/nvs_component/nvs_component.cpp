@@ -1,4 +1,5 @@
 #include "nvs_component.hpp"
+#include "boot_trace.hpp"
 #include <cstring>
 #include <cstdlib>
 #include <cinttypes>
@@ -6,6 +7,7 @@
 
 NVS_DEV::NVS_DEV()
 {
+    BootTrace::Scope trace("nvs_flash_init");
     esp_err_t err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
     {
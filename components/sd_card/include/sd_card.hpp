@@ -2,6 +2,10 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
+#include <atomic>
+
+#include "sd_speed.hpp"
 
 #ifdef __cplusplus
 extern "C"
@@ -13,9 +17,15 @@ extern "C"
 #include "esp_vfs_fat.h"
 #include "driver/sdmmc_host.h"
 #include "cJSON.h"
+#include "esp_console.h"
+#include "argtable3/argtable3.h"
 
     class SDCard
     {
+    public:
+        // 挂载状态订阅: 挂载成功后以 true 调用, 卸载前以 false 调用(此时卡可能已拔出), 在卡检测任务中执行
+        typedef void (*PresenceCallback)(bool mounted, void *context);
+
     private:
         const char *TAG = "SDCard";
 
@@ -50,6 +60,82 @@ extern "C"
 
         void card_detect(void);
 
+        // 速度档位: 挂载前按当前档设置 _host, 传输出错由 transaction_hook 统计, card_detect 任务负责降速重挂
+        SdSpeedPolicy _speed;
+        std::atomic<bool> _downgrade_requested{false};
+        esp_err_t (*_base_transaction)(int slot, sdmmc_command_t *cmd) = nullptr;
+        static SDCard *_active;
+
+        void apply_speed(void);
+        static esp_err_t transaction_hook(int slot, sdmmc_command_t *cmd);
+
+        struct PresenceListener
+        {
+            PresenceCallback callback;
+            void *context;
+        };
+        static const size_t MAX_LISTENERS = 4;
+        PresenceListener _listeners[MAX_LISTENERS] = {};
+        std::atomic<size_t> _listener_count{0};
+        // 通知与订阅互斥: 新订阅者拿到的是最后一次通知的状态, 之后的通知排在其后
+        SemaphoreHandle_t _presence_lock = nullptr;
+        bool _presence = false; // 最后一次通知的挂载状态
+
+        void notify_presence(bool mounted);
+
+        // USB-MSC 导出: 卸载 FAT 后以扇区方式访问卡, 见 sd_export.cpp.
+        // 请求由卡检测任务执行, 与插拔及降速重挂串行
+        enum Request : uint8_t
+        {
+            REQUEST_NONE,
+            REQUEST_EXPORT,
+            REQUEST_RETURN,
+            REQUEST_WIDTH_1, // sdbench -w: 换线宽重新挂载
+            REQUEST_WIDTH_4,
+        };
+        std::atomic<uint8_t> _request{REQUEST_NONE};
+        SemaphoreHandle_t _request_done = nullptr;
+        std::atomic<bool> _exported{false};
+        sdmmc_card_t *_raw_card = nullptr;
+        SemaphoreHandle_t _raw_lock = nullptr; // 保护 _raw_card
+
+        bool run_request(Request request);
+        void handle_request(Request request);
+        bool open_raw(void);
+        void close_raw(void);
+
+        // sdbench: 顺序读写测速与日志碎片统计, 见 sd_bench.cpp
+        struct BenchResult
+        {
+            size_t block;
+            bool sync; // 每块之后 fsync
+            uint32_t write_kbps;
+            uint32_t write_p50_us;
+            uint32_t write_p90_us;
+            uint32_t write_p99_us;
+            uint32_t write_max_us;
+            uint32_t read_kbps;
+            uint32_t read_p99_us;
+        };
+
+        static struct
+        {
+            struct arg_int *size;
+            struct arg_int *block;
+            struct arg_int *width;
+            struct arg_str *frag;
+            struct arg_end *end;
+        } bench_args;
+
+        bool bench_pass(char *buffer, size_t block, size_t total, bool sync, BenchResult &result);
+        void run_benchmark(const std::vector<size_t> &blocks, size_t total);
+        std::atomic<int> _bus_width{4}; // 当前线宽, 只在卡检测任务中修改
+        bool remount(int width);         // 交给卡检测任务执行 set_bus_width
+        void set_bus_width(int width);
+        void report_fragmentation(const std::string &dir);
+
+        static int benchCommand(void *context, int argc, char **argv);
+
     public:
         SDCard(gpio_num_t clk_pin = GPIO_NUM_13,
                gpio_num_t cmd_pin = GPIO_NUM_14,
@@ -63,6 +149,26 @@ extern "C"
         void mount_sd(void);
         void unmount_sd(void);
         void format_sd(void);
+        bool is_mounted(void) const;
+
+        // 当前速度档名称与累计链路错误数
+        const char *get_speed_name(void) const;
+        uint32_t get_link_errors(void) const;
+
+        // 添加订阅后立即在调用方任务中以当前状态回调一次, 与卡检测任务的通知不会交错
+        bool add_presence_listener(PresenceCallback callback, void *context);
+
+        void registerConsoleCommands();
+
+        // 交给 USB-MSC: 订阅者收到卸载通知, 卡以当前速度档重新初始化; 卡不在位时返回 false
+        bool export_card(void);
+        // 收回并重新挂载 FAT, 订阅者收到挂载通知
+        void return_card(void);
+        bool is_exported(void) const;
+        // 导出期间的扇区访问, 与拔卡互斥
+        uint32_t raw_sector_count(void);
+        esp_err_t read_raw(uint32_t lba, uint32_t count, void *buffer);
+        esp_err_t write_raw(uint32_t lba, uint32_t count, const void *buffer);
 
         std::string get_mount_path(void);
         void set_card_handle(sdmmc_card_t *card);
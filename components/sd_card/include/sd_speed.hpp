@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "esp_err.h"
+
+    // SDMMC 速度档位选择: 从最快档开始挂载, 挂载时或运行中出现 CRC/超时错误则逐档降速.
+    // 不依赖驱动, 由 SDCard 把结果应用到 sdmmc_host_t
+    class SdSpeedPolicy
+    {
+    public:
+        struct Step
+        {
+            const char *name;
+            int freq_khz;
+            bool ddr; // 仅对支持 DDR 的卡生效, 其余卡在同频下以 SDR 运行
+        };
+
+        static constexpr size_t STEP_COUNT = 4;
+        static const Step STEPS[STEP_COUNT];
+
+        static constexpr uint32_t ERROR_THRESHOLD = 3;                  // 窗口内链路错误达到此数即降速
+        static constexpr int64_t ERROR_WINDOW_US = 10 * 1000 * 1000;
+
+        // 换卡后从最快档开始
+        void reset();
+
+        const Step &current() const;
+        size_t get_index() const;
+
+        // 降一档, 已是最慢档返回 false
+        bool step_down();
+
+        // 超时、CRC、无效响应视为链路问题, 降速可能解决; 其余错误(无卡、文件系统损坏)降速无用
+        static bool is_link_error(esp_err_t err);
+
+        // 挂载失败: 链路错误且还能降档时降档并返回 true, 调用方按新档位重试
+        bool on_mount_failed(esp_err_t err);
+
+        // 挂载成功: 卡没有进入 DDR 时记为同频 SDR 档, 并清空错误计数
+        void on_mounted(bool ddr_active);
+
+        // 运行中每次传输的结果; 窗口内链路错误达到阈值且还能降档时返回 true
+        bool on_transfer(esp_err_t err, int64_t now_us);
+
+        uint32_t get_error_total() const;
+
+    private:
+        size_t _index = 0;
+        uint32_t _window_errors = 0;
+        int64_t _window_start_us = 0;
+        uint32_t _error_total = 0;
+    };
+
+#ifdef __cplusplus
+}
+#endif
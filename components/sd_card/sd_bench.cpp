@@ -0,0 +1,403 @@
+#include "sd_card.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "ff.h"
+#include "diskio_impl.h"
+#include "diskio_sdmmc.h"
+
+static const char *BENCH_FILE = "/.sdbench.tmp";
+static const size_t DEFAULT_BLOCKS[] = {512, 4096, 16384, 32768, 65536};
+static const int DEFAULT_TOTAL_KB = 4096;
+static const size_t MAX_BLOCK_SIZE = 64 * 1024;
+static const uint32_t SUGGEST_PERCENT = 90; // 达到峰值写入速度的这个比例即视为足够
+static const int MAX_DIR_DEPTH = 4;
+
+decltype(SDCard::bench_args) SDCard::bench_args;
+
+static uint32_t percentile(std::vector<uint32_t> &samples, uint32_t percent)
+{
+    if (samples.empty())
+    {
+        return 0;
+    }
+    const size_t index = std::min(samples.size() - 1, samples.size() * percent / 100);
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+static uint32_t rate_kbps(size_t bytes, int64_t elapsed_us)
+{
+    return elapsed_us > 0 ? static_cast<uint32_t>(static_cast<uint64_t>(bytes) * 1000000 / 1024 / elapsed_us) : 0;
+}
+
+// 顺序写 total 字节再读回; 不带 fsync 时末尾补一次 fsync, 速度按数据真正落卡计算
+bool SDCard::bench_pass(char *buffer, size_t block, size_t total, bool sync, BenchResult &result)
+{
+    const std::string path = _mount_point + BENCH_FILE;
+    const size_t count = total / block;
+    std::vector<uint32_t> samples;
+    samples.reserve(count);
+
+    result = {};
+    result.block = block;
+    result.sync = sync;
+
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        ESP_LOGE(TAG, "Failed to create %s", path.c_str());
+        return false;
+    }
+
+    const int64_t write_start = esp_timer_get_time();
+    for (size_t i = 0; i < count; i++)
+    {
+        buffer[0] = static_cast<char>(i); // 防止卡端对相同数据做优化
+        const int64_t start = esp_timer_get_time();
+        if (write(fd, buffer, block) != static_cast<ssize_t>(block) || (sync && fsync(fd) != 0))
+        {
+            ESP_LOGE(TAG, "Write failed at block %zu", i);
+            close(fd);
+            unlink(path.c_str());
+            return false;
+        }
+        samples.push_back(static_cast<uint32_t>(esp_timer_get_time() - start));
+    }
+    fsync(fd);
+    close(fd);
+    result.write_kbps = rate_kbps(count * block, esp_timer_get_time() - write_start);
+    result.write_max_us = samples.empty() ? 0 : *std::max_element(samples.begin(), samples.end());
+    result.write_p50_us = percentile(samples, 50);
+    result.write_p90_us = percentile(samples, 90);
+    result.write_p99_us = percentile(samples, 99);
+
+    samples.clear();
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        const int64_t read_start = esp_timer_get_time();
+        for (size_t i = 0; i < count; i++)
+        {
+            const int64_t start = esp_timer_get_time();
+            if (read(fd, buffer, block) != static_cast<ssize_t>(block))
+            {
+                break;
+            }
+            samples.push_back(static_cast<uint32_t>(esp_timer_get_time() - start));
+        }
+        result.read_kbps = rate_kbps(samples.size() * block, esp_timer_get_time() - read_start);
+        result.read_p99_us = percentile(samples, 99);
+        close(fd);
+    }
+    unlink(path.c_str());
+    return true;
+}
+
+void SDCard::run_benchmark(const std::vector<size_t> &blocks, size_t total)
+{
+    const size_t largest = *std::max_element(blocks.begin(), blocks.end());
+    char *buffer = static_cast<char *>(heap_caps_aligned_alloc(4, largest, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL));
+    if (buffer == nullptr)
+    {
+        ESP_LOGE(TAG, "No DMA memory for %zu bytes block", largest);
+        return;
+    }
+    for (size_t i = 0; i < largest; i++)
+    {
+        buffer[i] = static_cast<char>('A' + i % 26);
+    }
+
+    printf("bus %d-bit, %s %d kHz%s, %zu KiB per test, allocation unit %zu KiB\n",
+           1 << _card->log_bus_width, _speed.current().name, _card->real_freq_khz, _card->is_ddr ? " DDR" : "",
+           total / 1024, mount_config.allocation_unit_size / 1024);
+    printf("%7s %5s %9s %8s %8s %8s %8s %9s %8s\n",
+           "block", "fsync", "write", "p50_us", "p90_us", "p99_us", "max_us", "read", "p99_us");
+
+    std::vector<BenchResult> results;
+    for (size_t block : blocks)
+    {
+        for (bool sync : {false, true})
+        {
+            BenchResult result;
+            if (!bench_pass(buffer, block, total, sync, result))
+            {
+                free(buffer);
+                return;
+            }
+            printf("%7zu %5s %6" PRIu32 "K/s %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %6" PRIu32 "K/s %8" PRIu32 "\n",
+                   result.block, result.sync ? "yes" : "no", result.write_kbps,
+                   result.write_p50_us, result.write_p90_us, result.write_p99_us, result.write_max_us,
+                   result.read_kbps, result.read_p99_us);
+            results.push_back(result);
+        }
+    }
+    free(buffer);
+
+    // 建议: 不带 fsync 时达到峰值 90% 的最小块; 写入任务最长阻塞期间另一块缓冲能承接的速率
+    uint32_t peak = 0;
+    for (const BenchResult &result : results)
+    {
+        if (!result.sync)
+        {
+            peak = std::max(peak, result.write_kbps);
+        }
+    }
+    for (const BenchResult &result : results)
+    {
+        if (!result.sync && result.write_kbps * 100 >= peak * SUGGEST_PERCENT)
+        {
+            const uint32_t absorb_kbps = result.write_max_us ? static_cast<uint32_t>(static_cast<uint64_t>(result.block) * 1000000 / 1024 / result.write_max_us) : 0;
+            printf("suggested logger buffer_size: %zu bytes (%" PRIu32 "%% of peak %" PRIu32 " KiB/s)\n",
+                   result.block, result.write_kbps * 100 / std::max<uint32_t>(peak, 1), peak);
+            printf("  worst write stall %" PRIu32 " us, double buffering absorbs up to %" PRIu32 " KiB/s without blocking\n",
+                   result.write_max_us, absorb_kbps);
+            break;
+        }
+    }
+}
+
+// 控制台任务不直接改 _host/_slot_config, 由卡检测任务重挂, 与插拔及降速串行
+bool SDCard::remount(int width)
+{
+    return run_request(width == 1 ? REQUEST_WIDTH_1 : REQUEST_WIDTH_4) && is_mounted();
+}
+
+void SDCard::set_bus_width(int width)
+{
+    unmount_sd();
+    _slot_config.width = width;
+    if (width == 1)
+    {
+        _host.flags &= ~SDMMC_HOST_FLAG_4BIT;
+    }
+    else
+    {
+        _host.flags |= SDMMC_HOST_FLAG_4BIT;
+    }
+    _bus_width.store(width);
+    if (gpio_get_level(_det_pin) == 1)
+    {
+        mount_sd();
+    }
+}
+
+#if FF_USE_FASTSEEK
+// 用 FatFS 快速定位的簇链映射表统计片段数: 表长 = 片段数 * 2 + 1, 表不够时 f_lseek 返回所需长度
+static int count_fragments(const char *path)
+{
+    FIL *fil = new FIL;
+    if (f_open(fil, path, FA_READ) != FR_OK)
+    {
+        delete fil;
+        return -1;
+    }
+    DWORD table[16];
+    table[0] = sizeof(table) / sizeof(table[0]);
+    fil->cltbl = table;
+    const FRESULT res = f_lseek(fil, CREATE_LINKMAP);
+    f_close(fil);
+    delete fil;
+    if (res != FR_OK && res != FR_NOT_ENOUGH_CORE)
+    {
+        return -1;
+    }
+    return static_cast<int>((table[0] - 1) / 2);
+}
+#endif
+
+void SDCard::report_fragmentation(const std::string &dir)
+{
+#if FF_USE_FASTSEEK
+    const BYTE pdrv = ff_diskio_get_pdrv_card(_card);
+    if (pdrv == 0xFF)
+    {
+        ESP_LOGE(TAG, "Card is not registered with FatFS");
+        return;
+    }
+    if (dir.compare(0, _mount_point.size(), _mount_point) != 0)
+    {
+        printf("%s is not on %s\n", dir.c_str(), _mount_point.c_str());
+        return;
+    }
+
+    FATFS *fs = nullptr;
+    DWORD free_clusters = 0;
+    char drive[4];
+    snprintf(drive, sizeof(drive), "%u:", pdrv);
+    if (f_getfree(drive, &free_clusters, &fs) != FR_OK)
+    {
+        ESP_LOGE(TAG, "f_getfree failed");
+        return;
+    }
+    const uint32_t cluster_size = fs->csize * 512;
+
+    uint32_t files = 0;
+    uint32_t fragmented = 0;
+    uint64_t fragments = 0;
+    uint64_t bytes = 0;
+    int worst = 0;
+    std::string worst_path;
+
+    std::vector<std::pair<std::string, int>> pending{{dir, 0}};
+    while (!pending.empty())
+    {
+        const auto [path, depth] = pending.back();
+        pending.pop_back();
+
+        DIR *handle = opendir(path.c_str());
+        if (handle == nullptr)
+        {
+            continue;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(handle)) != nullptr)
+        {
+            const std::string child = path + "/" + entry->d_name;
+            if (entry->d_type == DT_DIR)
+            {
+                if (depth < MAX_DIR_DEPTH)
+                {
+                    pending.push_back({child, depth + 1});
+                }
+                continue;
+            }
+
+            struct stat st;
+            if (stat(child.c_str(), &st) != 0)
+            {
+                continue;
+            }
+            const std::string fatfs_path = drive + child.substr(_mount_point.size());
+            const int count = count_fragments(fatfs_path.c_str());
+            if (count < 0)
+            {
+                continue;
+            }
+
+            files++;
+            bytes += st.st_size;
+            fragments += count;
+            if (count > 1)
+            {
+                fragmented++;
+                printf("%6d %10ld  %s\n", count, static_cast<long>(st.st_size), child.c_str());
+            }
+            if (count > worst)
+            {
+                worst = count;
+                worst_path = child;
+            }
+        }
+        closedir(handle);
+    }
+
+    printf("%" PRIu32 " files, %" PRIu64 " bytes, cluster %" PRIu32 " bytes, %" PRIu32 " KiB free\n",
+           files, bytes, cluster_size, static_cast<uint32_t>(static_cast<uint64_t>(free_clusters) * cluster_size / 1024));
+    if (files > 0)
+    {
+        printf("%" PRIu32 " fragmented, %.2f fragments per file, worst %d (%s)\n",
+               fragmented, static_cast<double>(fragments) / files, worst, worst_path.c_str());
+    }
+#else
+    printf("Fragment report needs CONFIG_FATFS_USE_FASTSEEK\n");
+#endif
+}
+
+int SDCard::benchCommand(void *context, int argc, char **argv)
+{
+    SDCard *instance = static_cast<SDCard *>(context);
+
+    int nerrors = arg_parse(argc, argv, (void **)&bench_args);
+    if (nerrors != 0)
+    {
+        arg_print_errors(stderr, bench_args.end, argv[0]);
+        return 1;
+    }
+    if (!instance->is_mounted())
+    {
+        printf("SD card not mounted\n");
+        return 1;
+    }
+
+    if (bench_args.frag->count > 0)
+    {
+        instance->report_fragmentation(bench_args.frag->sval[0]);
+        return 0;
+    }
+
+    std::vector<size_t> blocks;
+    for (int i = 0; i < bench_args.block->count; i++)
+    {
+        const int block = bench_args.block->ival[i];
+        if (block < 512 || static_cast<size_t>(block) > MAX_BLOCK_SIZE || block % 512 != 0)
+        {
+            printf("Block size must be a multiple of 512 up to %zu\n", MAX_BLOCK_SIZE);
+            return 1;
+        }
+        blocks.push_back(block);
+    }
+    if (blocks.empty())
+    {
+        blocks.assign(std::begin(DEFAULT_BLOCKS), std::end(DEFAULT_BLOCKS));
+    }
+    const size_t total = static_cast<size_t>(bench_args.size->count > 0 ? std::max(bench_args.size->ival[0], 64) : DEFAULT_TOTAL_KB) * 1024;
+
+    // 换线宽需要重新挂载, 已打开的文件会失效
+    const int width = instance->_bus_width.load();
+    const int test_width = bench_args.width->count > 0 ? bench_args.width->ival[0] : width;
+    if (test_width != 1 && test_width != 4)
+    {
+        printf("Bus width must be 1 or 4\n");
+        return 1;
+    }
+    if (test_width != width)
+    {
+        printf("Remounting at %d-bit, open files on %s are invalidated\n", test_width, instance->_mount_point.c_str());
+        if (!instance->remount(test_width))
+        {
+            instance->remount(width);
+            return 1;
+        }
+    }
+
+    instance->run_benchmark(blocks, total);
+    printf("link errors since boot: %" PRIu32 "\n", instance->get_link_errors());
+
+    if (test_width != width && !instance->remount(width))
+    {
+        printf("Failed to restore %d-bit bus\n", width);
+        return 1;
+    }
+    return 0;
+}
+
+void SDCard::registerConsoleCommands()
+{
+    bench_args.size = arg_int0("s", "size", "<KiB>", "Bytes written per test (default 4096 KiB)");
+    bench_args.block = arg_intn("b", "block", "<bytes>", 0, 8, "Block size, repeatable (default 512..64K)");
+    bench_args.width = arg_int0("w", "width", "<1|4>", "Remount at this bus width for the test");
+    bench_args.frag = arg_str0("f", "frag", "<dir>", "Report FAT fragmentation of files under dir (e.g. /sdcard/twai) instead");
+    bench_args.end = arg_end(4);
+
+    const esp_console_cmd_t bench_cmd = {
+        .command = "sdbench",
+        .help = "Measure SD write/read throughput and latency, or report log fragmentation",
+        .hint = nullptr,
+        .func = nullptr,
+        .argtable = &bench_args,
+        .func_w_context = &SDCard::benchCommand,
+        .context = this,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&bench_cmd));
+}
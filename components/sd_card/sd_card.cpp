@@ -2,10 +2,14 @@
 #include <stdint.h>
 #include <sys/unistd.h>
 #include <errno.h>
+#include <inttypes.h>
 
 #include "sd_card.hpp"
 #include "esp_log.h"
 #include "esp_vfs_fat.h"
+#include "event_log.hpp"
+#include "boot_trace.hpp"
+#include "esp_timer.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
@@ -14,6 +18,8 @@
 
 static const uint32_t StackSize = 1024 * 5;
 
+SDCard *SDCard::_active = nullptr;
+
 void IRAM_ATTR SDCard::gpio_isr_handler(void *arg)
 {
     SDCard *instance = static_cast<SDCard *>(arg);
@@ -26,21 +32,81 @@ void SDCard::card_detect()
     {
         if (xSemaphoreTake(det_sem, pdMS_TO_TICKS(300)))
         {
+            const Request request = static_cast<Request>(_request.exchange(REQUEST_NONE));
+            if (request != REQUEST_NONE)
+            {
+                handle_request(request);
+                continue;
+            }
+
             vTaskDelay(pdMS_TO_TICKS(200));
             if (gpio_get_level(_det_pin) == 1)
             {
-                ESP_LOGI(TAG, "SD Card is Plug-In!");
-                mount_sd();
+                EVENT_LOG("sd: card inserted");
+                _speed.reset();
+                if (_exported.load())
+                {
+                    open_raw();
+                }
+                else
+                {
+                    mount_sd();
+                }
             }
             else
             {
-                ESP_LOGI(TAG, "SD Card is Plug-Out!");
+                EVENT_LOG("sd: card removed");
+                if (_exported.load())
+                {
+                    close_raw();
+                }
+                else
+                {
+                    unmount_sd();
+                }
+            }
+        }
+
+        // 链路错误过多: 卡仍在位时降一档重新挂载, 已打开的文件随之失效, 与拔插相同
+        if (_downgrade_requested.load() && is_mounted() && gpio_get_level(_det_pin) == 1)
+        {
+            if (_speed.step_down())
+            {
+                EVENT_LOG("sd: link errors, fall back to %s", _speed.current().name);
+                ESP_LOGW(TAG, "Link errors, remount at %s", _speed.current().name);
                 unmount_sd();
+                mount_sd();
             }
+            _downgrade_requested.store(false);
         }
     }
 }
 
+esp_err_t SDCard::transaction_hook(int slot, sdmmc_command_t *cmd)
+{
+    SDCard *instance = _active;
+    const esp_err_t err = instance->_base_transaction(slot, cmd);
+    if (err != ESP_OK && instance->is_mounted() && instance->_speed.on_transfer(err, esp_timer_get_time()))
+    {
+        instance->_downgrade_requested.store(true);
+    }
+    return err;
+}
+
+void SDCard::apply_speed(void)
+{
+    const SdSpeedPolicy::Step &step = _speed.current();
+    _host.max_freq_khz = step.freq_khz;
+    if (step.ddr)
+    {
+        _host.flags |= SDMMC_HOST_FLAG_DDR;
+    }
+    else
+    {
+        _host.flags &= ~SDMMC_HOST_FLAG_DDR;
+    }
+}
+
 SDCard::SDCard(gpio_num_t clk_pin,
                gpio_num_t cmd_pin,
                gpio_num_t d0_pin,
@@ -60,6 +126,9 @@ SDCard::SDCard(gpio_num_t clk_pin,
     gpio_config(&io_conf);
     // sd_evt_queue = xQueueCreate(1, sizeof(uint32_t));
     det_sem = xSemaphoreCreateBinary(); // 创建二进制信号量
+    _request_done = xSemaphoreCreateBinary();
+    _raw_lock = xSemaphoreCreateMutex();
+    _presence_lock = xSemaphoreCreateMutex();
 
     auto task_func = [](void *arg)
     {
@@ -85,7 +154,10 @@ SDCard::SDCard(gpio_num_t clk_pin,
     ESP_LOGI(TAG, "Initializing SD card");
     ESP_LOGI(TAG, "Using SDMMC peripheral");
 
-    _host.max_freq_khz = SDMMC_FREQ_HIGHSPEED;
+    // 统计每次传输的错误, 用于运行中降速
+    _active = this;
+    _base_transaction = _host.do_transaction;
+    _host.do_transaction = &SDCard::transaction_hook;
     _slot_config.width = 4;
 
     _slot_config.clk = _clk_pin;
@@ -118,10 +190,25 @@ void SDCard::mount_sd(void)
 {
     ESP_LOGI(TAG, "Mounting filesystem");
 
-    esp_err_t ret = esp_vfs_fat_sdmmc_mount(_mount_point.c_str(), &_host, &_slot_config, &mount_config, &_card);
+    // 从当前档开始, 链路错误时逐档降速重试
+    esp_err_t ret;
+    while (true)
+    {
+        apply_speed();
+        const uint32_t trace = BootTrace::begin("fat_mount");
+        ret = esp_vfs_fat_sdmmc_mount(_mount_point.c_str(), &_host, &_slot_config, &mount_config, &_card);
+        BootTrace::end(trace);
+        if (ret == ESP_OK || !_speed.on_mount_failed(ret))
+        {
+            break;
+        }
+        EVENT_LOG("sd: mount failed (%s), retry at %s", esp_err_to_name(ret), _speed.current().name);
+        ESP_LOGW(TAG, "Mount failed (%s), retry at %s", esp_err_to_name(ret), _speed.current().name);
+    }
 
     if (ret != ESP_OK)
     {
+        EVENT_LOG("sd: mount failed, %s", esp_err_to_name(ret));
         if (ret == ESP_FAIL)
         {
             ESP_LOGE(TAG, "Failed to mount filesystem. "
@@ -136,7 +223,12 @@ void SDCard::mount_sd(void)
         return;
     }
 
-    ESP_LOGI(TAG, "SD Card mounted at: %s", _mount_point.c_str());
+    _speed.on_mounted(_card->is_ddr);
+    const char *ddr = _card->is_ddr ? " DDR" : "";
+    EVENT_LOG("sd: mounted, %s %d kHz%s %d-bit", _speed.current().name, _card->real_freq_khz, ddr, 1 << _card->log_bus_width);
+    ESP_LOGI(TAG, "SD Card mounted at: %s (%s, %d kHz%s, %d-bit)", _mount_point.c_str(),
+             _speed.current().name, _card->real_freq_khz, ddr, 1 << _card->log_bus_width);
+    notify_presence(true);
 
     // sdmmc_card_print_info(stdout, card);
 
@@ -149,7 +241,14 @@ void SDCard::mount_sd(void)
 
 void SDCard::unmount_sd(void)
 {
+    // 订阅者先关闭文件, 卸载后旧文件描述符会被新挂载复用
+    if (is_mounted())
+    {
+        notify_presence(false);
+    }
     esp_vfs_fat_sdcard_unmount(_mount_point.c_str(), _card);
+    _card = nullptr;
+    EVENT_LOG("sd: unmounted");
     ESP_LOGI(TAG, "Card unmounted");
 }
 
@@ -162,6 +261,51 @@ void SDCard::format_sd(void)
     }
 }
 
+bool SDCard::is_mounted(void) const
+{
+    return _card != nullptr;
+}
+
+const char *SDCard::get_speed_name(void) const
+{
+    return _speed.current().name;
+}
+
+uint32_t SDCard::get_link_errors(void) const
+{
+    return _speed.get_error_total();
+}
+
+bool SDCard::add_presence_listener(PresenceCallback callback, void *context)
+{
+    // is_mounted() 在通知前后各有一段不一致的窗口(挂载后才通知, 卸载前先通知), 用最后一次通知的状态
+    xSemaphoreTake(_presence_lock, portMAX_DELAY);
+    const size_t index = _listener_count.load();
+    if (index >= MAX_LISTENERS)
+    {
+        xSemaphoreGive(_presence_lock);
+        ESP_LOGE(TAG, "Too many presence listeners");
+        return false;
+    }
+    _listeners[index] = {callback, context};
+    _listener_count.store(index + 1);
+    callback(_presence, context);
+    xSemaphoreGive(_presence_lock);
+    return true;
+}
+
+void SDCard::notify_presence(bool mounted)
+{
+    xSemaphoreTake(_presence_lock, portMAX_DELAY);
+    _presence = mounted;
+    const size_t count = _listener_count.load();
+    for (size_t i = 0; i < count; i++)
+    {
+        _listeners[i].callback(mounted, _listeners[i].context);
+    }
+    xSemaphoreGive(_presence_lock);
+}
+
 std::string SDCard::get_mount_path(void)
 {
     return _mount_point;
@@ -0,0 +1,193 @@
+#include "sd_card.hpp"
+
+#include <cstdlib>
+#include "esp_log.h"
+#include "event_log.hpp"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const uint32_t REQUEST_TIMEOUT_MS = 10000;
+
+static void deinit_host(sdmmc_host_t &host)
+{
+    if (host.flags & SDMMC_HOST_FLAG_DEINIT_ARG)
+    {
+        host.deinit_p(host.slot);
+    }
+    else
+    {
+        (*host.deinit)();
+    }
+}
+
+bool SDCard::run_request(Request request)
+{
+    // 借用卡检测信号量唤醒任务, 任务先看请求再看检测脚
+    _request.store(request);
+    xSemaphoreGive(det_sem);
+    if (xSemaphoreTake(_request_done, pdMS_TO_TICKS(REQUEST_TIMEOUT_MS)) != pdTRUE)
+    {
+        ESP_LOGE(TAG, "Card request %d timed out", request);
+        return false;
+    }
+    return true;
+}
+
+void SDCard::handle_request(Request request)
+{
+    switch (request)
+    {
+    case REQUEST_EXPORT:
+        if (!_exported.load())
+        {
+            // 订阅者先关闭文件, 日志转入暂存区或片上黑匣子
+            if (is_mounted())
+            {
+                unmount_sd();
+            }
+            _exported.store(true);
+            if (gpio_get_level(_det_pin) == 1)
+            {
+                open_raw();
+            }
+        }
+        break;
+
+    case REQUEST_RETURN:
+        if (_exported.load())
+        {
+            close_raw();
+            _exported.store(false);
+            if (gpio_get_level(_det_pin) == 1)
+            {
+                mount_sd();
+            }
+        }
+        break;
+
+    case REQUEST_WIDTH_1:
+    case REQUEST_WIDTH_4:
+        if (!_exported.load())
+        {
+            set_bus_width(request == REQUEST_WIDTH_1 ? 1 : 4);
+        }
+        break;
+
+    default:
+        break;
+    }
+    xSemaphoreGive(_request_done);
+}
+
+bool SDCard::open_raw(void)
+{
+    sdmmc_card_t *card = static_cast<sdmmc_card_t *>(calloc(1, sizeof(sdmmc_card_t)));
+    if (!card)
+    {
+        ESP_LOGE(TAG, "Failed to allocate card");
+        return false;
+    }
+
+    // 与 mount_sd 相同, 从当前档开始, 初始化失败时逐档降速
+    esp_err_t ret;
+    while (true)
+    {
+        apply_speed();
+        ret = (*_host.init)();
+        if (ret == ESP_OK)
+        {
+            ret = sdmmc_host_init_slot(_host.slot, &_slot_config);
+            if (ret == ESP_OK)
+            {
+                ret = sdmmc_card_init(&_host, card);
+            }
+            if (ret != ESP_OK)
+            {
+                deinit_host(_host);
+            }
+        }
+        if (ret == ESP_OK || !_speed.on_mount_failed(ret))
+        {
+            break;
+        }
+        ESP_LOGW(TAG, "Card init failed (%s), retry at %s", esp_err_to_name(ret), _speed.current().name);
+    }
+
+    if (ret != ESP_OK)
+    {
+        EVENT_LOG("sd: export init failed, %s", esp_err_to_name(ret));
+        ESP_LOGE(TAG, "Failed to initialize the card for export (%s)", esp_err_to_name(ret));
+        free(card);
+        return false;
+    }
+
+    _speed.on_mounted(card->is_ddr);
+    xSemaphoreTake(_raw_lock, portMAX_DELAY);
+    _raw_card = card;
+    xSemaphoreGive(_raw_lock);
+    EVENT_LOG("sd: exported, %s %d kHz", _speed.current().name, card->real_freq_khz);
+    ESP_LOGI(TAG, "Card exported (%s, %d kHz)", _speed.current().name, card->real_freq_khz);
+    return true;
+}
+
+void SDCard::close_raw(void)
+{
+    xSemaphoreTake(_raw_lock, portMAX_DELAY);
+    sdmmc_card_t *card = _raw_card;
+    _raw_card = nullptr;
+    xSemaphoreGive(_raw_lock);
+
+    if (card)
+    {
+        deinit_host(_host);
+        free(card);
+        EVENT_LOG("sd: export closed");
+    }
+}
+
+bool SDCard::export_card(void)
+{
+    if (!run_request(REQUEST_EXPORT))
+    {
+        return false;
+    }
+    xSemaphoreTake(_raw_lock, portMAX_DELAY);
+    const bool present = _raw_card != nullptr;
+    xSemaphoreGive(_raw_lock);
+    return present;
+}
+
+void SDCard::return_card(void)
+{
+    run_request(REQUEST_RETURN);
+}
+
+bool SDCard::is_exported(void) const
+{
+    return _exported.load();
+}
+
+uint32_t SDCard::raw_sector_count(void)
+{
+    xSemaphoreTake(_raw_lock, portMAX_DELAY);
+    const uint32_t count = _raw_card ? _raw_card->csd.capacity : 0;
+    xSemaphoreGive(_raw_lock);
+    return count;
+}
+
+esp_err_t SDCard::read_raw(uint32_t lba, uint32_t count, void *buffer)
+{
+    xSemaphoreTake(_raw_lock, portMAX_DELAY);
+    const esp_err_t ret = _raw_card ? sdmmc_read_sectors(_raw_card, buffer, lba, count) : ESP_ERR_INVALID_STATE;
+    xSemaphoreGive(_raw_lock);
+    return ret;
+}
+
+esp_err_t SDCard::write_raw(uint32_t lba, uint32_t count, const void *buffer)
+{
+    xSemaphoreTake(_raw_lock, portMAX_DELAY);
+    const esp_err_t ret = _raw_card ? sdmmc_write_sectors(_raw_card, buffer, lba, count) : ESP_ERR_INVALID_STATE;
+    xSemaphoreGive(_raw_lock);
+    return ret;
+}
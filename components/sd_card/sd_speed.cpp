@@ -0,0 +1,86 @@
+#include "sd_speed.hpp"
+
+#include "driver/sdmmc_host.h"
+
+const SdSpeedPolicy::Step SdSpeedPolicy::STEPS[STEP_COUNT] = {
+    {"HS DDR", SDMMC_FREQ_HIGHSPEED, true},
+    {"HS", SDMMC_FREQ_HIGHSPEED, false},
+    {"DS", SDMMC_FREQ_DEFAULT, false},
+    {"slow", 10000, false}, // 长线或接触不良时的保底档
+};
+
+void SdSpeedPolicy::reset()
+{
+    _index = 0;
+    _window_errors = 0;
+    _window_start_us = 0;
+}
+
+const SdSpeedPolicy::Step &SdSpeedPolicy::current() const
+{
+    return STEPS[_index];
+}
+
+size_t SdSpeedPolicy::get_index() const
+{
+    return _index;
+}
+
+bool SdSpeedPolicy::step_down()
+{
+    if (_index + 1 >= STEP_COUNT)
+    {
+        return false;
+    }
+    _index++;
+    _window_errors = 0;
+    return true;
+}
+
+bool SdSpeedPolicy::is_link_error(esp_err_t err)
+{
+    return err == ESP_ERR_TIMEOUT || err == ESP_ERR_INVALID_CRC || err == ESP_ERR_INVALID_RESPONSE;
+}
+
+bool SdSpeedPolicy::on_mount_failed(esp_err_t err)
+{
+    return is_link_error(err) && step_down();
+}
+
+void SdSpeedPolicy::on_mounted(bool ddr_active)
+{
+    if (STEPS[_index].ddr && !ddr_active)
+    {
+        _index++; // 同频 SDR 档, 之后出错再往下降
+    }
+    _window_errors = 0;
+}
+
+bool SdSpeedPolicy::on_transfer(esp_err_t err, int64_t now_us)
+{
+    if (!is_link_error(err))
+    {
+        return false;
+    }
+    _error_total++;
+
+    if (_window_errors == 0 || now_us - _window_start_us > ERROR_WINDOW_US)
+    {
+        _window_start_us = now_us;
+        _window_errors = 0;
+    }
+    _window_errors++;
+
+    // 报告一次后清零, 重挂前的后续错误重新累计
+    if (_window_errors >= ERROR_THRESHOLD && _index + 1 < STEP_COUNT)
+    {
+        _window_errors = 0;
+        return true;
+    }
+    return false;
+}
+
+uint32_t SdSpeedPolicy::get_error_total() const
+{
+    return _error_total;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+#include "can_frame.hpp"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "driver/twai.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_console.h"
+#include "argtable3/argtable3.h"
+
+    class TWAI_Device;
+
+    // SLCAN (Lawicel) 串口协议, 经 USB-CDC 供 slcand / python-can 使用.
+    // 协议层(命令解析、帧格式化)不依赖 RTOS 与 USB 栈, 可在主机上接 pty 测试; CDC 部分见 slcan_task.cpp.
+    // 与 gs_usb 相同, USB 与控制台共用片上 PHY, 需重启进入此模式.
+    //
+    // 支持的命令(以 \r 结尾, 成功回 \r, 失败回 \a):
+    //   Sn       设置波特率 0..8 = 10k 20k 50k 100k 125k 250k 500k 800k 1M, 仅在关闭时
+    //   O / L    打开 / 只听打开       C  关闭
+    //   tiiildd  标准帧  Tiiiiiiiildd 扩展帧  riiil / Riiiiiiiil 远程帧, 成功回 z\r / Z\r
+    //   Zn       接收帧后附 4 位十六进制毫秒时间戳(0..59999)
+    //   F 状态   V 版本   N 序列号   M/m/X 接受但忽略
+    class Slcan
+    {
+    public:
+        using OpenSink = bool (*)(uint32_t bitrate, bool listen_only, void *arg);
+        using TransmitSink = bool (*)(const twai_message_t &message, void *arg);
+
+        struct Stats
+        {
+            uint32_t rx_frames;  // 已格式化送往主机
+            uint32_t rx_dropped; // 主机来不及读
+            uint32_t tx_frames;  // 主机下发
+            uint32_t tx_failed;  // 发送队列满或格式错误
+        };
+
+        static constexpr size_t MAX_FRAME_TEXT = 32; // 最长的一行: T + 8 + 1 + 16 + 4 + \r
+
+        Slcan();
+        ~Slcan();
+
+        void set_open_sink(OpenSink sink, void *arg);
+        void set_transmit_sink(TransmitSink sink, void *arg);
+
+        // 输入主机发来的字节, 每遇到 \r 执行一条命令, 应答追加到 reply, 返回应答长度
+        size_t feed(const uint8_t *data, size_t length, char *reply, size_t reply_size);
+
+        // 格式化一帧接收, 通道未打开或空间不足返回 0
+        size_t format_frame(const CanFrameRecord &record, char *buffer, size_t size);
+        void count_dropped(uint32_t frames);
+
+        bool is_open() const { return _open.load(std::memory_order_acquire); }
+        uint32_t get_bitrate() const { return _bitrate; }
+        Stats get_stats() const;
+
+        // 以下为设备侧接口, 实现见 slcan_task.cpp
+        bool start(TWAI_Device &twai); // 安装 USB-CDC 并订阅 TWAI 接收, 是否启动由 UsbCanMode::take_boot_request 决定
+        void registerConsoleCommands();
+
+    private:
+        const char *TAG = "Slcan";
+        static const uint32_t StackSize = 3072;
+
+        static constexpr size_t LINE_SIZE = 32;
+
+        char _line[LINE_SIZE] = {};
+        size_t _line_length = 0;
+        bool _line_overflow = false;
+
+        uint32_t _bitrate = 500000;
+        bool _listen_only = false;
+        std::atomic<bool> _open{false};
+        std::atomic<bool> _timestamps{false};
+        std::atomic<bool> _overrun{false}; // F 命令读出后清除
+
+        OpenSink _open_sink = nullptr;
+        void *_open_arg = nullptr;
+        TransmitSink _transmit = nullptr;
+        void *_transmit_arg = nullptr;
+
+        std::atomic<uint32_t> _rx_frames{0};
+        std::atomic<uint32_t> _rx_dropped{0};
+        std::atomic<uint32_t> _tx_frames{0};
+        std::atomic<uint32_t> _tx_failed{0};
+
+        size_t execute(const char *line, size_t length, char *reply, size_t reply_size);
+        bool transmit(const char *line, size_t length);
+
+        // 设备侧
+        static constexpr size_t TX_BUFFER_SIZE = 2048;
+        static constexpr size_t REPLY_SIZE = 64;
+        static constexpr uint32_t WRITE_TIMEOUT_MS = 50;
+
+        int _subscription = -1;
+        TWAI_Device *_twai = nullptr;
+
+        // CDC 只由转发任务写入; USB 任务解析命令后把应答放入 _reply
+        char *_tx_buffer = nullptr;
+        char _reply[REPLY_SIZE] = {};
+        size_t _reply_length = 0;
+        SemaphoreHandle_t _reply_lock = nullptr;
+
+        friend struct SlcanCdc;
+
+        static bool open_twai(uint32_t bitrate, bool listen_only, void *arg);
+        static bool transmit_twai(const twai_message_t &message, void *arg);
+        bool write_all(const char *data, size_t length);
+        void forward_task();
+        static int command(int argc, char **argv);
+    };
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,328 @@
+#include "slcan.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include "esp_heap_caps.h"
+
+static const uint32_t BITRATES[] = {10000, 20000, 50000, 100000, 125000, 250000, 500000, 800000, 1000000};
+static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+static bool parse_hex(const char *text, size_t digits, uint32_t &value)
+{
+    value = 0;
+    for (size_t i = 0; i < digits; i++)
+    {
+        const char c = text[i];
+        uint32_t nibble;
+        if (c >= '0' && c <= '9')
+        {
+            nibble = c - '0';
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            nibble = c - 'A' + 10;
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            nibble = c - 'a' + 10;
+        }
+        else
+        {
+            return false;
+        }
+        value = (value << 4) | nibble;
+    }
+    return true;
+}
+
+static char *put_hex(char *out, uint32_t value, size_t digits)
+{
+    for (size_t i = digits; i > 0; i--)
+    {
+        out[i - 1] = HEX_DIGITS[value & 0xF];
+        value >>= 4;
+    }
+    return out + digits;
+}
+
+Slcan::Slcan()
+{
+}
+
+Slcan::~Slcan()
+{
+    heap_caps_free(_tx_buffer);
+}
+
+void Slcan::set_open_sink(OpenSink sink, void *arg)
+{
+    _open_sink = sink;
+    _open_arg = arg;
+}
+
+void Slcan::set_transmit_sink(TransmitSink sink, void *arg)
+{
+    _transmit = sink;
+    _transmit_arg = arg;
+}
+
+size_t Slcan::feed(const uint8_t *data, size_t length, char *reply, size_t reply_size)
+{
+    size_t reply_length = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        const char c = static_cast<char>(data[i]);
+        if (c == '\n')
+        {
+            continue; // 部分工具发送 \r\n
+        }
+        if (c != '\r')
+        {
+            if (_line_length < LINE_SIZE)
+            {
+                _line[_line_length++] = c;
+            }
+            else
+            {
+                _line_overflow = true;
+            }
+            continue;
+        }
+
+        // 应答最长 6 字节, 放不下时丢弃, 主机会超时重发
+        char response[8];
+        size_t response_length;
+        if (_line_overflow)
+        {
+            response[0] = '\a';
+            response_length = 1;
+        }
+        else
+        {
+            response_length = execute(_line, _line_length, response, sizeof(response));
+        }
+        if (reply_length + response_length <= reply_size)
+        {
+            memcpy(reply + reply_length, response, response_length);
+            reply_length += response_length;
+        }
+        _line_length = 0;
+        _line_overflow = false;
+    }
+    return reply_length;
+}
+
+size_t Slcan::execute(const char *line, size_t length, char *reply, size_t reply_size)
+{
+    static const char OK[] = "\r";
+    static const char ERROR[] = "\a";
+    const char *response = ERROR;
+
+    if (length == 0)
+    {
+        response = OK; // 空行用于同步
+    }
+    else
+    {
+        switch (line[0])
+        {
+        case 'S':
+            if (length == 2 && line[1] >= '0' && line[1] <= '8' && !is_open())
+            {
+                _bitrate = BITRATES[line[1] - '0'];
+                response = OK;
+            }
+            break;
+
+        case 'O':
+        case 'L':
+            if (length == 1 && !is_open())
+            {
+                const bool listen_only = line[0] == 'L';
+                if (!_open_sink || _open_sink(_bitrate, listen_only, _open_arg))
+                {
+                    _listen_only = listen_only;
+                    _open.store(true, std::memory_order_release);
+                    response = OK;
+                }
+            }
+            break;
+
+        case 'C':
+            // 工具启动时会先发 C, 已关闭也回成功
+            _open.store(false, std::memory_order_release);
+            response = OK;
+            break;
+
+        case 't':
+        case 'r':
+            if (transmit(line, length))
+            {
+                response = "z\r";
+            }
+            break;
+
+        case 'T':
+        case 'R':
+            if (transmit(line, length))
+            {
+                response = "Z\r";
+            }
+            break;
+
+        case 'Z':
+            if (length == 2 && (line[1] == '0' || line[1] == '1'))
+            {
+                _timestamps.store(line[1] == '1');
+                response = OK;
+            }
+            break;
+
+        case 'F':
+        {
+            // bit3 数据溢出
+            char status[5] = {'F', '0', '0', '\r', '\0'};
+            if (_overrun.exchange(false))
+            {
+                status[2] = '8';
+            }
+            const size_t status_length = std::min<size_t>(4, reply_size);
+            memcpy(reply, status, status_length);
+            return status_length;
+        }
+
+        case 'V':
+            response = "V1013\r";
+            break;
+
+        case 'N':
+            response = "NE32S\r";
+            break;
+
+        case 'M':
+        case 'm':
+        case 'X':
+        case 'W':
+            response = OK;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    const size_t response_length = std::min(strlen(response), reply_size);
+    memcpy(reply, response, response_length);
+    return response_length;
+}
+
+bool Slcan::transmit(const char *line, size_t length)
+{
+    if (!is_open() || _listen_only)
+    {
+        return false;
+    }
+
+    const bool extended = line[0] == 'T' || line[0] == 'R';
+    const bool remote = line[0] == 'r' || line[0] == 'R';
+    const size_t id_digits = extended ? 8 : 3;
+    uint32_t identifier;
+    uint32_t dlc;
+    if (length < 1 + id_digits + 1 ||
+        !parse_hex(line + 1, id_digits, identifier) ||
+        !parse_hex(line + 1 + id_digits, 1, dlc) || dlc > 8 ||
+        identifier > (extended ? 0x1FFFFFFFUL : 0x7FFUL))
+    {
+        _tx_failed++;
+        return false;
+    }
+
+    twai_message_t message;
+    memset(&message, 0, sizeof(message));
+    message.identifier = identifier;
+    message.extd = extended;
+    message.rtr = remote;
+    message.data_length_code = dlc;
+
+    const char *data = line + 1 + id_digits + 1;
+    const size_t data_digits = remote ? 0 : dlc * 2;
+    if (length != 1 + id_digits + 1 + data_digits)
+    {
+        _tx_failed++;
+        return false;
+    }
+    for (uint32_t i = 0; i < data_digits / 2; i++)
+    {
+        uint32_t byte;
+        if (!parse_hex(data + i * 2, 2, byte))
+        {
+            _tx_failed++;
+            return false;
+        }
+        message.data[i] = byte;
+    }
+
+    _tx_frames++;
+    if (_transmit && !_transmit(message, _transmit_arg))
+    {
+        _tx_failed++;
+        return false;
+    }
+    return true;
+}
+
+size_t Slcan::format_frame(const CanFrameRecord &record, char *buffer, size_t size)
+{
+    if (!is_open() || size < MAX_FRAME_TEXT)
+    {
+        return 0;
+    }
+
+    // 逐位查表, 比格式化函数快得多, 1Mbit/s 满负载时也跟得上
+    const twai_message_t &message = record.message;
+    const uint8_t dlc = std::min<uint8_t>(message.data_length_code, 8);
+    char *out = buffer;
+    if (message.extd)
+    {
+        *out++ = message.rtr ? 'R' : 'T';
+        out = put_hex(out, message.identifier & 0x1FFFFFFFUL, 8);
+    }
+    else
+    {
+        *out++ = message.rtr ? 'r' : 't';
+        out = put_hex(out, message.identifier & 0x7FFUL, 3);
+    }
+    *out++ = HEX_DIGITS[dlc];
+    if (!message.rtr)
+    {
+        for (uint8_t i = 0; i < dlc; i++)
+        {
+            out = put_hex(out, message.data[i], 2);
+        }
+    }
+    if (_timestamps.load(std::memory_order_relaxed))
+    {
+        out = put_hex(out, static_cast<uint32_t>((record.timestamp_us / 1000) % 60000), 4);
+    }
+    *out++ = '\r';
+
+    _rx_frames++;
+    return out - buffer;
+}
+
+void Slcan::count_dropped(uint32_t frames)
+{
+    _rx_frames -= frames;
+    _rx_dropped += frames;
+    _overrun = true;
+}
+
+Slcan::Stats Slcan::get_stats() const
+{
+    return {
+        .rx_frames = _rx_frames.load(),
+        .rx_dropped = _rx_dropped.load(),
+        .tx_frames = _tx_frames.load(),
+        .tx_failed = _tx_failed.load(),
+    };
+}
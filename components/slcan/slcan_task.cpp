@@ -0,0 +1,228 @@
+#include "slcan.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include "twai_device.hpp"
+#include "usb_can_mode.hpp"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "tinyusb.h"
+#include "tusb_cdc_acm.h"
+
+#define SLCAN_DESC_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN)
+
+enum
+{
+    ITF_NUM_CDC = 0,
+    ITF_NUM_CDC_DATA,
+    ITF_NUM_TOTAL
+};
+
+enum
+{
+    EDPT_CDC_NOTIF = 0x81,
+    EDPT_CDC_OUT = 0x02,
+    EDPT_CDC_IN = 0x82,
+};
+
+static const uint16_t EDPT_SIZE = 64;
+
+static const UsbCanMode::DeviceInfo device_info = {
+    .vendor_id = 0x303A, // This is Espressif VID. This needs to be changed according to Users / Customers
+    .product_id = 0x4002,
+    .iad = true,
+    .product = "SLCAN CAN Logger",
+    .interface_name = "SLCAN",
+};
+
+static uint8_t const slcan_configuration_desc[] = {
+    // Config number, interface count, string index, total length, attribute, power in mA
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, SLCAN_DESC_TOTAL_LEN, 0, 100),
+
+    // Interface number, string index, EP notification address and size, EP data address (out, in) and size
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 4, EDPT_CDC_NOTIF, 8, EDPT_CDC_OUT, EDPT_CDC_IN, EDPT_SIZE),
+};
+
+// CDC 接收回调运行在 TinyUSB 任务中, 只解析命令, 应答交给转发任务写出
+struct SlcanCdc
+{
+    static inline Slcan *instance = nullptr;
+
+    static void rx_callback(int itf, cdcacm_event_t *event)
+    {
+        (void)event;
+        uint8_t buffer[CONFIG_TINYUSB_CDC_RX_BUFSIZE];
+        size_t length = 0;
+        if (!instance || tinyusb_cdcacm_read(static_cast<tinyusb_cdcacm_itf_t>(itf), buffer, sizeof(buffer), &length) != ESP_OK)
+        {
+            return;
+        }
+
+        char reply[Slcan::REPLY_SIZE];
+        const size_t reply_length = instance->feed(buffer, length, reply, sizeof(reply));
+        if (reply_length == 0)
+        {
+            return;
+        }
+        xSemaphoreTake(instance->_reply_lock, portMAX_DELAY);
+        const size_t copy = std::min(reply_length, sizeof(instance->_reply) - instance->_reply_length);
+        memcpy(instance->_reply + instance->_reply_length, reply, copy);
+        instance->_reply_length += copy;
+        xSemaphoreGive(instance->_reply_lock);
+    }
+};
+
+bool Slcan::open_twai(uint32_t bitrate, bool listen_only, void *arg)
+{
+    TWAI_Device *twai = static_cast<TWAI_Device *>(arg);
+    const twai_mode_t mode = listen_only ? TWAI_MODE_LISTEN_ONLY : TWAI_MODE_NORMAL;
+    if (twai->get_bitrate() == bitrate && twai->get_mode() == mode)
+    {
+        return true;
+    }
+    return twai->reconfigure(bitrate, mode) == ESP_OK;
+}
+
+bool Slcan::transmit_twai(const twai_message_t &message, void *arg)
+{
+    // 发送队列满时回 \a, 不阻塞 USB 任务
+    return static_cast<TWAI_Device *>(arg)->send_message(message, 0);
+}
+
+bool Slcan::write_all(const char *data, size_t length)
+{
+    const uint8_t *cursor = reinterpret_cast<const uint8_t *>(data);
+    while (length > 0)
+    {
+        const size_t queued = tinyusb_cdcacm_write_queue(TINYUSB_CDC_ACM_0, cursor, length);
+        cursor += queued;
+        length -= queued;
+        if (length > 0 || queued == 0)
+        {
+            // 发送缓冲已满或主机未打开串口, 超时则放弃这一批
+            if (tinyusb_cdcacm_write_flush(TINYUSB_CDC_ACM_0, pdMS_TO_TICKS(WRITE_TIMEOUT_MS)) != ESP_OK)
+            {
+                return false;
+            }
+        }
+    }
+    tinyusb_cdcacm_write_flush(TINYUSB_CDC_ACM_0, 0);
+    return true;
+}
+
+void Slcan::forward_task()
+{
+    CanRxDispatcher &dispatcher = _twai->get_rx_dispatcher();
+    CanFrameRecord record;
+    char reply[REPLY_SIZE];
+
+    while (true)
+    {
+        // 短超时, 没有总线流量时也能及时送出命令应答
+        const bool received = dispatcher.receive(_subscription, record, pdMS_TO_TICKS(5));
+
+        xSemaphoreTake(_reply_lock, portMAX_DELAY);
+        const size_t reply_length = _reply_length;
+        memcpy(reply, _reply, reply_length);
+        _reply_length = 0;
+        xSemaphoreGive(_reply_lock);
+        if (reply_length > 0)
+        {
+            write_all(reply, reply_length);
+        }
+
+        if (!received)
+        {
+            continue;
+        }
+        // 取完已到的帧拼成一批, 一次写入减少 USB 事务
+        size_t length = 0;
+        uint32_t frames = 0;
+        do
+        {
+            const size_t text = format_frame(record, _tx_buffer + length, TX_BUFFER_SIZE - length);
+            if (text > 0)
+            {
+                length += text;
+                frames++;
+            }
+        } while (TX_BUFFER_SIZE - length >= MAX_FRAME_TEXT && dispatcher.receive(_subscription, record, 0));
+
+        if (length > 0 && !write_all(_tx_buffer, length))
+        {
+            count_dropped(frames);
+        }
+    }
+}
+
+bool Slcan::start(TWAI_Device &twai)
+{
+    _tx_buffer = static_cast<char *>(heap_caps_malloc(TX_BUFFER_SIZE, MALLOC_CAP_INTERNAL));
+    _reply_lock = xSemaphoreCreateMutex();
+    if (!_tx_buffer || !_reply_lock)
+    {
+        ESP_LOGE(TAG, "Failed to allocate buffers");
+        return false;
+    }
+    _subscription = twai.get_rx_dispatcher().subscribe("slcan", 256);
+    if (_subscription < 0)
+    {
+        ESP_LOGE(TAG, "Subscribe TWAI RX failed");
+        return false;
+    }
+    _twai = &twai;
+    set_open_sink(&Slcan::open_twai, &twai);
+    set_transmit_sink(&Slcan::transmit_twai, &twai);
+    SlcanCdc::instance = this;
+
+    esp_err_t ret = UsbCanMode::install_driver(device_info, slcan_configuration_desc);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "USB driver install failed: %s", esp_err_to_name(ret));
+        SlcanCdc::instance = nullptr;
+        return false;
+    }
+
+    const tinyusb_config_cdcacm_t acm_cfg = {
+        .usb_dev = TINYUSB_USBDEV_0,
+        .cdc_port = TINYUSB_CDC_ACM_0,
+        .rx_unread_buf_sz = 64,
+        .callback_rx = &SlcanCdc::rx_callback,
+        .callback_rx_wanted_char = NULL,
+        .callback_line_state_changed = NULL,
+        .callback_line_coding_changed = NULL,
+    };
+    ret = tusb_cdc_acm_init(&acm_cfg);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "CDC-ACM init failed: %s", esp_err_to_name(ret));
+        SlcanCdc::instance = nullptr;
+        return false;
+    }
+
+    auto task_func = [](void *arg)
+    {
+        Slcan *instance = static_cast<Slcan *>(arg);
+        instance->forward_task();
+    };
+    xTaskCreatePinnedToCore(task_func, "slcan", StackSize, this, 2, nullptr, tskNO_AFFINITY);
+
+    ESP_LOGI(TAG, "SLCAN device started, USB console unavailable until reset");
+    return true;
+}
+
+int Slcan::command(int argc, char **argv)
+{
+    return UsbCanMode::reboot_into(UsbCanMode::Mode::SLCAN);
+}
+
+void Slcan::registerConsoleCommands()
+{
+    const esp_console_cmd_t cmd = {
+        .command = "slcan",
+        .help = "Reboot as an SLCAN (Lawicel) USB serial adapter until the next reset",
+        .hint = NULL,
+        .func = &Slcan::command,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+}
@@ -0,0 +1,206 @@
+#include "can_frame_cache.hpp"
+
+#include <cstring>
+
+static portMUX_TYPE subscriber_lock = portMUX_INITIALIZER_UNLOCKED;
+
+CanFrameCache::CanFrameCache() : _slots(new Slot[CAPACITY])
+{
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+
+    for (size_t i = 0; i < CAPACITY; i++)
+    {
+        Slot &slot = _slots[i];
+        slot.key.store(0, std::memory_order_relaxed);
+        slot.sequence.store(0, std::memory_order_relaxed);
+        slot.update_count = 0;
+    }
+    for (Subscriber &subscriber : _subscribers)
+    {
+        subscriber.active.store(false, std::memory_order_relaxed);
+    }
+}
+
+CanFrameCache::~CanFrameCache()
+{
+}
+
+uint32_t CanFrameCache::make_key(uint32_t identifier, bool extended)
+{
+    return (identifier & 0x1FFFFFFF) | KEY_VALID | (extended ? KEY_EXTENDED : 0);
+}
+
+// 开放寻址, 线性探测; 槽位只增不删, 读者无需加锁即可安全探测
+CanFrameCache::Slot *CanFrameCache::find_slot(uint32_t key, bool insert)
+{
+    size_t index = (key * 2654435761UL) & (CAPACITY - 1);
+    for (size_t probe = 0; probe < CAPACITY; probe++)
+    {
+        Slot &slot = _slots[(index + probe) & (CAPACITY - 1)];
+        uint32_t slot_key = slot.key.load(std::memory_order_acquire);
+        if (slot_key == key)
+        {
+            return &slot;
+        }
+        if (slot_key == 0)
+        {
+            if (!insert)
+            {
+                return nullptr;
+            }
+            slot.key.store(key, std::memory_order_release);
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+const CanFrameCache::Slot *CanFrameCache::find_slot(uint32_t key) const
+{
+    return const_cast<CanFrameCache *>(this)->find_slot(key, false);
+}
+
+void CanFrameCache::update(const CanFrameRecord &record)
+{
+    const uint32_t key = make_key(record.message.identifier, record.message.extd);
+    Slot *slot = find_slot(key, true);
+    if (slot == nullptr)
+    {
+        _overflow_count.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // 只有写者会修改槽内容, 这里可以直接比较旧值
+    const bool changed = slot->update_count == 0 ||
+                         slot->record.message.data_length_code != record.message.data_length_code ||
+                         memcmp(slot->record.message.data, record.message.data, sizeof(record.message.data)) != 0;
+
+    uint32_t seq = slot->sequence.load(std::memory_order_relaxed);
+    slot->sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->record = record;
+    slot->update_count++;
+    slot->sequence.store(seq + 2, std::memory_order_release);
+
+    if (changed)
+    {
+        notify(record, key);
+    }
+}
+
+bool CanFrameCache::read(uint32_t key, CanFrameRecord &record, uint32_t *update_count) const
+{
+    const Slot *slot = find_slot(key);
+    if (slot == nullptr)
+    {
+        return false;
+    }
+
+    // 写者被抢占时序列号保持奇数; 读者优先级更高时自旋等不到它写完, 多次失败后让出 CPU.
+    // taskYIELD 只让给同优先级任务, 写者优先级可能更低, 所以用 vTaskDelay
+    uint32_t before, after, count;
+    int attempts = 0;
+    do
+    {
+        if (attempts++ >= READ_SPIN_LIMIT)
+        {
+            vTaskDelay(1);
+        }
+        before = slot->sequence.load(std::memory_order_acquire);
+        if (before & 1)
+        {
+            continue; // 写者正在更新
+        }
+        record = slot->record;
+        count = slot->update_count;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = slot->sequence.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+
+    if (update_count)
+    {
+        *update_count = count;
+    }
+    return count > 0;
+}
+
+int CanFrameCache::add_subscriber(uint32_t key, Callback callback, void *arg, TaskHandle_t task, uint32_t notify_bits)
+{
+    int handle = -1;
+    portENTER_CRITICAL(&subscriber_lock);
+    for (size_t i = 0; i < MAX_SUBSCRIBERS; i++)
+    {
+        Subscriber &subscriber = _subscribers[i];
+        if (!subscriber.active.load(std::memory_order_relaxed))
+        {
+            subscriber.key = key;
+            subscriber.callback = callback;
+            subscriber.arg = arg;
+            subscriber.task = task;
+            subscriber.notify_bits = notify_bits;
+            subscriber.active.store(true, std::memory_order_release);
+            handle = static_cast<int>(i);
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&subscriber_lock);
+    return handle;
+}
+
+int CanFrameCache::subscribe(uint32_t key, Callback callback, void *arg)
+{
+    if (callback == nullptr)
+    {
+        return -1;
+    }
+    return add_subscriber(key, callback, arg, nullptr, 0);
+}
+
+int CanFrameCache::subscribe(uint32_t key, TaskHandle_t task, uint32_t notify_bits)
+{
+    if (task == nullptr)
+    {
+        return -1;
+    }
+    return add_subscriber(key, nullptr, nullptr, task, notify_bits);
+}
+
+// 取消后写者可能还在执行本次回调, 回调参数的生命周期需覆盖这一窗口
+void CanFrameCache::unsubscribe(int handle)
+{
+    if (handle < 0 || static_cast<size_t>(handle) >= MAX_SUBSCRIBERS)
+    {
+        return;
+    }
+    portENTER_CRITICAL(&subscriber_lock);
+    _subscribers[handle].active.store(false, std::memory_order_release);
+    portEXIT_CRITICAL(&subscriber_lock);
+}
+
+void CanFrameCache::notify(const CanFrameRecord &record, uint32_t key)
+{
+    for (Subscriber &subscriber : _subscribers)
+    {
+        if (!subscriber.active.load(std::memory_order_acquire))
+        {
+            continue;
+        }
+        if (subscriber.key != ANY_ID && subscriber.key != key)
+        {
+            continue;
+        }
+        if (subscriber.callback)
+        {
+            subscriber.callback(record, subscriber.arg);
+        }
+        else
+        {
+            xTaskNotify(subscriber.task, subscriber.notify_bits, eSetBits);
+        }
+    }
+}
+
+uint32_t CanFrameCache::get_overflow_count() const
+{
+    return _overflow_count.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,205 @@
+#include "can_rx_dispatcher.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cinttypes>
+
+#include "esp_log.h"
+
+static const char *TAG = "CanRxDispatcher";
+
+static_assert(configTASK_NOTIFICATION_ARRAY_ENTRIES > CanRxDispatcher::NOTIFY_INDEX,
+              "CONFIG_FREERTOS_TASK_NOTIFICATION_ARRAY_ENTRIES must be at least 2");
+
+static portMUX_TYPE subscribe_lock = portMUX_INITIALIZER_UNLOCKED;
+
+CanRxDispatcher::CanRxDispatcher()
+{
+    for (Subscriber &subscriber : _subscribers)
+    {
+        subscriber.name = nullptr;
+        subscriber.ring = nullptr;
+        subscriber.mask_bits = 0;
+        subscriber.filter_id = 0;
+        subscriber.filter_mask = 0;
+        subscriber.head.store(0, std::memory_order_relaxed);
+        subscriber.tail.store(0, std::memory_order_relaxed);
+        subscriber.waiter.store(nullptr, std::memory_order_relaxed);
+        subscriber.signal.store(nullptr, std::memory_order_relaxed);
+        subscriber.overflow.store(0, std::memory_order_relaxed);
+        subscriber.delivered.store(0, std::memory_order_relaxed);
+    }
+}
+
+CanRxDispatcher::~CanRxDispatcher()
+{
+    for (Subscriber &subscriber : _subscribers)
+    {
+        free(subscriber.ring);
+    }
+}
+
+bool CanRxDispatcher::valid(int handle) const
+{
+    return handle >= 0 && static_cast<size_t>(handle) < _subscriber_count.load(std::memory_order_acquire);
+}
+
+int CanRxDispatcher::subscribe(const char *name, size_t depth, uint32_t id, uint32_t mask)
+{
+    size_t capacity = 2;
+    while (capacity < depth)
+    {
+        capacity <<= 1;
+    }
+
+    CanFrameRecord *ring = static_cast<CanFrameRecord *>(calloc(capacity, sizeof(CanFrameRecord)));
+    if (ring == nullptr)
+    {
+        ESP_LOGE(TAG, "No memory for subscriber %s (%zu frames)", name, capacity);
+        return -1;
+    }
+
+    // 订阅者只增不减; 先填好槽位再发布计数, 生产者看到计数时槽位已完整
+    int handle = -1;
+    portENTER_CRITICAL(&subscribe_lock);
+    const size_t count = _subscriber_count.load(std::memory_order_relaxed);
+    if (count < MAX_SUBSCRIBERS)
+    {
+        Subscriber &subscriber = _subscribers[count];
+        subscriber.name = name;
+        subscriber.ring = ring;
+        subscriber.mask_bits = static_cast<uint32_t>(capacity - 1);
+        subscriber.filter_id = id;
+        subscriber.filter_mask = mask;
+        _subscriber_count.store(count + 1, std::memory_order_release);
+        handle = static_cast<int>(count);
+    }
+    portEXIT_CRITICAL(&subscribe_lock);
+
+    if (handle < 0)
+    {
+        ESP_LOGE(TAG, "Too many subscribers, %s rejected", name);
+        free(ring);
+    }
+    return handle;
+}
+
+void CanRxDispatcher::publish(const CanFrameRecord &record)
+{
+    const size_t count = _subscriber_count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; i++)
+    {
+        Subscriber &subscriber = _subscribers[i];
+        if (((record.message.identifier ^ subscriber.filter_id) & subscriber.filter_mask) != 0)
+        {
+            continue;
+        }
+
+        const uint32_t head = subscriber.head.load(std::memory_order_relaxed);
+        const uint32_t tail = subscriber.tail.load(std::memory_order_acquire);
+        if (head - tail > subscriber.mask_bits)
+        {
+            // 环已满: 丢弃新帧, 只影响这一个订阅者
+            subscriber.overflow.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        subscriber.ring[head & subscriber.mask_bits] = record;
+        subscriber.delivered.fetch_add(1, std::memory_order_relaxed);
+
+        // 只有消费者声明了正在等待才唤醒, 避免每帧一次通知.
+        // 写 head 再读 waiter, 与消费者写 waiter 再读 head 是 Dekker 式握手, 四个操作都要 seq_cst:
+        // release/acquire 允许双方都读到旧值, 消费者睡下而生产者没有唤醒
+        subscriber.head.store(head + 1, std::memory_order_seq_cst);
+        TaskHandle_t waiter = subscriber.waiter.exchange(nullptr, std::memory_order_seq_cst);
+        if (waiter != nullptr)
+        {
+            xTaskNotifyGiveIndexed(waiter, NOTIFY_INDEX);
+        }
+        SemaphoreHandle_t signal = subscriber.signal.exchange(nullptr, std::memory_order_seq_cst);
+        if (signal != nullptr)
+        {
+            xSemaphoreGive(signal);
+        }
+    }
+}
+
+bool CanRxDispatcher::receive(int handle, CanFrameRecord &record, TickType_t timeout)
+{
+    if (!valid(handle))
+    {
+        return false;
+    }
+    Subscriber &subscriber = _subscribers[handle];
+
+    const TickType_t start = xTaskGetTickCount();
+    while (true)
+    {
+        const uint32_t tail = subscriber.tail.load(std::memory_order_relaxed);
+        if (subscriber.head.load(std::memory_order_acquire) != tail)
+        {
+            record = subscriber.ring[tail & subscriber.mask_bits];
+            subscriber.tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        const TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout)
+        {
+            return false;
+        }
+
+        // 登记后再检查一次, 防止生产者在两次检查之间写入而漏掉唤醒; 与 publish 的握手需 seq_cst
+        subscriber.waiter.store(xTaskGetCurrentTaskHandle(), std::memory_order_seq_cst);
+        if (subscriber.head.load(std::memory_order_seq_cst) == tail)
+        {
+            ulTaskNotifyTakeIndexed(NOTIFY_INDEX, pdTRUE, timeout == portMAX_DELAY ? portMAX_DELAY : timeout - elapsed);
+        }
+        subscriber.waiter.store(nullptr, std::memory_order_release);
+    }
+}
+
+bool CanRxDispatcher::arm(int handle, SemaphoreHandle_t signal)
+{
+    if (!valid(handle))
+    {
+        return false;
+    }
+    Subscriber &subscriber = _subscribers[handle];
+
+    // 同 receive: 登记后再检查一次; 撤销登记时生产者可能已经 give 过, 消费者多醒一次而已
+    subscriber.signal.store(signal, std::memory_order_seq_cst);
+    if (subscriber.head.load(std::memory_order_seq_cst) != subscriber.tail.load(std::memory_order_relaxed))
+    {
+        subscriber.signal.store(nullptr, std::memory_order_release);
+        return false;
+    }
+    return true;
+}
+
+uint32_t CanRxDispatcher::get_overflow_count(int handle) const
+{
+    return valid(handle) ? _subscribers[handle].overflow.load(std::memory_order_relaxed) : 0;
+}
+
+uint32_t CanRxDispatcher::get_delivered_count(int handle) const
+{
+    return valid(handle) ? _subscribers[handle].delivered.load(std::memory_order_relaxed) : 0;
+}
+
+void CanRxDispatcher::print_stats() const
+{
+    const size_t count = _subscriber_count.load(std::memory_order_acquire);
+    printf("%-12s %6s %6s %10s %10s\n", "subscriber", "depth", "used", "delivered", "overflow");
+    for (size_t i = 0; i < count; i++)
+    {
+        const Subscriber &subscriber = _subscribers[i];
+        const uint32_t used = subscriber.head.load(std::memory_order_relaxed) - subscriber.tail.load(std::memory_order_relaxed);
+        printf("%-12s %6" PRIu32 " %6" PRIu32 " %10" PRIu32 " %10" PRIu32 "\n",
+               subscriber.name,
+               subscriber.mask_bits + 1,
+               used,
+               subscriber.delivered.load(std::memory_order_relaxed),
+               subscriber.overflow.load(std::memory_order_relaxed));
+    }
+}
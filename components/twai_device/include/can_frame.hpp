@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "driver/twai.h"
+
+    // 带时间戳与通道号的CAN帧, 所有CAN控制器(片上TWAI/SPI扩展)统一使用此格式入队
+    struct CanFrameRecord
+    {
+        int64_t timestamp_us;   // 接收时刻, 相对 origin_time 的微秒数
+        uint8_t channel;        // ASC 通道号(从1开始)
+        twai_message_t message; // 原始帧
+    };
+
+#ifdef __cplusplus
+}
+#endif
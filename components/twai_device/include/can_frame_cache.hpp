@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <array>
+#include <memory>
+
+#include "can_frame.hpp"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+    // 按CAN ID索引的最新帧缓存
+    // 单写者(TWAI接收任务)更新, 任意任务通过序列锁无锁读取;
+    // 订阅者在对应ID的数据发生变化时收到回调或任务通知
+    class CanFrameCache
+    {
+    public:
+        static constexpr size_t CAPACITY = 128; // 必须是2的幂
+        static constexpr size_t MAX_SUBSCRIBERS = 16;
+        static constexpr uint32_t ANY_ID = 0;   // 订阅所有ID
+
+        // 在写者任务上下文中调用, 必须尽快返回
+        using Callback = void (*)(const CanFrameRecord &record, void *arg);
+
+        CanFrameCache();
+        ~CanFrameCache();
+
+        // 生成缓存键: 标准帧与扩展帧的同值ID互不冲突
+        static uint32_t make_key(uint32_t identifier, bool extended);
+
+        // 写者: 更新缓存, 数据变化时通知订阅者
+        void update(const CanFrameRecord &record);
+
+        // 读者: 读取某ID的最新帧, update_count 返回该ID累计更新次数; 写者正在更新时可能休眠, 不可在中断中调用
+        bool read(uint32_t key, CanFrameRecord &record, uint32_t *update_count = nullptr) const;
+
+        // 订阅, 返回句柄, 失败返回 -1
+        int subscribe(uint32_t key, Callback callback, void *arg);
+        int subscribe(uint32_t key, TaskHandle_t task, uint32_t notify_bits);
+        void unsubscribe(int handle);
+
+        // 缓存已满而未能记录的帧数
+        uint32_t get_overflow_count() const;
+
+    private:
+        static constexpr uint32_t KEY_EXTENDED = 0x80000000UL;
+        static constexpr uint32_t KEY_VALID = 0x40000000UL; // 0 表示空槽
+        static constexpr int READ_SPIN_LIMIT = 8;           // 读者连续重试次数, 超过后每次重试前休眠一个 tick
+
+        struct Slot
+        {
+            std::atomic<uint32_t> key;      // 写入后不再改变
+            std::atomic<uint32_t> sequence; // 奇数表示正在写
+            uint32_t update_count;
+            CanFrameRecord record;
+        };
+
+        struct Subscriber
+        {
+            std::atomic<bool> active;
+            uint32_t key;
+            Callback callback;
+            void *arg;
+            TaskHandle_t task;
+            uint32_t notify_bits;
+        };
+
+        std::unique_ptr<Slot[]> _slots; // 约 6.5KB, 放在堆上, 缓存所在对象可以是任务栈上的局部变量
+        std::array<Subscriber, MAX_SUBSCRIBERS> _subscribers;
+        std::atomic<uint32_t> _overflow_count{0};
+
+        Slot *find_slot(uint32_t key, bool insert);
+        const Slot *find_slot(uint32_t key) const;
+        int add_subscriber(uint32_t key, Callback callback, void *arg, TaskHandle_t task, uint32_t notify_bits);
+        void notify(const CanFrameRecord &record, uint32_t key);
+    };
+
+#ifdef __cplusplus
+}
+#endif
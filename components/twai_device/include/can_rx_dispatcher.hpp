@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <array>
+
+#include "can_frame.hpp"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+    // 接收帧广播分发: 每个订阅者独占一个单生产者/单消费者环形缓冲,
+    // 接收任务无锁写入所有匹配的环, 某个订阅者处理慢只会让它自己溢出
+    class CanRxDispatcher
+    {
+    public:
+        static constexpr size_t MAX_SUBSCRIBERS = 8;
+        // 消费者阻塞等待用的任务通知索引; 索引 0 留给 CanFrameCache 的 eSetBits 订阅等, 两者互不干扰
+        static constexpr UBaseType_t NOTIFY_INDEX = 1;
+
+        CanRxDispatcher();
+        ~CanRxDispatcher();
+
+        // 注册订阅者, depth 向上取整为2的幂; 过滤条件 ((identifier ^ id) & mask) == 0, mask 为 0 时接收全部
+        // 返回句柄, 失败返回 -1
+        int subscribe(const char *name, size_t depth, uint32_t id = 0, uint32_t mask = 0);
+
+        // 生产者: 只能由一个任务调用
+        void publish(const CanFrameRecord &record);
+
+        // 消费者: 每个句柄只能由一个任务调用
+        bool receive(int handle, CanFrameRecord &record, TickType_t timeout);
+
+        // 消费者同时等待其他队列时用: 环为空则登记 signal 并返回 true, 下一帧写入时生产者 give 一次 signal,
+        // signal 可以放进队列集; 环里已有帧返回 false, 不需要等待
+        bool arm(int handle, SemaphoreHandle_t signal);
+
+        uint32_t get_overflow_count(int handle) const;
+        uint32_t get_delivered_count(int handle) const;
+
+        void print_stats() const;
+
+    private:
+        struct Subscriber
+        {
+            const char *name;
+            CanFrameRecord *ring;
+            uint32_t mask_bits; // depth - 1
+            uint32_t filter_id;
+            uint32_t filter_mask;
+            std::atomic<uint32_t> head;   // 生产者写
+            std::atomic<uint32_t> tail;   // 消费者写
+            std::atomic<TaskHandle_t> waiter; // 阻塞等待中的消费者
+            std::atomic<SemaphoreHandle_t> signal; // arm() 登记的唤醒信号量
+            std::atomic<uint32_t> overflow;
+            std::atomic<uint32_t> delivered;
+        };
+
+        std::array<Subscriber, MAX_SUBSCRIBERS> _subscribers;
+        std::atomic<size_t> _subscriber_count{0};
+
+        bool valid(int handle) const;
+    };
+
+#ifdef __cplusplus
+}
+#endif
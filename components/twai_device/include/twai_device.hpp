@@ -4,8 +4,15 @@
 #include <vector>
 #include <string>
 #include <optional>
+#include <array>
+#include <atomic>
 
 #include "logger.hpp"
+#include "can_frame.hpp"
+#include "can_dbc.hpp"
+#include "can_frame_cache.hpp"
+#include "can_rx_dispatcher.hpp"
+#include "blackbox.hpp"
 
 #ifdef __cplusplus
 extern "C"
@@ -14,10 +21,13 @@ extern "C"
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
 
 #include "driver/twai.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_console.h"
+#include "argtable3/argtable3.h"
 
     class TWAI_Device
     {
@@ -25,12 +35,12 @@ extern "C"
         // 构造函数:初始化TWAI设备
         TWAI_Device(QueueHandle_t &beep_queue,
                     QueueHandle_t &tx_queue,
-                    QueueHandle_t &rx_queue,
                     std::chrono::time_point<std::chrono::steady_clock> &origin_time,
                     gpio_num_t tx_gpio_num = GPIO_NUM_5,
                     gpio_num_t rx_gpio_num = GPIO_NUM_6,
                     gpio_num_t std_gpio_num = GPIO_NUM_4,
-                    twai_timing_config_t timing_config = TWAI_TIMING_CONFIG_250KBITS(),
+                    uint32_t bitrate = 250000,
+                    twai_mode_t mode = TWAI_MODE_NORMAL,
                     twai_filter_config_t filter_config = TWAI_FILTER_CONFIG_ACCEPT_ALL());
 
         // 析构函数:清理资源
@@ -40,12 +50,48 @@ extern "C"
 
         void bus_enbale(bool enbale);
 
-        // 发送消息到TWAI总线
-        void send_message(const twai_message_t &message);
+        // 发送消息到TWAI总线, 发送队列满且超时返回 false
+        bool send_message(const twai_message_t &message, TickType_t timeout = portMAX_DELAY);
 
-        // 从TWAI总线接收消息
+        // 从TWAI总线接收消息, 使用独立订阅, 不影响记录任务
         bool receive_message(twai_message_t &message, TickType_t timeout = portMAX_DELAY);
 
+        // 注册额外的CAN通道接收队列(元素为CanFrameRecord), 与本机TWAI按时间戳合并写入同一个ASC文件.
+        // 队列加入队列集时必须为空, 需在生产者开始写入前注册; 长度不超过 64
+        bool add_log_channel(QueueHandle_t queue);
+
+        // 设置信号解码器, 接收任务收到帧后立即解码更新信号值
+        void set_signal_decoder(CanDbc *dbc);
+
+        // 最新帧缓存, 读者无需订阅即可取得各ID最新帧
+        CanFrameCache &get_frame_cache();
+
+        // 接收帧分发器, 需要完整帧流的模块(转发/监控)各自订阅
+        CanRxDispatcher &get_rx_dispatcher();
+
+        // 记录器, 用于订阅存储卡挂载状态
+        LoggerBase &get_logger();
+
+        // 设置片上 Flash 黑匣子, 记录任务按其模式同时写入
+        void set_blackbox(BlackBox *blackbox);
+
+        // 运行时切换波特率与模式, 收发任务在切换期间暂停; bitrate 为 AUTO_BITRATE 时先自动检测
+        esp_err_t reconfigure(uint32_t bitrate, twai_mode_t mode);
+
+        // 只听模式下依次尝试各波特率, 返回收到有效帧且无总线错误的波特率, 检测失败返回 0
+        // 总耗时不超过 AUTOBAUD_WINDOW_MS * 候选数, 检测期间不发送任何位(含ACK), 不干扰总线
+        uint32_t detect_bitrate();
+
+        // 与接收帧时间戳同一时间基准(自 origin_time 起的微秒数)
+        int64_t get_timestamp_us() const;
+
+        uint32_t get_bitrate() const;
+        twai_mode_t get_mode() const;
+
+        void registerConsoleCommands();
+
+        static constexpr uint32_t AUTO_BITRATE = 0;
+
     private:
         const char *TAG = "TWAI";
 
@@ -58,6 +104,32 @@ extern "C"
         // 清理TWAI驱动和资源
         void deinit();
 
+        // 按当前配置安装并启动驱动
+        esp_err_t driver_start(uint32_t bitrate, twai_mode_t mode, uint32_t alerts);
+        esp_err_t driver_stop();
+
+        // 收发任务每次调用 twai_* 前后调用, 只标记自己是否在驱动内, 切换期间在 enter 等待.
+        // 收发两个任务互不等待, 发送不会被接收的阻塞调用拖住
+        void driver_enter(std::atomic<bool> &in_driver);
+        void driver_leave(std::atomic<bool> &in_driver);
+
+        // 切换方之间互斥, 也用于保护状态查询
+        void driver_lock();
+        void driver_unlock();
+
+        // 切换方独占驱动: 置暂停标志, 等收发任务在当前阻塞调用返回后离开驱动
+        void pause_driver();
+        void resume_driver();
+
+        // 只听模式扫描候选波特率, 调用前需已 pause_driver 且驱动已停止
+        uint32_t scan_bitrates();
+
+        static bool get_timing(uint32_t bitrate, twai_timing_config_t &timing);
+        static const char *mode_to_str(twai_mode_t mode);
+
+        void load_config();
+        void save_config();
+
         // 后台任务:处理发送消息
         static void tx_task(void *arg);
 
@@ -66,26 +138,92 @@ extern "C"
 
         static void rx_log(void *arg);
 
-        std::string format_asc(int channel,
-                               uint32_t canId,
-                               const std::string &direction,
-                               int dataLength,
-                               const uint8_t *data);
+        // 从所有通道中按时间戳顺序取出下一帧
+        bool take_next_record(CanFrameRecord &record, TickType_t timeout);
+
+        // ASC 行的最大长度(不含换行)
+        static constexpr size_t ASC_LINE_MAX = 96;
+
+        // 直接格式化到 buffer, 返回长度; size 不小于 ASC_LINE_MAX 时不会截断
+        static size_t format_asc(char *buffer,
+                                 size_t size,
+                                 int channel,
+                                 int64_t timestamp_us,
+                                 uint32_t canId,
+                                 const char *direction,
+                                 int dataLength,
+                                 const uint8_t *data);
 
         std::string get_timestamp(std::time_t &time);
 
         std::string get_date(std::time_t &time);
 
-        gpio_num_t &_tx_gpio_num;             // TX引脚
-        gpio_num_t &_rx_gpio_num;             // RX引脚
-        gpio_num_t &_std_gpio_num;            // RX引脚
-        twai_timing_config_t &_timing_config; // TWAI时序配置
-        twai_filter_config_t &_filter_config; // TWAI过滤器配置
-        QueueHandle_t &_beep_queue;           // 蜂鸣器消息队列
-        QueueHandle_t &_tx_queue;             // 发送消息队列
-        QueueHandle_t &_rx_queue;             // 接收消息队列
+        // 从第 index 个记录通道取一帧; 外部通道不阻塞, 只在队列集交出过句柄时读取
+        bool pop_log_channel(size_t index, CanFrameRecord &record, TickType_t timeout);
+
+        static int statCommand(void *context, int argc, char **argv);
+        static int cfgCommand(void *context, int argc, char **argv);
+
+        static struct
+        {
+            struct arg_str *bitrate;
+            struct arg_str *mode;
+            struct arg_str *format;
+            struct arg_end *end;
+        } cfg_args;
+
+        gpio_num_t _tx_gpio_num;             // TX引脚
+        gpio_num_t _rx_gpio_num;             // RX引脚
+        gpio_num_t _std_gpio_num;            // STB引脚
+        twai_filter_config_t _filter_config; // TWAI过滤器配置
+        QueueHandle_t &_beep_queue;          // 蜂鸣器消息队列
+        QueueHandle_t &_tx_queue;            // 发送消息队列
+
+        static constexpr const char *NVS_NAMESPACE = "twai";
+        static constexpr const char *NVS_KEY_BITRATE = "bitrate";
+        static constexpr const char *NVS_KEY_MODE = "mode";
+        static constexpr const char *NVS_KEY_LOG_FORMAT = "log_format";
+
+        static constexpr uint32_t AUTOBAUD_WINDOW_MS = 300; // 每个候选波特率的监听时长
+        static constexpr uint32_t DRIVER_POLL_MS = 50;      // 收发任务单次阻塞上限, 决定切换等待时间
+
+        uint32_t _default_bitrate;              // 构造参数, 自动检测失败时使用
+        std::atomic<uint32_t> _bitrate{250000}; // 当前波特率
+        std::atomic<twai_mode_t> _mode{TWAI_MODE_NORMAL};
+        std::atomic<bool> _auto_bitrate{false}; // 当前波特率由自动检测得到
+        SemaphoreHandle_t _driver_mutex;        // 持有者才能停止/重装驱动
+        std::atomic<bool> _driver_paused{false}; // 切换中, 收发任务不再进入驱动
+        std::atomic<bool> _rx_in_driver{false};  // 接收任务正在 twai_receive 中
+        std::atomic<bool> _tx_in_driver{false};  // 发送任务正在 twai_transmit 中
+        bool _driver_running = false;
 
         LoggerBase _twai_logger;
+
+        std::atomic<CanDbc *> _dbc{nullptr}; // 信号解码器
+        std::atomic<BlackBox *> _blackbox{nullptr};
+
+        CanFrameCache _frame_cache; // 按ID的最新帧
+
+        static constexpr size_t LOG_RING_DEPTH = 256; // 记录任务订阅深度, 覆盖一次SD卡写入停顿
+        static constexpr size_t API_RING_DEPTH = 32;  // receive_message 订阅深度
+
+        CanRxDispatcher _rx_dispatcher; // 本机TWAI接收帧广播
+        int _log_subscription = -1;     // 记录任务订阅句柄
+        int _api_subscription = -1;     // receive_message 订阅句柄
+
+        static constexpr size_t MAX_LOG_CHANNELS = 4;    // 含本机TWAI
+        static constexpr int64_t MERGE_WINDOW_US = 5000; // 多通道合并的乱序等待窗口
+        static constexpr size_t MAX_CHANNEL_QUEUE_LENGTH = 64; // 外部通道队列的最大长度
+        // 队列集: 本机订阅的唤醒信号量加上所有外部通道队列, 每个队列元素在集合中占一个句柄
+        static constexpr size_t LOG_SET_LENGTH = 1 + (MAX_LOG_CHANNELS - 1) * MAX_CHANNEL_QUEUE_LENGTH;
+
+        std::array<QueueHandle_t, MAX_LOG_CHANNELS> _log_channels{}; // [0] 为本机, 经 _log_subscription 读取
+        std::array<CanFrameRecord, MAX_LOG_CHANNELS> _log_heads{};   // 每个通道已取出但未写入的帧
+        std::array<bool, MAX_LOG_CHANNELS> _log_head_valid{};        // _log_heads 是否有效
+        std::array<uint32_t, MAX_LOG_CHANNELS> _log_credits{};       // 队列集已交出句柄、尚未读取的帧数
+        std::atomic<size_t> _log_channel_count{1};                   // 已注册通道数
+        QueueSetHandle_t _log_set = nullptr;
+        SemaphoreHandle_t _log_signal = nullptr; // 本机订阅有新帧, 属于 _log_set
     };
 
 #ifdef __cplusplus
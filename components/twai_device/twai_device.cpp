@@ -4,16 +4,33 @@
 #include <ctime>
 #include <time.h>
 #include <iostream>
-#include <sstream>
-#include <iomanip>
 #include <vector>
 #include <string>
 #include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
 
 #include "logger.hpp"
+#include "nvs_handle.hpp"
+#include "boot_trace.hpp"
 
 static const uint32_t StackSize = 1024 * 5;
 
+decltype(TWAI_Device::cfg_args) TWAI_Device::cfg_args;
+
+// 支持的波特率, 同时也是自动检测的尝试顺序(按常见程度)
+static const struct
+{
+    uint32_t bitrate;
+    twai_timing_config_t timing;
+} timing_table[] = {
+    {500000, TWAI_TIMING_CONFIG_500KBITS()},
+    {250000, TWAI_TIMING_CONFIG_250KBITS()},
+    {125000, TWAI_TIMING_CONFIG_125KBITS()},
+    {1000000, TWAI_TIMING_CONFIG_1MBITS()},
+};
+
 // 后台任务:处理发送消息
 void TWAI_Device::tx_task(void *arg)
 {
@@ -23,7 +40,14 @@ void TWAI_Device::tx_task(void *arg)
     {
         if (xQueueReceive(device->_tx_queue, &message, pdMS_TO_TICKS(50)))
         {
-            twai_transmit(&message, portMAX_DELAY);
+            // 分段等待发送队列空位, 每段之间检查是否需要让出驱动以便切换配置
+            esp_err_t err;
+            do
+            {
+                device->driver_enter(device->_tx_in_driver);
+                err = twai_transmit(&message, pdMS_TO_TICKS(DRIVER_POLL_MS));
+                device->driver_leave(device->_tx_in_driver);
+            } while (err == ESP_ERR_TIMEOUT);
         }
     }
 }
@@ -33,20 +57,35 @@ void TWAI_Device::rx_task(void *arg)
 {
     TWAI_Device *device = static_cast<TWAI_Device *>(arg);
 
-    twai_message_t message;
+    CanFrameRecord record = {};
+    record.channel = 1;
+    twai_message_t &message = record.message;
 
     while (true)
     {
-        if (twai_receive(&message, portMAX_DELAY) == ESP_OK)
+        device->driver_enter(device->_rx_in_driver);
+        esp_err_t err = twai_receive(&message, pdMS_TO_TICKS(DRIVER_POLL_MS));
+        device->driver_leave(device->_rx_in_driver);
+
+        if (err == ESP_OK)
         {
-            // 打印接收到的消息
-            printf("TWAI_RX:Received message: ID=0x%08" PRIu32 ", DLC=%2d, Data=[%02x, %02x, %02x, %02x, %02x, %02x, %02x, %02x]\r",
-                   message.identifier, message.data_length_code,
-                   message.data[0], message.data[1], message.data[2], message.data[3],
-                   message.data[4], message.data[5], message.data[6], message.data[7]);
+            record.timestamp_us = device->get_timestamp_us();
+
+            CanDbc *dbc = device->_dbc.load(std::memory_order_acquire);
+            if (dbc != nullptr)
+            {
+                dbc->decode(message);
+            }
 
-            // 将消息放入接收队列
-            xQueueSend(device->_rx_queue, &message, portMAX_DELAY);
+            device->_frame_cache.update(record);
+
+            // 广播给所有订阅者, 某个订阅者满了只丢它自己的帧, 接收任务不阻塞
+            device->_rx_dispatcher.publish(record);
+        }
+        else if (err != ESP_ERR_TIMEOUT)
+        {
+            // 驱动未运行(切换失败), 避免空转
+            vTaskDelay(pdMS_TO_TICKS(DRIVER_POLL_MS));
         }
     }
 }
@@ -54,12 +93,26 @@ void TWAI_Device::rx_task(void *arg)
 void TWAI_Device::rx_log(void *arg)
 {
     TWAI_Device *device = static_cast<TWAI_Device *>(arg);
-    twai_message_t message;
+    CanFrameRecord record;
 
     while (true)
     {
-        if (xQueueReceive(device->_rx_queue, &message, pdMS_TO_TICKS(2000)))
+        if (device->take_next_record(record, pdMS_TO_TICKS(2000)))
         {
+            BlackBox *blackbox = device->_blackbox.load(std::memory_order_acquire);
+            if (blackbox != nullptr && blackbox->is_active())
+            {
+                const twai_message_t &message = record.message;
+                BlackBox::CanRecord frame;
+                frame.timestamp_us = record.timestamp_us;
+                frame.identifier = message.identifier;
+                frame.channel = record.channel;
+                frame.flags = (message.extd ? 0x01 : 0x00) | (message.rtr ? 0x02 : 0x00);
+                frame.dlc = message.data_length_code;
+                const size_t length = std::min<size_t>(message.data_length_code, sizeof(frame.data));
+                memcpy(frame.data, message.data, length);
+                blackbox->append(BlackBox::RECORD_CAN, &frame, offsetof(BlackBox::CanRecord, data) + length);
+            }
 
             std::time_t now = std::time(nullptr);
 
@@ -68,7 +121,18 @@ void TWAI_Device::rx_log(void *arg)
                 device->_twai_logger.init(device->get_date(now) + "/" + device->get_timestamp(now) + ".asc");
             }
 
-            device->_twai_logger.log(device->format_asc(1, message.identifier, "Rx", message.data_length_code, &message.data[0]), 50000);
+            // 直接格式化到写入缓冲, 不产生临时字符串; 轮转只由构造函数中的 RotationPolicy 决定
+            const twai_message_t &message = record.message;
+            char *line = device->_twai_logger.reserve(ASC_LINE_MAX);
+            if (line != nullptr)
+            {
+                device->_twai_logger.commit(format_asc(line, ASC_LINE_MAX, record.channel, record.timestamp_us, message.identifier, "Rx", message.data_length_code, &message.data[0]));
+            }
+            // 启动追踪到第一帧交给记录器为止
+            if (!BootTrace::is_finished())
+            {
+                BootTrace::finish("first_frame");
+            }
         }
         else
         {
@@ -81,42 +145,132 @@ void TWAI_Device::rx_log(void *arg)
     }
 }
 
-std::string TWAI_Device::format_asc(int channel, uint32_t canId, const std::string &direction, int dataLength, const uint8_t *data)
+// 各通道队列内部按时间有序, 每次取所有通道队首中最早的一帧.
+// 某些通道暂时为空时, 等待 MERGE_WINDOW_US 以容纳其在途的更早帧; 等待阻塞在队列集上, 任一通道来帧即醒
+bool TWAI_Device::take_next_record(CanFrameRecord &record, TickType_t timeout)
 {
-    auto current_time = std::chrono::steady_clock::now();
-
-    auto timestamp = std::chrono::duration_cast<std::chrono::microseconds>(current_time - _origin_time).count();
+    const TickType_t start = xTaskGetTickCount();
 
-    // 将微秒转换为秒
-    double timestamp_seconds = static_cast<double>(timestamp) / 1'000'000.0;
+    while (true)
+    {
+        const size_t count = _log_channel_count.load(std::memory_order_acquire);
 
-    std::ostringstream oss;
+        // 单通道时直接阻塞在本机订阅上
+        if (count == 1)
+        {
+            if (_log_head_valid[0] || pop_log_channel(0, _log_heads[0], timeout))
+            {
+                _log_head_valid[0] = false;
+                record = _log_heads[0];
+                return true;
+            }
+            return false;
+        }
 
-    // Format timestamp (6 decimal places)
-    oss << std::fixed << std::setprecision(6) << timestamp_seconds << " ";
+        size_t pending = 0;
+        int oldest = -1;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!_log_head_valid[i] && pop_log_channel(i, _log_heads[i], 0))
+            {
+                _log_head_valid[i] = true;
+            }
+            if (_log_head_valid[i])
+            {
+                pending++;
+                if (oldest < 0 || _log_heads[i].timestamp_us < _log_heads[oldest].timestamp_us)
+                {
+                    oldest = static_cast<int>(i);
+                }
+            }
+        }
 
-    // Format channel
-    oss << channel << " ";
+        TickType_t wait;
+        if (oldest >= 0)
+        {
+            const int64_t age_us = get_timestamp_us() - _log_heads[oldest].timestamp_us;
+            if (pending == count || age_us >= MERGE_WINDOW_US)
+            {
+                _log_head_valid[oldest] = false;
+                record = _log_heads[oldest];
+                return true;
+            }
+            wait = std::max<TickType_t>(1, pdMS_TO_TICKS((MERGE_WINDOW_US - age_us + 999) / 1000));
+        }
+        else
+        {
+            const TickType_t elapsed = xTaskGetTickCount() - start;
+            if (elapsed >= timeout)
+            {
+                return false;
+            }
+            wait = timeout - elapsed;
+        }
 
-    // Format CAN ID (8-digit hex with 'x' suffix)
-    oss << std::hex << std::setw(8) << std::setfill('0') << canId << "x ";
+        // 本机环为空时登记唤醒; 登记时环里已有帧则直接再取一轮
+        if (!_log_head_valid[0] && !_rx_dispatcher.arm(_log_subscription, _log_signal))
+        {
+            continue;
+        }
 
-    // Format direction and data length
-    oss << direction << " d " << std::dec << dataLength << " ";
+        // 队列集交出的每个句柄对应外部队列里的一帧, 记为可读额度, 队首空出时再读
+        QueueSetMemberHandle_t member = xQueueSelectFromSet(_log_set, wait);
+        if (member == _log_signal)
+        {
+            xSemaphoreTake(_log_signal, 0);
+        }
+        else if (member != nullptr)
+        {
+            for (size_t i = 1; i < MAX_LOG_CHANNELS; i++)
+            {
+                if (_log_channels[i] == member)
+                {
+                    _log_credits[i]++;
+                    break;
+                }
+            }
+        }
+    }
+}
 
-    for (int i = 0; i < dataLength; ++i)
+bool TWAI_Device::pop_log_channel(size_t index, CanFrameRecord &record, TickType_t timeout)
+{
+    if (index == 0)
+    {
+        return _rx_dispatcher.receive(_log_subscription, record, timeout);
+    }
+    // 队列集成员只能在集合交出其句柄后读取
+    if (_log_credits[index] == 0 || xQueueReceive(_log_channels[index], &record, 0) != pdTRUE)
     {
-        oss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(data[i]) << " ";
+        return false;
     }
+    _log_credits[index]--;
+    return true;
+}
+
+size_t TWAI_Device::format_asc(char *buffer, size_t size, int channel, int64_t timestamp_us, uint32_t canId, const char *direction, int dataLength, const uint8_t *data)
+{
+    static const char HEX_DIGITS[] = "0123456789abcdef";
 
-    // Remove the trailing space and return the formatted string
-    std::string result = oss.str();
-    if (!result.empty() && result.back() == ' ')
+    // 时间戳(秒, 6位小数) 通道 ID(8位十六进制加x) 方向 d 长度
+    int written = snprintf(buffer, size, "%" PRId64 ".%06" PRId64 " %d %08" PRIx32 "x %s d %d",
+                           timestamp_us / 1000000, timestamp_us % 1000000, channel, canId, direction, dataLength);
+    if (written < 0)
     {
-        result.pop_back(); // Remove the last space
+        return 0;
     }
+    size_t length = std::min(static_cast<size_t>(written), size - 1);
 
-    return result;
+    // 数据字节逐个查表, 比格式化函数快得多
+    const int count = std::min(dataLength, TWAI_FRAME_MAX_DLC);
+    for (int i = 0; i < count && length + 3 < size; ++i)
+    {
+        buffer[length++] = ' ';
+        buffer[length++] = HEX_DIGITS[data[i] >> 4];
+        buffer[length++] = HEX_DIGITS[data[i] & 0x0F];
+    }
+    buffer[length] = '\0';
+    return length;
 }
 
 std::string TWAI_Device::get_timestamp(std::time_t &time)
@@ -142,24 +296,59 @@ std::string TWAI_Device::get_date(std::time_t &time)
 // 构造函数:初始化TWAI设备
 TWAI_Device::TWAI_Device(QueueHandle_t &beep_queue,
                          QueueHandle_t &tx_queue,
-                         QueueHandle_t &rx_queue,
                          std::chrono::time_point<std::chrono::steady_clock> &origin_time,
                          gpio_num_t tx_gpio_num,
                          gpio_num_t rx_gpio_num,
                          gpio_num_t std_gpio_num,
-                         twai_timing_config_t timing_config,
+                         uint32_t bitrate,
+                         twai_mode_t mode,
                          twai_filter_config_t filter_config)
     : _origin_time(origin_time),
       _tx_gpio_num(tx_gpio_num),
       _rx_gpio_num(rx_gpio_num),
       _std_gpio_num(std_gpio_num),
-      _timing_config(timing_config),
       _filter_config(filter_config),
       _beep_queue(beep_queue),
       _tx_queue(tx_queue),
-      _rx_queue(rx_queue),
+      _default_bitrate(bitrate),
+      _bitrate(bitrate),
+      _mode(mode),
       _twai_logger("/sdcard/twai")
 {
+    _driver_mutex = xSemaphoreCreateMutex();
+
+    // 记录任务只拷贝到内存, 写卡与 fsync 由后台写入任务完成, 掉电最多丢失 1 秒数据
+    AsyncWriteConfig write_config;
+    write_config.buffer_size = 16 * 1024;
+    write_config.durability = Durability::INTERVAL;
+    write_config.sync_interval_ms = 1000;
+    _twai_logger.enable_async_writer(write_config);
+    // 默认写校验块, 掉电后可恢复到最后一个完整块; NVS 中的设置在 init() 中覆盖
+    _twai_logger.set_file_format(LogFileFormat::FRAMED);
+
+    // 按大小/时长轮转, 下一个文件由后台预分配; 卡剩余空间不足时删除最旧的记录
+    RotationPolicy policy;
+    policy.max_bytes = 8 * 1024 * 1024;
+    policy.max_seconds = 3600;
+    policy.prealloc_bytes = 8 * 1024 * 1024;
+    policy.min_free_bytes = 512ULL * 1024 * 1024;
+    _twai_logger.set_rotation_policy(policy);
+    // 拔卡期间记录进入暂存区, 插卡后按原顺序写回同一个文件
+    // SD 卡可能晚于 TWAI 挂载, 收到在位通知前的帧先进暂存区
+    if (_twai_logger.enable_spill(SpillConfig()))
+    {
+        _twai_logger.set_storage_available(false);
+    }
+
+    // 订阅需在接收任务启动前完成
+    _log_subscription = _rx_dispatcher.subscribe("logger", LOG_RING_DEPTH);
+    _api_subscription = _rx_dispatcher.subscribe("api", API_RING_DEPTH);
+
+    // 多通道合并时记录任务阻塞在队列集上, 本机订阅经信号量唤醒
+    _log_set = xQueueCreateSet(LOG_SET_LENGTH);
+    _log_signal = xSemaphoreCreateBinary();
+    xQueueAddToSet(_log_signal, _log_set);
+
     init();
     init_io();
     bus_enbale(true);
@@ -191,10 +380,25 @@ void TWAI_Device::bus_enbale(bool enbale)
 // 初始化TWAI驱动和任务
 void TWAI_Device::init()
 {
+    // NVS 中保存的配置优先于构造参数
+    load_config();
+
+    uint32_t bitrate = _bitrate.load();
+    if (bitrate == AUTO_BITRATE)
+    {
+        bitrate = scan_bitrates();
+        _auto_bitrate = true;
+        if (bitrate == AUTO_BITRATE)
+        {
+            ESP_LOGW(TAG, "Auto-baud found no traffic, fall back to %" PRIu32, _default_bitrate);
+            bitrate = _default_bitrate;
+        }
+        _bitrate = bitrate;
+    }
+
     // 初始化TWAI驱动
-    twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(_tx_gpio_num, _rx_gpio_num, TWAI_MODE_NORMAL);
-    ESP_ERROR_CHECK(twai_driver_install(&g_config, &_timing_config, &_filter_config));
-    ESP_ERROR_CHECK(twai_start());
+    ESP_ERROR_CHECK(driver_start(bitrate, _mode.load(), TWAI_ALERT_NONE));
+    ESP_LOGI(TAG, "Bitrate %" PRIu32 ", mode %s", bitrate, mode_to_str(_mode.load()));
 
     // 创建后台任务
     xTaskCreatePinnedToCore(&TWAI_Device::tx_task, "TWAI_TX", StackSize, this, 1, nullptr, tskNO_AFFINITY);
@@ -206,18 +410,512 @@ void TWAI_Device::init()
 void TWAI_Device::deinit()
 {
     // 停止并卸载TWAI驱动
-    ESP_ERROR_CHECK(twai_stop());
-    ESP_ERROR_CHECK(twai_driver_uninstall());
+    pause_driver();
+    ESP_ERROR_CHECK(driver_stop());
+    resume_driver();
+}
+
+esp_err_t TWAI_Device::driver_start(uint32_t bitrate, twai_mode_t mode, uint32_t alerts)
+{
+    twai_timing_config_t timing;
+    if (!get_timing(bitrate, timing))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(_tx_gpio_num, _rx_gpio_num, mode);
+    g_config.alerts_enabled = alerts;
+
+    const uint32_t trace = BootTrace::begin("twai_install");
+    esp_err_t err = twai_driver_install(&g_config, &timing, &_filter_config);
+    BootTrace::end(trace);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Driver install failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    err = twai_start();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Driver start failed: %s", esp_err_to_name(err));
+        twai_driver_uninstall();
+        return err;
+    }
+    _driver_running = true;
+    return ESP_OK;
+}
+
+esp_err_t TWAI_Device::driver_stop()
+{
+    if (!_driver_running)
+    {
+        return ESP_OK;
+    }
+    _driver_running = false;
+
+    // 总线关闭状态下 twai_stop 会失败, 不影响卸载
+    twai_stop();
+    return twai_driver_uninstall();
+}
+
+// 先声明进入再检查暂停标志, 与 pause_driver 的先置标志再检查相对,
+// 两边都是顺序一致的读写, 至少有一方能看到对方, 不会同时进入
+void TWAI_Device::driver_enter(std::atomic<bool> &in_driver)
+{
+    while (true)
+    {
+        in_driver.store(true);
+        if (!_driver_paused.load())
+        {
+            return;
+        }
+        in_driver.store(false);
+        while (_driver_paused.load())
+        {
+            vTaskDelay(1);
+        }
+    }
+}
+
+void TWAI_Device::driver_leave(std::atomic<bool> &in_driver)
+{
+    in_driver.store(false);
+}
+
+void TWAI_Device::driver_lock()
+{
+    xSemaphoreTake(_driver_mutex, portMAX_DELAY);
+}
+
+void TWAI_Device::driver_unlock()
+{
+    xSemaphoreGive(_driver_mutex);
+}
+
+// 等待时间不超过一次 DRIVER_POLL_MS 阻塞调用
+void TWAI_Device::pause_driver()
+{
+    driver_lock();
+    _driver_paused.store(true);
+    while (_rx_in_driver.load() || _tx_in_driver.load())
+    {
+        vTaskDelay(1);
+    }
+}
+
+void TWAI_Device::resume_driver()
+{
+    _driver_paused.store(false);
+    driver_unlock();
+}
+
+bool TWAI_Device::get_timing(uint32_t bitrate, twai_timing_config_t &timing)
+{
+    for (const auto &entry : timing_table)
+    {
+        if (entry.bitrate == bitrate)
+        {
+            timing = entry.timing;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *TWAI_Device::mode_to_str(twai_mode_t mode)
+{
+    switch (mode)
+    {
+    case TWAI_MODE_NORMAL:
+        return "normal";
+    case TWAI_MODE_NO_ACK:
+        return "noack";
+    case TWAI_MODE_LISTEN_ONLY:
+        return "listen";
+    default:
+        return "unknown";
+    }
+}
+
+// 只听模式不发送ACK和错误帧, 波特率不对时只会在本地累计总线错误.
+// 某个波特率在窗口内收到有效帧且没有任何总线错误即认为匹配.
+uint32_t TWAI_Device::scan_bitrates()
+{
+    twai_message_t message;
+
+    for (const auto &entry : timing_table)
+    {
+        if (driver_start(entry.bitrate, TWAI_MODE_LISTEN_ONLY, TWAI_ALERT_NONE) != ESP_OK)
+        {
+            continue;
+        }
+
+        uint32_t frames = 0;
+        const TickType_t window = pdMS_TO_TICKS(AUTOBAUD_WINDOW_MS);
+        const TickType_t start = xTaskGetTickCount();
+        TickType_t elapsed = 0;
+        while (elapsed < window)
+        {
+            if (twai_receive(&message, window - elapsed) == ESP_OK)
+            {
+                frames++;
+            }
+            elapsed = xTaskGetTickCount() - start;
+        }
+
+        twai_status_info_t status = {};
+        twai_get_status_info(&status);
+        driver_stop();
+
+        ESP_LOGI(TAG, "Auto-baud %7" PRIu32 ": frames=%" PRIu32 " bus_errors=%" PRIu32,
+                 entry.bitrate, frames, status.bus_error_count);
+
+        if (frames > 0 && status.bus_error_count == 0)
+        {
+            return entry.bitrate;
+        }
+    }
+    return AUTO_BITRATE;
+}
+
+uint32_t TWAI_Device::detect_bitrate()
+{
+    pause_driver();
+    driver_stop();
+    uint32_t bitrate = scan_bitrates();
+
+    // 恢复原配置
+    if (driver_start(_bitrate.load(), _mode.load(), TWAI_ALERT_NONE) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to restore bitrate %" PRIu32, _bitrate.load());
+    }
+    resume_driver();
+    return bitrate;
+}
+
+esp_err_t TWAI_Device::reconfigure(uint32_t bitrate, twai_mode_t mode)
+{
+    uint32_t target = bitrate;
+    if (bitrate == AUTO_BITRATE)
+    {
+        target = detect_bitrate();
+        if (target == AUTO_BITRATE)
+        {
+            ESP_LOGE(TAG, "Auto-baud found no valid traffic, keep %" PRIu32, _bitrate.load());
+            return ESP_ERR_NOT_FOUND;
+        }
+    }
+
+    twai_timing_config_t timing;
+    if (!get_timing(target, timing))
+    {
+        ESP_LOGE(TAG, "Unsupported bitrate %" PRIu32, target);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pause_driver();
+    driver_stop();
+    esp_err_t err = driver_start(target, mode, TWAI_ALERT_NONE);
+    if (err == ESP_OK)
+    {
+        _bitrate = target;
+        _mode = mode;
+        _auto_bitrate = (bitrate == AUTO_BITRATE);
+    }
+    else if (driver_start(_bitrate.load(), _mode.load(), TWAI_ALERT_NONE) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to restore bitrate %" PRIu32, _bitrate.load());
+    }
+    resume_driver();
+
+    if (err == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Bitrate %" PRIu32 "%s, mode %s", target, bitrate == AUTO_BITRATE ? " (auto)" : "", mode_to_str(mode));
+    }
+    return err;
+}
+
+int64_t TWAI_Device::get_timestamp_us() const
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _origin_time).count();
+}
+
+uint32_t TWAI_Device::get_bitrate() const
+{
+    return _bitrate.load();
+}
+
+twai_mode_t TWAI_Device::get_mode() const
+{
+    return _mode.load();
+}
+
+void TWAI_Device::load_config()
+{
+    esp_err_t ret;
+    std::unique_ptr<nvs::NVSHandle> nvs_handle = nvs::open_nvs_handle(NVS_NAMESPACE, NVS_READONLY, &ret);
+    if (ret != ESP_OK)
+    {
+        return; // 从未保存过
+    }
+
+    uint32_t bitrate;
+    twai_timing_config_t timing;
+    if (nvs_handle->get_item(NVS_KEY_BITRATE, bitrate) == ESP_OK &&
+        (bitrate == AUTO_BITRATE || get_timing(bitrate, timing)))
+    {
+        _bitrate = bitrate;
+    }
+
+    uint8_t mode;
+    if (nvs_handle->get_item(NVS_KEY_MODE, mode) == ESP_OK && mode <= TWAI_MODE_LISTEN_ONLY)
+    {
+        _mode = static_cast<twai_mode_t>(mode);
+    }
+
+    uint8_t format;
+    if (nvs_handle->get_item(NVS_KEY_LOG_FORMAT, format) == ESP_OK && format <= static_cast<uint8_t>(LogFileFormat::LZ4))
+    {
+        _twai_logger.set_file_format(static_cast<LogFileFormat>(format));
+    }
+}
+
+void TWAI_Device::save_config()
+{
+    esp_err_t ret;
+    std::unique_ptr<nvs::NVSHandle> nvs_handle = nvs::open_nvs_handle(NVS_NAMESPACE, NVS_READWRITE, &ret);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Open NVS failed: %s", esp_err_to_name(ret));
+        return;
+    }
+
+    // 自动检测的结果不固化, 下次启动重新检测
+    nvs_handle->set_item(NVS_KEY_BITRATE, _auto_bitrate.load() ? AUTO_BITRATE : _bitrate.load());
+    nvs_handle->set_item(NVS_KEY_MODE, static_cast<uint8_t>(_mode.load()));
+    nvs_handle->set_item(NVS_KEY_LOG_FORMAT, static_cast<uint8_t>(_twai_logger.get_file_format()));
+    nvs_handle->commit();
 }
 
 // 发送消息到TWAI总线
-void TWAI_Device::send_message(const twai_message_t &message)
+bool TWAI_Device::send_message(const twai_message_t &message, TickType_t timeout)
 {
-    xQueueSend(_tx_queue, &message, portMAX_DELAY);
+    return xQueueSend(_tx_queue, &message, timeout) == pdTRUE;
 }
 
 // 从TWAI总线接收消息
 bool TWAI_Device::receive_message(twai_message_t &message, TickType_t timeout)
 {
-    return xQueueReceive(_rx_queue, &message, timeout) == pdTRUE;
+    CanFrameRecord record;
+    if (!_rx_dispatcher.receive(_api_subscription, record, timeout))
+    {
+        return false;
+    }
+    message = record.message;
+    return true;
+}
+
+bool TWAI_Device::add_log_channel(QueueHandle_t queue)
+{
+    const size_t count = _log_channel_count.load(std::memory_order_relaxed);
+    if (queue == nullptr || count >= MAX_LOG_CHANNELS)
+    {
+        ESP_LOGE(TAG, "Cannot add log channel (%zu/%zu)", count, MAX_LOG_CHANNELS);
+        return false;
+    }
+    const size_t length = uxQueueMessagesWaiting(queue) + uxQueueSpacesAvailable(queue);
+    if (length > MAX_CHANNEL_QUEUE_LENGTH)
+    {
+        ESP_LOGE(TAG, "Log channel queue too long (%zu)", length);
+        return false;
+    }
+    // 先填好通道表再加入队列集, 记录任务拿到句柄时一定能找到对应通道
+    _log_channels[count] = queue;
+    if (xQueueAddToSet(queue, _log_set) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Log channel queue must be empty when added");
+        _log_channels[count] = nullptr;
+        return false;
+    }
+    _log_channel_count.store(count + 1, std::memory_order_release);
+    return true;
+}
+
+void TWAI_Device::set_signal_decoder(CanDbc *dbc)
+{
+    _dbc.store(dbc, std::memory_order_release);
+}
+
+CanFrameCache &TWAI_Device::get_frame_cache()
+{
+    return _frame_cache;
+}
+
+CanRxDispatcher &TWAI_Device::get_rx_dispatcher()
+{
+    return _rx_dispatcher;
+}
+
+LoggerBase &TWAI_Device::get_logger()
+{
+    return _twai_logger;
+}
+
+void TWAI_Device::set_blackbox(BlackBox *blackbox)
+{
+    _blackbox.store(blackbox, std::memory_order_release);
+}
+
+int TWAI_Device::statCommand(void *context, int argc, char **argv)
+{
+    TWAI_Device *device = static_cast<TWAI_Device *>(context);
+
+    device->_rx_dispatcher.print_stats();
+    printf("frame cache overflow: %" PRIu32 "\n", device->_frame_cache.get_overflow_count());
+    device->_twai_logger.print_writer_stats();
+    return 0;
+}
+
+int TWAI_Device::cfgCommand(void *context, int argc, char **argv)
+{
+    TWAI_Device *device = static_cast<TWAI_Device *>(context);
+
+    int nerrors = arg_parse(argc, argv, (void **)&cfg_args);
+    if (nerrors != 0)
+    {
+        arg_print_errors(stderr, cfg_args.end, argv[0]);
+        return 1;
+    }
+
+    if (cfg_args.bitrate->count == 0 && cfg_args.mode->count == 0 && cfg_args.format->count == 0)
+    {
+        twai_status_info_t status = {};
+        device->driver_lock();
+        esp_err_t err = twai_get_status_info(&status);
+        device->driver_unlock();
+
+        printf("bitrate: %" PRIu32 "%s\n", device->get_bitrate(), device->_auto_bitrate.load() ? " (auto)" : "");
+        printf("mode:    %s\n", mode_to_str(device->get_mode()));
+        static const char *FORMAT_NAMES[] = {"plain", "framed", "lz4"};
+        printf("log:     %s\n", FORMAT_NAMES[static_cast<int>(device->_twai_logger.get_file_format())]);
+        if (err == ESP_OK)
+        {
+            printf("state:   %d, tx_err=%" PRIu32 " rx_err=%" PRIu32 " bus_err=%" PRIu32 " rx_missed=%" PRIu32 "\n",
+                   status.state, status.tx_error_counter, status.rx_error_counter, status.bus_error_count, status.rx_missed_count);
+        }
+        return 0;
+    }
+
+    uint32_t bitrate = device->_auto_bitrate.load() ? AUTO_BITRATE : device->get_bitrate();
+    if (cfg_args.bitrate->count > 0)
+    {
+        const char *value = cfg_args.bitrate->sval[0];
+        if (strcmp(value, "auto") == 0)
+        {
+            bitrate = AUTO_BITRATE;
+        }
+        else
+        {
+            // 允许 500 或 500000 两种写法
+            bitrate = strtoul(value, nullptr, 10);
+            if (bitrate < 10000)
+            {
+                bitrate *= 1000;
+            }
+            twai_timing_config_t timing;
+            if (!get_timing(bitrate, timing))
+            {
+                printf("Unsupported bitrate: %s (125/250/500/1000/auto)\n", value);
+                return 1;
+            }
+        }
+    }
+
+    twai_mode_t mode = device->get_mode();
+    if (cfg_args.mode->count > 0)
+    {
+        const char *value = cfg_args.mode->sval[0];
+        if (strcmp(value, "normal") == 0)
+        {
+            mode = TWAI_MODE_NORMAL;
+        }
+        else if (strcmp(value, "listen") == 0)
+        {
+            mode = TWAI_MODE_LISTEN_ONLY;
+        }
+        else if (strcmp(value, "noack") == 0)
+        {
+            mode = TWAI_MODE_NO_ACK;
+        }
+        else
+        {
+            printf("Unsupported mode: %s (normal/listen/noack)\n", value);
+            return 1;
+        }
+    }
+
+    if (cfg_args.format->count > 0)
+    {
+        const char *value = cfg_args.format->sval[0];
+        LogFileFormat format;
+        if (strcmp(value, "plain") == 0)
+        {
+            format = LogFileFormat::PLAIN;
+        }
+        else if (strcmp(value, "framed") == 0)
+        {
+            format = LogFileFormat::FRAMED;
+        }
+        else if (strcmp(value, "lz4") == 0)
+        {
+            format = LogFileFormat::LZ4;
+        }
+        else
+        {
+            printf("Unsupported format: %s (plain/framed/lz4)\n", value);
+            return 1;
+        }
+        if (!device->_twai_logger.set_file_format(format))
+        {
+            return 1;
+        }
+        printf("Log format %s from next file\n", value);
+    }
+
+    if ((cfg_args.bitrate->count > 0 || cfg_args.mode->count > 0) && device->reconfigure(bitrate, mode) != ESP_OK)
+    {
+        return 1;
+    }
+    device->save_config();
+    return 0;
+}
+
+void TWAI_Device::registerConsoleCommands()
+{
+    cfg_args.bitrate = arg_str0("b", "bitrate", "<125|250|500|1000|auto>", "Bitrate in kbit/s, auto = listen-only detection");
+    cfg_args.mode = arg_str0("m", "mode", "<normal|listen|noack>", "Controller mode");
+    cfg_args.format = arg_str0("f", "format", "<plain|framed|lz4>", "Log file format, framed/lz4 are decoded with tools/logcat.py");
+    cfg_args.end = arg_end(3);
+
+    const esp_console_cmd_t cfg_cmd = {
+        .command = "can_cfg",
+        .help = "Show or change TWAI bitrate/mode/log format, saved to NVS",
+        .hint = nullptr,
+        .func = nullptr,
+        .argtable = &cfg_args,
+        .func_w_context = &TWAI_Device::cfgCommand,
+        .context = this,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cfg_cmd));
+
+    const esp_console_cmd_t stat_cmd = {
+        .command = "can_stat",
+        .help = "Show CAN RX subscriber ring usage and overflow counters",
+        .hint = nullptr,
+        .func = nullptr,
+        .argtable = nullptr,
+        .func_w_context = &TWAI_Device::statCommand,
+        .context = this,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&stat_cmd));
 }
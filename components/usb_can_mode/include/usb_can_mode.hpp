@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "esp_err.h"
+
+    // gs_usb 与 SLCAN 共用的设备侧部分:
+    // 一次性的 "重启后作为 USB CAN 适配器运行" 标记, 两种模式共用一个 NVS 键, 后写入的生效;
+    // 以及 TinyUSB 设备/字符串描述符, 两者只有 VID/PID, 设备类与名称不同
+    class UsbCanMode
+    {
+    public:
+        enum class Mode : uint8_t
+        {
+            CONSOLE = 0, // 正常启动, USB 控制台可用
+            GS_USB = 1,
+            SLCAN = 2,
+        };
+
+        struct DeviceInfo
+        {
+            uint16_t vendor_id;
+            uint16_t product_id;
+            bool iad;                   // 复合设备(CDC 需要 IAD), 否则设备类由接口决定
+            const char *product;        // 字符串描述符 2
+            const char *interface_name; // 字符串描述符 4, 配置描述符中的接口名索引
+        };
+
+        static Mode take_boot_request();    // 读取并清除启动标记, 只生效一次, 复位后回到控制台
+        static int reboot_into(Mode mode);  // 写入启动标记并重启, 只有写 NVS 失败时返回 1
+        static const char *mode_name(Mode mode);
+
+        // 用 info 生成设备与字符串描述符并安装 TinyUSB 驱动; 每次启动只有一种模式安装驱动
+        static esp_err_t install_driver(const DeviceInfo &info, const uint8_t *configuration_descriptor);
+
+    private:
+        static constexpr const char *TAG = "UsbCanMode";
+        static constexpr const char *NVS_NAMESPACE = "usb_can";
+        static constexpr const char *NVS_KEY_BOOT = "boot_mode";
+    };
+
+#ifdef __cplusplus
+}
+#endif
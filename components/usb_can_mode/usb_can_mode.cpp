@@ -0,0 +1,110 @@
+#include "usb_can_mode.hpp"
+
+#include <memory>
+
+#include "nvs_handle.hpp"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "tinyusb.h"
+
+// TinyUSB 保存描述符指针, 描述符需在驱动运行期间有效
+static const char LANGUAGE_ID[] = {0x09, 0x04}; // 英语 (0x0409)
+static tusb_desc_device_t descriptor_config;
+static const char *string_desc_arr[5];
+
+UsbCanMode::Mode UsbCanMode::take_boot_request()
+{
+    esp_err_t ret;
+    std::unique_ptr<nvs::NVSHandle> nvs_handle = nvs::open_nvs_handle(NVS_NAMESPACE, NVS_READWRITE, &ret);
+    if (ret != ESP_OK)
+    {
+        return Mode::CONSOLE;
+    }
+
+    uint8_t mode = 0;
+    if (nvs_handle->get_item(NVS_KEY_BOOT, mode) != ESP_OK || mode == static_cast<uint8_t>(Mode::CONSOLE))
+    {
+        return Mode::CONSOLE;
+    }
+    // 只生效一次, 复位后回到控制台
+    nvs_handle->set_item(NVS_KEY_BOOT, static_cast<uint8_t>(Mode::CONSOLE));
+    nvs_handle->commit();
+
+    if (mode != static_cast<uint8_t>(Mode::GS_USB) && mode != static_cast<uint8_t>(Mode::SLCAN))
+    {
+        ESP_LOGW(TAG, "Unknown boot mode %u, ignored", mode);
+        return Mode::CONSOLE;
+    }
+    return static_cast<Mode>(mode);
+}
+
+int UsbCanMode::reboot_into(Mode mode)
+{
+    esp_err_t ret;
+    std::unique_ptr<nvs::NVSHandle> nvs_handle = nvs::open_nvs_handle(NVS_NAMESPACE, NVS_READWRITE, &ret);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Open NVS failed: %s", esp_err_to_name(ret));
+        return 1;
+    }
+    ret = nvs_handle->set_item(NVS_KEY_BOOT, static_cast<uint8_t>(mode));
+    if (ret == ESP_OK)
+    {
+        ret = nvs_handle->commit();
+    }
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Write NVS failed: %s", esp_err_to_name(ret));
+        return 1;
+    }
+
+    ESP_LOGI(TAG, "Restarting into %s mode, reset again to get the console back", mode_name(mode));
+    esp_restart();
+}
+
+const char *UsbCanMode::mode_name(Mode mode)
+{
+    switch (mode)
+    {
+    case Mode::GS_USB:
+        return "gs_usb";
+    case Mode::SLCAN:
+        return "SLCAN";
+    default:
+        return "console";
+    }
+}
+
+esp_err_t UsbCanMode::install_driver(const DeviceInfo &info, const uint8_t *configuration_descriptor)
+{
+    descriptor_config = {
+        .bLength = sizeof(descriptor_config),
+        .bDescriptorType = TUSB_DESC_DEVICE,
+        .bcdUSB = 0x0200,
+        .bDeviceClass = static_cast<uint8_t>(info.iad ? TUSB_CLASS_MISC : 0x00),
+        .bDeviceSubClass = static_cast<uint8_t>(info.iad ? MISC_SUBCLASS_COMMON : 0x00),
+        .bDeviceProtocol = static_cast<uint8_t>(info.iad ? MISC_PROTOCOL_IAD : 0x00),
+        .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
+        .idVendor = info.vendor_id,
+        .idProduct = info.product_id,
+        .bcdDevice = 0x100,
+        .iManufacturer = 0x01,
+        .iProduct = 0x02,
+        .iSerialNumber = 0x03,
+        .bNumConfigurations = 0x01};
+
+    string_desc_arr[0] = LANGUAGE_ID;                // 0: Supported language
+    string_desc_arr[1] = "TinyUSB";                  // 1: Manufacturer
+    string_desc_arr[2] = info.product;               // 2: Product
+    string_desc_arr[3] = "123456";                   // 3: Serials
+    string_desc_arr[4] = info.interface_name;        // 4: Interface
+
+    const tinyusb_config_t tusb_cfg = {
+        .device_descriptor = &descriptor_config,
+        .string_descriptor = string_desc_arr,
+        .string_descriptor_count = sizeof(string_desc_arr) / sizeof(string_desc_arr[0]),
+        .external_phy = false,
+        .configuration_descriptor = configuration_descriptor,
+    };
+    return tinyusb_driver_install(&tusb_cfg);
+}
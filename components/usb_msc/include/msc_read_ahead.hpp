@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+    // USB-MSC 的 SD 预读缓存
+    // TinyUSB 每次 READ10 回调只请求一个 MSC 缓冲(数 KB), 直接转成 SD 读时每块都要等卡响应,
+    // USB 与 SD 串行. 这里以 WINDOW_SECTORS 为单位整窗多扇区读入, 顺序读到窗口后半段时由预读任务
+    // 在另一窗口读入下一段, SD 读与 USB 传输重叠. 卡访问经 ReadSink, 不依赖 SDMMC, 可在主机上测试.
+    class MscReadAhead
+    {
+    public:
+        // 从 lba 起读 count 个扇区, 由设备侧加锁保证与写入互斥
+        using ReadSink = bool (*)(uint32_t lba, uint32_t count, uint8_t *buffer, void *arg);
+
+        static constexpr uint32_t SECTOR_SIZE = 512;
+        static constexpr uint32_t WINDOW_SECTORS = 64; // 32 KiB, 一次 CMD18
+        static constexpr size_t SLOT_COUNT = 2;
+
+        struct Stats
+        {
+            uint32_t hits;        // 整个请求落在已读入的窗口
+            uint32_t waits;       // 请求落在读入中的窗口, 等待完成
+            uint32_t misses;      // 同步读入
+            uint32_t prefetches;  // 预读任务读入的窗口
+            uint32_t errors;      // SD 读失败
+            uint64_t bytes;       // 交给主机的字节数
+            uint64_t sd_busy_us;  // SD 读累计耗时
+        };
+
+        MscReadAhead();
+        ~MscReadAhead();
+
+        // 分配窗口缓冲并启动预读任务, sector_count 为卡容量; 再次调用时只更新容量并清空窗口
+        bool init(uint32_t sector_count, ReadSink sink, void *arg);
+
+        // TinyUSB READ10 回调: 返回复制的字节数, 失败返回 -1
+        int32_t read(uint32_t lba, uint32_t offset, void *buffer, uint32_t size);
+
+        // 写入后丢弃重叠的窗口; 正在读入的窗口完成后作废
+        void invalidate(uint32_t lba, uint32_t count);
+
+        Stats get_stats() const;
+
+    private:
+        const char *TAG = "MscReadAhead";
+        static const uint32_t StackSize = 3072;
+
+        enum SlotState : uint8_t
+        {
+            SLOT_EMPTY,
+            SLOT_QUEUED,  // 已排给预读任务
+            SLOT_LOADING, // SD 读进行中
+            SLOT_READY,
+        };
+
+        struct Slot
+        {
+            uint8_t *buffer;
+            uint32_t lba;
+            uint32_t count;
+            SlotState state;
+            bool stale; // 读入期间有重叠写入
+            uint32_t last_use;
+        };
+
+        Slot _slots[SLOT_COUNT] = {};
+        uint32_t _sector_count = 0;
+        uint32_t _use_clock = 0;
+
+        ReadSink _sink = nullptr;
+        void *_sink_arg = nullptr;
+
+        SemaphoreHandle_t _lock = nullptr;   // 保护 _slots
+        SemaphoreHandle_t _wake = nullptr;   // 有窗口排队
+        SemaphoreHandle_t _loaded = nullptr; // 有窗口读入完成
+        TaskHandle_t _task = nullptr;
+
+        std::atomic<uint32_t> _hits{0};
+        std::atomic<uint32_t> _waits{0};
+        std::atomic<uint32_t> _misses{0};
+        std::atomic<uint32_t> _prefetches{0};
+        std::atomic<uint32_t> _errors{0};
+        std::atomic<uint64_t> _bytes{0};
+        std::atomic<uint64_t> _sd_busy_us{0};
+
+        Slot *find(uint32_t lba, uint32_t count);
+        Slot *victim();
+        void queue_next(const Slot &current, uint32_t end);
+        bool load(Slot &slot);
+        void prefetch_task();
+    };
+
+#ifdef __cplusplus
+}
+#endif
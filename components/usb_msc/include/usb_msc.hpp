@@ -1,45 +1,92 @@
 #pragma once
 
 #include <string>
-#include "nvs_handle.hpp"
+#include <atomic>
 #include "sd_card.hpp"
+#include "msc_read_ahead.hpp"
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-#include "driver/gpio.h"
 #include "tinyusb.h"
-#include "tusb_msc_storage.h"
-#include "nvs.h"
+#include "esp_private/usb_phy.h"
 #include "sdmmc_cmd.h"
+#include "esp_console.h"
+#include "argtable3/argtable3.h"
 
+    // 运行中把 SD 卡切换为 USB 大容量存储, 不重启.
+    // 导出: 卸载 FAT(日志收到卸载通知转入暂存区/片上黑匣子) -> 卡以扇区方式重新初始化 -> 安装 TinyUSB.
+    // 收回: 主机弹出(或断开超过 HOST_TIMEOUT_MS) -> 卸载 TinyUSB, PHY 交还 USB 控制台 -> 重新挂载 FAT.
+    // 只有 SD 卡重新初始化, 其它模块照常运行; 各阶段耗时由 usb_mount -s 查看.
     class USB_MSC
     {
     private:
         const char *TAG = "USB_MSC";
-        SDCard sd_obj;
+        static const uint32_t StackSize = 3072;
+        static const uint32_t HOST_TIMEOUT_MS = 10000;
 
-    public:
-        USB_MSC();
-        ~USB_MSC();
+        SDCard &_sd;
+
+        // SCSI 回调直接访问卡: 读经预读缓存, 写入直接下发
+        MscReadAhead _read_ahead;
+        std::atomic<bool> _attached{false};
+        std::atomic<bool> _ejected{false};
+        bool _host_seen = false;
+
+        bool _usb_installed = false;
+        usb_phy_handle_t _console_phy = nullptr; // 收回后把内部 PHY 切回 USB-Serial-JTAG
+        SemaphoreHandle_t _return_sem = nullptr;
+        TaskHandle_t _task = nullptr;
+
+        // 切换耗时, 均从发起时刻算起
+        struct SwitchTiming
+        {
+            uint32_t export_us;     // 日志停写、FAT 卸载、卡重新初始化
+            uint32_t usb_us;        // TinyUSB 安装完成
+            uint32_t host_ready_us; // 主机首次 TEST UNIT READY 成功
+            uint32_t return_us;     // 弹出到 FAT 重新挂载、日志恢复
+        };
+        SwitchTiming _timing = {};
+        int64_t _attach_start_us = 0;
+        uint32_t _switch_count = 0;
 
-        esp_err_t storage_init_sdmmc(void);
+        static struct
+        {
+            struct arg_lit *writable;
+            struct arg_lit *status;
+            struct arg_end *end;
+        } mount_args;
 
-        void _mount(void);
+        static bool read_card(uint32_t lba, uint32_t count, uint8_t *buffer, void *arg);
 
-        static int get_init_msc_key(const char *ns_name = "storage");
+        bool attach(bool writable);
+        void detach(const char *reason);
+        void return_task(void);
+        void print_status(void);
 
-        static void set_init_msc_key(uint8_t new_val, const char *ns_name = "storage");
+        static int console_mount(void *context, int argc, char **argv);
 
-        static int console_mount(int argc, char **argv);
+    public:
+        explicit USB_MSC(SDCard &sd);
+        ~USB_MSC();
+
+        void registerConsoleCommands();
 
-        static void registerMount();
+        // 供 tud_msc_is_writable_cb 查询
+        static bool _writable;
 
-        static const char *_init_msc_key;
+        // 供 TinyUSB MSC 回调使用的当前实例
+        static USB_MSC *_active;
+
+        bool unit_ready(void);
+        uint32_t sector_count(void);
+        int32_t read10(uint32_t lba, uint32_t offset, void *buffer, uint32_t size);
+        int32_t write10(uint32_t lba, uint32_t offset, const uint8_t *buffer, uint32_t size);
+        void eject(void);
     };
 
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
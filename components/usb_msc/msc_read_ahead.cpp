@@ -0,0 +1,279 @@
+#include "msc_read_ahead.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+MscReadAhead::MscReadAhead()
+{
+}
+
+MscReadAhead::~MscReadAhead()
+{
+    if (_task)
+    {
+        vTaskDelete(_task);
+    }
+    for (Slot &slot : _slots)
+    {
+        heap_caps_free(slot.buffer);
+    }
+    if (_lock)
+    {
+        vSemaphoreDelete(_lock);
+        vSemaphoreDelete(_wake);
+        vSemaphoreDelete(_loaded);
+    }
+}
+
+bool MscReadAhead::init(uint32_t sector_count, ReadSink sink, void *arg)
+{
+    if (_lock)
+    {
+        // 再次导出: 换卡后容量可能不同, 旧窗口全部作废
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        _sector_count = sector_count;
+        _sink = sink;
+        _sink_arg = arg;
+        xSemaphoreGive(_lock);
+        invalidate(0, UINT32_MAX);
+        return true;
+    }
+    _sector_count = sector_count;
+    _sink = sink;
+    _sink_arg = arg;
+
+    // SDMMC 直接 DMA 到窗口, 免去驱动内部的逐扇区中转
+    for (Slot &slot : _slots)
+    {
+        slot.buffer = static_cast<uint8_t *>(heap_caps_malloc(WINDOW_SECTORS * SECTOR_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL));
+        if (!slot.buffer)
+        {
+            ESP_LOGE(TAG, "Failed to allocate read-ahead window");
+            return false;
+        }
+        slot.state = SLOT_EMPTY;
+    }
+    _lock = xSemaphoreCreateMutex();
+    _wake = xSemaphoreCreateBinary();
+    _loaded = xSemaphoreCreateBinary();
+
+    auto task_func = [](void *arg)
+    {
+        MscReadAhead *instance = static_cast<MscReadAhead *>(arg);
+        instance->prefetch_task();
+    };
+    // 与 TinyUSB 任务同优先级, 预读不会被 USB 回调饿死
+    xTaskCreatePinnedToCore(task_func, "msc_ahead", StackSize, this, 5, &_task, tskNO_AFFINITY);
+    return true;
+}
+
+MscReadAhead::Slot *MscReadAhead::find(uint32_t lba, uint32_t count)
+{
+    for (Slot &slot : _slots)
+    {
+        if (slot.state != SLOT_EMPTY && !slot.stale && lba >= slot.lba && lba + count <= slot.lba + slot.count)
+        {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+MscReadAhead::Slot *MscReadAhead::victim()
+{
+    Slot *oldest = nullptr;
+    for (Slot &slot : _slots)
+    {
+        if (slot.state == SLOT_EMPTY)
+        {
+            return &slot;
+        }
+        if (slot.state == SLOT_READY && (!oldest || slot.last_use < oldest->last_use))
+        {
+            oldest = &slot;
+        }
+    }
+    return oldest;
+}
+
+void MscReadAhead::queue_next(const Slot &current, uint32_t end)
+{
+    // 读到窗口后半段才预读, 随机访问不会把缓存冲掉
+    const uint32_t next = current.lba + current.count;
+    if (end - current.lba < current.count / 2 || next >= _sector_count || find(next, 1))
+    {
+        return;
+    }
+    Slot *slot = victim();
+    if (!slot || slot == &current)
+    {
+        return;
+    }
+    slot->lba = next;
+    slot->count = std::min(WINDOW_SECTORS, _sector_count - next);
+    slot->state = SLOT_QUEUED;
+    slot->stale = false;
+    xSemaphoreGive(_wake);
+}
+
+bool MscReadAhead::load(Slot &slot)
+{
+    const int64_t start = esp_timer_get_time();
+    const bool ok = _sink(slot.lba, slot.count, slot.buffer, _sink_arg);
+    _sd_busy_us += esp_timer_get_time() - start;
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    slot.state = (ok && !slot.stale) ? SLOT_READY : SLOT_EMPTY;
+    slot.stale = false;
+    slot.last_use = ++_use_clock;
+    xSemaphoreGive(_lock);
+
+    if (!ok)
+    {
+        _errors++;
+    }
+    xSemaphoreGive(_loaded);
+    return ok;
+}
+
+int32_t MscReadAhead::read(uint32_t lba, uint32_t offset, void *buffer, uint32_t size)
+{
+    const uint32_t first = lba + offset / SECTOR_SIZE;
+    const uint32_t skip = offset % SECTOR_SIZE;
+    const uint32_t count = (skip + size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    if (size == 0 || !_sink || first >= _sector_count || count > _sector_count - first)
+    {
+        return -1;
+    }
+
+    // 超过一个窗口的请求不经缓存(MSC 缓冲大于窗口时)
+    if (count > WINDOW_SECTORS)
+    {
+        if (skip != 0 || size % SECTOR_SIZE != 0 || !_sink(first, count, static_cast<uint8_t *>(buffer), _sink_arg))
+        {
+            _errors++;
+            return -1;
+        }
+        _misses++;
+        _bytes += size;
+        return size;
+    }
+
+    bool counted = false;
+    while (true)
+    {
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        Slot *slot = find(first, count);
+        if (slot && slot->state == SLOT_READY)
+        {
+            memcpy(buffer, slot->buffer + (first - slot->lba) * SECTOR_SIZE + skip, size);
+            slot->last_use = ++_use_clock;
+            queue_next(*slot, first + count);
+            xSemaphoreGive(_lock);
+            if (!counted)
+            {
+                _hits++;
+            }
+            _bytes += size;
+            return size;
+        }
+        if (slot)
+        {
+            // 预读已在路上, 等它比重新读一遍快
+            xSemaphoreGive(_lock);
+            if (!counted)
+            {
+                _waits++;
+                counted = true;
+            }
+            xSemaphoreTake(_loaded, pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        slot = victim();
+        if (!slot)
+        {
+            xSemaphoreGive(_lock);
+            xSemaphoreTake(_loaded, pdMS_TO_TICKS(100));
+            continue;
+        }
+        slot->lba = first;
+        slot->count = std::min(WINDOW_SECTORS, _sector_count - first);
+        slot->state = SLOT_LOADING;
+        slot->stale = false;
+        xSemaphoreGive(_lock);
+
+        if (!counted)
+        {
+            _misses++;
+            counted = true;
+        }
+        if (!load(*slot))
+        {
+            return -1;
+        }
+    }
+}
+
+void MscReadAhead::invalidate(uint32_t lba, uint32_t count)
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    for (Slot &slot : _slots)
+    {
+        if (slot.state == SLOT_EMPTY || lba >= slot.lba + slot.count || lba + count <= slot.lba)
+        {
+            continue;
+        }
+        if (slot.state == SLOT_LOADING)
+        {
+            slot.stale = true;
+        }
+        else
+        {
+            slot.state = SLOT_EMPTY;
+        }
+    }
+    xSemaphoreGive(_lock);
+}
+
+void MscReadAhead::prefetch_task()
+{
+    while (true)
+    {
+        xSemaphoreTake(_wake, portMAX_DELAY);
+
+        Slot *queued = nullptr;
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        for (Slot &slot : _slots)
+        {
+            if (slot.state == SLOT_QUEUED)
+            {
+                slot.state = SLOT_LOADING;
+                queued = &slot;
+                break;
+            }
+        }
+        xSemaphoreGive(_lock);
+
+        if (queued && load(*queued))
+        {
+            _prefetches++;
+        }
+    }
+}
+
+MscReadAhead::Stats MscReadAhead::get_stats() const
+{
+    return {
+        .hits = _hits.load(),
+        .waits = _waits.load(),
+        .misses = _misses.load(),
+        .prefetches = _prefetches.load(),
+        .errors = _errors.load(),
+        .bytes = _bytes.load(),
+        .sd_busy_us = _sd_busy_us.load(),
+    };
+}
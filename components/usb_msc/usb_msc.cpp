@@ -3,12 +3,18 @@
 #include <errno.h>
 #include <dirent.h>
 #include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
 
-#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "event_log.hpp"
 
 #define TUSB_DESC_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_MSC_DESC_LEN)
 
-decltype(USB_MSC::_init_msc_key) USB_MSC::_init_msc_key = "init_msc";
+decltype(USB_MSC::_writable) USB_MSC::_writable = false;
+decltype(USB_MSC::_active) USB_MSC::_active = nullptr;
+decltype(USB_MSC::mount_args) USB_MSC::mount_args;
 
 enum
 {
@@ -25,10 +31,78 @@ enum
     EDPT_MSC_IN = 0x81,
 };
 
-// callback that is delivered when storage is mounted/unmounted by application.
-static void storage_mount_changed_cb(tinyusb_msc_event_t *event)
+// 只读时主机在 MODE SENSE 中看到写保护, 不会修改卡上的文件系统
+extern "C" bool tud_msc_is_writable_cb(uint8_t lun)
 {
-    ESP_LOGI("USB_MSC", "Storage mounted to application: %s", event->mount_changed_data.is_mounted ? "Yes" : "No");
+    (void)lun;
+    return USB_MSC::_writable;
+}
+
+// SCSI 回调, 取代 esp_tinyusb 的 tusb_msc_storage, 读请求经预读缓存
+extern "C" void tud_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8], uint8_t product_id[16], uint8_t product_rev[4])
+{
+    (void)lun;
+    memcpy(vendor_id, "ESP32S3 ", 8);
+    memcpy(product_id, "CAN Logger SD   ", 16);
+    memcpy(product_rev, "1.0 ", 4);
+}
+
+extern "C" bool tud_msc_test_unit_ready_cb(uint8_t lun)
+{
+    (void)lun;
+    if (!USB_MSC::_active || !USB_MSC::_active->unit_ready())
+    {
+        // Medium not present
+        tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x3A, 0x00);
+        return false;
+    }
+    return true;
+}
+
+extern "C" void tud_msc_capacity_cb(uint8_t lun, uint32_t *block_count, uint16_t *block_size)
+{
+    (void)lun;
+    *block_count = USB_MSC::_active ? USB_MSC::_active->sector_count() : 0;
+    *block_size = MscReadAhead::SECTOR_SIZE;
+}
+
+extern "C" bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, bool load_eject)
+{
+    (void)lun;
+    (void)power_condition;
+    if (load_eject && !start && USB_MSC::_active)
+    {
+        USB_MSC::_active->eject();
+    }
+    return true;
+}
+
+extern "C" int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize)
+{
+    (void)lun;
+    return USB_MSC::_active ? USB_MSC::_active->read10(lba, offset, buffer, bufsize) : -1;
+}
+
+extern "C" int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t *buffer, uint32_t bufsize)
+{
+    (void)lun;
+    return USB_MSC::_active ? USB_MSC::_active->write10(lba, offset, buffer, bufsize) : -1;
+}
+
+extern "C" int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void *buffer, uint16_t bufsize)
+{
+    (void)buffer;
+    (void)bufsize;
+    switch (scsi_cmd[0])
+    {
+    case SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL:
+        return 0;
+
+    default:
+        // Invalid command operation code
+        tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00);
+        return -1;
+    }
 }
 
 static char const *string_desc_arr[] = {
@@ -60,27 +134,122 @@ static uint8_t const msc_fs_configuration_desc[] = {
     TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, TUSB_DESC_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
     // Interface number, string index, EP Out & EP In address, EP size
+    // 全速设备批量端点最大 64 字节, 吞吐取决于 MSC 缓冲(CONFIG_TINYUSB_MSC_BUFSIZE)与 SD 读
     TUD_MSC_DESCRIPTOR(ITF_NUM_MSC, 0, EDPT_MSC_OUT, EDPT_MSC_IN, 64),
 };
 
-USB_MSC::USB_MSC()
+USB_MSC::USB_MSC(SDCard &sd) : _sd(sd)
 {
-    ESP_LOGI(TAG, "Initializing storage...");
+    _return_sem = xSemaphoreCreateBinary();
+}
 
-    //     ESP_ERROR_CHECK(storage_init_sdmmc());
-    //
-    const tinyusb_msc_sdmmc_config_t config_sdmmc = {
-        .card = sd_obj.get_card_handle(),
-        .callback_mount_changed = storage_mount_changed_cb, /* First way to register the callback. This is while initializing the storage. */
-        .mount_config{.max_files = 5},
-    };
-    //
-    ESP_ERROR_CHECK(tinyusb_msc_storage_init_sdmmc(&config_sdmmc));
-    // ESP_ERROR_CHECK(tinyusb_msc_register_callback(TINYUSB_MSC_EVENT_MOUNT_CHANGED, storage_mount_changed_cb));
-    //
-    //     _mount();
+USB_MSC::~USB_MSC()
+{
+    _active = nullptr;
+}
+
+bool USB_MSC::read_card(uint32_t lba, uint32_t count, uint8_t *buffer, void *arg)
+{
+    return static_cast<USB_MSC *>(arg)->_sd.read_raw(lba, count, buffer) == ESP_OK;
+}
+
+bool USB_MSC::unit_ready(void)
+{
+    if (_ejected.load() || _sd.raw_sector_count() == 0)
+    {
+        return false;
+    }
+    if (!_host_seen)
+    {
+        _host_seen = true;
+        _timing.host_ready_us = static_cast<uint32_t>(esp_timer_get_time() - _attach_start_us);
+    }
+    return true;
+}
+
+uint32_t USB_MSC::sector_count(void)
+{
+    return _sd.raw_sector_count();
+}
+
+int32_t USB_MSC::read10(uint32_t lba, uint32_t offset, void *buffer, uint32_t size)
+{
+    return _read_ahead.read(lba, offset, buffer, size);
+}
+
+int32_t USB_MSC::write10(uint32_t lba, uint32_t offset, const uint8_t *buffer, uint32_t size)
+{
+    if (!_writable || offset % MscReadAhead::SECTOR_SIZE != 0 || size % MscReadAhead::SECTOR_SIZE != 0)
+    {
+        return -1;
+    }
+    const uint32_t first = lba + offset / MscReadAhead::SECTOR_SIZE;
+    const uint32_t count = size / MscReadAhead::SECTOR_SIZE;
+    const esp_err_t ret = _sd.write_raw(first, count, buffer);
+
+    // 写完再作废, 期间读入的旧窗口不会留下
+    _read_ahead.invalidate(first, count);
+    return ret == ESP_OK ? static_cast<int32_t>(size) : -1;
+}
+
+void USB_MSC::eject(void)
+{
+    // 在 TinyUSB 任务中, 卸载驱动交给收回任务
+    _ejected.store(true);
+    xSemaphoreGive(_return_sem);
+}
 
-    ESP_LOGI(TAG, "USB MSC initialization");
+bool USB_MSC::attach(bool writable)
+{
+    if (_attached.load())
+    {
+        ESP_LOGE(TAG, "Card already exported");
+        return false;
+    }
+
+    _attach_start_us = esp_timer_get_time();
+    _timing = {};
+    if (!_sd.export_card())
+    {
+        ESP_LOGE(TAG, "No card to export");
+        _sd.return_card();
+        return false;
+    }
+    _timing.export_us = static_cast<uint32_t>(esp_timer_get_time() - _attach_start_us);
+
+    if (!_read_ahead.init(_sd.raw_sector_count(), &USB_MSC::read_card, this))
+    {
+        _sd.return_card();
+        return false;
+    }
+    if (!_task)
+    {
+        auto task_func = [](void *arg)
+        {
+            USB_MSC *instance = static_cast<USB_MSC *>(arg);
+            instance->return_task();
+        };
+        xTaskCreatePinnedToCore(task_func, "usb_msc", StackSize, this, 4, &_task, tskNO_AFFINITY);
+    }
+
+    _writable = writable;
+    _ejected.store(false);
+    _host_seen = false;
+    _active = this;
+    _attached.store(true);
+    xSemaphoreTake(_return_sem, 0);
+
+    // 此后控制台所在的 USB 口变为 U 盘, 日志在主机弹出后才能看到
+    ESP_LOGI(TAG, "Card exported in %" PRIu32 " ms (%s), USB console returns after the host ejects it",
+             _timing.export_us / 1000, writable ? "read-write" : "read-only");
+    fflush(stdout);
+    vTaskDelay(pdMS_TO_TICKS(20));
+
+    if (_console_phy)
+    {
+        usb_del_phy(_console_phy);
+        _console_phy = nullptr;
+    }
     const tinyusb_config_t tusb_cfg = {
         .device_descriptor = &descriptor_config,
         .string_descriptor = string_desc_arr,
@@ -94,123 +263,147 @@ USB_MSC::USB_MSC()
         .configuration_descriptor = msc_fs_configuration_desc,
 #endif // TUD_OPT_HIGH_SPEED
     };
-    ESP_ERROR_CHECK(tinyusb_driver_install(&tusb_cfg));
-    ESP_LOGI(TAG, "USB MSC initialization DONE");
-    set_init_msc_key(0);
-}
-
-USB_MSC::~USB_MSC()
-{
+    const esp_err_t ret = tinyusb_driver_install(&tusb_cfg);
+    if (ret != ESP_OK)
+    {
+        EVENT_LOG("msc: usb install failed, %s", esp_err_to_name(ret));
+        detach("usb install failed");
+        return false;
+    }
+    _usb_installed = true;
+    _timing.usb_us = static_cast<uint32_t>(esp_timer_get_time() - _attach_start_us);
+    EVENT_LOG("msc: attached, export %u us, usb %u us", _timing.export_us, _timing.usb_us);
+    return true;
 }
 
-esp_err_t USB_MSC::storage_init_sdmmc(void)
+void USB_MSC::detach(const char *reason)
 {
-    esp_err_t ret = ESP_OK;
-    bool host_init = false;
+    const int64_t start = esp_timer_get_time();
+    _ejected.store(true);
 
-    ESP_LOGI(TAG, "Initializing SDCard");
-
-    sdmmc_host_t host{sd_obj.get_host_handle()};
-    sdmmc_slot_config_t slot_config{sd_obj.get_slot_config()};
-
-    sdmmc_card_t *sd_card = (sdmmc_card_t *)malloc(sizeof(sdmmc_card_t));
-    // not using ff_memalloc here, as allocation in internal RAM is preferred
-    sd_card = (sdmmc_card_t *)malloc(sizeof(sdmmc_card_t));
-    ESP_GOTO_ON_FALSE(sd_card, ESP_ERR_NO_MEM, clean, TAG, "could not allocate new sdmmc_card_t");
-
-    ESP_GOTO_ON_ERROR((*host.init)(), clean, TAG, "Host Config Init fail");
-    host_init = true;
-
-    ESP_GOTO_ON_ERROR(sdmmc_host_init_slot(host.slot, (const sdmmc_slot_config_t *)&slot_config),
-                      clean, TAG, "Host init slot fail");
-
-    while (sdmmc_card_init(&host, sd_card))
+    if (_usb_installed)
     {
-        ESP_LOGE(TAG, "The detection pin of the slot is disconnected(Insert uSD card). Retrying...");
-        vTaskDelay(pdMS_TO_TICKS(3000));
-    }
-
-    sd_obj.set_card_handle(sd_card);
-    return ESP_OK;
-clean:
-    if (host_init)
-    {
-        if (host.flags & SDMMC_HOST_FLAG_DEINIT_ARG)
-        {
-            host.deinit_p(host.slot);
-        }
-        else
+        tud_disconnect();
+        const esp_err_t ret = tinyusb_driver_uninstall();
+        if (ret != ESP_OK)
         {
-            (*host.deinit)();
+            EVENT_LOG("msc: usb uninstall failed, %s", esp_err_to_name(ret));
         }
+        _usb_installed = false;
     }
-    if (sd_card)
+    // 内部 PHY 切回 USB-Serial-JTAG, 主机重新枚举出控制台串口
+    if (!_console_phy)
     {
-        free(sd_card);
-        sd_card = NULL;
+        const usb_phy_config_t phy_config = {
+            .controller = USB_PHY_CTRL_SERIAL_JTAG,
+            .target = USB_PHY_TARGET_INT,
+            .otg_mode = USB_OTG_MODE_DEVICE,
+        };
+        usb_new_phy(&phy_config, &_console_phy);
     }
 
-    return ret;
+    // 读失败的预读不会留在缓存中, 收回后不必等它
+    _sd.return_card();
+    _attached.store(false);
+    _timing.return_us = static_cast<uint32_t>(esp_timer_get_time() - start);
+    _switch_count++;
+
+    const MscReadAhead::Stats stats = _read_ahead.get_stats();
+    EVENT_LOG("msc: returned (%s) in %u us", reason, _timing.return_us);
+    EVENT_LOG("msc: read-ahead hits %u waits %u misses %u", stats.hits, stats.waits, stats.misses);
+    ESP_LOGI(TAG, "Card returned to the device (%s) in %" PRIu32 " ms", reason, _timing.return_us / 1000);
 }
 
-void USB_MSC::_mount(void)
+void USB_MSC::return_task(void)
 {
-    std::string path = sd_obj.get_mount_path();
+    int64_t idle_since = 0;
+    while (true)
+    {
+        if (xSemaphoreTake(_return_sem, pdMS_TO_TICKS(500)) == pdTRUE)
+        {
+            if (_attached.load())
+            {
+                detach("host eject");
+            }
+            idle_since = 0;
+            continue;
+        }
+        if (!_attached.load())
+        {
+            continue;
+        }
 
-    ESP_LOGI(TAG, "Mount storage at %s", path.c_str());
-    ESP_ERROR_CHECK(tinyusb_msc_storage_mount(path.c_str()));
+        // 拔线或主机不接管时不会有弹出, 超时后收回, 以免卡一直不可用
+        const int64_t now = esp_timer_get_time();
+        if (tud_mounted() && !tud_suspended())
+        {
+            idle_since = 0;
+        }
+        else if (idle_since == 0)
+        {
+            idle_since = now;
+        }
+        else if (now - idle_since > HOST_TIMEOUT_MS * 1000LL)
+        {
+            detach("host gone");
+            idle_since = 0;
+        }
+    }
 }
 
-int USB_MSC::get_init_msc_key(const char *ns_name)
+void USB_MSC::print_status(void)
 {
-    esp_err_t ret;
-    std::unique_ptr<nvs::NVSHandle>
-        nvs_handle = nvs::open_nvs_handle(ns_name, NVS_READWRITE, &ret);
-
-    nvs_type_t nvs_type;
-    ret = nvs_handle->find_key(USB_MSC::_init_msc_key, nvs_type);
-    uint8_t _msc_key_val;
-    if (ESP_ERR_NVS_NOT_FOUND == ret)
+    printf("Card: %s, switched %" PRIu32 " times\n", _attached.load() ? "exported" : "mounted on device", _switch_count);
+    if (_timing.export_us == 0)
     {
-        ESP_LOGE("USB_MSC", "_init_msc_key not exit , inited to 0");
-        nvs_handle->set_item(USB_MSC::_init_msc_key, 0);
-        return 0;
+        return;
     }
-    else if (ESP_OK == ret)
+    printf("Last switch to USB:  export %" PRIu32 " ms, USB up %" PRIu32 " ms, host ready %" PRIu32 " ms\n",
+           _timing.export_us / 1000, _timing.usb_us / 1000, _timing.host_ready_us / 1000);
+    printf("Last return:         %" PRIu32 " ms\n", _timing.return_us / 1000);
+
+    const MscReadAhead::Stats stats = _read_ahead.get_stats();
+    const uint64_t busy_ms = stats.sd_busy_us / 1000;
+    printf("Read-ahead: %" PRIu64 " KiB, hits %" PRIu32 " waits %" PRIu32 " misses %" PRIu32 " prefetches %" PRIu32 " errors %" PRIu32 "\n",
+           stats.bytes / 1024, stats.hits, stats.waits, stats.misses, stats.prefetches, stats.errors);
+    if (busy_ms > 0)
     {
-        ret = nvs_handle->get_item(USB_MSC::_init_msc_key, _msc_key_val);
-        if (ESP_OK == ret)
-        {
-            ESP_LOGI("USB_MSC", "_init_msc_key found = %d", _msc_key_val);
-            return _msc_key_val;
-        }
+        printf("SD read: %" PRIu64 " ms busy\n", busy_ms);
     }
-    return 0;
 }
 
-void USB_MSC::set_init_msc_key(uint8_t new_val, const char *ns_name)
+int USB_MSC::console_mount(void *context, int argc, char **argv)
 {
-    esp_err_t ret;
-    std::unique_ptr<nvs::NVSHandle>
-        nvs_handle = nvs::open_nvs_handle(ns_name, NVS_READWRITE, &ret);
-    nvs_handle->set_item(USB_MSC::_init_msc_key, new_val);
-}
+    USB_MSC *instance = static_cast<USB_MSC *>(context);
+    int nerrors = arg_parse(argc, argv, (void **)&mount_args);
+    if (nerrors != 0)
+    {
+        arg_print_errors(stderr, mount_args.end, argv[0]);
+        return 1;
+    }
 
-// unmount storage
-int USB_MSC::console_mount(int argc, char **argv)
-{
-    set_init_msc_key(1);
-    ESP_LOGI("USB_MSC", "Restarting");
-    esp_restart();
+    if (mount_args.status->count > 0)
+    {
+        instance->print_status();
+        return 0;
+    }
+    return instance->attach(mount_args.writable->count > 0) ? 0 : 1;
 }
 
-void USB_MSC::registerMount()
+void USB_MSC::registerConsoleCommands()
 {
+    mount_args.writable = arg_lit0("w", "writable", "Let the host modify the card (default read-only)");
+    mount_args.status = arg_lit0("s", "status", "Show the last switch timings instead of exporting");
+    mount_args.end = arg_end(2);
+
     const esp_console_cmd_t cmd = {
         .command = "usb_mount",
-        .help = "Mount SD-Card to USB-MSC",
+        .help = "Export SD-Card over USB-MSC without rebooting; eject it on the host to get it (and this console) back",
         .hint = NULL,
-        .func = &console_mount,
+        .func = nullptr,
+        .argtable = &mount_args,
+        .func_w_context = &USB_MSC::console_mount,
+        .context = this,
     };
     ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
 }
@@ -32,7 +32,7 @@ extern "C"
         void initialize_nvs();
         void initialize_filesystem();
         void initialize_console_peripheral();
-        void initialize_console_library(std::string_view history_path);
+        void initialize_console_library();
 
         void task();
         void update_prompt(void);
@@ -5,6 +5,7 @@
 #include <filesystem>
 
 #include "user_console.hpp"
+#include "boot_trace.hpp"
 #include "linenoise/linenoise.h"
 #include "esp_system.h"
 #include "nvs.h"
@@ -22,6 +23,9 @@ static const uint32_t StackSize = 1024 * 16;
 
 void USER_CONSOLE::task()
 {
+    // 历史记录在控制台任务里读入, 不占启动时间
+    linenoiseHistoryLoad(cmd_history_path.c_str());
+
     while (true)
     {
         if (xSemaphoreTake(_prompt_change_sem, 0))
@@ -132,7 +136,9 @@ void USER_CONSOLE::initialize_console_peripheral()
     };
 
     /* Install USB-SERIAL-JTAG driver for interrupt-driven reads and writes */
+    const uint32_t trace = BootTrace::begin("jtag_install");
     ESP_ERROR_CHECK(usb_serial_jtag_driver_install(&jtag_config));
+    BootTrace::end(trace);
 
     /* Tell vfs to use usb-serial-jtag driver */
     usb_serial_jtag_vfs_use_driver();
@@ -170,7 +176,7 @@ void USER_CONSOLE::initialize_console_peripheral()
     setvbuf(stdin, nullptr, _IONBF, 0);
 }
 
-void USER_CONSOLE::initialize_console_library(std::string_view history_path)
+void USER_CONSOLE::initialize_console_library()
 {
 
     const esp_console_config_t console_config = {
@@ -189,7 +195,6 @@ void USER_CONSOLE::initialize_console_library(std::string_view history_path)
     linenoiseHistorySetMaxLen(100);
     linenoiseSetMaxLineLen(console_config.max_cmdline_length);
     linenoiseAllowEmpty(false);
-    linenoiseHistoryLoad(history_path.data());
 
     if (linenoiseProbe())
     {
@@ -221,7 +226,7 @@ USER_CONSOLE::USER_CONSOLE(SemaphoreHandle_t &prompt_change,
     ESP_LOGI(TAG, "Command history enabled");
 
     initialize_console_peripheral();
-    initialize_console_library(cmd_history_path);
+    initialize_console_library();
 
     prompt = (char *)malloc(CONSOLE_PROMPT_MAX_LEN);
     if (!prompt)
@@ -36,6 +36,9 @@ extern "C"
       bool connect(const std::string &ssid, const std::string &password, int timeout_ms = 10000);
       bool disconnect();
       bool isConnected();
+
+      // 密码记录器, 用于订阅存储卡挂载状态
+      LoggerBase &get_key_logger();
       void wifi_scan();
 
       void registerConsoleCommands();
@@ -1,5 +1,6 @@
 #include "wifi_component.hpp"
 #include "esp_log.h"
+#include "boot_trace.hpp"
 #include "argtable3/argtable3.h"
 
 decltype(WiFiComponent::_wifi_state) WiFiComponent::_wifi_state{""};
@@ -34,7 +35,9 @@ void WiFiComponent::initializeWiFi()
     assert(sta_netif);
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    const uint32_t trace = BootTrace::begin("wifi_init");
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    BootTrace::end(trace);
 
     ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &WiFiComponent::eventHandler, this));
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &WiFiComponent::eventHandler, this));
@@ -108,6 +111,11 @@ bool WiFiComponent::isConnected()
     return (xEventGroupGetBits(_wifi_event) & CONNECTED_BIT);
 }
 
+LoggerBase &WiFiComponent::get_key_logger()
+{
+    return _wifikey_logger;
+}
+
 void WiFiComponent::registerConsoleCommands()
 {
     join_args.ssid = arg_str1(NULL, NULL, "<ssid>", "SSID of AP");
@@ -8,11 +8,13 @@
 #include <inttypes.h>
 #include <time.h>
 #include <iostream>
+#include <memory>
 
 #include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "nvs_handle.hpp"
+#include "driver/gpio.h"
 
 #include "sntp_service.hpp"
 #include "elrs.hpp"
@@ -22,10 +24,20 @@
 #include "wifi_component.hpp"
 #include "user_console.hpp"
 #include "twai_device.hpp"
+#include "mcp2515.hpp"
+#include "can_dbc.hpp"
+#include "can_gateway.hpp"
 #include "logger.hpp"
 #include "system_cmd.hpp"
 #include "nvs_component.hpp"
 #include "filesystem_cmd.hpp"
+#include "event_log.hpp"
+#include "blackbox.hpp"
+#include "gs_usb.hpp"
+#include "slcan.hpp"
+#include "usb_can_mode.hpp"
+#include "boot_graph.hpp"
+#include "boot_trace.hpp"
 
 #include "usb_msc.hpp"
 
@@ -33,6 +45,7 @@ USER_CONSOLE *console_obj;
 
 extern "C" void app_main(void)
 {
+    BootTrace::mark("app_main");
 
     setenv("TZ", "CST-8", 1);
     tzset();
@@ -47,52 +60,161 @@ extern "C" void app_main(void)
         ESP_LOGE("Main", "Failed to create default event loop: %s", esp_err_to_name(ret));
         return;
     }
+    // SD 卡、MCP2515、RTC 各自安装 GPIO 中断服务, 并行初始化前先装好, 它们的调用只返回 INVALID_STATE
+    gpio_install_isr_service(0);
 
-    NVS_DEV nvs_obj;
+    QueueHandle_t beep_queue = xQueueCreate(5, sizeof(BeeperMessage));
+    QueueHandle_t twai_tx_queue = xQueueCreate(10, sizeof(twai_message_t));
+#if CONFIG_MCP2515_ENABLE
+    QueueHandle_t mcp2515_rx_queue = xQueueCreate(32, sizeof(CanFrameRecord));
+#endif
+    EventGroupHandle_t wifi_event_group = xEventGroupCreate();
+    SemaphoreHandle_t sntp_sem = xSemaphoreCreateBinary();
 
-    if (1 == USB_MSC::get_init_msc_key())
-    {
-        USB_MSC msc_obj;
-        while (1)
-        {
-            vTaskDelay(pdMS_TO_TICKS(100));
-        }
-    }
-    else
-    {
-        /* SD-Card */
-        SDCard sd_obj;
-        /* 蜂鸣器 */
-        QueueHandle_t beep_queue = xQueueCreate(5, sizeof(BeeperMessage));
-        Buzzer buzzer_obj(beep_queue);
-        /* TWAI外设初始化 */
-        QueueHandle_t twai_tx_queue = xQueueCreate(10, sizeof(twai_message_t));
-        QueueHandle_t twai_rx_queue = xQueueCreate(10, sizeof(twai_message_t));
-        TWAI_Device twai_obj(beep_queue, twai_tx_queue, twai_rx_queue, origin_time);
-        /* WIFI事件 */
-        EventGroupHandle_t wifi_event_group = xEventGroupCreate();
-        /* SNTP服务 */
-        SemaphoreHandle_t sntp_sem = xSemaphoreCreateBinary();
-        SNTPManager sntp_obj(sntp_sem, wifi_event_group);
-        /* RCT服务 */
-        RTC ds3231_obj(beep_queue, sntp_sem);
-        printf("\033[92;45m RTC_IMTE: CST-8:=%s \033[0m \r\n", ds3231_obj.get_cst8_time().c_str());
+    std::unique_ptr<NVS_DEV> nvs_obj;
+    std::unique_ptr<SDCard> sd_obj;
+    std::unique_ptr<Buzzer> buzzer_obj;
+    std::unique_ptr<TWAI_Device> twai_obj;
+    std::unique_ptr<BlackBox> blackbox_obj;
+#if CONFIG_MCP2515_ENABLE
+    std::unique_ptr<MCP2515> mcp2515_obj;
+#endif
+    std::unique_ptr<CanDbc> dbc_obj;
+    std::unique_ptr<RTC> ds3231_obj;
+    std::unique_ptr<CanGateway> gateway_obj;
+    std::unique_ptr<GsUsb> gs_usb_obj;
+    std::unique_ptr<Slcan> slcan_obj;
+    std::unique_ptr<USB_MSC> msc_obj;
+    std::unique_ptr<WiFiComponent> wifi;
+    std::unique_ptr<SNTPManager> sntp_obj;
 
-        /* ELRS解析业务 */
-        // ELRS elrs_obj(twai_tx_queue, 0x12345678UL);
-        /* 串口终端控制台 */
-        console_obj = new USER_CONSOLE(CmdFilesystem::_prompt_change_sem, CmdFilesystem::_current_path, WiFiComponent::_wifi_state);
-        /* WIFI业务初始化 */
-        WiFiComponent wifi(CmdFilesystem::_prompt_change_sem, wifi_event_group);
-        wifi.registerConsoleCommands();
+    /* 启动依赖图: 无依赖关系的子系统在两个核上同时初始化.
+       各子系统与依赖图放在堆上, app_main 任务栈只留指针 */
+    std::unique_ptr<BootGraph> boot = std::make_unique<BootGraph>();
+    const int nvs = boot->add("nvs", [&]
+                              { nvs_obj = std::make_unique<NVS_DEV>(); });
+    /* TWAI外设初始化, 固定在核0(中断分配在安装驱动的核上); SD卡挂载前接收的帧记入内存暂存区 */
+    const int twai = boot->add("twai", [&]
+                               { twai_obj = std::make_unique<TWAI_Device>(beep_queue, twai_tx_queue, origin_time); }, {nvs}, 0);
+    /* SD-Card, 挂载耗时最长, 放在核1与TWAI并行 */
+    const int sd = boot->add("sd", [&]
+                             { sd_obj = std::make_unique<SDCard>(); }, {}, 1);
+    /* 蜂鸣器 */
+    boot->add("buzzer", [&]
+              { buzzer_obj = std::make_unique<Buzzer>(beep_queue); });
+    /* RCT服务 */
+    const int rtc = boot->add("rtc", [&]
+                              {
+                                  ds3231_obj = std::make_unique<RTC>(beep_queue, sntp_sem);
+                                  printf("\033[92;45m RTC_IMTE: CST-8:=%s \033[0m \r\n", ds3231_obj->get_cst8_time().c_str()); });
+    /* 片上Flash黑匣子, 默认只在存储卡不在时记录CAN帧 */
+    const int blackbox = boot->add("blackbox", [&]
+                                   {
+                                       blackbox_obj = std::make_unique<BlackBox>();
+                                       twai_obj->set_blackbox(&*blackbox_obj); }, {twai});
+#if CONFIG_MCP2515_ENABLE
+    /* SPI-CAN 第二通道, 与TWAI合并记录; 引脚与波特率见 menuconfig */
+    boot->add("mcp2515", [&]
+              {
+#if CONFIG_MCP2515_BITRATE_125K
+                  const MCP2515::Bitrate bitrate = MCP2515::Bitrate::KBPS_125;
+#elif CONFIG_MCP2515_BITRATE_500K
+                  const MCP2515::Bitrate bitrate = MCP2515::Bitrate::KBPS_500;
+#elif CONFIG_MCP2515_BITRATE_1M
+                  const MCP2515::Bitrate bitrate = MCP2515::Bitrate::KBPS_1000;
+#else
+                  const MCP2515::Bitrate bitrate = MCP2515::Bitrate::KBPS_250;
+#endif
+                  // 队列需在 MCP2515 开始接收前加入合并记录; 初始化失败时只是一个没有帧的通道
+                  twai_obj->add_log_channel(mcp2515_rx_queue);
+                  mcp2515_obj = std::make_unique<MCP2515>(mcp2515_rx_queue, origin_time,
+                                                          static_cast<gpio_num_t>(CONFIG_MCP2515_SCLK_GPIO),
+                                                          static_cast<gpio_num_t>(CONFIG_MCP2515_MOSI_GPIO),
+                                                          static_cast<gpio_num_t>(CONFIG_MCP2515_MISO_GPIO),
+                                                          static_cast<gpio_num_t>(CONFIG_MCP2515_CS_GPIO),
+                                                          static_cast<gpio_num_t>(CONFIG_MCP2515_INT_GPIO),
+                                                          2, bitrate, CONFIG_MCP2515_CRYSTAL_HZ); }, {twai});
+#endif
+    /* 卡挂载且时间已由RTC校准后订阅在位通知, 日志开始按原顺序写出暂存区 */
+    boot->add("storage", [&]
+              {
+                  sd_obj->add_presence_listener(&LoggerBase::storage_listener, &twai_obj->get_logger());
+                  sd_obj->add_presence_listener(&BlackBox::storage_listener, &*blackbox_obj); }, {sd, blackbox, rtc});
+    /* DBC信号解码 */
+    const int dbc = boot->add("dbc", [&]
+                              {
+                                  dbc_obj = std::make_unique<CanDbc>();
+                                  if (dbc_obj->load("/sdcard/can.dbc"))
+                                  {
+                                      twai_obj->set_signal_decoder(&*dbc_obj);
+                                  } }, {sd, twai});
+    /* ELRS解析业务 */
+    // ELRS elrs_obj(twai_tx_queue, 0x12345678UL);
+    /* CAN/CRSF 网关, SD卡无规则文件时使用NVS中的备份 */
+    const int gateway = boot->add("gateway", [&]
+                                  {
+                                      gateway_obj = std::make_unique<CanGateway>();
+                                      if (gateway_obj->load("/sdcard/gateway.txt") || gateway_obj->load_nvs())
+                                      {
+                                          gateway_obj->start(*twai_obj);
+                                      }
+                                      else
+                                      {
+                                          gateway_obj->defer_start(*twai_obj);
+                                      }
+                                      // gateway_obj->attach_elrs(elrs_obj);
+                                  }, {sd, twai});
+    /* gs_usb / SLCAN: gsusb 或 slcan 命令重启后本次运行作为 USB CAN 适配器, USB 控制台不可用 */
+    const int usb = boot->add("usb_can", [&]
+                              {
+                                  gs_usb_obj = std::make_unique<GsUsb>();
+                                  slcan_obj = std::make_unique<Slcan>();
+                                  const UsbCanMode::Mode mode = UsbCanMode::take_boot_request();
+                                  if (mode == UsbCanMode::Mode::GS_USB)
+                                  {
+                                      gs_usb_obj->start(*twai_obj);
+                                  }
+                                  else if (mode == UsbCanMode::Mode::SLCAN)
+                                  {
+                                      slcan_obj->start(*twai_obj);
+                                  } }, {twai});
+    /* USB-MSC: usb_mount 运行中把卡导出给主机, 主机弹出后收回, 不重启 */
+    const int msc = boot->add("usb_msc", [&]
+                              { msc_obj = std::make_unique<USB_MSC>(*sd_obj); }, {sd});
+    /* 串口终端控制台, 命令历史在控制台任务中读入 */
+    const int console = boot->add("console", [&]
+                                  { console_obj = new USER_CONSOLE(CmdFilesystem::_prompt_change_sem, CmdFilesystem::_current_path, WiFiComponent::_wifi_state); }, {usb});
+    /* 注册终端命令: 命令表没有锁, 集中在一个阶段里注册 */
+    const int commands = boot->add("commands", [&]
+                                   {
+                                       CmdSystem::registerSystem();
+                                       EventLog::registerConsoleCommands();
+                                       BootTrace::registerConsoleCommands();
+                                       CmdFilesystem::registerCommands();
+                                       sd_obj->registerConsoleCommands();
+                                       msc_obj->registerConsoleCommands();
+                                       dbc_obj->registerConsoleCommands();
+                                       twai_obj->registerConsoleCommands();
+                                       blackbox_obj->registerConsoleCommands();
+                                       gs_usb_obj->registerConsoleCommands();
+                                       slcan_obj->registerConsoleCommands();
+                                       gateway_obj->registerConsoleCommands(); }, {console, msc, dbc, gateway, blackbox});
+    /* WIFI业务初始化, 不在CAN记录的关键路径上 */
+    const int wifi_stage = boot->add_lazy("wifi", [&]
+                                          {
+                                              wifi = std::make_unique<WiFiComponent>(CmdFilesystem::_prompt_change_sem, wifi_event_group);
+                                              sd_obj->add_presence_listener(&LoggerBase::storage_listener, &wifi->get_key_logger());
+                                              wifi->registerConsoleCommands(); }, {commands});
+    /* SNTP服务 */
+    boot->add_lazy("sntp", [&]
+                   { sntp_obj = std::make_unique<SNTPManager>(sntp_sem, wifi_event_group); }, {wifi_stage});
 
-        /* 注册终端命令 */
-        CmdSystem::registerSystem();
-        CmdFilesystem::registerCommands();
-        USB_MSC::registerMount();
-        while (1)
-        {
-            vTaskDelay(pdMS_TO_TICKS(100));
-        }
+    boot->start();
+    boot->wait_all();
+    boot->print_timings();
+
+    while (1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(100));
     }
 }
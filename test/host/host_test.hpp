@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdio>
+
+// 主机测试的断言: 失败时打印位置并计数, main 最后以 host_test::result() 作为退出码
+namespace host_test
+{
+    inline int failures = 0;
+
+    inline int result()
+    {
+        if (failures)
+        {
+            std::printf("%d check(s) failed\n", failures);
+            return 1;
+        }
+        std::printf("all checks passed\n");
+        return 0;
+    }
+}
+
+#define CHECK(expr)                                                            \
+    do                                                                         \
+    {                                                                          \
+        if (!(expr))                                                           \
+        {                                                                      \
+            std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr); \
+            host_test::failures++;                                             \
+        }                                                                      \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                          \
+    do                                                                                      \
+    {                                                                                       \
+        const auto actual_ = (actual);                                                      \
+        const auto expected_ = (expected);                                                  \
+        if (!(actual_ == expected_))                                                        \
+        {                                                                                   \
+            std::printf("%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, \
+                        #actual, #expected, static_cast<long long>(actual_),                \
+                        static_cast<long long>(expected_));                                 \
+            host_test::failures++;                                                          \
+        }                                                                                   \
+    } while (0)
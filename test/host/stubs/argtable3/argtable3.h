@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdio.h>
+
+// 主机测试只需要命令参数结构体能够定义, 解析不会被调用
+struct arg_hdr
+{
+    int flag;
+};
+struct arg_lit
+{
+    struct arg_hdr hdr;
+    int count;
+};
+struct arg_int
+{
+    struct arg_hdr hdr;
+    int count;
+    int *ival;
+};
+struct arg_dbl
+{
+    struct arg_hdr hdr;
+    int count;
+    double *dval;
+};
+struct arg_str
+{
+    struct arg_hdr hdr;
+    int count;
+    const char **sval;
+};
+struct arg_end
+{
+    struct arg_hdr hdr;
+    int count;
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    struct arg_lit *arg_lit0(const char *shortopts, const char *longopts, const char *glossary);
+    struct arg_int *arg_int0(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+    struct arg_int *arg_int1(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+    struct arg_dbl *arg_dbl0(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+    struct arg_str *arg_str0(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+    struct arg_str *arg_str1(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+    struct arg_end *arg_end(int maxerrors);
+    int arg_parse(int argc, char **argv, void **argtable);
+    void arg_print_errors(FILE *fp, struct arg_end *end, const char *progname);
+
+#ifdef __cplusplus
+}
+#endif
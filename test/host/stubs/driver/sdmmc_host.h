@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+// 与 sdmmc_types.h 取值一致, 只保留速度档位与主机标志
+#define SDMMC_FREQ_DEFAULT 20000
+#define SDMMC_FREQ_HIGHSPEED 40000
+#define SDMMC_FREQ_PROBING 400
+
+#define SDMMC_HOST_FLAG_1BIT (1 << 0)
+#define SDMMC_HOST_FLAG_4BIT (1 << 1)
+#define SDMMC_HOST_FLAG_8BIT (1 << 2)
+#define SDMMC_HOST_FLAG_SPI (1 << 3)
+#define SDMMC_HOST_FLAG_DDR (1 << 4)
+
+typedef struct
+{
+    uint32_t flags;
+    int max_freq_khz;
+} sdmmc_host_t;
@@ -0,0 +1,254 @@
+// 主机测试: ESP-IDF 驱动与系统接口的替身
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+#include "argtable3/argtable3.h"
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "host_hooks.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+
+namespace
+{
+    const auto start_time = std::chrono::steady_clock::now();
+
+    struct Pin
+    {
+        int level = 1;
+        gpio_int_type_t intr_type = GPIO_INTR_DISABLE;
+        gpio_isr_t handler = nullptr;
+        void *arg = nullptr;
+    };
+
+    std::mutex gpio_mutex;
+    Pin pins[GPIO_NUM_MAX];
+
+    std::mutex spi_mutex;
+    host::SpiSlave spi_slave;
+    spi_device_t *const spi_device = reinterpret_cast<spi_device_t *>(0x5350);
+}
+
+void host::set_spi_slave(SpiSlave slave)
+{
+    std::lock_guard<std::mutex> lock(spi_mutex);
+    spi_slave = std::move(slave);
+}
+
+void host::set_gpio_level(gpio_num_t pin, int level)
+{
+    gpio_isr_t handler = nullptr;
+    void *arg = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(gpio_mutex);
+        Pin &p = pins[pin];
+        const bool rising = p.level == 0 && level != 0;
+        const bool falling = p.level != 0 && level == 0;
+        p.level = level != 0;
+        if ((falling && (p.intr_type == GPIO_INTR_NEGEDGE || p.intr_type == GPIO_INTR_ANYEDGE)) ||
+            (rising && (p.intr_type == GPIO_INTR_POSEDGE || p.intr_type == GPIO_INTR_ANYEDGE)))
+        {
+            handler = p.handler;
+            arg = p.arg;
+        }
+    }
+    if (handler)
+    {
+        handler(arg);
+    }
+}
+
+extern "C"
+{
+    const char *esp_err_to_name(esp_err_t code)
+    {
+        switch (code)
+        {
+        case ESP_OK:
+            return "ESP_OK";
+        case ESP_ERR_NO_MEM:
+            return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:
+            return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE:
+            return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_TIMEOUT:
+            return "ESP_ERR_TIMEOUT";
+        default:
+            return "ESP_FAIL";
+        }
+    }
+
+    void *heap_caps_malloc(size_t size, uint32_t)
+    {
+        return malloc(size);
+    }
+
+    void *heap_caps_calloc(size_t n, size_t size, uint32_t)
+    {
+        return calloc(n, size);
+    }
+
+    void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t)
+    {
+        return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    }
+
+    void heap_caps_free(void *ptr)
+    {
+        free(ptr);
+    }
+
+    size_t heap_caps_get_free_size(uint32_t)
+    {
+        return 256 * 1024;
+    }
+
+    size_t heap_caps_get_largest_free_block(uint32_t)
+    {
+        return 128 * 1024;
+    }
+
+    uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+    {
+        crc = ~crc;
+        for (uint32_t i = 0; i < len; i++)
+        {
+            crc ^= buf[i];
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+            }
+        }
+        return ~crc;
+    }
+
+    int64_t esp_timer_get_time(void)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+    }
+
+    esp_err_t esp_console_cmd_register(const esp_console_cmd_t *)
+    {
+        return ESP_OK;
+    }
+
+    struct arg_lit *arg_lit0(const char *, const char *, const char *)
+    {
+        return nullptr;
+    }
+    struct arg_int *arg_int0(const char *, const char *, const char *, const char *)
+    {
+        return nullptr;
+    }
+    struct arg_int *arg_int1(const char *, const char *, const char *, const char *)
+    {
+        return nullptr;
+    }
+    struct arg_dbl *arg_dbl0(const char *, const char *, const char *, const char *)
+    {
+        return nullptr;
+    }
+    struct arg_str *arg_str0(const char *, const char *, const char *, const char *)
+    {
+        return nullptr;
+    }
+    struct arg_str *arg_str1(const char *, const char *, const char *, const char *)
+    {
+        return nullptr;
+    }
+    struct arg_end *arg_end(int)
+    {
+        return nullptr;
+    }
+    int arg_parse(int, char **, void **)
+    {
+        return 1;
+    }
+    void arg_print_errors(FILE *, struct arg_end *, const char *)
+    {
+    }
+
+    esp_err_t gpio_config(const gpio_config_t *config)
+    {
+        std::lock_guard<std::mutex> lock(gpio_mutex);
+        for (int pin = 0; pin < GPIO_NUM_MAX; pin++)
+        {
+            if (config->pin_bit_mask & (1ULL << pin))
+            {
+                pins[pin].intr_type = config->intr_type;
+            }
+        }
+        return ESP_OK;
+    }
+
+    esp_err_t gpio_install_isr_service(int)
+    {
+        return ESP_OK;
+    }
+
+    esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
+    {
+        std::lock_guard<std::mutex> lock(gpio_mutex);
+        pins[gpio_num].handler = isr_handler;
+        pins[gpio_num].arg = args;
+        return ESP_OK;
+    }
+
+    esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num)
+    {
+        std::lock_guard<std::mutex> lock(gpio_mutex);
+        pins[gpio_num].handler = nullptr;
+        pins[gpio_num].arg = nullptr;
+        return ESP_OK;
+    }
+
+    int gpio_get_level(gpio_num_t gpio_num)
+    {
+        std::lock_guard<std::mutex> lock(gpio_mutex);
+        return pins[gpio_num].level;
+    }
+
+    esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+    {
+        host::set_gpio_level(gpio_num, level);
+        return ESP_OK;
+    }
+
+    esp_err_t spi_bus_initialize(spi_host_device_t, const spi_bus_config_t *, int)
+    {
+        return ESP_OK;
+    }
+
+    esp_err_t spi_bus_free(spi_host_device_t)
+    {
+        return ESP_OK;
+    }
+
+    esp_err_t spi_bus_add_device(spi_host_device_t, const spi_device_interface_config_t *, spi_device_handle_t *handle)
+    {
+        *handle = spi_device;
+        return ESP_OK;
+    }
+
+    esp_err_t spi_bus_remove_device(spi_device_handle_t)
+    {
+        return ESP_OK;
+    }
+
+    esp_err_t spi_device_polling_transmit(spi_device_handle_t, spi_transaction_t *transaction)
+    {
+        std::lock_guard<std::mutex> lock(spi_mutex);
+        if (!spi_slave)
+        {
+            return ESP_ERR_INVALID_STATE;
+        }
+        spi_slave(static_cast<const uint8_t *>(transaction->tx_buffer), static_cast<uint8_t *>(transaction->rx_buffer),
+                  transaction->length / 8);
+        return ESP_OK;
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // 进程启动以来的微秒数
+    int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *QueueHandle_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+    void vQueueDelete(QueueHandle_t queue);
+    BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+    BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken);
+    BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+    BaseType_t xQueueReset(QueueHandle_t queue);
+    UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define xQueueSendToBack(queue, item, ticks) xQueueSend(queue, item, ticks)
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    SemaphoreHandle_t xSemaphoreCreateBinary(void);
+    SemaphoreHandle_t xSemaphoreCreateMutex(void);
+    SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count);
+    BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+    BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+    BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *woken);
+    UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t semaphore);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define vSemaphoreDelete(semaphore) vQueueDelete(semaphore)
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+
+#define tskNO_AFFINITY ((BaseType_t)0x7FFFFFFF)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // 任务以分离的线程运行, 优先级与绑核被忽略
+    BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth,
+                                       void *arg, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core);
+    BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth,
+                           void *arg, UBaseType_t priority, TaskHandle_t *handle);
+    void vTaskDelete(TaskHandle_t handle);
+    void vTaskDelay(TickType_t ticks);
+    TickType_t xTaskGetTickCount(void);
+    TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+#ifdef __cplusplus
+}
+#endif
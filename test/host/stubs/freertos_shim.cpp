@@ -0,0 +1,210 @@
+// 主机测试: 在 std::thread 与条件变量上实现组件用到的 FreeRTOS 接口
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    const auto start_time = std::chrono::steady_clock::now();
+
+    // 队列与信号量共用: 信号量的元素长度为 0, 计数即队列中的元素数
+    struct Queue
+    {
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<std::vector<uint8_t>> items;
+        size_t length;
+        size_t item_size;
+    };
+
+    std::chrono::steady_clock::time_point deadline(TickType_t ticks)
+    {
+        if (ticks == portMAX_DELAY)
+        {
+            return std::chrono::steady_clock::time_point::max();
+        }
+        return std::chrono::steady_clock::now() + std::chrono::milliseconds(ticks * portTICK_PERIOD_MS);
+    }
+
+    thread_local int current_task = 0;
+    std::atomic<int> next_task{1};
+}
+
+extern "C"
+{
+    BaseType_t xPortGetCoreID(void)
+    {
+        return 0;
+    }
+
+    BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *, uint32_t, void *arg,
+                                       UBaseType_t, TaskHandle_t *handle, BaseType_t)
+    {
+        const int id = next_task++;
+        std::thread([function, arg, id]
+                    {
+                        current_task = id;
+                        function(arg); })
+            .detach();
+        if (handle)
+        {
+            *handle = reinterpret_cast<TaskHandle_t>(static_cast<intptr_t>(id));
+        }
+        return pdPASS;
+    }
+
+    BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *arg,
+                           UBaseType_t priority, TaskHandle_t *handle)
+    {
+        return xTaskCreatePinnedToCore(function, name, stack_depth, arg, priority, handle, tskNO_AFFINITY);
+    }
+
+    void vTaskDelete(TaskHandle_t handle)
+    {
+        // 只支持任务删除自己: 线程停在这里, 进程退出时一并结束
+        if (handle == nullptr)
+        {
+            while (true)
+            {
+                std::this_thread::sleep_for(std::chrono::hours(1));
+            }
+        }
+    }
+
+    void vTaskDelay(TickType_t ticks)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+    }
+
+    TickType_t xTaskGetTickCount(void)
+    {
+        const auto elapsed = std::chrono::steady_clock::now() - start_time;
+        return static_cast<TickType_t>(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / portTICK_PERIOD_MS);
+    }
+
+    TaskHandle_t xTaskGetCurrentTaskHandle(void)
+    {
+        return reinterpret_cast<TaskHandle_t>(static_cast<intptr_t>(current_task));
+    }
+
+    QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+    {
+        Queue *queue = new Queue;
+        queue->length = length;
+        queue->item_size = item_size;
+        return queue;
+    }
+
+    void vQueueDelete(QueueHandle_t handle)
+    {
+        delete static_cast<Queue *>(handle);
+    }
+
+    BaseType_t xQueueSend(QueueHandle_t handle, const void *item, TickType_t ticks)
+    {
+        Queue *queue = static_cast<Queue *>(handle);
+        std::unique_lock<std::mutex> lock(queue->mutex);
+        if (!queue->changed.wait_until(lock, deadline(ticks), [queue]
+                                       { return queue->items.size() < queue->length; }))
+        {
+            return pdFALSE;
+        }
+        const uint8_t *bytes = static_cast<const uint8_t *>(item);
+        queue->items.emplace_back(bytes, bytes + queue->item_size);
+        queue->changed.notify_all();
+        return pdTRUE;
+    }
+
+    BaseType_t xQueueSendFromISR(QueueHandle_t handle, const void *item, BaseType_t *woken)
+    {
+        if (woken)
+        {
+            *woken = pdFALSE;
+        }
+        return xQueueSend(handle, item, 0);
+    }
+
+    BaseType_t xQueueReceive(QueueHandle_t handle, void *item, TickType_t ticks)
+    {
+        Queue *queue = static_cast<Queue *>(handle);
+        std::unique_lock<std::mutex> lock(queue->mutex);
+        if (!queue->changed.wait_until(lock, deadline(ticks), [queue]
+                                       { return !queue->items.empty(); }))
+        {
+            return pdFALSE;
+        }
+        if (queue->item_size)
+        {
+            memcpy(item, queue->items.front().data(), queue->item_size);
+        }
+        queue->items.pop_front();
+        queue->changed.notify_all();
+        return pdTRUE;
+    }
+
+    BaseType_t xQueueReset(QueueHandle_t handle)
+    {
+        Queue *queue = static_cast<Queue *>(handle);
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->items.clear();
+        queue->changed.notify_all();
+        return pdPASS;
+    }
+
+    UBaseType_t uxQueueMessagesWaiting(QueueHandle_t handle)
+    {
+        Queue *queue = static_cast<Queue *>(handle);
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        return queue->items.size();
+    }
+
+    SemaphoreHandle_t xSemaphoreCreateBinary(void)
+    {
+        return xQueueCreate(1, 0);
+    }
+
+    SemaphoreHandle_t xSemaphoreCreateMutex(void)
+    {
+        return xSemaphoreCreateCounting(1, 1);
+    }
+
+    SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+    {
+        SemaphoreHandle_t semaphore = xQueueCreate(max_count, 0);
+        for (UBaseType_t i = 0; i < initial_count; i++)
+        {
+            xSemaphoreGive(semaphore);
+        }
+        return semaphore;
+    }
+
+    BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+    {
+        return xQueueReceive(semaphore, nullptr, ticks);
+    }
+
+    BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+    {
+        return xQueueSend(semaphore, nullptr, 0);
+    }
+
+    BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *woken)
+    {
+        return xQueueSendFromISR(semaphore, nullptr, woken);
+    }
+
+    UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t semaphore)
+    {
+        return uxQueueMessagesWaiting(semaphore);
+    }
+}
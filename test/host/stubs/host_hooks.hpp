@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "driver/gpio.h"
+
+// 测试驱动外设模型用的钩子, 只在主机测试中存在
+namespace host
+{
+    // SPI 从机: 一次调用即一次片选周期, rx 可为空
+    using SpiSlave = std::function<void(const uint8_t *tx, uint8_t *rx, size_t length)>;
+    void set_spi_slave(SpiSlave slave);
+
+    // 设置输入引脚电平, 按 gpio_config 配置的边沿在调用线程上执行已注册的中断处理
+    void set_gpio_level(gpio_num_t pin, int level);
+}
@@ -0,0 +1,2 @@
+#pragma once
+// 主机测试: 不带 menuconfig 选项, 各组件按默认配置编译
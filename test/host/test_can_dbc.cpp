@@ -0,0 +1,320 @@
+// CanDbc 在大型 DBC 上的解码正确性与吞吐基准.
+// 生成约 1000 个报文、12000 个信号的 DBC(标准/扩展帧, Intel/Motorola, 有无符号, 复用), 对照逐位解码的参考实现
+#include "can_dbc.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "host_test.hpp"
+
+namespace
+{
+    struct Signal
+    {
+        std::string name;
+        uint32_t start_bit;
+        uint32_t length;
+        bool big_endian;
+        bool is_signed;
+        double factor;
+        double offset;
+        bool multiplexor;
+        int mux;
+        int index; // CanDbc 中的下标
+    };
+
+    struct Message
+    {
+        uint32_t key; // DBC 写法, 扩展帧带 0x80000000
+        std::vector<Signal> signals;
+    };
+
+    const size_t MESSAGE_COUNT = 1000;
+    const size_t CHECKED_MESSAGES = 100; // 逐信号核对的报文数, 其余只参与基准
+
+    bool bit_at(const uint8_t *data, uint32_t bit)
+    {
+        return (data[bit / 8] >> (bit % 8)) & 1;
+    }
+
+    // DBC 语义的逐位参考解码, 返回信号占用的最高字节, 用于判断 DLC 是否覆盖
+    uint64_t reference_raw(const Signal &signal, const uint8_t *data, uint32_t &last_byte)
+    {
+        uint64_t raw = 0;
+        last_byte = 0;
+        if (signal.big_endian)
+        {
+            // Motorola: 从 MSB 开始, 字节内向低位走, 走出字节后到下一字节的最高位
+            uint32_t bit = signal.start_bit;
+            for (uint32_t i = 0; i < signal.length; i++)
+            {
+                raw = (raw << 1) | bit_at(data, bit);
+                last_byte = std::max(last_byte, bit / 8);
+                bit = (bit % 8 == 0) ? bit + 15 : bit - 1;
+            }
+        }
+        else
+        {
+            for (uint32_t i = 0; i < signal.length; i++)
+            {
+                raw |= static_cast<uint64_t>(bit_at(data, signal.start_bit + i)) << i;
+            }
+            last_byte = (signal.start_bit + signal.length - 1) / 8;
+        }
+        return raw;
+    }
+
+    float reference_value(const Signal &signal, uint64_t raw)
+    {
+        int64_t value = static_cast<int64_t>(raw);
+        if (signal.is_signed && (raw >> (signal.length - 1)) & 1)
+        {
+            value = static_cast<int64_t>(raw | ~((1ULL << signal.length) - 1));
+        }
+        return static_cast<float>(value) * static_cast<float>(signal.factor) + static_cast<float>(signal.offset);
+    }
+
+    // 随机放置信号, 允许重叠: 解码彼此独立
+    Signal random_signal(std::mt19937 &rng, const std::string &name)
+    {
+        Signal signal = {};
+        signal.name = name;
+        signal.length = 1 + rng() % 32;
+        signal.big_endian = rng() % 2;
+        signal.is_signed = signal.length > 1 && rng() % 3 == 0;
+        static const double factors[] = {1, 0.5, 0.125, 0.01, 2};
+        static const double offsets[] = {0, -40, 100, -0.5};
+        signal.factor = factors[rng() % 5];
+        signal.offset = offsets[rng() % 4];
+        signal.mux = -1;
+        if (signal.big_endian)
+        {
+            // 在大端 64 位字中取 LSB 位置, 换算为 MSB 的锯齿编号
+            const uint32_t lsb = rng() % (65 - signal.length);
+            const uint32_t msb = lsb + signal.length - 1;
+            signal.start_bit = (7 - msb / 8) * 8 + msb % 8;
+        }
+        else
+        {
+            signal.start_bit = rng() % (65 - signal.length);
+        }
+        return signal;
+    }
+
+    std::vector<Message> generate(std::mt19937 &rng)
+    {
+        std::vector<Message> messages;
+        for (size_t m = 0; m < MESSAGE_COUNT; m++)
+        {
+            Message message;
+            // 标准帧与扩展帧交替, ID 各自不重复
+            message.key = (m % 2) ? (0x80000000u | (0x18F00000u + static_cast<uint32_t>(m))) : static_cast<uint32_t>(m / 2 + 1);
+            const std::string prefix = "M" + std::to_string(m) + "_";
+
+            if (m % 10 == 0)
+            {
+                // 复用报文: 低 2 位为选择信号, 每个复用值若干信号
+                Signal selector = {prefix + "Mux", 0, 2, false, false, 1, 0, true, -1, -1};
+                message.signals.push_back(selector);
+                for (int value = 0; value < 4; value++)
+                {
+                    for (int i = 0; i < 3; i++)
+                    {
+                        Signal signal = random_signal(rng, prefix + "m" + std::to_string(value) + "_" + std::to_string(i));
+                        signal.mux = value;
+                        message.signals.push_back(signal);
+                    }
+                }
+            }
+            else
+            {
+                const size_t count = 4 + rng() % 16;
+                for (size_t i = 0; i < count; i++)
+                {
+                    message.signals.push_back(random_signal(rng, prefix + "S" + std::to_string(i)));
+                }
+            }
+            messages.push_back(std::move(message));
+        }
+        return messages;
+    }
+
+    void write_dbc(const std::string &path, const std::vector<Message> &messages)
+    {
+        FILE *file = fopen(path.c_str(), "w");
+        fprintf(file, "VERSION \"\"\n\nNS_ :\n\nBS_:\n\nBU_: ECU\n\n");
+        for (const Message &message : messages)
+        {
+            fprintf(file, "BO_ %u MSG_%08X: 8 ECU\n", message.key, message.key);
+            for (const Signal &signal : message.signals)
+            {
+                char mux[8] = "";
+                if (signal.multiplexor)
+                {
+                    strcpy(mux, "M ");
+                }
+                else if (signal.mux >= 0)
+                {
+                    snprintf(mux, sizeof(mux), "m%d ", signal.mux);
+                }
+                fprintf(file, " SG_ %s %s: %u|%u@%c%c (%g,%g) [0|0] \"u\" Vector__XXX\n",
+                        signal.name.c_str(), mux, signal.start_bit, signal.length,
+                        signal.big_endian ? '0' : '1', signal.is_signed ? '-' : '+', signal.factor, signal.offset);
+            }
+            fprintf(file, "\n");
+        }
+        fclose(file);
+    }
+
+    twai_message_t make_frame(const Message &message, std::mt19937 &rng)
+    {
+        twai_message_t frame = {};
+        frame.extd = (message.key & 0x80000000u) ? 1 : 0;
+        frame.identifier = message.key & 0x1FFFFFFF;
+        frame.data_length_code = (rng() % 4 == 0) ? rng() % 9 : 8;
+        for (uint8_t &byte : frame.data)
+        {
+            byte = static_cast<uint8_t>(rng());
+        }
+        return frame;
+    }
+
+    bool close(float actual, float expected)
+    {
+        return std::fabs(actual - expected) <= 1e-6f + 1e-5f * std::fabs(expected);
+    }
+
+    void test_decode(CanDbc &dbc, std::vector<Message> &messages, std::mt19937 &rng)
+    {
+        for (size_t m = 0; m < CHECKED_MESSAGES; m++)
+        {
+            for (Signal &signal : messages[m].signals)
+            {
+                signal.index = dbc.find_signal(signal.name);
+                CHECK(signal.index >= 0);
+            }
+        }
+
+        for (int round = 0; round < 50; round++)
+        {
+            for (size_t m = 0; m < CHECKED_MESSAGES; m++)
+            {
+                const Message &message = messages[m];
+                const twai_message_t frame = make_frame(message, rng);
+
+                // 复用值不在 DLC 内时所有复用信号都不解码
+                int mux_value = -1;
+                for (const Signal &signal : message.signals)
+                {
+                    uint32_t last_byte;
+                    const uint64_t raw = reference_raw(signal, frame.data, last_byte);
+                    if (signal.multiplexor && last_byte < frame.data_length_code)
+                    {
+                        mux_value = static_cast<int>(raw);
+                    }
+                }
+
+                std::vector<float> before(message.signals.size(), NAN);
+                for (size_t i = 0; i < message.signals.size(); i++)
+                {
+                    dbc.get_value(message.signals[i].index, before[i]);
+                }
+
+                size_t expected_count = 0;
+                const size_t decoded = dbc.decode(frame);
+                for (size_t i = 0; i < message.signals.size(); i++)
+                {
+                    const Signal &signal = message.signals[i];
+                    uint32_t last_byte;
+                    const uint64_t raw = reference_raw(signal, frame.data, last_byte);
+                    const bool expected = last_byte < frame.data_length_code && (signal.mux < 0 || signal.mux == mux_value);
+                    float value = NAN;
+                    dbc.get_value(signal.index, value);
+                    if (expected)
+                    {
+                        expected_count++;
+                        if (!close(value, reference_value(signal, raw)))
+                        {
+                            printf("%s: %g != %g (raw 0x%llx)\n", signal.name.c_str(), value,
+                                   reference_value(signal, raw), static_cast<unsigned long long>(raw));
+                            host_test::failures++;
+                        }
+                    }
+                    else if (!std::isnan(before[i]))
+                    {
+                        CHECK(value == before[i]); // 未覆盖的信号保持旧值
+                    }
+                }
+                CHECK_EQ(decoded, expected_count);
+            }
+        }
+
+        // 不在表中的 ID 与远程帧不解码
+        twai_message_t unknown = {};
+        unknown.identifier = 0x7FF;
+        unknown.data_length_code = 8;
+        CHECK_EQ(dbc.decode(unknown), 0u);
+        twai_message_t remote = make_frame(messages[1], rng);
+        remote.rtr = 1;
+        CHECK_EQ(dbc.decode(remote), 0u);
+    }
+
+    // 吞吐基准: 轮流解码所有报文的随机帧, 只打印结果, 不设阈值
+    void benchmark(CanDbc &dbc, const std::vector<Message> &messages, std::mt19937 &rng)
+    {
+        const size_t FRAME_POOL = 4096;
+        const size_t ITERATIONS = 2000000;
+
+        std::vector<twai_message_t> frames;
+        for (size_t i = 0; i < FRAME_POOL; i++)
+        {
+            twai_message_t frame = make_frame(messages[rng() % messages.size()], rng);
+            frame.data_length_code = 8;
+            frames.push_back(frame);
+        }
+
+        size_t signals = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < ITERATIONS; i++)
+        {
+            signals += dbc.decode(frames[i % FRAME_POOL]);
+        }
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        printf("benchmark: %zu messages, %zu signals in table\n", dbc.get_message_count(), dbc.get_signal_count());
+        printf("benchmark: %zu frames, %zu signals in %.3f s\n", ITERATIONS, signals, elapsed);
+        printf("benchmark: %.0f frames/s, %.0f signals/s, %.1f ns/frame\n",
+               ITERATIONS / elapsed, signals / elapsed, elapsed * 1e9 / ITERATIONS);
+        CHECK(signals > ITERATIONS);
+    }
+}
+
+int main()
+{
+    std::mt19937 rng(20240611);
+    std::vector<Message> messages = generate(rng);
+    const std::string path = (std::filesystem::temp_directory_path() / "host_test_large.dbc").string();
+    write_dbc(path, messages);
+
+    size_t signal_total = 0;
+    for (const Message &message : messages)
+    {
+        signal_total += message.signals.size();
+    }
+
+    CanDbc dbc;
+    CHECK(dbc.load(path));
+    CHECK_EQ(dbc.get_message_count(), MESSAGE_COUNT);
+    CHECK_EQ(dbc.get_signal_count(), signal_total);
+
+    test_decode(dbc, messages, rng);
+    benchmark(dbc, messages, rng);
+
+    std::filesystem::remove(path);
+    return host_test::result();
+}
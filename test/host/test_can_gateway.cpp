@@ -0,0 +1,431 @@
+// CanGateway 路由核心: 规则解析与拒绝, 标准/扩展帧查找, can2can 改写ID, Intel/Motorola 信号到 CRSF 遥测,
+// CRSF 通道打包成 CAN 帧, 输出最小间隔, 以及每条规则的命中/丢弃/延迟统计
+#include "can_gateway.hpp"
+
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#include "host_test.hpp"
+
+namespace
+{
+    struct Sinks
+    {
+        bool can_result = true;
+        bool crsf_result = true;
+        std::vector<twai_message_t> can;
+        std::vector<std::vector<uint8_t>> crsf;
+
+        static bool can_sink(const twai_message_t &message, void *arg)
+        {
+            Sinks *sinks = static_cast<Sinks *>(arg);
+            sinks->can.push_back(message);
+            return sinks->can_result;
+        }
+
+        static bool crsf_sink(const uint8_t *frame, size_t length, void *arg)
+        {
+            Sinks *sinks = static_cast<Sinks *>(arg);
+            sinks->crsf.emplace_back(frame, frame + length);
+            return sinks->crsf_result;
+        }
+
+        void attach(CanGateway &gateway)
+        {
+            gateway.set_can_sink(&Sinks::can_sink, this);
+            gateway.set_crsf_sink(&Sinks::crsf_sink, this);
+        }
+
+        void clear()
+        {
+            can.clear();
+            crsf.clear();
+        }
+    };
+
+    CanFrameRecord make_frame(uint32_t id, bool extended, std::initializer_list<uint8_t> data, int64_t timestamp_us = 0)
+    {
+        CanFrameRecord record = {};
+        record.channel = 1;
+        record.timestamp_us = timestamp_us;
+        record.message.identifier = id;
+        record.message.extd = extended ? 1 : 0;
+        record.message.data_length_code = static_cast<uint8_t>(data.size());
+        size_t i = 0;
+        for (uint8_t byte : data)
+        {
+            record.message.data[i++] = byte;
+        }
+        return record;
+    }
+
+    bool has_id(const twai_message_t &message, uint32_t id, bool extended)
+    {
+        return message.identifier == id && message.extd == (extended ? 1u : 0u);
+    }
+
+    // 独立实现的 CRSF CRC8 (多项式 0xD5), 校验网关输出的帧
+    uint8_t crc8_d5(const uint8_t *data, size_t length)
+    {
+        uint8_t crc = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            crc ^= data[i];
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc & 0x80) ? static_cast<uint8_t>((crc << 1) ^ 0xD5) : static_cast<uint8_t>(crc << 1);
+            }
+        }
+        return crc;
+    }
+
+    // 检查帧头, 长度与 CRC, 返回负载
+    std::vector<uint8_t> crsf_payload(const std::vector<uint8_t> &frame, uint8_t type)
+    {
+        if (frame.size() < 4 || frame[0] != 0xC8 || frame[1] != frame.size() - 2 || frame[2] != type ||
+            frame.back() != crc8_d5(&frame[2], frame.size() - 3))
+        {
+            printf("bad CRSF frame, type 0x%02X, %zu bytes\n", type, frame.size());
+            host_test::failures++;
+            return {};
+        }
+        return std::vector<uint8_t>(frame.begin() + 3, frame.end() - 1);
+    }
+
+    void test_parse()
+    {
+        CanGateway gateway;
+        CHECK(gateway.compile("# comment only\n\n   \t\r\n"));
+        CHECK_EQ(gateway.get_rule_count(), 0u);
+
+        const char *good =
+            "can2can 0x100 0x200   # 行尾注释\r\n"
+            "can2crsf 0x18FF50E5 0|16@1+ 0.1 0 voltage\n"
+            "crsf2can 3 0x300x 0|16@1+ 1 0\n"
+            "period crsf2can 10\n"
+            "period can2crsf 50\n";
+        CHECK(gateway.compile(good));
+        CHECK_EQ(gateway.get_rule_count(), 3u);
+        CHECK(gateway.describe_rule(0) == "can 0x100 -> can 0x200");
+        CHECK(gateway.describe_rule(1) == "can 0x18ff50e5x -> crsf voltage");
+        CHECK(gateway.describe_rule(2) == "crsf ch3 -> can 0x00000300x");
+        CHECK(gateway.describe_rule(3).empty());
+
+        const char *bad[] = {
+            "forward 0x100 0x200",                         // 未知规则
+            "can2can 0x100",                               // 参数个数
+            "can2can 0x100 0x200 0x300",                   //
+            "can2can 0x100 zz",                            // ID 不是数字
+            "can2can 0x20000000 0x100",                    // 超出 29 位
+            "can2can x 0x100",                             // 只有扩展标记
+            "can2crsf 0x100 0|16@1+ 0.1 0 rpm",            // 未知字段
+            "can2crsf 0x100 0|16@1+ 0.1 0",                // 缺字段
+            "can2crsf 0x100 56|16@1+ 1 0 voltage",         // Intel 越过第 64 位
+            "can2crsf 0x100 56|16@0+ 1 0 voltage",         // Motorola 越过最后一字节
+            "can2crsf 0x100 0|0@1+ 1 0 voltage",           // 长度为 0
+            "can2crsf 0x100 0|65@1+ 1 0 voltage",          // 长度超过 64
+            "can2crsf 0x100 0|16@2+ 1 0 voltage",          // 字节序
+            "can2crsf 0x100 0|16@1* 1 0 voltage",          // 符号
+            "can2crsf 0x100 0|16@1+ 0 0 voltage",          // factor 为 0
+            "can2crsf 0x100 0|16@1+ 1 abc voltage",        // offset 不是数字
+            "crsf2can 0 0x100 0|16@1+ 1 0",                // 通道从 1 开始
+            "crsf2can 17 0x100 0|16@1+ 1 0",               // 最多 16 通道
+            "crsf2can 1 0x100 0|16@1+ 1",                  // 参数个数
+            "period",                                      //
+            "period can2crsf",                             //
+            "period can2crsf -5",                          // 负周期
+            "period telemetry 10",                         // 未知周期
+        };
+        for (const char *line : bad)
+        {
+            // 出错的行之前有正确的规则, 整份文本仍被拒绝, 原有规则保留
+            const std::string text = std::string("can2can 0x1 0x2\n") + line + "\n";
+            if (gateway.compile(text))
+            {
+                printf("accepted bad rule: %s\n", line);
+                host_test::failures++;
+            }
+        }
+        CHECK_EQ(gateway.get_rule_count(), 3u);
+        CHECK(gateway.describe_rule(0) == "can 0x100 -> can 0x200");
+    }
+
+    void test_lookup()
+    {
+        CanGateway gateway;
+        Sinks sinks;
+        sinks.attach(gateway);
+
+        // 未编译规则时不输出
+        gateway.route_can(make_frame(0x100, false, {1}), 0);
+        CHECK(sinks.can.empty());
+
+        CHECK(gateway.compile(
+            "can2can 0x18DAF110 0x7FF\n"
+            "can2can 0x100 0x200\n"
+            "can2can 0x100x 0x300\n" // 扩展帧 0x100 与标准帧 0x100 是不同的源
+            "can2can 0x100 0x201x\n" // 同一源的多条规则按文件顺序执行
+            "can2can 0x7FF 0x800\n"  // 大于 0x7FF 自动视为扩展帧
+            "can2can 0 5\n"));
+
+        gateway.route_can(make_frame(0x100, false, {1, 2, 3}), 0);
+        CHECK_EQ(sinks.can.size(), 2u);
+        if (sinks.can.size() == 2)
+        {
+            CHECK(has_id(sinks.can[0], 0x200, false));
+            CHECK(has_id(sinks.can[1], 0x201, true));
+            // 只改写ID, 数据与长度不变
+            CHECK_EQ(sinks.can[0].data_length_code, 3);
+            CHECK(sinks.can[1].data[0] == 1 && sinks.can[1].data[1] == 2 && sinks.can[1].data[2] == 3);
+        }
+
+        sinks.clear();
+        gateway.route_can(make_frame(0x100, true, {}), 0);
+        CHECK_EQ(sinks.can.size(), 1u);
+        CHECK(!sinks.can.empty() && has_id(sinks.can[0], 0x300, false));
+
+        sinks.clear();
+        gateway.route_can(make_frame(0x18DAF110, true, {0xAA}), 0);
+        CHECK_EQ(sinks.can.size(), 1u);
+        CHECK(!sinks.can.empty() && has_id(sinks.can[0], 0x7FF, false) && sinks.can[0].data[0] == 0xAA);
+
+        sinks.clear();
+        gateway.route_can(make_frame(0x7FF, false, {}), 0);
+        CHECK_EQ(sinks.can.size(), 1u);
+        CHECK(!sinks.can.empty() && has_id(sinks.can[0], 0x800, true));
+
+        // ID 0 的标准帧
+        sinks.clear();
+        gateway.route_can(make_frame(0, false, {}), 0);
+        CHECK_EQ(sinks.can.size(), 1u);
+        CHECK(!sinks.can.empty() && has_id(sinks.can[0], 5, false));
+
+        // 没有规则的ID, 以及同值的另一种帧格式
+        sinks.clear();
+        gateway.route_can(make_frame(0x101, false, {}), 0);
+        gateway.route_can(make_frame(0x7FF, true, {}), 0);
+        gateway.route_can(make_frame(0x18DAF111, true, {}), 0);
+        gateway.route_can(make_frame(0x18DAF10F, true, {}), 0);
+        gateway.route_can(make_frame(0x1FFFFFFF, true, {}), 0);
+        CHECK(sinks.can.empty());
+    }
+
+    void test_can_to_crsf()
+    {
+        CanGateway gateway;
+        Sinks sinks;
+        sinks.attach(gateway);
+        CHECK(gateway.compile(
+            "period can2crsf 100\n"
+            "can2crsf 0x200 0|16@1+ 0.1 0 voltage\n"     // Intel: 字节 0 为低字节
+            "can2crsf 0x200 7|16@0+ 0.1 0 current\n"     // Motorola: 同一段数据, 字节 0 为高字节
+            "can2crsf 0x201 16|24@1+ 1 0 capacity\n"     //
+            "can2crsf 0x201 56|8@1+ 1 0 remaining\n"     //
+            "can2crsf 0x202 0|16@1- 0.1 -100 altitude\n" // 有符号, 带偏移
+            "can2crsf 0x202 23|16@0- 0.01 0 vspeed\n"));  // Motorola 有符号, 字节 2..3
+
+        // voltage 读 LE 0x00FA = 25.0 V 并立即发出电池帧, current(BE 0xFA00) 在发出之后才更新
+        gateway.route_can(make_frame(0x200, false, {0xFA, 0x00}), 0);
+        CHECK_EQ(sinks.crsf.size(), 1u);
+        if (sinks.crsf.size() == 1)
+        {
+            const std::vector<uint8_t> payload = crsf_payload(sinks.crsf[0], 0x08);
+            CHECK_EQ(payload.size(), 8u);
+            if (payload.size() == 8)
+            {
+                CHECK_EQ(payload[0] << 8 | payload[1], 250); // 0.1 V
+                CHECK_EQ(payload[2] << 8 | payload[3], 0);
+                CHECK_EQ(payload[4] << 16 | payload[5] << 8 | payload[6], 0);
+                CHECK_EQ(payload[7], 0);
+            }
+        }
+
+        // 电池帧的各字段共用发送周期: 周期内的更新只记下, 到期后一起发出
+        sinks.clear();
+        gateway.route_can(make_frame(0x201, false, {0, 0, 0x39, 0x30, 0, 0, 0, 75}), 50000);
+        gateway.route_can(make_frame(0x200, false, {0x00, 0x64}), 99999); // voltage 2560.0 V, current 10.0 A
+        CHECK(sinks.crsf.empty());
+        gateway.route_can(make_frame(0x200, false, {0x2C, 0x01}), 100000); // voltage 30.0 V, 到期发出
+        CHECK_EQ(sinks.crsf.size(), 1u);
+        if (sinks.crsf.size() == 1)
+        {
+            const std::vector<uint8_t> payload = crsf_payload(sinks.crsf[0], 0x08);
+            CHECK_EQ(payload.size(), 8u);
+            if (payload.size() == 8)
+            {
+                CHECK_EQ(payload[0] << 8 | payload[1], 300);
+                CHECK_EQ(payload[2] << 8 | payload[3], 100);
+                CHECK_EQ(payload[4] << 16 | payload[5] << 8 | payload[6], 0x3039);
+                CHECK_EQ(payload[7], 75);
+            }
+        }
+
+        // 气压帧独立计时. altitude LE 0xFFF6 = -10 -> -101.0 m, vspeed BE 0xFF38 = -200 -> -2.00 m/s
+        sinks.clear();
+        gateway.route_can(make_frame(0x202, false, {0xF6, 0xFF, 0xFF, 0x38}), 100000);
+        gateway.route_can(make_frame(0x202, false, {0xF6, 0xFF, 0xFF, 0x38}), 150000);
+        gateway.route_can(make_frame(0x202, false, {0xF6, 0xFF, 0xFF, 0x38}), 200000);
+        CHECK_EQ(sinks.crsf.size(), 2u);
+        if (sinks.crsf.size() == 2)
+        {
+            const std::vector<uint8_t> first = crsf_payload(sinks.crsf[0], 0x09);
+            const std::vector<uint8_t> second = crsf_payload(sinks.crsf[1], 0x09);
+            CHECK(first.size() == 4 && second.size() == 4);
+            if (first.size() == 4 && second.size() == 4)
+            {
+                CHECK_EQ(first[0] << 8 | first[1], 10000 - 1010); // dm, 偏移 10000
+                CHECK_EQ(static_cast<int16_t>(first[2] << 8 | first[3]), 0);
+                CHECK_EQ(second[0] << 8 | second[1], 10000 - 1010);
+                CHECK_EQ(static_cast<int16_t>(second[2] << 8 | second[3]), -200); // cm/s
+            }
+        }
+
+        // 数据不足以容纳信号时不更新遥测
+        sinks.clear();
+        gateway.route_can(make_frame(0x200, false, {0x01}), 300000);
+        gateway.route_can(make_frame(0x202, false, {0x00}), 300000);
+        CHECK(sinks.crsf.empty());
+        gateway.route_can(make_frame(0x201, false, {0, 0, 0, 0, 0, 0, 0, 75}), 300000); // 到期, 发出原值
+        CHECK_EQ(sinks.crsf.size(), 1u);
+        if (sinks.crsf.size() == 1)
+        {
+            const std::vector<uint8_t> payload = crsf_payload(sinks.crsf[0], 0x08);
+            // current 为上次发出后 0x200 帧(BE 0x2C01)的值
+            CHECK(payload.size() == 8 && (payload[0] << 8 | payload[1]) == 300 && (payload[2] << 8 | payload[3]) == 11265);
+        }
+    }
+
+    void test_crsf_to_can()
+    {
+        CanGateway gateway;
+        Sinks sinks;
+        sinks.attach(gateway);
+        CHECK(gateway.compile(
+            "period crsf2can 20\n"
+            "crsf2can 1 0x300 0|16@1+ 1 0\n"
+            "crsf2can 3 0x301x 7|16@0+ 1 0\n"  // 每个目标ID一帧, 按首次出现的顺序发出
+            "crsf2can 2 0x300 16|16@1+ 1 0\n"  // 与第一条打包进同一帧
+            "crsf2can 4 0x302 0|8@1+ 10 1000\n"));
+
+        // CRSF 原始值 992/172/1811 对应 1500/988/2012 us
+        uint16_t channels[CanGateway::CRSF_CHANNELS] = {};
+        channels[0] = 992;
+        channels[1] = 172;
+        channels[2] = 1811;
+        channels[3] = 992;
+
+        gateway.route_crsf(channels, CanGateway::CRSF_CHANNELS, 1000, 1000);
+        CHECK_EQ(sinks.can.size(), 3u);
+        if (sinks.can.size() == 3)
+        {
+            const twai_message_t &packed = sinks.can[0];
+            CHECK(has_id(packed, 0x300, false));
+            CHECK_EQ(packed.data_length_code, 4);
+            CHECK(packed.data[0] == 0xDC && packed.data[1] == 0x05 && packed.data[2] == 0xDC && packed.data[3] == 0x03);
+
+            const twai_message_t &motorola = sinks.can[1];
+            CHECK(has_id(motorola, 0x301, true));
+            CHECK_EQ(motorola.data_length_code, 2);
+            CHECK(motorola.data[0] == 0x07 && motorola.data[1] == 0xDC);
+
+            const twai_message_t &scaled = sinks.can[2];
+            CHECK(has_id(scaled, 0x302, false));
+            CHECK_EQ(scaled.data_length_code, 1);
+            CHECK_EQ(scaled.data[0], 50); // (1500 - 1000) / 10
+        }
+
+        // 输出最小间隔
+        sinks.clear();
+        gateway.route_crsf(channels, CanGateway::CRSF_CHANNELS, 20999, 20999);
+        CHECK(sinks.can.empty());
+        gateway.route_crsf(channels, CanGateway::CRSF_CHANNELS, 21000, 21000);
+        CHECK_EQ(sinks.can.size(), 3u);
+
+        // 通道数不足: 缺少的通道不写入, 对应规则计为丢弃
+        sinks.clear();
+        gateway.route_crsf(channels, 2, 41000, 41000);
+        CHECK_EQ(sinks.can.size(), 3u);
+        if (sinks.can.size() == 3)
+        {
+            CHECK_EQ(sinks.can[0].data_length_code, 4);
+            CHECK_EQ(sinks.can[1].data_length_code, 0);
+            CHECK_EQ(sinks.can[2].data_length_code, 0);
+        }
+        CanGateway::RuleStats stats;
+        CHECK(gateway.get_rule_stats(0, stats) && stats.hits == 3 && stats.drops == 0);
+        CHECK(gateway.get_rule_stats(1, stats) && stats.hits == 3 && stats.drops == 1);
+        CHECK(gateway.get_rule_stats(2, stats) && stats.hits == 3 && stats.drops == 0);
+        CHECK(gateway.get_rule_stats(3, stats) && stats.hits == 3 && stats.drops == 1);
+
+        // 没有 crsf2can 规则时不输出
+        CHECK(gateway.compile("can2can 0x1 0x2\n"));
+        sinks.clear();
+        gateway.route_crsf(channels, CanGateway::CRSF_CHANNELS, 100000, 100000);
+        CHECK(sinks.can.empty());
+    }
+
+    void test_stats()
+    {
+        CanGateway gateway;
+        Sinks sinks;
+        sinks.attach(gateway);
+        CHECK(gateway.compile(
+            "can2can 0x100 0x200\n"
+            "can2can 0x100 0x201\n"
+            "can2crsf 0x180 0|16@1+ 1 0 voltage\n"));
+
+        CanGateway::RuleStats stats;
+        CHECK(!gateway.get_rule_stats(3, stats));
+
+        gateway.route_can(make_frame(0x100, false, {}, 1000), 1500);
+        gateway.route_can(make_frame(0x100, false, {}, 2000), 2100);
+        sinks.can_result = false; // 发送队列满
+        gateway.route_can(make_frame(0x100, false, {}, 3000), 3300);
+        gateway.route_can(make_frame(0x100, false, {}, 5000), 4000); // 时间戳晚于当前时间, 延迟记为 0
+        sinks.can_result = true;
+
+        for (size_t i = 0; i < 2; i++)
+        {
+            CHECK(gateway.get_rule_stats(i, stats));
+            CHECK_EQ(stats.hits, 4u);
+            CHECK_EQ(stats.drops, 2u);
+            CHECK_EQ(stats.latency_max_us, 500u);
+            CHECK_EQ(stats.latency_sum_us, 500u + 100u + 300u);
+        }
+
+        // can2crsf: CRSF 输出不计入规则的丢弃, 只有 DLC 不足时丢弃
+        sinks.crsf_result = false;
+        gateway.route_can(make_frame(0x180, false, {1, 2}, 0), 10);
+        gateway.route_can(make_frame(0x180, false, {1}, 0), 20);
+        CHECK(gateway.get_rule_stats(2, stats));
+        CHECK_EQ(stats.hits, 2u);
+        CHECK_EQ(stats.drops, 1u);
+        CHECK_EQ(stats.latency_max_us, 20u);
+
+        gateway.clear_stats();
+        for (size_t i = 0; i < 3; i++)
+        {
+            CHECK(gateway.get_rule_stats(i, stats));
+            CHECK(stats.hits == 0 && stats.drops == 0 && stats.latency_max_us == 0 && stats.latency_sum_us == 0);
+        }
+
+        // 编译失败保留统计, 编译成功按新规则清零
+        gateway.route_can(make_frame(0x100, false, {}, 0), 0);
+        CHECK(!gateway.compile("can2can 0x100\n"));
+        CHECK(gateway.get_rule_stats(0, stats) && stats.hits == 1);
+        CHECK(gateway.compile("can2can 0x100 0x200\n"));
+        CHECK(gateway.get_rule_stats(0, stats) && stats.hits == 0);
+        CHECK(!gateway.get_rule_stats(1, stats));
+    }
+}
+
+int main()
+{
+    test_parse();
+    test_lookup();
+    test_can_to_crsf();
+    test_crsf_to_can();
+    test_stats();
+    return host_test::result();
+}
@@ -0,0 +1,311 @@
+// 分块日志文件的掉电恢复: 在内存中拼出分块文件, 注入截断, 撕裂尾块, 校验错误与预分配的全 0 尾部,
+// 检查 LogBlockEncoder::recover 找到的最后一个有效块, 并对照 LZ4 解码核对编码结果
+#include "log_block.hpp"
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "host_test.hpp"
+
+namespace
+{
+    const size_t MAX_RAW = 4096; // 与日志缓冲大小相当
+    const size_t BLOCK_COUNT = 40;
+
+    struct Block
+    {
+        long offset;
+        long data_end;  // 块头加数据, 不含补齐
+        long block_end; // 补齐到扇区之后
+        uint32_t line_total;
+        uint32_t sequence;
+    };
+
+    struct LogFile
+    {
+        std::vector<uint8_t> bytes;
+        std::vector<Block> blocks;
+        std::vector<std::string> raw;
+    };
+
+    struct Recovered
+    {
+        bool found;
+        uint32_t lines;
+        uint32_t next_sequence;
+        long data_end;
+    };
+
+    // 文本日志行可压缩, 随机字节不可压缩, 两种块交替出现
+    std::string make_payload(std::mt19937 &rng, size_t index)
+    {
+        std::string text;
+        const size_t length = 64 + rng() % (MAX_RAW - 64);
+        if (index % 4 == 3)
+        {
+            while (text.size() < length)
+            {
+                text.push_back(static_cast<char>(1 + rng() % 255));
+            }
+            return text;
+        }
+        while (text.size() < length)
+        {
+            char line[96];
+            snprintf(line, sizeof(line), "%10u,1,%08X,8,%02X %02X %02X %02X 00 00 00 00\n",
+                     static_cast<unsigned>(rng() % 1000000000), static_cast<unsigned>(rng() % 0x800),
+                     static_cast<unsigned>(rng() & 0xFF), static_cast<unsigned>(rng() & 0xFF),
+                     static_cast<unsigned>(rng() & 0x0F), static_cast<unsigned>(rng() & 0x01));
+            text += line;
+        }
+        text.resize(length);
+        return text;
+    }
+
+    LogFile build(std::mt19937 &rng)
+    {
+        LogBlockEncoder encoder;
+        CHECK(encoder.init(MAX_RAW, true));
+
+        LogFile file;
+        uint32_t line_total = 0;
+        for (size_t i = 0; i < BLOCK_COUNT; i++)
+        {
+            const std::string text = make_payload(rng, i);
+            const size_t total = encoder.encode(reinterpret_cast<const uint8_t *>(text.data()), text.size(), i % 2 == 0,
+                                                static_cast<uint32_t>(i), line_total);
+            CHECK_EQ(total % LogBlockEncoder::SECTOR_SIZE, 0u);
+
+            LogBlockEncoder::BlockHeader header;
+            memcpy(&header, encoder.output(), sizeof(header));
+
+            Block block = {};
+            block.offset = static_cast<long>(file.bytes.size());
+            block.data_end = block.offset + static_cast<long>(sizeof(header) + header.stored_length);
+            block.block_end = block.offset + static_cast<long>(total);
+            block.line_total = line_total;
+            block.sequence = header.sequence;
+            file.blocks.push_back(block);
+            file.raw.push_back(text);
+            file.bytes.insert(file.bytes.end(), encoder.output(), encoder.output() + total);
+        }
+        return file;
+    }
+
+    Recovered recover(const std::vector<uint8_t> &bytes)
+    {
+        FILE *file = tmpfile();
+        fwrite(bytes.data(), 1, bytes.size(), file);
+        fflush(file);
+        Recovered result = {};
+        result.found = LogBlockEncoder::recover(file, MAX_RAW, result.lines, result.next_sequence, result.data_end);
+        fclose(file);
+        return result;
+    }
+
+    // 期望恢复到 count 个完整块之后; count 为 0 时没有有效块
+    void check_recovered(const Recovered &actual, const LogFile &file, size_t count, const char *what)
+    {
+        const bool ok = count == 0
+                            ? !actual.found && actual.lines == 0 && actual.next_sequence == 0 && actual.data_end == 0
+                            : actual.found && actual.lines == file.blocks[count - 1].line_total &&
+                                  actual.next_sequence == count && actual.data_end == file.blocks[count - 1].block_end;
+        if (!ok)
+        {
+            printf("%s: expected %zu blocks, got found=%d lines=%u next=%u end=%ld\n", what, count, actual.found,
+                   actual.lines, actual.next_sequence, actual.data_end);
+            host_test::failures++;
+        }
+    }
+
+    // 数据完整位于 length 之内的块数
+    size_t complete_blocks(const LogFile &file, long length)
+    {
+        size_t count = 0;
+        while (count < file.blocks.size() && file.blocks[count].data_end <= length)
+        {
+            count++;
+        }
+        return count;
+    }
+
+    bool lz4_decode(const uint8_t *src, size_t length, std::vector<uint8_t> &out)
+    {
+        const uint8_t *ip = src;
+        const uint8_t *const end = src + length;
+        auto read_length = [&](size_t value)
+        {
+            if (value == 15)
+            {
+                uint8_t byte;
+                do
+                {
+                    byte = *ip++;
+                    value += byte;
+                } while (byte == 255 && ip < end);
+            }
+            return value;
+        };
+
+        while (ip < end)
+        {
+            const uint8_t token = *ip++;
+            const size_t literals = read_length(token >> 4);
+            if (ip + literals > end)
+            {
+                return false;
+            }
+            out.insert(out.end(), ip, ip + literals);
+            ip += literals;
+            if (ip == end)
+            {
+                break;
+            }
+            const size_t offset = ip[0] | (ip[1] << 8);
+            ip += 2;
+            const size_t match = read_length(token & 0x0F) + 4;
+            if (offset == 0 || offset > out.size())
+            {
+                return false;
+            }
+            for (size_t i = 0; i < match; i++)
+            {
+                out.push_back(out[out.size() - offset]);
+            }
+        }
+        return true;
+    }
+
+    void test_blocks_decode(const LogFile &file)
+    {
+        size_t compressed = 0;
+        for (size_t i = 0; i < file.blocks.size(); i++)
+        {
+            LogBlockEncoder::BlockHeader header;
+            memcpy(&header, file.bytes.data() + file.blocks[i].offset, sizeof(header));
+            const uint8_t *payload = file.bytes.data() + file.blocks[i].offset + sizeof(header);
+            CHECK(LogBlockEncoder::check_block(header, payload, MAX_RAW));
+
+            std::vector<uint8_t> raw;
+            if (header.flags & LogBlockEncoder::FLAG_LZ4)
+            {
+                compressed++;
+                CHECK(lz4_decode(payload, header.stored_length, raw));
+            }
+            else
+            {
+                raw.assign(payload, payload + header.stored_length);
+            }
+            CHECK(raw.size() == file.raw[i].size() && memcmp(raw.data(), file.raw[i].data(), raw.size()) == 0);
+
+            // 补齐部分全为 0
+            for (long p = file.blocks[i].data_end; p < file.blocks[i].block_end; p++)
+            {
+                CHECK_EQ(file.bytes[p], 0);
+            }
+        }
+        CHECK(compressed > 0);
+    }
+
+    void test_intact(const LogFile &file)
+    {
+        check_recovered(recover(file.bytes), file, BLOCK_COUNT, "intact");
+        check_recovered(recover({}), file, 0, "empty");
+
+        // 预分配的文件尾部全为 0
+        std::vector<uint8_t> bytes = file.bytes;
+        bytes.resize(bytes.size() + 64 * 1024, 0);
+        check_recovered(recover(bytes), file, BLOCK_COUNT, "zero tail");
+    }
+
+    // 任意位置截断: 末块数据完整时保留(补齐由调用方补回), 否则回退到前一块
+    void test_truncation(const LogFile &file, std::mt19937 &rng)
+    {
+        std::vector<long> cuts;
+        for (const Block &block : file.blocks)
+        {
+            cuts.push_back(block.data_end - 1);
+            cuts.push_back(block.data_end);
+            cuts.push_back(block.offset + 10); // 块头撕裂
+        }
+        for (int i = 0; i < 300; i++)
+        {
+            cuts.push_back(static_cast<long>(rng() % (file.bytes.size() + 1)));
+        }
+
+        for (const long cut : cuts)
+        {
+            std::vector<uint8_t> bytes(file.bytes.begin(), file.bytes.begin() + cut);
+            const size_t expected = complete_blocks(file, cut);
+            check_recovered(recover(bytes), file, expected, "truncated");
+
+            // 同样的撕裂发生在预分配的文件中: 未写到的部分保持为 0
+            bytes.resize(file.bytes.size() + 8 * LogBlockEncoder::SECTOR_SIZE, 0);
+            check_recovered(recover(bytes), file, expected, "truncated in preallocated file");
+        }
+    }
+
+    // 末块写入了一部分: 数据中段被旧内容覆盖, 或块头校验字段错误
+    void test_torn_tail(const LogFile &file, std::mt19937 &rng)
+    {
+        const Block &last = file.blocks.back();
+
+        std::vector<uint8_t> bytes = file.bytes;
+        const long middle = last.offset + static_cast<long>(sizeof(LogBlockEncoder::BlockHeader)) + (last.data_end - last.offset) / 2;
+        for (long p = middle; p < last.data_end; p++)
+        {
+            bytes[p] = static_cast<uint8_t>(rng());
+        }
+        check_recovered(recover(bytes), file, BLOCK_COUNT - 1, "torn payload");
+
+        bytes = file.bytes;
+        bytes[last.offset + offsetof(LogBlockEncoder::BlockHeader, crc)] ^= 0x01;
+        check_recovered(recover(bytes), file, BLOCK_COUNT - 1, "bad crc");
+
+        bytes = file.bytes;
+        bytes[last.offset + offsetof(LogBlockEncoder::BlockHeader, line_total)] ^= 0x80;
+        check_recovered(recover(bytes), file, BLOCK_COUNT - 1, "bad header field");
+
+        // 块头声明的长度超出文件
+        bytes = file.bytes;
+        bytes.resize(last.data_end - 1);
+        check_recovered(recover(bytes), file, BLOCK_COUNT - 1, "short payload");
+    }
+
+    // 尾部损坏超出回看窗口(两个最大块): 从头沿块链保留最长的有效前缀
+    void test_wide_corruption(const LogFile &file, std::mt19937 &rng)
+    {
+        const long max_block = static_cast<long>(LogBlockEncoder::block_size(MAX_RAW));
+        const long garbage_start = static_cast<long>(file.bytes.size()) - 3 * max_block - 100;
+
+        std::vector<uint8_t> bytes = file.bytes;
+        for (long p = garbage_start; p < static_cast<long>(bytes.size()); p++)
+        {
+            bytes[p] = static_cast<uint8_t>(1 + rng() % 255);
+        }
+        check_recovered(recover(bytes), file, complete_blocks(file, garbage_start), "wide corruption");
+
+        // 整个文件都是无效数据
+        for (uint8_t &byte : bytes)
+        {
+            byte = static_cast<uint8_t>(1 + rng() % 255);
+        }
+        check_recovered(recover(bytes), file, 0, "all garbage");
+    }
+}
+
+int main()
+{
+    std::mt19937 rng(20240611);
+    const LogFile file = build(rng);
+
+    test_blocks_decode(file);
+    test_intact(file);
+    test_truncation(file, rng);
+    test_torn_tail(file, rng);
+    test_wide_corruption(file, rng);
+
+    return host_test::result();
+}
@@ -0,0 +1,450 @@
+// MCP2515 驱动对 SPI 寄存器模型的测试: 位时序表, READ STATUS 与接收缓冲区解码, 双缓冲滚动, 溢出, 发送, INT 边沿唤醒
+#include "mcp2515.hpp"
+
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "host_hooks.hpp"
+#include "host_test.hpp"
+
+namespace
+{
+    const gpio_num_t INT_PIN = GPIO_NUM_38;
+
+    // 按数据手册排布的寄存器模型, 只实现驱动用到的指令
+    class Mcp2515Model
+    {
+    public:
+        struct Frame
+        {
+            uint32_t id;
+            bool extd;
+            bool rtr;
+            uint8_t dlc;
+            uint8_t data[8];
+        };
+
+        void transfer(const uint8_t *tx, uint8_t *rx, size_t length)
+        {
+            bool int_changed;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                std::vector<uint8_t> out(length, 0);
+                execute(tx, out.data(), length);
+                if (rx)
+                {
+                    memcpy(rx, out.data(), length);
+                }
+                int_changed = update_int();
+            }
+            if (int_changed)
+            {
+                host::set_gpio_level(INT_PIN, _int_level);
+            }
+        }
+
+        // 总线上收到若干帧: 一次放入, 只产生一个 INT 下降沿
+        void receive(const std::vector<Frame> &frames)
+        {
+            bool int_changed;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                for (const Frame &frame : frames)
+                {
+                    load_rx(frame);
+                }
+                int_changed = update_int();
+            }
+            if (int_changed)
+            {
+                host::set_gpio_level(INT_PIN, _int_level);
+            }
+        }
+
+        void complete_tx()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _regs[TXB0CTRL] &= ~TXREQ;
+        }
+
+        uint8_t reg(uint8_t address)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _regs[address];
+        }
+
+        int status_reads()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _status_reads;
+        }
+
+        std::vector<Frame> sent()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _sent;
+        }
+
+        static void encode(const Frame &frame, uint8_t *buf)
+        {
+            memset(buf, 0, 13);
+            if (frame.extd)
+            {
+                buf[0] = frame.id >> 21;
+                buf[1] = ((frame.id >> 13) & 0xE0) | 0x08 | ((frame.id >> 16) & 0x03);
+                buf[2] = frame.id >> 8;
+                buf[3] = frame.id;
+                buf[4] = frame.dlc | (frame.rtr ? 0x40 : 0x00);
+            }
+            else
+            {
+                buf[0] = frame.id >> 3;
+                buf[1] = ((frame.id & 0x07) << 5) | (frame.rtr ? 0x10 : 0x00); // 接收侧标准帧的 RTR 在 SIDL.SRR
+                buf[4] = frame.dlc;
+            }
+            memcpy(&buf[5], frame.data, frame.dlc > 8 ? 8 : frame.dlc);
+        }
+
+    private:
+        static constexpr uint8_t CANSTAT = 0x0E, CANCTRL = 0x0F;
+        static constexpr uint8_t CANINTE = 0x2B, CANINTF = 0x2C, EFLG = 0x2D;
+        static constexpr uint8_t TXB0CTRL = 0x30, TXB0SIDH = 0x31;
+        static constexpr uint8_t RXB0CTRL = 0x60, RXB0SIDH = 0x61, RXB1SIDH = 0x71;
+        static constexpr uint8_t RX0IF = 0x01, RX1IF = 0x02, TXREQ = 0x08;
+        static constexpr uint8_t RX0OVR = 0x40, RX1OVR = 0x80, BUKT = 0x04;
+
+        std::mutex _mutex;
+        uint8_t _regs[128] = {};
+        int _int_level = 1;
+        int _status_reads = 0;
+        std::vector<Frame> _sent;
+
+        void execute(const uint8_t *tx, uint8_t *rx, size_t length)
+        {
+            switch (tx[0])
+            {
+            case 0xC0: // RESET
+                memset(_regs, 0, sizeof(_regs));
+                _regs[CANCTRL] = 0x87;
+                _regs[CANSTAT] = 0x80;
+                break;
+            case 0x03: // READ
+                for (size_t i = 2; i < length; i++)
+                {
+                    rx[i] = _regs[(tx[1] + i - 2) & 0x7F];
+                }
+                break;
+            case 0x02: // WRITE
+                for (size_t i = 2; i < length; i++)
+                {
+                    write((tx[1] + i - 2) & 0x7F, tx[i]);
+                }
+                break;
+            case 0x05: // BIT MODIFY
+                write(tx[1], (_regs[tx[1]] & ~tx[2]) | (tx[3] & tx[2]));
+                break;
+            case 0xA0: // READ STATUS, 之后重复输出
+            {
+                _status_reads++;
+                const uint8_t status = (_regs[CANINTF] & (RX0IF | RX1IF)) |
+                                       ((_regs[TXB0CTRL] & TXREQ) ? 0x04 : 0x00);
+                for (size_t i = 1; i < length; i++)
+                {
+                    rx[i] = status;
+                }
+                break;
+            }
+            case 0x90: // READ RX BUFFER, 片选结束时清对应的 RXnIF
+            case 0x94:
+            {
+                const uint8_t start = tx[0] == 0x90 ? RXB0SIDH : RXB1SIDH;
+                for (size_t i = 1; i < length; i++)
+                {
+                    rx[i] = _regs[start + i - 1];
+                }
+                _regs[CANINTF] &= ~(tx[0] == 0x90 ? RX0IF : RX1IF);
+                break;
+            }
+            case 0x40: // LOAD TX BUFFER 0
+                for (size_t i = 1; i < length; i++)
+                {
+                    _regs[TXB0SIDH + i - 1] = tx[i];
+                }
+                break;
+            case 0x81: // RTS TXB0
+            {
+                _regs[TXB0CTRL] |= TXREQ;
+                _sent.push_back(decode_tx(&_regs[TXB0SIDH]));
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        void write(uint8_t address, uint8_t value)
+        {
+            _regs[address] = value;
+            if (address == CANCTRL)
+            {
+                _regs[CANSTAT] = (_regs[CANSTAT] & 0x1F) | (value & 0xE0); // 模式切换立即生效
+            }
+        }
+
+        void load_rx(const Frame &frame)
+        {
+            uint8_t buf[13];
+            encode(frame, buf);
+            if (!(_regs[CANINTF] & RX0IF))
+            {
+                memcpy(&_regs[RXB0SIDH], buf, sizeof(buf));
+                _regs[CANINTF] |= RX0IF;
+            }
+            else if ((_regs[RXB0CTRL] & BUKT) && !(_regs[CANINTF] & RX1IF))
+            {
+                memcpy(&_regs[RXB1SIDH], buf, sizeof(buf));
+                _regs[CANINTF] |= RX1IF;
+            }
+            else
+            {
+                _regs[EFLG] |= (_regs[RXB0CTRL] & BUKT) ? RX1OVR : RX0OVR;
+            }
+        }
+
+        // 发送缓冲区按发送侧格式解码: 标准帧与扩展帧的 RTR 都在 DLC 寄存器
+        static Frame decode_tx(const uint8_t *buf)
+        {
+            Frame frame = {};
+            frame.extd = buf[1] & 0x08;
+            if (frame.extd)
+            {
+                frame.id = (buf[0] << 21) | ((buf[1] & 0xE0) << 13) | ((buf[1] & 0x03) << 16) | (buf[2] << 8) | buf[3];
+            }
+            else
+            {
+                frame.id = (buf[0] << 3) | (buf[1] >> 5);
+            }
+            frame.rtr = buf[4] & 0x40;
+            frame.dlc = buf[4] & 0x0F;
+            memcpy(frame.data, &buf[5], 8);
+            return frame;
+        }
+
+        bool update_int()
+        {
+            const int level = (_regs[CANINTF] & _regs[CANINTE]) ? 0 : 1;
+            if (level == _int_level)
+            {
+                return false;
+            }
+            _int_level = level;
+            return true;
+        }
+    };
+
+    Mcp2515Model model;
+    std::chrono::time_point<std::chrono::steady_clock> origin_time = std::chrono::steady_clock::now();
+
+    // 驱动任务不退出, 对象与固件中一样保持到进程结束
+    MCP2515 *make(QueueHandle_t &queue, MCP2515::Bitrate bitrate, uint32_t crystal_hz)
+    {
+        return new MCP2515(queue, origin_time, GPIO_NUM_36, GPIO_NUM_35, GPIO_NUM_37, GPIO_NUM_7, INT_PIN,
+                           2, bitrate, crystal_hz);
+    }
+
+    struct Timing
+    {
+        uint32_t bitrate;
+        double sample_point;
+        int quanta;
+    };
+
+    // 按数据手册由 CNF1-3 计算位速率与采样点
+    Timing timing_from_registers(uint32_t crystal_hz)
+    {
+        const uint8_t cnf1 = model.reg(0x2A), cnf2 = model.reg(0x29), cnf3 = model.reg(0x28);
+        const int brp = cnf1 & 0x3F;
+        const int sjw = (cnf1 >> 6) + 1;
+        const int prop = (cnf2 & 0x07) + 1;
+        const int ps1 = ((cnf2 >> 3) & 0x07) + 1;
+        const int ps2 = (cnf2 & 0x80) ? (cnf3 & 0x07) + 1 : ps1;
+        const int quanta = 1 + prop + ps1 + ps2;
+
+        // 数据手册的时序约束
+        CHECK(prop + ps1 >= ps2);
+        CHECK(ps2 > sjw);
+        CHECK(ps2 >= 2);
+        CHECK(quanta >= 5 && quanta <= 25);
+
+        Timing timing;
+        timing.quanta = quanta;
+        timing.bitrate = crystal_hz / (2 * (brp + 1) * quanta);
+        timing.sample_point = static_cast<double>(1 + prop + ps1) / quanta;
+        return timing;
+    }
+
+    void test_bit_timing()
+    {
+        static QueueHandle_t queue = xQueueCreate(4, sizeof(CanFrameRecord));
+        const struct
+        {
+            MCP2515::Bitrate bitrate;
+            uint32_t crystal_hz;
+            uint32_t expected;
+        } cases[] = {
+            {MCP2515::Bitrate::KBPS_125, 16000000, 125000},
+            {MCP2515::Bitrate::KBPS_250, 16000000, 250000},
+            {MCP2515::Bitrate::KBPS_500, 16000000, 500000},
+            {MCP2515::Bitrate::KBPS_1000, 16000000, 1000000},
+            {MCP2515::Bitrate::KBPS_125, 8000000, 125000},
+            {MCP2515::Bitrate::KBPS_250, 8000000, 250000},
+            {MCP2515::Bitrate::KBPS_500, 8000000, 500000},
+        };
+        for (const auto &c : cases)
+        {
+            MCP2515 *device = make(queue, c.bitrate, c.crystal_hz);
+            CHECK(device->is_ready());
+            const Timing timing = timing_from_registers(c.crystal_hz);
+            CHECK_EQ(timing.bitrate, c.expected);
+            CHECK(timing.sample_point == 0.75);
+        }
+
+        // 8MHz 晶振做不到 1M
+        MCP2515 *device = make(queue, MCP2515::Bitrate::KBPS_1000, 8000000);
+        CHECK(!device->is_ready());
+        device = make(queue, MCP2515::Bitrate::KBPS_250, 20000000);
+        CHECK(!device->is_ready());
+    }
+
+    bool receive(QueueHandle_t queue, CanFrameRecord &record)
+    {
+        return xQueueReceive(queue, &record, pdMS_TO_TICKS(1000)) == pdTRUE;
+    }
+
+    void check_frame(const CanFrameRecord &record, const Mcp2515Model::Frame &frame)
+    {
+        CHECK_EQ(record.channel, 2);
+        CHECK_EQ(record.message.identifier, frame.id);
+        CHECK_EQ(record.message.extd, frame.extd);
+        CHECK_EQ(record.message.rtr, frame.rtr);
+        CHECK_EQ(record.message.data_length_code, frame.dlc > 8 ? 8 : frame.dlc);
+        if (!frame.rtr)
+        {
+            CHECK(memcmp(record.message.data, frame.data, record.message.data_length_code) == 0);
+        }
+    }
+
+    void test_receive(MCP2515 &device, QueueHandle_t queue)
+    {
+        CanFrameRecord record;
+        const Mcp2515Model::Frame standard = {0x123, false, false, 8, {1, 2, 3, 4, 5, 6, 7, 8}};
+        const Mcp2515Model::Frame extended = {0x18FEF100, true, false, 3, {0xAA, 0xBB, 0xCC}};
+        const Mcp2515Model::Frame standard_rtr = {0x7FF, false, true, 2, {}};
+        const Mcp2515Model::Frame extended_rtr = {0x1FFFFFFF, true, true, 4, {}};
+        const Mcp2515Model::Frame long_dlc = {0x001, false, false, 15, {9, 9, 9, 9, 9, 9, 9, 9}};
+
+        for (const auto &frame : {standard, extended, standard_rtr, extended_rtr, long_dlc})
+        {
+            model.receive({frame});
+            CHECK(receive(queue, record));
+            check_frame(record, frame);
+        }
+
+        // RXB0 未读时第二帧滚动到 RXB1, 按缓冲区顺序读出
+        model.receive({standard, extended});
+        CHECK(receive(queue, record));
+        check_frame(record, standard);
+        CHECK(receive(queue, record));
+        check_frame(record, extended);
+        CHECK_EQ(model.reg(0x2C) & 0x03, 0);
+        CHECK_EQ(gpio_get_level(INT_PIN), 1);
+
+        // 两个缓冲区都满时的第三帧丢失, 记一次溢出并清除 EFLG
+        const uint32_t overruns = device.get_overrun_count();
+        model.receive({standard, extended, standard_rtr});
+        CHECK(receive(queue, record));
+        check_frame(record, standard);
+        CHECK(receive(queue, record));
+        check_frame(record, extended);
+        for (int i = 0; i < 100 && device.get_overrun_count() == overruns; i++)
+        {
+            vTaskDelay(pdMS_TO_TICKS(1));
+        }
+        CHECK_EQ(device.get_overrun_count(), overruns + 1);
+        CHECK_EQ(model.reg(0x2D) & 0xC0, 0);
+        CHECK_EQ(uxQueueMessagesWaiting(queue), 0u);
+    }
+
+    // 总线空闲时驱动只等 INT 下降沿, 不轮询 READ STATUS
+    void test_idle(QueueHandle_t queue)
+    {
+        vTaskDelay(pdMS_TO_TICKS(20));
+        const int reads = model.status_reads();
+        vTaskDelay(pdMS_TO_TICKS(100));
+        CHECK_EQ(model.status_reads(), reads);
+
+        CanFrameRecord record;
+        const Mcp2515Model::Frame frame = {0x456, false, false, 1, {0x42}};
+        model.receive({frame});
+        CHECK(receive(queue, record));
+        check_frame(record, frame);
+    }
+
+    void test_send(MCP2515 &device)
+    {
+        twai_message_t message = {};
+        message.extd = 1;
+        message.identifier = 0x0CF00400;
+        message.data_length_code = 4;
+        message.data[0] = 0x11;
+        message.data[3] = 0x44;
+        CHECK_EQ(device.send_message(message), ESP_OK);
+
+        // TXB0 仍在发送
+        CHECK_EQ(device.send_message(message), ESP_ERR_TIMEOUT);
+        model.complete_tx();
+
+        twai_message_t remote = {};
+        remote.identifier = 0x321;
+        remote.rtr = 1;
+        remote.data_length_code = 2;
+        CHECK_EQ(device.send_message(remote), ESP_OK);
+
+        const std::vector<Mcp2515Model::Frame> sent = model.sent();
+        CHECK_EQ(sent.size(), 2u);
+        if (sent.size() == 2)
+        {
+            CHECK(sent[0].extd);
+            CHECK_EQ(sent[0].id, 0x0CF00400u);
+            CHECK_EQ(sent[0].dlc, 4);
+            CHECK_EQ(sent[0].data[0], 0x11);
+            CHECK_EQ(sent[0].data[3], 0x44);
+            CHECK(!sent[1].extd);
+            CHECK(sent[1].rtr);
+            CHECK_EQ(sent[1].id, 0x321u);
+            CHECK_EQ(sent[1].dlc, 2);
+        }
+        model.complete_tx();
+    }
+}
+
+int main()
+{
+    host::set_spi_slave([](const uint8_t *tx, uint8_t *rx, size_t length)
+                        { model.transfer(tx, rx, length); });
+
+    test_bit_timing();
+
+    static QueueHandle_t queue = xQueueCreate(8, sizeof(CanFrameRecord));
+    MCP2515 *device = make(queue, MCP2515::Bitrate::KBPS_500, 16000000);
+    CHECK(device->is_ready());
+    CHECK_EQ(model.reg(0x0E) & 0xE0, 0x00); // 正常模式
+    CHECK_EQ(model.reg(0x2B), 0x03);        // 仅接收中断
+
+    test_receive(*device, queue);
+    test_idle(queue);
+    test_send(*device);
+
+    return host_test::result();
+}
@@ -0,0 +1,285 @@
+// SdSpeedPolicy: 用假卡模拟各档位下的挂载结果与传输错误, 按 SDCard 的方式(apply_speed, 挂载重试, 降速重挂)驱动策略
+#include "sd_speed.hpp"
+
+#include <cstring>
+
+#include "driver/sdmmc_host.h"
+#include "host_test.hpp"
+
+namespace
+{
+    // 假卡: 高于 max_good_khz 的频率链路出错, DDR 卡在 ddr_broken 时 DDR 下出 CRC 错误
+    struct FakeCard
+    {
+        int max_good_khz = SDMMC_FREQ_HIGHSPEED;
+        bool ddr_capable = true;
+        bool ddr_broken = false;
+        esp_err_t init_error = ESP_OK; // 与速度无关的错误, 如无卡或文件系统损坏
+
+        int mount_attempts = 0;
+        bool is_ddr = false;
+
+        esp_err_t mount(const sdmmc_host_t &host)
+        {
+            mount_attempts++;
+            if (init_error != ESP_OK)
+            {
+                return init_error;
+            }
+            if (host.max_freq_khz > max_good_khz)
+            {
+                return ESP_ERR_TIMEOUT;
+            }
+            is_ddr = ddr_capable && (host.flags & SDMMC_HOST_FLAG_DDR);
+            if (is_ddr && ddr_broken)
+            {
+                return ESP_ERR_INVALID_CRC;
+            }
+            return ESP_OK;
+        }
+
+        esp_err_t transfer(const sdmmc_host_t &host) const
+        {
+            if (host.max_freq_khz > max_good_khz)
+            {
+                return ESP_ERR_INVALID_CRC;
+            }
+            return (is_ddr && ddr_broken) ? ESP_ERR_INVALID_CRC : ESP_OK;
+        }
+    };
+
+    void apply_speed(const SdSpeedPolicy &speed, sdmmc_host_t &host)
+    {
+        const SdSpeedPolicy::Step &step = speed.current();
+        host.max_freq_khz = step.freq_khz;
+        if (step.ddr)
+        {
+            host.flags |= SDMMC_HOST_FLAG_DDR;
+        }
+        else
+        {
+            host.flags &= ~SDMMC_HOST_FLAG_DDR;
+        }
+    }
+
+    // 与 SDCard::mount_sd 相同: 从当前档开始, 链路错误时逐档降速重试
+    esp_err_t mount(SdSpeedPolicy &speed, FakeCard &card, sdmmc_host_t &host)
+    {
+        esp_err_t ret;
+        while (true)
+        {
+            apply_speed(speed, host);
+            ret = card.mount(host);
+            if (ret == ESP_OK || !speed.on_mount_failed(ret))
+            {
+                break;
+            }
+        }
+        if (ret == ESP_OK)
+        {
+            speed.on_mounted(card.is_ddr);
+        }
+        return ret;
+    }
+
+    void test_steps()
+    {
+        CHECK_EQ(SdSpeedPolicy::STEP_COUNT, 4u);
+        CHECK(SdSpeedPolicy::STEPS[0].ddr);
+        for (size_t i = 1; i < SdSpeedPolicy::STEP_COUNT; i++)
+        {
+            CHECK(!SdSpeedPolicy::STEPS[i].ddr);
+            CHECK(SdSpeedPolicy::STEPS[i].freq_khz <= SdSpeedPolicy::STEPS[i - 1].freq_khz);
+        }
+        // DDR 档之后是同频 SDR 档, on_mounted 依赖这一点
+        CHECK_EQ(SdSpeedPolicy::STEPS[1].freq_khz, SdSpeedPolicy::STEPS[0].freq_khz);
+
+        CHECK(SdSpeedPolicy::is_link_error(ESP_ERR_TIMEOUT));
+        CHECK(SdSpeedPolicy::is_link_error(ESP_ERR_INVALID_CRC));
+        CHECK(SdSpeedPolicy::is_link_error(ESP_ERR_INVALID_RESPONSE));
+        CHECK(!SdSpeedPolicy::is_link_error(ESP_OK));
+        CHECK(!SdSpeedPolicy::is_link_error(ESP_FAIL));
+        CHECK(!SdSpeedPolicy::is_link_error(ESP_ERR_NOT_FOUND));
+        CHECK(!SdSpeedPolicy::is_link_error(ESP_ERR_NO_MEM));
+    }
+
+    void test_mount()
+    {
+        struct Case
+        {
+            const char *what;
+            FakeCard card;
+            esp_err_t result;
+            const char *step;
+            int attempts;
+        };
+        FakeCard ddr_card;
+        FakeCard sdr_card;
+        sdr_card.ddr_capable = false;
+        FakeCard bad_ddr;
+        bad_ddr.ddr_broken = true;
+        FakeCard long_wires;
+        long_wires.max_good_khz = SDMMC_FREQ_DEFAULT;
+        FakeCard very_long_wires;
+        very_long_wires.max_good_khz = 10000;
+        FakeCard dead_link;
+        dead_link.max_good_khz = 0;
+        FakeCard no_card;
+        no_card.init_error = ESP_ERR_NOT_FOUND;
+        FakeCard corrupt_fs;
+        corrupt_fs.init_error = ESP_FAIL;
+
+        Case cases[] = {
+            {"DDR card", ddr_card, ESP_OK, "HS DDR", 1},
+            {"card without DDR", sdr_card, ESP_OK, "HS", 1}, // 主机悄悄退回 SDR, 记为 HS 档
+            {"DDR CRC errors", bad_ddr, ESP_OK, "HS", 2},
+            {"20 MHz link", long_wires, ESP_OK, "DS", 3},
+            {"10 MHz link", very_long_wires, ESP_OK, "slow", 4},
+            {"dead link", dead_link, ESP_ERR_TIMEOUT, "slow", 4},
+            {"no card", no_card, ESP_ERR_NOT_FOUND, "HS DDR", 1},
+            {"corrupt filesystem", corrupt_fs, ESP_FAIL, "HS DDR", 1},
+        };
+
+        for (Case &c : cases)
+        {
+            SdSpeedPolicy speed;
+            sdmmc_host_t host = {};
+            const esp_err_t ret = mount(speed, c.card, host);
+            if (ret != c.result || strcmp(speed.current().name, c.step) != 0 || c.card.mount_attempts != c.attempts)
+            {
+                printf("%s: got %s at %s after %d attempts\n", c.what, esp_err_to_name(ret), speed.current().name,
+                       c.card.mount_attempts);
+                host_test::failures++;
+            }
+            // 挂载过程中的错误不计入运行时统计
+            CHECK_EQ(speed.get_error_total(), 0u);
+        }
+
+        // 已在 SDR 档时 on_mounted(false) 不再降档
+        SdSpeedPolicy speed;
+        CHECK(speed.step_down());
+        speed.on_mounted(false);
+        CHECK_EQ(speed.get_index(), 1u);
+        speed.on_mounted(true);
+        CHECK_EQ(speed.get_index(), 1u);
+
+        // 最慢档挂载失败不再降档
+        while (speed.step_down())
+        {
+        }
+        CHECK_EQ(speed.get_index(), SdSpeedPolicy::STEP_COUNT - 1);
+        CHECK(!speed.on_mount_failed(ESP_ERR_TIMEOUT));
+        CHECK(!speed.step_down());
+    }
+
+    void test_transfer_window()
+    {
+        const int64_t window = SdSpeedPolicy::ERROR_WINDOW_US;
+
+        // 窗口内第三个链路错误才报告, 报告后重新累计
+        SdSpeedPolicy speed;
+        CHECK(!speed.on_transfer(ESP_ERR_TIMEOUT, 1000));
+        CHECK(!speed.on_transfer(ESP_OK, 2000));
+        CHECK(!speed.on_transfer(ESP_FAIL, 3000));
+        CHECK(!speed.on_transfer(ESP_ERR_INVALID_CRC, 4000));
+        CHECK(speed.on_transfer(ESP_ERR_INVALID_RESPONSE, 5000));
+        CHECK_EQ(speed.get_error_total(), 3u);
+        CHECK(!speed.on_transfer(ESP_ERR_TIMEOUT, 6000));
+        CHECK(!speed.on_transfer(ESP_ERR_TIMEOUT, 7000));
+        CHECK(speed.on_transfer(ESP_ERR_TIMEOUT, 8000));
+        CHECK_EQ(speed.get_index(), 0u); // 策略只报告, 由卡检测任务降档
+
+        // 间隔超过窗口的零星错误不降速
+        SdSpeedPolicy sparse;
+        int64_t now = 0;
+        for (int i = 0; i < 20; i++)
+        {
+            CHECK(!sparse.on_transfer(ESP_ERR_INVALID_CRC, now));
+            now += window / 2 + 1;
+        }
+        CHECK_EQ(sparse.get_error_total(), 20u);
+
+        // 窗口边界: 与窗口起点相差恰好 ERROR_WINDOW_US 仍在窗口内
+        SdSpeedPolicy edge;
+        CHECK(!edge.on_transfer(ESP_ERR_TIMEOUT, 0));
+        CHECK(!edge.on_transfer(ESP_ERR_TIMEOUT, window / 2));
+        CHECK(edge.on_transfer(ESP_ERR_TIMEOUT, window));
+
+        SdSpeedPolicy expired;
+        CHECK(!expired.on_transfer(ESP_ERR_TIMEOUT, 0));
+        CHECK(!expired.on_transfer(ESP_ERR_TIMEOUT, window / 2));
+        CHECK(!expired.on_transfer(ESP_ERR_TIMEOUT, window + 1)); // 新窗口从这里开始
+        CHECK(!expired.on_transfer(ESP_ERR_TIMEOUT, window + 2));
+        CHECK(expired.on_transfer(ESP_ERR_TIMEOUT, window + 3));
+
+        // 降档清空窗口
+        SdSpeedPolicy stepped;
+        CHECK(!stepped.on_transfer(ESP_ERR_TIMEOUT, 0));
+        CHECK(!stepped.on_transfer(ESP_ERR_TIMEOUT, 1));
+        CHECK(stepped.step_down());
+        CHECK(!stepped.on_transfer(ESP_ERR_TIMEOUT, 2));
+        CHECK(!stepped.on_transfer(ESP_ERR_TIMEOUT, 3));
+        CHECK(stepped.on_transfer(ESP_ERR_TIMEOUT, 4));
+
+        // 挂载成功清空窗口
+        SdSpeedPolicy remounted;
+        CHECK(!remounted.on_transfer(ESP_ERR_TIMEOUT, 0));
+        CHECK(!remounted.on_transfer(ESP_ERR_TIMEOUT, 1));
+        remounted.on_mounted(true);
+        CHECK(!remounted.on_transfer(ESP_ERR_TIMEOUT, 2));
+
+        // 最慢档不再报告, 错误照常计数
+        SdSpeedPolicy slowest;
+        while (slowest.step_down())
+        {
+        }
+        for (int i = 0; i < 10; i++)
+        {
+            CHECK(!slowest.on_transfer(ESP_ERR_TIMEOUT, i));
+        }
+        CHECK_EQ(slowest.get_error_total(), 10u);
+
+        // 换卡从最快档开始, 累计错误数保留
+        slowest.reset();
+        CHECK_EQ(slowest.get_index(), 0u);
+        CHECK_EQ(slowest.get_error_total(), 10u);
+        CHECK(!slowest.on_transfer(ESP_ERR_TIMEOUT, 100));
+    }
+
+    // 运行中链路变差: 与 SDCard 的 transaction_hook 和 card_detect 一样, 报告后降一档重挂, 直到传输稳定
+    void test_runtime_downgrade()
+    {
+        FakeCard card;
+        SdSpeedPolicy speed;
+        sdmmc_host_t host = {};
+        CHECK_EQ(mount(speed, card, host), ESP_OK);
+        CHECK(strcmp(speed.current().name, "HS DDR") == 0);
+
+        card.max_good_khz = SDMMC_FREQ_DEFAULT; // 例如发热或线缆松动
+        int64_t now = 0;
+        int remounts = 0;
+        for (int i = 0; i < 1000; i++, now += 1000)
+        {
+            if (speed.on_transfer(card.transfer(host), now))
+            {
+                CHECK(speed.step_down());
+                CHECK_EQ(mount(speed, card, host), ESP_OK);
+                remounts++;
+            }
+        }
+        CHECK_EQ(remounts, 1); // HS DDR 降到 HS, HS 挂载超时再降到 DS
+        CHECK(strcmp(speed.current().name, "DS") == 0);
+        CHECK_EQ(host.max_freq_khz, SDMMC_FREQ_DEFAULT);
+        CHECK(!(host.flags & SDMMC_HOST_FLAG_DDR));
+        CHECK_EQ(speed.get_error_total(), SdSpeedPolicy::ERROR_THRESHOLD);
+    }
+}
+
+int main()
+{
+    test_steps();
+    test_mount();
+    test_transfer_window();
+    test_runtime_downgrade();
+    return host_test::result();
+}
@@ -0,0 +1,403 @@
+// Slcan 协议层: 直接调用 feed 检查各命令的应答与下发的帧, 再经 pty 模拟 slcand 的一次完整会话
+#include "slcan.hpp"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "host_test.hpp"
+
+namespace
+{
+    struct Sinks
+    {
+        bool open_result = true;
+        bool transmit_result = true;
+        int opens = 0;
+        uint32_t bitrate = 0;
+        bool listen_only = false;
+        std::vector<twai_message_t> sent;
+
+        static bool open(uint32_t bitrate, bool listen_only, void *arg)
+        {
+            Sinks *sinks = static_cast<Sinks *>(arg);
+            sinks->opens++;
+            sinks->bitrate = bitrate;
+            sinks->listen_only = listen_only;
+            return sinks->open_result;
+        }
+
+        static bool transmit(const twai_message_t &message, void *arg)
+        {
+            Sinks *sinks = static_cast<Sinks *>(arg);
+            sinks->sent.push_back(message);
+            return sinks->transmit_result;
+        }
+
+        void attach(Slcan &slcan)
+        {
+            slcan.set_open_sink(&Sinks::open, this);
+            slcan.set_transmit_sink(&Sinks::transmit, this);
+        }
+    };
+
+    std::string feed(Slcan &slcan, const std::string &input, size_t reply_size = 256)
+    {
+        std::vector<char> reply(reply_size);
+        const size_t length = slcan.feed(reinterpret_cast<const uint8_t *>(input.data()), input.size(), reply.data(), reply.size());
+        return std::string(reply.data(), length);
+    }
+
+    std::string format(Slcan &slcan, const CanFrameRecord &record)
+    {
+        char buffer[Slcan::MAX_FRAME_TEXT];
+        return std::string(buffer, slcan.format_frame(record, buffer, sizeof(buffer)));
+    }
+
+    CanFrameRecord make_record(uint32_t identifier, bool extended, bool remote, uint8_t dlc, int64_t timestamp_us = 0)
+    {
+        CanFrameRecord record = {};
+        record.timestamp_us = timestamp_us;
+        record.channel = 1;
+        record.message.identifier = identifier;
+        record.message.extd = extended;
+        record.message.rtr = remote;
+        record.message.data_length_code = dlc;
+        for (int i = 0; i < 8; i++)
+        {
+            record.message.data[i] = static_cast<uint8_t>(0x11 * (i + 1));
+        }
+        return record;
+    }
+
+#define CHECK_REPLY(actual, expected)                                                             \
+    do                                                                                            \
+    {                                                                                             \
+        const std::string actual_ = (actual);                                                     \
+        if (actual_ != (expected))                                                                \
+        {                                                                                         \
+            std::printf("%s:%d: %s replied %zu bytes, expected %s\n", __FILE__, __LINE__, #actual, \
+                        actual_.size(), #expected);                                               \
+            host_test::failures++;                                                                \
+        }                                                                                         \
+    } while (0)
+
+    void test_bitrate_and_open()
+    {
+        static const uint32_t expected[] = {10000, 20000, 50000, 100000, 125000, 250000, 500000, 800000, 1000000};
+        Slcan slcan;
+        Sinks sinks;
+        sinks.attach(slcan);
+
+        for (int i = 0; i <= 8; i++)
+        {
+            CHECK_REPLY(feed(slcan, "S" + std::to_string(i) + "\r"), "\r");
+            CHECK_EQ(slcan.get_bitrate(), expected[i]);
+        }
+        CHECK_REPLY(feed(slcan, "S9\r"), "\a");
+        CHECK_REPLY(feed(slcan, "S\r"), "\a");
+        CHECK_REPLY(feed(slcan, "S10\r"), "\a");
+        CHECK_EQ(slcan.get_bitrate(), 1000000u);
+
+        // 打开失败(驱动重装失败)保持关闭
+        CHECK_REPLY(feed(slcan, "S6\r"), "\r");
+        sinks.open_result = false;
+        CHECK_REPLY(feed(slcan, "O\r"), "\a");
+        CHECK(!slcan.is_open());
+        sinks.open_result = true;
+
+        CHECK_REPLY(feed(slcan, "O\r"), "\r");
+        CHECK(slcan.is_open());
+        CHECK_EQ(sinks.opens, 2);
+        CHECK_EQ(sinks.bitrate, 500000u);
+        CHECK(!sinks.listen_only);
+
+        // 打开后不能改波特率, 也不能重复打开
+        CHECK_REPLY(feed(slcan, "S4\r"), "\a");
+        CHECK_EQ(slcan.get_bitrate(), 500000u);
+        CHECK_REPLY(feed(slcan, "O\r"), "\a");
+        CHECK_REPLY(feed(slcan, "L\r"), "\a");
+        CHECK_REPLY(feed(slcan, "O1\r"), "\a");
+        CHECK_EQ(sinks.opens, 2);
+
+        // C 总是成功, 已关闭时也一样
+        CHECK_REPLY(feed(slcan, "C\r"), "\r");
+        CHECK(!slcan.is_open());
+        CHECK_REPLY(feed(slcan, "C\r"), "\r");
+
+        CHECK_REPLY(feed(slcan, "L\r"), "\r");
+        CHECK(slcan.is_open());
+        CHECK(sinks.listen_only);
+
+        // 只听模式不发送
+        CHECK_REPLY(feed(slcan, "t1230\r"), "\a");
+        CHECK(sinks.sent.empty());
+        CHECK_REPLY(feed(slcan, "C\r"), "\r");
+    }
+
+    void test_transmit()
+    {
+        Slcan slcan;
+        Sinks sinks;
+        sinks.attach(slcan);
+
+        // 关闭时拒绝, 不计入统计
+        CHECK_REPLY(feed(slcan, "t1230\r"), "\a");
+        CHECK_EQ(slcan.get_stats().tx_failed, 0u);
+        CHECK_REPLY(feed(slcan, "O\r"), "\r");
+
+        CHECK_REPLY(feed(slcan, "t12320aFf\r"), "z\r");
+        CHECK_REPLY(feed(slcan, "T1ABCDEF080011223344556677\r"), "Z\r");
+        CHECK_REPLY(feed(slcan, "r7FF8\r"), "z\r");
+        CHECK_REPLY(feed(slcan, "R1FFFFFFF0\r"), "Z\r");
+        CHECK_REPLY(feed(slcan, "t0000\r"), "z\r");
+        CHECK_EQ(sinks.sent.size(), 5u);
+
+        if (sinks.sent.size() == 5)
+        {
+            const twai_message_t &standard = sinks.sent[0];
+            CHECK_EQ(standard.identifier, 0x123u);
+            CHECK(!standard.extd && !standard.rtr);
+            CHECK_EQ(standard.data_length_code, 2);
+            CHECK_EQ(standard.data[0], 0x0A);
+            CHECK_EQ(standard.data[1], 0xFF);
+            CHECK_EQ(standard.data[2], 0);
+
+            const twai_message_t &extended = sinks.sent[1];
+            CHECK_EQ(extended.identifier, 0x1ABCDEF0u);
+            CHECK(extended.extd && !extended.rtr);
+            CHECK_EQ(extended.data_length_code, 8);
+            for (int i = 0; i < 8; i++)
+            {
+                CHECK_EQ(extended.data[i], 0x11 * i);
+            }
+
+            // 远程帧 DLC 为请求长度, 不带数据
+            const twai_message_t &remote = sinks.sent[2];
+            CHECK_EQ(remote.identifier, 0x7FFu);
+            CHECK(!remote.extd && remote.rtr);
+            CHECK_EQ(remote.data_length_code, 8);
+            CHECK_EQ(remote.data[0], 0);
+
+            const twai_message_t &extended_remote = sinks.sent[3];
+            CHECK_EQ(extended_remote.identifier, 0x1FFFFFFFu);
+            CHECK(extended_remote.extd && extended_remote.rtr);
+            CHECK_EQ(extended_remote.data_length_code, 0);
+
+            CHECK_EQ(sinks.sent[4].data_length_code, 0);
+        }
+
+        // 格式错误: 每条都回 \a, 计入 tx_failed, 不下发
+        static const char *const malformed[] = {
+            "t\r",                            // 没有 ID
+            "t12\r",                          // ID 不足
+            "t123\r",                         // 没有 DLC
+            "t1239\r",                        // DLC 超过 8
+            "t1232AA\r",                      // 数据少于 DLC
+            "t1232AABBCC\r",                  // 数据多于 DLC
+            "t1231ZZ\r",                      // 数据不是十六进制
+            "t12G0\r",                        // ID 不是十六进制
+            "t8000\r",                        // 标准帧 ID 超过 0x7FF
+            "T200000000\r",                   // 扩展帧 ID 超过 0x1FFFFFFF
+            "T1234567\r",                     // 扩展帧 ID 不足
+            "r1232AABB\r",                    // 远程帧带数据
+            "T1ABCDEF09001122334455667788\r", // 扩展帧 DLC 超过 8
+        };
+        const Slcan::Stats before = slcan.get_stats();
+        for (const char *line : malformed)
+        {
+            const std::string reply = feed(slcan, line);
+            if (reply != "\a")
+            {
+                printf("malformed %s accepted\n", line);
+                host_test::failures++;
+            }
+        }
+        const Slcan::Stats after = slcan.get_stats();
+        CHECK_EQ(after.tx_failed - before.tx_failed, sizeof(malformed) / sizeof(malformed[0]));
+        CHECK_EQ(after.tx_frames, before.tx_frames);
+        CHECK_EQ(sinks.sent.size(), 5u);
+
+        // 发送队列满: 已解析的帧计入 tx_frames, 同时计入 tx_failed
+        sinks.transmit_result = false;
+        CHECK_REPLY(feed(slcan, "t1230\r"), "\a");
+        CHECK_EQ(slcan.get_stats().tx_frames, after.tx_frames + 1);
+        CHECK_EQ(slcan.get_stats().tx_failed, after.tx_failed + 1);
+    }
+
+    void test_line_handling()
+    {
+        Slcan slcan;
+        Sinks sinks;
+        sinks.attach(slcan);
+
+        // 空行同步, \n 忽略, 一次输入多条命令, 命令跨多次输入
+        CHECK_REPLY(feed(slcan, "\r\r"), "\r\r");
+        CHECK_REPLY(feed(slcan, "V\r\nN\r\n"), "V1013\rNE32S\r");
+        CHECK_REPLY(feed(slcan, "S"), "");
+        CHECK_REPLY(feed(slcan, "5"), "");
+        CHECK_REPLY(feed(slcan, "\rO\r"), "\r\r");
+        CHECK_EQ(slcan.get_bitrate(), 250000u);
+        CHECK_REPLY(feed(slcan, "t1"), "");
+        CHECK_REPLY(feed(slcan, "231"), "");
+        CHECK_REPLY(feed(slcan, "42\r"), "z\r");
+        CHECK_EQ(sinks.sent.size(), 1u);
+
+        // 未知命令与接受但忽略的命令
+        CHECK_REPLY(feed(slcan, "?\r"), "\a");
+        CHECK_REPLY(feed(slcan, "M00000000\rm00000000\rX1\rW2\r"), "\r\r\r\r");
+
+        // 超长行: 回 \a 且不执行, 下一行不受影响
+        const std::string long_line = "T1ABCDEF08" + std::string(40, '0') + "\r";
+        CHECK_REPLY(feed(slcan, long_line), "\a");
+        CHECK_REPLY(feed(slcan, std::string(1000, 'x') + "\rV\r"), "\aV1013\r");
+        CHECK_EQ(sinks.sent.size(), 1u);
+
+        // 恰好 LINE_SIZE 个字符仍可执行
+        CHECK_REPLY(feed(slcan, "M" + std::string(31, '0') + "\r"), "\r");
+
+        // 应答空间不足时丢弃放不下的应答, 后面的命令仍执行
+        CHECK_REPLY(feed(slcan, "V\rC\r", 3), "\r");
+        CHECK(!slcan.is_open());
+        CHECK_REPLY(feed(slcan, "C\rV\r", 3), "\r");
+    }
+
+    void test_status_and_format()
+    {
+        Slcan slcan;
+
+        // 关闭时不格式化
+        CHECK_REPLY(format(slcan, make_record(0x123, false, false, 2)), "");
+        CHECK_REPLY(feed(slcan, "O\r"), "\r");
+
+        CHECK_REPLY(format(slcan, make_record(0x123, false, false, 2)), "t12321122\r");
+        CHECK_REPLY(format(slcan, make_record(0x1ABCDEF0, true, false, 8)), "T1ABCDEF081122334455667788\r");
+        CHECK_REPLY(format(slcan, make_record(0x7FF, false, true, 4)), "r7FF4\r");
+        CHECK_REPLY(format(slcan, make_record(0x1FFFFFFF, true, true, 0)), "R1FFFFFFF0\r");
+        CHECK_REPLY(format(slcan, make_record(0x001, false, false, 0)), "t0010\r");
+        CHECK_REPLY(format(slcan, make_record(0x001, false, false, 15)), "t00181122334455667788\r"); // DLC 截到 8
+
+        // 时间戳: 毫秒, 60 秒回绕
+        CHECK_REPLY(feed(slcan, "Z1\r"), "\r");
+        CHECK_REPLY(format(slcan, make_record(0x123, false, false, 1, 61234567)), "t12311104D2\r");
+        CHECK_REPLY(format(slcan, make_record(0x1ABCDEF0, true, false, 8, 59999999)), "T1ABCDEF081122334455667788EA5F\r");
+        CHECK_REPLY(feed(slcan, "Z0\r"), "\r");
+        CHECK_REPLY(feed(slcan, "Z2\r"), "\a");
+        CHECK_REPLY(format(slcan, make_record(0x123, false, false, 0, 5000)), "t1230\r");
+
+        // 缓冲区不足一行最大长度时不格式化
+        char small[Slcan::MAX_FRAME_TEXT - 1];
+        CHECK_EQ(slcan.format_frame(make_record(0x123, false, false, 0), small, sizeof(small)), 0u);
+
+        // F: 溢出位读出后清除
+        CHECK_REPLY(feed(slcan, "F\r"), "F00\r");
+        slcan.count_dropped(2);
+        CHECK_REPLY(feed(slcan, "F\r"), "F08\r");
+        CHECK_REPLY(feed(slcan, "F\r"), "F00\r");
+
+        const Slcan::Stats stats = slcan.get_stats();
+        CHECK_EQ(stats.rx_frames, 9u - 2u);
+        CHECK_EQ(stats.rx_dropped, 2u);
+    }
+
+    // slcand 与 python-can 的初始化顺序: C, Sn, O, 之后收发帧; 设备侧与 slcan_task.cpp 一样逐块读入并回写应答
+    void test_pty_session()
+    {
+        const int host = posix_openpt(O_RDWR | O_NOCTTY);
+        CHECK(host >= 0);
+        if (host < 0 || grantpt(host) != 0 || unlockpt(host) != 0)
+        {
+            return;
+        }
+        const int device = open(ptsname(host), O_RDWR | O_NOCTTY);
+        CHECK(device >= 0);
+        if (device < 0)
+        {
+            close(host);
+            return;
+        }
+        termios tio;
+        tcgetattr(device, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(device, TCSANOW, &tio);
+
+        Slcan slcan;
+        Sinks sinks;
+        sinks.attach(slcan);
+
+        // 设备侧: 把 pty 上已到达的字节交给 feed, 应答写回
+        auto pump = [&]()
+        {
+            pollfd fd = {device, POLLIN, 0};
+            while (poll(&fd, 1, 50) > 0)
+            {
+                uint8_t buffer[64];
+                const ssize_t length = read(device, buffer, sizeof(buffer));
+                if (length <= 0)
+                {
+                    break;
+                }
+                char reply[64];
+                const size_t reply_length = slcan.feed(buffer, length, reply, sizeof(reply));
+                CHECK(write(device, reply, reply_length) == static_cast<ssize_t>(reply_length));
+            }
+        };
+        auto host_read = [&](size_t expected)
+        {
+            std::string text;
+            pollfd fd = {host, POLLIN, 0};
+            while (text.size() < expected && poll(&fd, 1, 200) > 0)
+            {
+                char buffer[64];
+                const ssize_t length = read(host, buffer, sizeof(buffer));
+                if (length <= 0)
+                {
+                    break;
+                }
+                text.append(buffer, length);
+            }
+            return text;
+        };
+        auto host_write = [&](const std::string &text)
+        {
+            CHECK(write(host, text.data(), text.size()) == static_cast<ssize_t>(text.size()));
+            pump();
+        };
+
+        host_write("C\rS8\rO\r");
+        CHECK_REPLY(host_read(3), "\r\r\r");
+        CHECK(slcan.is_open());
+        CHECK_EQ(sinks.bitrate, 1000000u);
+
+        host_write("t7E8803410D2800000000\rT18DAF1103023E00\r");
+        CHECK_REPLY(host_read(4), "z\rZ\r");
+        CHECK_EQ(sinks.sent.size(), 2u);
+
+        // 接收方向: 转发任务格式化后直接写 CDC
+        const std::string frame = format(slcan, make_record(0x7DF, false, false, 8));
+        CHECK(write(device, frame.data(), frame.size()) == static_cast<ssize_t>(frame.size()));
+        CHECK_REPLY(host_read(frame.size()), "t7DF81122334455667788\r");
+
+        host_write("t7E8\rF\rC\r");
+        CHECK_REPLY(host_read(6), "\aF00\r\r");
+        CHECK(!slcan.is_open());
+
+        close(device);
+        close(host);
+    }
+}
+
+int main()
+{
+    test_bitrate_and_open();
+    test_transmit();
+    test_line_handling();
+    test_status_and_format();
+    test_pty_session();
+    return host_test::result();
+}
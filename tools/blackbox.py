@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""把片上 Flash 黑匣子转换为 ASC 文本.
+
+输入可以是设备导出的文件 (blackbox -s <file>), 也可以是直接读出的整个分区:
+    parttool.py --port <port> read_partition --partition-name blackbox --output blackbox.bin
+
+分区格式 (小端):
+    每个 4096 字节扇区:
+        magic     u32  0x31584242 ("BBX1")
+        sequence  u32  每换一个扇区加 1, 按此排序即为时间顺序
+        crc       u32  前两个字段的 CRC32
+        记录, 直到全 0xFF 的记录头:
+            length  u8   载荷长度
+            type    u8   0 开始标记, 1 CAN 帧
+            crc     u16  length、type 与载荷的 CRC32 低 16 位
+            载荷
+    开始标记载荷: unix_us i64, timer_us i64
+    CAN 帧载荷: timestamp_us i64, identifier u32, channel u8, flags u8, dlc u8, data[0..8]
+
+导出文件在扇区之前有文件头: magic u32 0x46584242 ("BBXF"), sector_size u32, count u32
+
+用法:
+    blackbox.py blackbox.bin > frames.asc
+"""
+
+import argparse
+import datetime
+import struct
+import sys
+import zlib
+
+SECTOR_MAGIC = 0x31584242
+FILE_MAGIC = 0x46584242
+SECTOR_SIZE = 4096
+
+FILE_HEADER = struct.Struct("<3I")
+SECTOR_HEADER = struct.Struct("<3I")
+RECORD_HEADER = struct.Struct("<BBH")
+MARK = struct.Struct("<qq")
+CAN = struct.Struct("<qIBBB")
+
+RECORD_MARK = 0
+RECORD_CAN = 1
+
+
+def read_sectors(data, sector_size):
+    sectors = []
+    for offset in range(0, len(data) - sector_size + 1, sector_size):
+        magic, sequence, crc = SECTOR_HEADER.unpack_from(data, offset)
+        if magic != SECTOR_MAGIC or sequence == 0xFFFFFFFF:
+            continue
+        if crc != zlib.crc32(data[offset:offset + 8]):
+            continue
+        sectors.append((sequence, data[offset:offset + sector_size]))
+    sectors.sort(key=lambda s: s[0])
+    return sectors
+
+
+def parse_records(sector, errors):
+    offset = SECTOR_HEADER.size
+    while offset + RECORD_HEADER.size <= len(sector):
+        length, kind, crc = RECORD_HEADER.unpack_from(sector, offset)
+        if length == 0xFF and kind == 0xFF and crc == 0xFFFF:
+            return
+        start = offset + RECORD_HEADER.size
+        payload = sector[start:start + length]
+        if len(payload) != length or crc != zlib.crc32(payload, zlib.crc32(sector[offset:offset + 2])) & 0xFFFF:
+            # 掉电时写了一半, 扇区其余部分不再可信
+            errors.append(offset)
+            return
+        yield kind, payload
+        offset = start + length
+
+
+def format_can(payload):
+    timestamp, identifier, channel, _flags, dlc = CAN.unpack_from(payload, 0)
+    data = payload[CAN.size:]
+    line = "%d.%06d %d %08xx Rx d %d" % (timestamp // 1000000, timestamp % 1000000, channel, identifier, dlc)
+    return line + "".join(" %02x" % b for b in data[:dlc])
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert a black box export or partition dump to ASC")
+    parser.add_argument("input", help="file saved by 'blackbox -s' or a raw partition dump")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+
+    sector_size = SECTOR_SIZE
+    if len(data) >= FILE_HEADER.size:
+        magic, size, count = FILE_HEADER.unpack_from(data, 0)
+        if magic == FILE_MAGIC:
+            sector_size = size
+            data = data[FILE_HEADER.size:FILE_HEADER.size + size * count]
+
+    sectors = read_sectors(data, sector_size)
+    if not sectors:
+        sys.exit("%s: no black box sectors" % args.input)
+
+    frames = 0
+    previous = None
+    for sequence, sector in sectors:
+        if previous is not None and sequence != previous + 1:
+            print("// sectors %d..%d missing" % (previous + 1, sequence - 1))
+        previous = sequence
+
+        errors = []
+        for kind, payload in parse_records(sector, errors):
+            if kind == RECORD_MARK and len(payload) >= MARK.size:
+                unix_us, timer_us = MARK.unpack_from(payload, 0)
+                when = datetime.datetime.fromtimestamp(unix_us / 1e6, datetime.timezone.utc)
+                print("// start %s UTC, timer %d.%06d" % (when.strftime("%Y-%m-%d %H:%M:%S.%f"),
+                                                          timer_us // 1000000, timer_us % 1000000))
+            elif kind == RECORD_CAN and len(payload) >= CAN.size:
+                print(format_can(payload))
+                frames += 1
+        for offset in errors:
+            print("// sector %d: bad record at offset %d" % (sequence, offset))
+
+    print("%s: %d sectors (#%d..#%d), %d frames" % (args.input, len(sectors), sectors[0][0], sectors[-1][0], frames),
+          file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""格式化设备导出的二进制事件日志 (evtlog -s <file>).
+
+设备只记录格式串地址与原始参数, 本工具从固件 ELF 的只读段中取出格式串和 %s 参数后格式化.
+必须使用与设备上运行的固件相同的 ELF.
+
+文件格式 (小端):
+    magic        u32  0x314C5645 ("EVL1")
+    record_size  u32  每条记录的字节数, 当前为 32
+    count        u32  记录条数
+    记录:
+        timestamp_us  i64  esp_timer 时间
+        format        u32  格式串地址
+        args          4 x u32  参数, 浮点数为 float 位模式
+        core          u8
+        reserved      3 字节
+
+用法:
+    evtlog.py build/app.elf events.bin
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+FILE_MAGIC = 0x314C5645
+FILE_HEADER = struct.Struct("<3I")
+RECORD = struct.Struct("<qI4IB3x")
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+SPEC = re.compile(r"%([-+ #0]*[0-9]*(?:\.[0-9]*)?)(?:hh|h|ll|l|L|q|j|z|t)?([diouxXcspfFeEgG%])")
+
+
+class Elf:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF":
+            raise ValueError("%s is not an ELF file" % path)
+        is_64 = self.data[4] == 2
+        if is_64:
+            shoff, = struct.unpack_from("<Q", self.data, 0x28)
+            shentsize, shnum = struct.unpack_from("<HH", self.data, 0x3A)
+            section = struct.Struct("<IIQQQQ")
+        else:
+            shoff, = struct.unpack_from("<I", self.data, 0x20)
+            shentsize, shnum = struct.unpack_from("<HH", self.data, 0x2E)
+            section = struct.Struct("<IIIIII")
+
+        # 只保留加载到内存且在文件中有内容的段
+        self.sections = []
+        for i in range(shnum):
+            _, sh_type, flags, addr, offset, size = section.unpack_from(self.data, shoff + i * shentsize)
+            if flags & SHF_ALLOC and sh_type != SHT_NOBITS and size > 0:
+                self.sections.append((addr, offset, size))
+
+    def string(self, address):
+        for addr, offset, size in self.sections:
+            if addr <= address < addr + size:
+                start = offset + address - addr
+                end = self.data.find(b"\0", start, offset + size)
+                if end < 0:
+                    end = offset + size
+                return self.data[start:end].decode("utf-8", "replace")
+        return None
+
+
+def format_event(elf, fmt, args):
+    values = iter(args)
+
+    def convert(match):
+        flags, conversion = match.groups()
+        if conversion == "%":
+            return "%"
+        try:
+            word = next(values)
+        except StopIteration:
+            return "<?>"
+        if conversion in "di":
+            value = word - (1 << 32) if word & 0x80000000 else word
+            return ("%" + flags + "d") % value
+        if conversion in "ouxX":
+            return ("%" + flags + conversion.replace("u", "d")) % word
+        if conversion == "c":
+            return ("%" + flags + "c") % chr(word & 0xFF)
+        if conversion == "s":
+            text = elf.string(word) if word else "(null)"
+            return ("%" + flags + "s") % (text if text is not None else "<0x%08x>" % word)
+        if conversion == "p":
+            return "0x%x" % word
+        value, = struct.unpack("<f", struct.pack("<I", word))
+        return ("%" + flags + conversion) % value
+
+    return SPEC.sub(convert, fmt)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Format a binary event log saved by 'evtlog -s'")
+    parser.add_argument("elf", help="firmware ELF that produced the log")
+    parser.add_argument("log", help="file saved by 'evtlog -s'")
+    args = parser.parse_args()
+
+    elf = Elf(args.elf)
+    with open(args.log, "rb") as f:
+        data = f.read()
+
+    if len(data) < FILE_HEADER.size:
+        sys.exit("%s: file too short" % args.log)
+    magic, record_size, count = FILE_HEADER.unpack_from(data, 0)
+    if magic != FILE_MAGIC or record_size < RECORD.size:
+        sys.exit("%s: not an event log" % args.log)
+
+    events = []
+    for i in range(count):
+        offset = FILE_HEADER.size + i * record_size
+        if offset + RECORD.size > len(data):
+            print("%s: truncated after %d records" % (args.log, i), file=sys.stderr)
+            break
+        timestamp, fmt_address, a0, a1, a2, a3, core = RECORD.unpack_from(data, offset)
+        events.append((timestamp, core, fmt_address, (a0, a1, a2, a3)))
+
+    for timestamp, core, fmt_address, values in sorted(events):
+        fmt = elf.string(fmt_address)
+        if fmt is None:
+            text = "<unknown format 0x%08x> %s" % (fmt_address, " ".join("%08x" % v for v in values))
+        else:
+            text = format_event(elf, fmt, values)
+        print("%6d.%06d [%d] %s" % (timestamp // 1000000, timestamp % 1000000, core, text))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""用户态 gs_usb 主机, 代替内核驱动验证设备 (gsusb 命令重启后).
+
+按内核 gs_usb 驱动的顺序发送控制请求, 启动后打印收到的帧, 格式与 candump 相近.
+需要 pyusb; 若内核 gs_usb 驱动已绑定, 先卸载或用 --detach 让本工具接管.
+正常使用时直接由内核驱动创建 can0:
+    sudo ip link set can0 up type can bitrate 500000 && candump -td can0
+
+用法:
+    gs_usb_dump.py --bitrate 500000 [--listen-only] [--send 123#11223344]
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+import usb.core
+import usb.util
+
+VID, PID = 0x1D50, 0x606F
+EP_IN, EP_OUT = 0x81, 0x02
+
+BREQ_HOST_FORMAT, BREQ_BITTIMING, BREQ_MODE = 0, 1, 2
+BREQ_BT_CONST, BREQ_DEVICE_CONFIG, BREQ_TIMESTAMP = 4, 5, 6
+
+MODE_RESET, MODE_START = 0, 1
+FLAG_LISTEN_ONLY, FLAG_HW_TIMESTAMP = 1 << 0, 1 << 4
+FRAME_FLAG_OVERFLOW = 1 << 0
+
+CAN_EFF_FLAG, CAN_RTR_FLAG = 0x80000000, 0x40000000
+ECHO_ID_RX = 0xFFFFFFFF
+
+OUT = usb.util.CTRL_OUT | usb.util.CTRL_TYPE_VENDOR | usb.util.CTRL_RECIPIENT_INTERFACE
+IN = usb.util.CTRL_IN | usb.util.CTRL_TYPE_VENDOR | usb.util.CTRL_RECIPIENT_INTERFACE
+
+FRAME = struct.Struct("<IIBBBB8sI")
+BT_CONST = struct.Struct("<10I")
+
+
+def find_timing(bt_const, bitrate):
+    """与内核 can_calc_bittiming 类似: 取能整除且采样点最接近 87.5% 的组合."""
+    _, fclk, tseg1_min, tseg1_max, tseg2_min, tseg2_max, _, brp_min, brp_max, brp_inc = bt_const
+    best = None
+    for brp in range(brp_min, brp_max + 1, brp_inc):
+        quanta, remainder = divmod(fclk, brp * bitrate)
+        if remainder or quanta < 1 + tseg1_min + tseg2_min or quanta > 1 + tseg1_max + tseg2_max:
+            continue
+        tseg2 = max(tseg2_min, min(tseg2_max, round(quanta * 0.125)))
+        tseg1 = quanta - 1 - tseg2
+        if not tseg1_min <= tseg1 <= tseg1_max:
+            continue
+        error = abs((1 + tseg1) / quanta - 0.875)
+        if best is None or error < best[0]:
+            best = (error, brp, tseg1, tseg2)
+    if best is None:
+        sys.exit("bitrate %d not reachable" % bitrate)
+    _, brp, tseg1, tseg2 = best
+    prop = tseg1 // 2
+    return struct.pack("<5I", prop, tseg1 - prop, tseg2, 1, brp)
+
+
+def parse_frame(text):
+    ident, _, data = text.partition("#")
+    can_id = int(ident, 16)
+    if len(ident) > 3:
+        can_id |= CAN_EFF_FLAG
+    payload = bytes.fromhex(data)
+    return can_id, payload
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Userspace gs_usb host for testing the device")
+    parser.add_argument("--bitrate", type=int, default=500000)
+    parser.add_argument("--listen-only", action="store_true")
+    parser.add_argument("--send", action="append", default=[], help="frame to send, e.g. 123#1122 or 18FF0001#00")
+    parser.add_argument("--detach", action="store_true", help="detach the kernel gs_usb driver first")
+    args = parser.parse_args()
+
+    dev = usb.core.find(idVendor=VID, idProduct=PID)
+    if dev is None:
+        sys.exit("gs_usb device %04x:%04x not found" % (VID, PID))
+    if args.detach and dev.is_kernel_driver_active(0):
+        dev.detach_kernel_driver(0)
+    dev.set_configuration()
+
+    dev.ctrl_transfer(OUT, BREQ_HOST_FORMAT, 1, 0, struct.pack("<I", 0x0000BEEF))
+    config = dev.ctrl_transfer(IN, BREQ_DEVICE_CONFIG, 1, 0, 12)
+    _, _, _, icount, sw_version, hw_version = struct.unpack("<4B2I", config)
+    bt_const = BT_CONST.unpack(dev.ctrl_transfer(IN, BREQ_BT_CONST, 0, 0, BT_CONST.size))
+    print("channels %d, sw %d, hw %d, features 0x%x, fclk %d" % (icount + 1, sw_version, hw_version, bt_const[0], bt_const[1]),
+          file=sys.stderr)
+
+    dev.ctrl_transfer(OUT, BREQ_BITTIMING, 0, 0, find_timing(bt_const, args.bitrate))
+    flags = FLAG_HW_TIMESTAMP | (FLAG_LISTEN_ONLY if args.listen_only else 0)
+    dev.ctrl_transfer(OUT, BREQ_MODE, 0, 0, struct.pack("<2I", MODE_START, flags))
+
+    for echo_id, text in enumerate(args.send):
+        can_id, payload = parse_frame(text)
+        dev.write(EP_OUT, FRAME.pack(echo_id, can_id, len(payload), 0, 0, 0, payload.ljust(8, b"\0"), 0)[:FRAME.size - 4])
+
+    frames = 0
+    start = time.monotonic()
+    try:
+        while True:
+            try:
+                data = bytes(dev.read(EP_IN, 64, timeout=1000))
+            except usb.core.USBTimeoutError:
+                continue
+            echo_id, can_id, dlc, channel, flags, _, payload, timestamp = FRAME.unpack(data.ljust(FRAME.size, b"\0"))
+            ident = "%08X" % (can_id & 0x1FFFFFFF) if can_id & CAN_EFF_FLAG else "%03X" % (can_id & 0x7FF)
+            body = "R" if can_id & CAN_RTR_FLAG else " ".join("%02X" % b for b in payload[:dlc])
+            kind = "TX" if echo_id != ECHO_ID_RX else "RX"
+            note = " overflow" if flags & FRAME_FLAG_OVERFLOW else ""
+            print("(%10.6f) can%d %s %s [%d] %s%s" % (timestamp / 1e6, channel, kind, ident, dlc, body, note))
+            frames += 1
+    except KeyboardInterrupt:
+        pass
+    finally:
+        dev.ctrl_transfer(OUT, BREQ_MODE, 0, 0, struct.pack("<2I", MODE_RESET, 0))
+        elapsed = time.monotonic() - start
+        print("%d frames in %.1f s (%.0f/s)" % (frames, elapsed, frames / elapsed if elapsed else 0), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
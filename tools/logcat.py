@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""解码并输出设备写入的分块日志 (*.blk / *.lz4).
+
+文件由若干独立的块组成, 每块从 512 字节扇区边界开始, 为 28 字节块头加数据, 不足整扇区补 0.
+块头字段均为小端:
+    magic          u32  0x314B4C43 ("CLK1")
+    sequence       u32  文件内从 0 递增
+    flags          u32  bit0: 数据为 LZ4 块格式, 否则为原文
+    raw_length     u32  解码后长度
+    stored_length  u32  块头之后的数据长度, 不含补齐
+    line_total     u32  文件开头到本块结束的换行数
+    crc            u32  前六个字段与数据的 CRC32
+预分配文件末尾未写入的部分为 0, 遇到无效块即停止.
+
+用法:
+    logcat.py 2025-01-01/12-00-00.asc.blk > out.asc
+    logcat.py -o out.asc a.asc.lz4 a_001.asc.lz4
+    logcat.py --stats a.asc.lz4
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+BLOCK_MAGIC = 0x314B4C43
+FLAG_LZ4 = 0x0001
+SECTOR_SIZE = 512
+HEADER = struct.Struct("<7I")
+
+
+class BlockError(Exception):
+    pass
+
+
+def lz4_decompress(src, raw_length):
+    dst = bytearray()
+    i = 0
+    n = len(src)
+    while i < n:
+        token = src[i]
+        i += 1
+
+        literals = token >> 4
+        if literals == 15:
+            while True:
+                b = src[i]
+                i += 1
+                literals += b
+                if b != 255:
+                    break
+        dst += src[i:i + literals]
+        i += literals
+        if i >= n:
+            break  # 最后一个序列只有字面量
+
+        offset = src[i] | (src[i + 1] << 8)
+        i += 2
+        if offset == 0 or offset > len(dst):
+            raise BlockError("bad match offset %d" % offset)
+
+        match = token & 0x0F
+        if match == 15:
+            while True:
+                b = src[i]
+                i += 1
+                match += b
+                if b != 255:
+                    break
+        match += 4
+
+        start = len(dst) - offset
+        if offset >= match:
+            dst += dst[start:start + match]
+        else:
+            for k in range(match):  # 重叠复制
+                dst.append(dst[start + k])
+
+    if len(dst) != raw_length:
+        raise BlockError("length mismatch %d != %d" % (len(dst), raw_length))
+    return bytes(dst)
+
+
+def read_blocks(path):
+    """逐块产出 (偏移, 块头, 原始数据); 末尾的无效数据产出一次 (偏移, None, 原因)."""
+    with open(path, "rb") as f:
+        data = f.read()
+
+    offset = 0
+    expected = 0
+    while offset + HEADER.size <= len(data):
+        magic, sequence, flags, raw_length, stored_length, line_total, crc = HEADER.unpack_from(data, offset)
+        if magic != BLOCK_MAGIC:
+            if any(data[offset:]):
+                yield offset, None, "bad magic"
+            return
+        payload = data[offset + HEADER.size:offset + HEADER.size + stored_length]
+        if len(payload) != stored_length:
+            yield offset, None, "truncated block"
+            return
+        if zlib.crc32(payload, zlib.crc32(data[offset:offset + HEADER.size - 4])) != crc:
+            yield offset, None, "crc mismatch"
+            return
+        if sequence != expected:
+            print("%s: block sequence %d, expected %d" % (path, sequence, expected), file=sys.stderr)
+        expected = sequence + 1
+
+        if flags & FLAG_LZ4:
+            raw = lz4_decompress(payload, raw_length)
+        else:
+            raw = payload
+        yield offset, (raw_length, stored_length, line_total, flags), raw
+        offset += (HEADER.size + stored_length + SECTOR_SIZE - 1) // SECTOR_SIZE * SECTOR_SIZE
+
+    if offset < len(data) and any(data[offset:]):
+        yield offset, None, "truncated header"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("files", nargs="+")
+    parser.add_argument("-o", "--output", help="写入文件, 默认标准输出")
+    parser.add_argument("--stats", action="store_true", help="只打印块数、行数与压缩率")
+    args = parser.parse_args()
+
+    out = None
+    if not args.stats:
+        out = open(args.output, "wb") if args.output else sys.stdout.buffer
+
+    status = 0
+    for path in args.files:
+        blocks = raw_total = stored_total = lines_total = 0
+        file_size = 0
+        for offset, header, raw in read_blocks(path):
+            if header is None:
+                print("%s: %s at offset %d, stop" % (path, raw, offset), file=sys.stderr)
+                status = 1
+                break
+            raw_length, stored_length, line_total, _ = header
+            blocks += 1
+            raw_total += raw_length
+            stored_total += HEADER.size + stored_length
+            lines_total = line_total
+            file_size = offset + (HEADER.size + stored_length + SECTOR_SIZE - 1) // SECTOR_SIZE * SECTOR_SIZE
+            if out:
+                out.write(raw)
+
+        if args.stats:
+            ratio = raw_total / file_size if file_size else 0.0
+            print("%s: %d blocks, %d lines, %d -> %d bytes (%d padding), ratio %.2f"
+                  % (path, blocks, lines_total, raw_total, file_size, file_size - stored_total, ratio))
+
+    if out and out is not sys.stdout.buffer:
+        out.close()
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""USB-MSC 顺序读测速 (usb_mount 导出后, 主机挂载卡).
+
+顺序读取卡上的一个大文件 (或整个块设备), 按块输出累计速度, 最后给出 MB/s.
+Linux 下用 O_DIRECT 绕过页缓存, 每次读都经过 USB; 其它系统先丢弃文件缓存, 重复测量时结果可能偏高.
+
+用法:
+    msc_bench.py /media/user/SDCARD/can_log/2024-01-01.asc [--block 1M] [--runs 3]
+    sudo msc_bench.py /dev/sdb --size 256M
+"""
+
+import argparse
+import mmap
+import os
+import sys
+import time
+
+MIB = 1024 * 1024
+
+
+def parse_size(text):
+    units = {"K": 1024, "M": MIB, "G": 1024 * MIB}
+    text = text.strip().upper()
+    if text and text[-1] in units:
+        return int(float(text[:-1]) * units[text[-1]])
+    return int(text)
+
+
+def open_uncached(path):
+    flags = os.O_RDONLY
+    direct = hasattr(os, "O_DIRECT")
+    if direct:
+        try:
+            return os.open(path, flags | os.O_DIRECT), True
+        except OSError:
+            pass
+    fd = os.open(path, flags)
+    if hasattr(os, "posix_fadvise"):
+        os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+    return fd, False
+
+
+def run(path, block, limit, verbose):
+    fd, direct = open_uncached(path)
+    # O_DIRECT 要求缓冲按页对齐, mmap 匿名映射满足
+    buffer = mmap.mmap(-1, block)
+    total = 0
+    start = last = time.monotonic()
+    try:
+        while limit is None or total < limit:
+            count = os.readv(fd, [buffer])
+            if count <= 0:
+                break
+            total += count
+            now = time.monotonic()
+            if verbose and now - last >= 1.0:
+                print("  %8.1f MiB  %6.2f MB/s" % (total / MIB, total / (now - start) / 1e6), file=sys.stderr)
+                last = now
+    finally:
+        os.close(fd)
+        buffer.close()
+    return total, time.monotonic() - start, direct
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Sequential read benchmark through the USB mass storage path")
+    parser.add_argument("path", help="large file on the exported card, or the block device")
+    parser.add_argument("--block", default="1M", help="read size per call (default 1M)")
+    parser.add_argument("--size", default=None, help="stop after this many bytes (e.g. 256M)")
+    parser.add_argument("--runs", type=int, default=1)
+    parser.add_argument("-q", "--quiet", action="store_true", help="only print the summary")
+    args = parser.parse_args()
+
+    block = parse_size(args.block)
+    limit = parse_size(args.size) if args.size else None
+    results = []
+    for index in range(args.runs):
+        total, elapsed, direct = run(args.path, block, limit, not args.quiet)
+        if total == 0:
+            sys.exit("nothing read from %s" % args.path)
+        rate = total / elapsed / 1e6
+        results.append(rate)
+        note = "" if direct else " (page cache not bypassed)"
+        print("run %d: %.1f MiB in %.2f s, %.2f MB/s%s" % (index + 1, total / MIB, elapsed, rate, note))
+
+    if len(results) > 1:
+        print("min %.2f  avg %.2f  max %.2f MB/s" % (min(results), sum(results) / len(results), max(results)))
+
+
+if __name__ == "__main__":
+    main()